@@ -0,0 +1,837 @@
+#include "eyre_turing_lib.h"
+#include <vector>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * tunnel-bench: loopback benchmark of a server/client pair.
+ * Server and client are started as subprocesses in a temp dir for every
+ * level of concurrent streams, this process is both the users and an echo
+ * real server, all sockets in one poll loop.
+ * Measured for every level:
+ *   setup: stream opened until first byte echoed, streams per sec.
+ *   rtt: small message ping pong of every stream, p50, p99, p999.
+ *   bulk: every stream sends its part and reads it back, MB/s.
+ *   memory: RSS of server and client grown per stream opened.
+ * Every byte echoed is checked, bulk is compressible text so a -z run goes
+ * through the compressed frames; a stream got wrong bytes is corrupt, and
+ * any corrupt stream makes the exit status 1.
+ * Result is printed as json.
+ *
+ * usage: tunnel-bench [-s server] [-c client] [-n 1,10,100,1000] [-r rounds]
+ *                     [-b bulkBytes] [-w window] [-p port] [-l label] [-o file]
+ *                     [-e auto|uring|epoll] [-z none|lz]
+ */
+
+#ifdef _WIN32
+
+int main()
+{
+	fprintf(stderr, "tunnel-bench needs fork and poll, not supported on windows.\n");
+	return -1;
+}
+
+#else
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <iostream>
+
+#define BENCH_PROBE		1		// bytes echoed to know a stream is set up.
+#define BENCH_MESSAGE	64		// bytes of rtt message.
+#define BENCH_CHUNK		16384	// bytes once written in bulk.
+#define BENCH_TIMEOUT	60		// sec of a phase at most.
+#define BENCH_TEXT		"tunnel-bench bulk, a line of text compressed well by the tunnel.\n"
+
+#define PHASE_SETUP	0
+#define PHASE_RTT	1
+#define PHASE_BULK	2
+
+using namespace std;
+
+struct Conn
+{
+	int fd;
+	int stream;	// -1 means an echo connection of real server.
+	string out;	// not written yet.
+};
+
+struct BenchStream
+{
+	int conn;	// index in conns, -1 if not open.
+	bool connected;
+	bool done;	// finished current phase.
+	bool failed;
+	bool corrupt;	// echoed bytes differ from sent.
+	unsigned long long at;	// usec current wait started.
+	unsigned long long received;	// bytes of current phase.
+	unsigned long long expected;
+	unsigned int rounds;
+};
+
+vector<Conn> conns;
+vector<BenchStream> streams;
+int listenFd = -1;
+int phase = PHASE_SETUP;
+
+unsigned short userPort;
+unsigned int rounds = 100;
+unsigned long long bulkBytes = 16*1048576;	// of a level, split to streams.
+unsigned int window = 64;	// streams setting up at same time.
+
+StatHistogram *setupLatency = NULL;	// of current level.
+StatHistogram *rttLatency = NULL;
+
+void setNonBlock(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int addConn(int fd, int stream)
+{
+	Conn c;
+	c.fd = fd;
+	c.stream = stream;
+	conns.push_back(c);
+	return conns.size()-1;
+}
+
+void closeConn(int index)
+{
+	if(conns[index].fd >= 0)
+	{
+		close(conns[index].fd);
+		conns[index].fd = -1;
+	}
+	int s = conns[index].stream;
+	if(s>=0 && !streams[s].done)
+	{
+		streams[s].failed = true;
+		streams[s].done = true;
+	}
+}
+
+void queue(int index, const string &data)
+{
+	conns[index].out.append(data);
+}
+
+// byte offset of current phase stream s sends, and reads back.
+char phaseByte(int s, unsigned long long offset)
+{
+	if(phase == PHASE_SETUP)
+	{
+		return 'p';
+	}
+	if(phase == PHASE_RTT)
+	{
+		return 'r';
+	}
+	static const char text[] = BENCH_TEXT;
+	return text[(offset+s)%(sizeof(text)-1)];
+}
+
+bool openStream(int s)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+	{
+		return false;
+	}
+	setNonBlock(fd);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(userPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(connect(fd, (struct sockaddr *) &addr, sizeof(addr))<0 && errno!=EINPROGRESS)
+	{
+		close(fd);
+		return false;
+	}
+	streams[s].conn = addConn(fd, s);
+	streams[s].connected = false;
+	streams[s].at = TimerWheel::nowUsec();
+	return true;
+}
+
+// start what stream s does in current phase.
+void startPhase(int s)
+{
+	BenchStream &stream = streams[s];
+	stream.done = false;
+	stream.received = 0;
+	stream.at = TimerWheel::nowUsec();
+	if(phase == PHASE_SETUP)
+	{
+		stream.expected = BENCH_PROBE;
+		queue(stream.conn, string(BENCH_PROBE, 'p'));
+	}
+	else if(phase == PHASE_RTT)
+	{
+		stream.rounds = 0;
+		stream.expected = BENCH_MESSAGE;
+		queue(stream.conn, string(BENCH_MESSAGE, 'r'));
+	}
+	else
+	{
+		stream.expected = bulkBytes/streams.size();
+		if(stream.expected < BENCH_CHUNK)
+		{
+			stream.expected = BENCH_CHUNK;
+		}
+		string chunk;
+		for(unsigned long long i=0; i<stream.expected; i+=BENCH_CHUNK)
+		{
+			chunk.clear();
+			for(unsigned long long j=i; j<stream.expected && j<i+BENCH_CHUNK; ++j)
+			{
+				chunk.push_back(phaseByte(s, j));
+			}
+			queue(stream.conn, chunk);
+		}
+	}
+}
+
+void onStreamRead(int s, const char *data, unsigned int size)
+{
+	BenchStream &stream = streams[s];
+	if(stream.done)
+	{
+		return;
+	}
+	for(unsigned int i=0; i<size && !stream.corrupt; ++i)
+	{
+		if(data[i] != phaseByte(s, stream.received+i))
+		{
+			stream.corrupt = true;
+		}
+	}
+	stream.received += size;
+	if(stream.received < stream.expected)
+	{
+		return;
+	}
+	unsigned long long now = TimerWheel::nowUsec();
+	if(phase == PHASE_SETUP)
+	{
+		setupLatency->record(now-stream.at);
+		stream.done = true;
+	}
+	else if(phase == PHASE_RTT)
+	{
+		rttLatency->record(now-stream.at);
+		stream.received -= stream.expected;
+		if(++stream.rounds >= rounds)
+		{
+			stream.done = true;
+			return;
+		}
+		stream.at = now;
+		queue(stream.conn, string(BENCH_MESSAGE, 'r'));
+	}
+	else
+	{
+		stream.done = true;
+	}
+}
+
+void onReadable(int index)
+{
+	char buffer[65536];
+	while(conns[index].fd >= 0)
+	{
+		int size = recv(conns[index].fd, buffer, sizeof(buffer), 0);
+		if(size > 0)
+		{
+			if(conns[index].stream < 0)
+			{
+				conns[index].out.append(buffer, size);	// echo.
+			}
+			else
+			{
+				onStreamRead(conns[index].stream, buffer, size);
+			}
+			continue;
+		}
+		if(size<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+		{
+			return;
+		}
+		closeConn(index);	// closed or error.
+	}
+}
+
+void onWritable(int index)
+{
+	Conn &c = conns[index];
+	int s = c.stream;
+	if(s>=0 && !streams[s].connected)
+	{
+		int error = 0;
+		socklen_t len = sizeof(error);
+		getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+		if(error)
+		{
+			closeConn(index);
+			return;
+		}
+		streams[s].connected = true;
+	}
+	while(c.out.size())
+	{
+		int size = ::send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+		if(size <= 0)
+		{
+			if(size<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+			{
+				return;
+			}
+			closeConn(index);
+			return;
+		}
+		c.out.erase(0, size);
+	}
+}
+
+void onAccept()
+{
+	while(true)
+	{
+		int fd = accept(listenFd, NULL, NULL);
+		if(fd < 0)
+		{
+			return;
+		}
+		setNonBlock(fd);
+		addConn(fd, -1);
+	}
+}
+
+// one poll round, msec at most.
+void pollOnce(int msec)
+{
+	vector<struct pollfd> fds;
+	vector<int> index;
+	struct pollfd p;
+	p.fd = listenFd;
+	p.events = POLLIN;
+	fds.push_back(p);
+	index.push_back(-1);
+	for(unsigned int i=0; i<conns.size(); ++i)
+	{
+		if(conns[i].fd < 0)
+		{
+			continue;
+		}
+		p.fd = conns[i].fd;
+		p.events = POLLIN;
+		int s = conns[i].stream;
+		if(conns[i].out.size() || (s>=0 && !streams[s].connected))
+		{
+			p.events |= POLLOUT;
+		}
+		fds.push_back(p);
+		index.push_back(i);
+	}
+	if(poll(&fds[0], fds.size(), msec) <= 0)
+	{
+		return;
+	}
+	for(unsigned int i=0; i<fds.size(); ++i)
+	{
+		if(!fds[i].revents)
+		{
+			continue;
+		}
+		if(index[i] < 0)
+		{
+			onAccept();
+			continue;
+		}
+		if(fds[i].revents & POLLOUT)
+		{
+			onWritable(index[i]);
+		}
+		if(fds[i].revents & (POLLIN|POLLERR|POLLHUP))
+		{
+			onReadable(index[i]);
+		}
+	}
+}
+
+unsigned int countDone()
+{
+	unsigned int done = 0;
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		if(streams[i].done)
+		{
+			++done;
+		}
+	}
+	return done;
+}
+
+unsigned int countCorrupt()
+{
+	unsigned int corrupt = 0;
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		if(streams[i].corrupt)
+		{
+			++corrupt;
+		}
+	}
+	return corrupt;
+}
+
+unsigned int countFailed()
+{
+	unsigned int failed = 0;
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		if(streams[i].failed)
+		{
+			++failed;
+		}
+	}
+	return failed;
+}
+
+// run phase on streams not failed, return seconds used.
+double runPhase(int which, unsigned int timeout=BENCH_TIMEOUT)
+{
+	phase = which;
+	unsigned long long begin = TimerWheel::nowUsec();
+	unsigned long long deadline = begin+(unsigned long long) timeout*1000000;
+	unsigned int next = 0;	// stream to open next in setup.
+	unsigned int pending = 0;
+	if(which != PHASE_SETUP)
+	{
+		for(unsigned int i=0; i<streams.size(); ++i)
+		{
+			if(!streams[i].failed)
+			{
+				startPhase(i);
+			}
+		}
+	}
+	while(TimerWheel::nowUsec() < deadline)
+	{
+		if(which == PHASE_SETUP)
+		{
+			pending = next-countDone();
+			while(next<streams.size() && pending<window)
+			{
+				if(openStream(next))
+				{
+					startPhase(next);
+				}
+				else
+				{
+					streams[next].done = true;
+					streams[next].failed = true;
+				}
+				++next;
+				++pending;
+			}
+		}
+		if(countDone() == streams.size())
+		{
+			break;
+		}
+		pollOnce(10);
+	}
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		if(!streams[i].done)
+		{
+			streams[i].done = true;
+			streams[i].failed = true;	// timeout.
+		}
+	}
+	return (TimerWheel::nowUsec()-begin)/1e6;
+}
+
+// RSS bytes of process pid, 0 if unknown.
+unsigned long long rssOf(pid_t pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/statm", (int) pid);
+	FILE *fp = fopen(path, "r");
+	if(!fp)
+	{
+		return 0;
+	}
+	unsigned long long size = 0, rss = 0;
+	if(fscanf(fp, "%llu %llu", &size, &rss) != 2)
+	{
+		rss = 0;
+	}
+	fclose(fp);
+	return rss*sysconf(_SC_PAGESIZE);
+}
+
+bool writeFile(const string &fileName, const string &text)
+{
+	FILE *fp = fopen(fileName.c_str(), "w");
+	if(!fp)
+	{
+		return false;
+	}
+	fwrite(text.data(), 1, text.size(), fp);
+	fclose(fp);
+	return true;
+}
+
+pid_t spawn(const string &dir, const string &program)
+{
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		if(chdir(dir.c_str()) == 0)
+		{
+			int fd = open("run.log", O_WRONLY|O_CREAT|O_TRUNC, 0644);
+			if(fd >= 0)
+			{
+				dup2(fd, 1);
+				dup2(fd, 2);
+				close(fd);
+			}
+			execl(program.c_str(), program.c_str(), (char *) NULL);
+		}
+		_exit(127);
+	}
+	return pid;
+}
+
+// SIGTERM first, a profiling build writes its profile when exit normally.
+void stop(pid_t pid)
+{
+	if(pid <= 0)
+	{
+		return;
+	}
+	kill(pid, SIGTERM);
+	for(unsigned int i=0; i<300; ++i)
+	{
+		if(waitpid(pid, NULL, WNOHANG) == pid)
+		{
+			return;
+		}
+		usleep(10000);
+	}
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+int openListen(unsigned short port)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(fd, (struct sockaddr *) &addr, sizeof(addr))<0 || listen(fd, 1024)<0)
+	{
+		close(fd);
+		return -1;
+	}
+	setNonBlock(fd);
+	return fd;
+}
+
+void closeAll()
+{
+	for(unsigned int i=0; i<conns.size(); ++i)
+	{
+		if(conns[i].fd >= 0)
+		{
+			close(conns[i].fd);
+		}
+	}
+	conns.clear();
+	streams.clear();
+}
+
+void resetStreams(unsigned int count)
+{
+	closeAll();
+	BenchStream s = {-1, false, false, false, false, 0, 0, 0, 0};
+	streams.assign(count, s);
+}
+
+// wait a stream can be echoed through tunnel, server and client are ready then.
+bool waitReady()
+{
+	for(unsigned int i=0; i<50; ++i)
+	{
+		resetStreams(1);
+		runPhase(PHASE_SETUP, 1);
+		if(!countFailed())
+		{
+			return true;
+		}
+		usleep(100000);
+	}
+	return false;
+}
+
+Json latencyJson(const StatHistogram &histogram)
+{
+	StatHistogram::Snapshot s = histogram.snapshot();
+	Json result;
+	result.asObject();
+	result.set("count", Json((double) s.count));
+	result.set("p50_us", Json((double) s.percentile(0.5)));
+	result.set("p99_us", Json((double) s.percentile(0.99)));
+	result.set("p999_us", Json((double) s.percentile(0.999)));
+	result.set("max_us", Json((double) s.max));
+	return result;
+}
+
+int main(int argc, char *argv[])
+{
+	string server = "../server/server";
+	string client = "../client/client";
+	string levels = "1,10,100,1000";
+	string label = "";
+	string output = "";
+	string backend = "auto";	// network/backend of server and client.
+	string compress = "none";	// compress/algorithm of server and client.
+	unsigned short port = 27000;
+	for(int i=1; i+1<argc; i+=2)
+	{
+		if(strcmp(argv[i], "-s") == 0)
+		{
+			server = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-c") == 0)
+		{
+			client = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-n") == 0)
+		{
+			levels = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-r") == 0)
+		{
+			rounds = atoi(argv[i+1]);
+		}
+		else if(strcmp(argv[i], "-b") == 0)
+		{
+			bulkBytes = strtoull(argv[i+1], NULL, 10);
+		}
+		else if(strcmp(argv[i], "-w") == 0)
+		{
+			window = atoi(argv[i+1]);
+		}
+		else if(strcmp(argv[i], "-p") == 0)
+		{
+			port = atoi(argv[i+1]);
+		}
+		else if(strcmp(argv[i], "-l") == 0)
+		{
+			label = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-o") == 0)
+		{
+			output = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-e") == 0)
+		{
+			backend = argv[i+1];
+		}
+		else if(strcmp(argv[i], "-z") == 0)
+		{
+			compress = argv[i+1];
+		}
+	}
+	char path[4096];
+	if(!realpath(server.c_str(), path))
+	{
+		fprintf(stderr, "server %s not found!\n", server.c_str());
+		return -1;
+	}
+	server = path;
+	if(!realpath(client.c_str(), path))
+	{
+		fprintf(stderr, "client %s not found!\n", client.c_str());
+		return -1;
+	}
+	client = path;
+	char dir[] = "/tmp/tunnel-bench.XXXXXX";
+	if(!mkdtemp(dir))
+	{
+		perror("mkdtemp");
+		return -1;
+	}
+	string serverDir = string(dir)+"/server";
+	string clientDir = string(dir)+"/client";
+	mkdir(serverDir.c_str(), 0755);
+	mkdir(clientDir.c_str(), 0755);
+
+	// user sockets, echo sockets, and children's sockets of all streams.
+	struct rlimit limit;
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0)
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	Json results;
+	results.asArray();
+	unsigned int corrupt = 0;	// streams of all levels.
+	vector<String> levelList = String(levels.c_str()).split(",");
+	for(unsigned int l=0; l<levelList.size(); ++l)
+	{
+		unsigned int count = levelList[l].toInt();
+		if(!count)
+		{
+			continue;
+		}
+		// ports of every level differ, no TIME_WAIT of last one in the way.
+		unsigned short base = port+l*4;
+		userPort = base+1;
+		char text[1024];
+		snprintf(text, sizeof(text), "[listen]\nclient=%u\nuser=%u\nmanager=%u\ntitle=bench\n\n"
+			"[network]\nbackend=%s\n\n[compress]\nalgorithm=%s\n\n[log]\nlevel=warn\n",
+			base, base+1, base+2, backend.c_str(), compress.c_str());
+		writeFile(serverDir+"/config.ini", text);
+		snprintf(text, sizeof(text), "[real]\nhost=127.0.0.1\nport=%u\nconnectTimeout=5000\n\n"
+			"[virtual]\nhost=127.0.0.1\nport=%u\n\n[network]\nbackend=%s\n\n"
+			"[compress]\nalgorithm=%s\n\n[log]\nlevel=warn\n",
+			base+3, base, backend.c_str(), compress.c_str());
+		writeFile(clientDir+"/config.ini", text);
+
+		listenFd = openListen(base+3);
+		if(listenFd < 0)
+		{
+			fprintf(stderr, "can not listen port %u!\n", base+3);
+			break;
+		}
+		pid_t serverPid = spawn(serverDir, server);
+		usleep(200000);
+		pid_t clientPid = spawn(clientDir, client);
+
+		setupLatency = new StatHistogram();
+		rttLatency = new StatHistogram();
+		Json result;
+		result.asObject();
+		result.set("streams", Json((int) count));
+		if(!waitReady())
+		{
+			fprintf(stderr, "tunnel not ready, see logs in %s.\n", dir);
+			result.set("error", Json("not ready"));
+		}
+		else
+		{
+			delete setupLatency;
+			setupLatency = new StatHistogram();
+			resetStreams(0);
+			usleep(200000);	// closed probe gone.
+			unsigned long long serverRss = rssOf(serverPid);
+			unsigned long long clientRss = rssOf(clientPid);
+
+			fprintf(stderr, "%u streams: setup...\n", count);
+			resetStreams(count);
+			double seconds = runPhase(PHASE_SETUP);
+			unsigned int opened = count-countFailed();
+			Json setup = latencyJson(*setupLatency);
+			setup.set("seconds", Json(seconds));
+			setup.set("per_sec", Json(seconds>0 ? opened/seconds : 0.0));
+			setup.set("failed", Json((int) (count-opened)));
+			result.set("setup", setup);
+
+			usleep(200000);	// memory after streams set up.
+			Json memory;
+			memory.asObject();
+			unsigned long long serverNow = rssOf(serverPid), clientNow = rssOf(clientPid);
+			memory.set("server_rss", Json((double) serverNow));
+			memory.set("client_rss", Json((double) clientNow));
+			memory.set("server_per_stream", Json(opened ? ((double) serverNow-serverRss)/opened : 0.0));
+			memory.set("client_per_stream", Json(opened ? ((double) clientNow-clientRss)/opened : 0.0));
+			result.set("memory", memory);
+
+			fprintf(stderr, "%u streams: rtt...\n", count);
+			seconds = runPhase(PHASE_RTT);
+			Json rtt = latencyJson(*rttLatency);
+			rtt.set("seconds", Json(seconds));
+			rtt.set("failed", Json((int) (countFailed()+opened-count)));
+			result.set("rtt", rtt);
+
+			fprintf(stderr, "%u streams: bulk...\n", count);
+			unsigned int alive = count-countFailed();
+			seconds = runPhase(PHASE_BULK);
+			unsigned long long bytes = 0;
+			for(unsigned int i=0; i<streams.size(); ++i)
+			{
+				if(!streams[i].failed)
+				{
+					bytes += streams[i].expected;
+				}
+			}
+			Json bulk;
+			bulk.asObject();
+			bulk.set("bytes", Json((double) bytes));
+			bulk.set("seconds", Json(seconds));
+			bulk.set("mb_per_sec", Json(seconds>0 ? bytes/seconds/1048576 : 0.0));
+			bulk.set("failed", Json((int) (alive-(count-countFailed()))));
+			result.set("bulk", bulk);
+			result.set("corrupt", Json((int) countCorrupt()));
+			corrupt += countCorrupt();
+		}
+		results.toArray().append(result);
+
+		resetStreams(0);
+		close(listenFd);
+		stop(clientPid);
+		stop(serverPid);
+		delete setupLatency;
+		delete rttLatency;
+		setupLatency = NULL;
+		rttLatency = NULL;
+	}
+
+	Json report;
+	report.asObject();
+	report.set("label", Json(String(label.c_str())));
+	report.set("backend", Json(String(backend.c_str())));
+	report.set("compress", Json(String(compress.c_str())));
+	report.set("rounds", Json((int) rounds));
+	report.set("bulk_bytes", Json((double) bulkBytes));
+	report.set("levels", results);
+	String text = report.toString(true);
+	cout<<text<<endl;
+	if(output.size() && !writeFile(output, string((const char *) text)+"\n"))
+	{
+		fprintf(stderr, "can not write %s!\n", output.c_str());
+	}
+	if(corrupt)
+	{
+		fprintf(stderr, "%u streams echoed wrong bytes!\n", corrupt);
+		return 1;
+	}
+	return 0;
+}
+
+#endif	//_WIN32
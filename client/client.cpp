@@ -4,6 +4,7 @@
 #include <map>
 #include <vector>
 #include <string.h>
+#include <signal.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -15,6 +16,8 @@ using namespace std;
 
 TcpSocket *vSocket = NULL;
 
+volatile bool beKilled = false;	// SIGTERM/SIGINT, quit main loop.
+
 map<String, TcpSocket *> users;
 map<TcpSocket *, String> users_;
 pthread_mutex_t usersMutex;
@@ -23,12 +26,16 @@ ByteArray head;
 ByteArray buffer;
 String sender;
 unsigned long long restBufferSize = 0;
+bool compressedBuffer = false;	// buffer is a "M" frame.
+bool datagramBuffer = false;	// buffer is a "u" frame.
+unsigned long long rawBufferSize = 0;
 
 struct Message
 {
 	String type;
 	String id;
 	ByteArray data;
+	unsigned long long stamp;	// usec data was read from virtual server.
 };
 vector<Message> m_messages;
 pthread_mutex_t messagesMutex;
@@ -39,219 +46,1866 @@ unsigned short rPort;
 String vHost;
 unsigned short vPort;
 
+Resolver *resolver = NULL;	// names of real and proxy server, a connect never waits DNS.
+
+/*
+ * Real servers new users are spread to, real/backends lists them as
+ * host:port by ",", else real/host and real/port is the only one.
+ * A backend failed or timeout to connect is down for a backoff delay,
+ * users go to backends up, by least connections or power of two choices;
+ * when all are down, the one back soonest is tried.
+ */
+struct Backend
+{
+	String host;
+	unsigned short port;
+	unsigned int active;	// users connecting or connected.
+	unsigned long long downUntil;	// msec, 0 means up.
+	Backoff *backoff;
+	unsigned long long opened;
+	unsigned long long failed;
+};
+vector<Backend> backends;
+map<TcpSocket *, unsigned int> backendOf;	// backend of user socket.
+pthread_mutex_t backendsMutex;
+bool leastConn = false;
+unsigned int backendTurn = 0;	// where least connections starts, so ties rotate.
+
+void addBackend(const String &host, unsigned short port, unsigned int downMin, unsigned int downMax)
+{
+	Backend backend = {host, port, 0, 0, new Backoff(downMin, downMax), 0, 0};
+	backends.push_back(backend);
+}
+
+// "h1:80, [::1]:81, h2", port is defaultPort if not given.
+void parseBackends(const String &list, unsigned short defaultPort,
+				unsigned int downMin, unsigned int downMax)
+{
+	vector<String> items = list.split(",");
+	for(unsigned int i=0; i<items.size(); ++i)
+	{
+		string item = (const char *) items[i];
+		item.erase(0, item.find_first_not_of(" \t"));
+		item.erase(item.find_last_not_of(" \t")+1);
+		if(item.empty())
+		{
+			continue;
+		}
+		string host = item;
+		unsigned short port = defaultPort;
+		string::size_type colon = item.rfind(':');
+		if(item[0] == '[')
+		{
+			string::size_type close = item.find(']');
+			host = item.substr(1, close==string::npos ? string::npos : close-1);
+			if(close!=string::npos && colon==close+1)
+			{
+				port = String(item.substr(colon+1).c_str()).toUInt();
+			}
+		}
+		else if(colon!=string::npos && item.find(':')==colon)	// more ':' is an IPv6 address.
+		{
+			host = item.substr(0, colon);
+			port = String(item.substr(colon+1).c_str()).toUInt();
+		}
+		addBackend(host.c_str(), port, downMin, downMax);
+	}
+}
+
+// choose a backend for new user target and count it, in handleEvent.
+unsigned int takeBackend(TcpSocket *target)
+{
+	unsigned long long now = TimerWheel::now();
+	vector<unsigned int> up;
+	pthread_mutex_lock(&backendsMutex);
+	unsigned int result = 0;
+	for(unsigned int i=0; i<backends.size(); ++i)
+	{
+		unsigned int n = (backendTurn+i)%backends.size();
+		if(backends[n].downUntil <= now)
+		{
+			up.push_back(n);
+		}
+		else if(backends[n].downUntil < backends[result].downUntil)
+		{
+			result = n;
+		}
+	}
+	++backendTurn;
+	if(up.size() == 1)
+	{
+		result = up[0];
+	}
+	else if(up.size() && leastConn)
+	{
+		result = up[0];
+		for(unsigned int i=1; i<up.size(); ++i)
+		{
+			if(backends[up[i]].active < backends[result].active)
+			{
+				result = up[i];
+			}
+		}
+	}
+	else if(up.size())
+	{
+		unsigned int a = rand()%up.size();
+		unsigned int b = rand()%(up.size()-1);
+		if(b >= a)
+		{
+			++b;	// two different ones.
+		}
+		result = backends[up[b]].active<backends[up[a]].active ? up[b] : up[a];
+	}
+	++backends[result].active;
+	backendOf[target] = result;
+	pthread_mutex_unlock(&backendsMutex);
+	return result;
+}
+
+// user socket is gone, where it is taken out of users_.
+void releaseBackend(TcpSocket *target)
+{
+	pthread_mutex_lock(&backendsMutex);
+	map<TcpSocket *, unsigned int>::iterator it = backendOf.find(target);
+	if(it != backendOf.end())
+	{
+		--backends[it->second].active;
+		backendOf.erase(it);
+	}
+	pthread_mutex_unlock(&backendsMutex);
+}
+
+// passive health, by connect of a user.
+void reportBackend(unsigned int n, bool connected)
+{
+	unsigned int delay = 0;
+	pthread_mutex_lock(&backendsMutex);
+	Backend &backend = backends[n];
+	if(connected)
+	{
+		++backend.opened;
+		backend.downUntil = 0;
+		backend.backoff->reset();
+	}
+	else
+	{
+		++backend.failed;
+		delay = backend.backoff->next();
+		backend.downUntil = TimerWheel::now()+delay;
+	}
+	pthread_mutex_unlock(&backendsMutex);
+	if(delay)
+	{
+		EYRE_LOG_WARN("real server "<<backends[n].host<<":"<<backends[n].port<<" is down for "<<delay<<" msec.");
+	}
+}
+
 unsigned int connectToRealServerTimeout;
-unsigned int heart;
-unsigned long long heartRest = 0;
+
+/*
+ * Users connecting to real server, the connect thread posts how it ended
+ * to handleEvent, and a timer gives up after connectToRealServerTimeout.
+ * Only handleEvent and timers touch them, frames come before connected
+ * wait in pending.
+ */
+struct Connecting
+{
+	TcpSocket *target;
+	unsigned int backend;
+	unsigned long long at;	// usec connect started.
+	unsigned long long timer;
+	vector<Message> pending;
+};
+map<String, Connecting> connecting;
+map<unsigned long long, String> connectTimers;	// timer to its user.
 
 bool printMessage = false;
+unsigned int previewBytes = LOG_PREVIEW;	// bytes of payload printed with -p.
+CaptureWriter *capture = NULL;	// --capture file, streams recorded for tunnel-replay.
+
+void onCaptureFlush(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	capture->flush();
+	wheel->add(1000, onCaptureFlush);
+}
+
+CompressAlgorithm compressAlgorithm = COMPRESS_NONE;
+int compressLevel = COMPRESS_LEVEL_MIN;
+unsigned int compressMinSize = COMPRESS_MIN_SIZE;
+bool compressEnabled = false;	// negotiated with virtual server.
+map<String, StreamCompressor *> compressors;		// per user, frames we send.
+map<String, StreamDecompressor *> decompressors;	// per user, frames we receive.
+pthread_mutex_t compressMutex;
 
-pthread_mutex_t tellMutex;
+FrameScheduler *scheduler = NULL;	// write frames to virtual server fairly.
+unsigned int tcpWeight = 1;	// scheduler weight of each tcp user stream.
+unsigned int udpWeight = 1;	// scheduler weight of each udp flow.
+
+/*
+ * Session, a short drop of the link to virtual server does not kill users.
+ * format:
+ * hello: s:token# (s# for a new session)
+ * ack: k:id;offset#
+ * resume: r:id;offset# for every stream, then R#
+ * Each side keeps bytes it sent of a stream until peer acks them, on resume
+ * both sides tell how many bytes they got and send the rest again.
+ * Real server connections are kept grace sec after the link drops.
+ */
+struct Stream
+{
+	ReplayBuffer sent;	// bytes sent to virtual server, until acked.
+	unsigned long long received;	// bytes got from virtual server.
+	unsigned long long acked;		// received bytes we acked.
+	bool readDone;	// real server finished sending, "h" sent after its datas.
+	bool writeDone;	// user finished, real server got fin.
+	unsigned long long active;	// msec a byte went either way.
+	unsigned long long idleTimer;
+	unsigned long long closeTimer;	// deadline once a way finished.
+};
+map<String, Stream *> streams;
+pthread_mutex_t sessionMutex;
+String sessionToken;
+bool linkReady = false;	// session is established on current link.
+map<String, unsigned long long> resumeOffsets;	// bytes virtual server got, when resuming.
+unsigned int grace = 30;	// sec to keep users without link.
+unsigned long long graceTimer = 0;
+unsigned long long replayLimit = REPLAY_BUFFER_LIMIT;	// bytes kept per stream.
+unsigned long long ackBytes = 65536;	// ack once got this many bytes.
+
+/*
+ * A user nothing went to or from for idle sec is closed, and once a way
+ * of a user finished the rest must close in closeTimeout sec, so real
+ * servers that never read or never send fin do not pile up.
+ */
+unsigned int idle = 3600;	// sec, 0 never.
+map<unsigned long long, String> idleTimers;	// timer to its user.
+unsigned int closeTimeout = 60;	// sec, 0 never.
+map<unsigned long long, String> closeTimers;	// timer to its user.
+
+TimerWheel *timers = NULL;
+
+/*
+ * UDP service, datagrams of udp users come as flows, each flow has its
+ * own socket to real udp service, so replies find the way back.
+ * format:
+ * datagram: u:flow;length#data
+ * flow closed: x:flow#
+ * Datagrams are not kept for resume, a new session drops all flows.
+ * Either side drops a flow idle udpIdle sec and tells the other.
+ */
+struct Flow
+{
+	UdpSocket *socket;
+	unsigned long long active;	// msec of last datagram.
+};
+map<String, Flow> flows;	// by flow id.
+map<UdpSocket *, String> flows_;
+pthread_mutex_t flowsMutex;
+String rUdpHost;
+unsigned short rUdpPort = 0;	// 0 means no udp service.
+SocketAddress rUdpAddr;	// resolved once.
+unsigned int udpIdle = 60;	// sec.
+bool udpOffload = true;	// GRO/GSO if kernel has.
+unsigned int udpBuffer = 1048576;	// socket buffer, a burst waits loop here.
+vector<UdpSocket::Datagram> udpOut;	// to real udp service, sent in one batch by handleEvent.
+vector<UdpSocket *> udpOutSockets;	// socket of each in udpOut.
+
+/*
+ * Stats, scraped by a http GET on stats port if it is set:
+ * /metrics for Prometheus text format, /stats for json.
+ * Counters and histograms take no lock, threads forwarding data never
+ * wait each other for stats. Times are in usec.
+ */
+struct Stats
+{
+	StatCounter realBytesIn;	// read from real server.
+	StatCounter realBytesOut;	// written to real server.
+	StatCounter tunnelBytesIn;	// read from virtual server.
+	StatCounter tunnelFramesIn;
+	StatCounter streamsOpened;	// connected to real server.
+	StatCounter streamsFailed;	// can not connect to real server.
+	StatCounter streamsClosed;	// real server disconnected.
+	StatCounter streamsEnded;	// user disconnected.
+	StatCounter streamsKilled;	// lost with session or broken frame.
+	StatCounter brokenFrames;
+	StatCounter linkDrops;
+	StatCounter linkConnects;
+	StatCounter datagramsIn;	// read from real udp service.
+	StatCounter datagramsOut;	// written to real udp service.
+	StatCounter datagramsDropped;	// link down or no udp service.
+	StatCounter flowsOpened;
+	StatCounter flowsExpired;
+	StatCounter sendPauses;	// virtual server paused, a real server reads too slow.
+	StatCounter sendStalls;	// users killed, real server full too long.
+	StatCounter streamsIdle;	// closed by idle timeout.
+	StatCounter closeTimeouts;	// aborted, not closed in closeTimeout.
+	StatHistogram connect;	// connect to real server.
+	StatHistogram frameDecode;	// unpack payload of a frame.
+	StatHistogram realToTunnel;	// read from real server to written to virtual server.
+	StatHistogram tunnelToReal;	// read from virtual server to written to real server.
+	StatHistogram loop;	// event loop iteration.
+	unsigned long long linkConnectAt;	// connecting proxy server started.
+	unsigned long long linkConnectUsec;	// last connect to proxy server.
+};
+Stats stats;
+unsigned long long readStamp = 0;	// usec of data messageRead() is handling.
+
+/*
+ * Datas to real server are posted to the socket of the user and sent as
+ * real server reads, handleEvent never waits one. A socket with more than
+ * sendHighWater bytes waiting pauses reading virtual server till it drains
+ * to sendLowWater. All users wait then, so one full sendStall msec is killed.
+ */
+unsigned long long sendHighWater = 1048576;
+unsigned long long sendLowWater = 262144;
+unsigned int sendStall = 5000;	// msec, 0 never.
+map<TcpSocket *, unsigned long long> fullUsers;	// to msec full since.
+TcpSocket *pausedLink = NULL;	// vSocket paused for fullUsers.
+pthread_mutex_t fullMutex;
+map<TcpSocket *, unsigned long long> closing;	// user gone, datas still sent, in handleEvent only.
+
+// queue of user socket passed high water.
+void userFull(TcpSocket *target)
+{
+	pthread_mutex_lock(&fullMutex);
+	if(fullUsers.find(target) == fullUsers.end())
+	{
+		fullUsers[target] = TimerWheel::now();
+		stats.sendPauses.add();
+	}
+	if(!pausedLink)
+	{
+		pausedLink = vSocket;
+		pausedLink->setReadPaused(true, TCP_SOCKET_PAUSE_SEND);
+	}
+	pthread_mutex_unlock(&fullMutex);
+}
+
+// user socket drained or gone, virtual server goes on when none is full.
+void forgetFull(TcpSocket *target)
+{
+	pthread_mutex_lock(&fullMutex);
+	fullUsers.erase(target);
+	if(fullUsers.empty() && pausedLink)
+	{
+		pausedLink->setReadPaused(false, TCP_SOCKET_PAUSE_SEND);
+		pausedLink = NULL;
+	}
+	pthread_mutex_unlock(&fullMutex);
+}
+
+void onSendSweep(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	unsigned long long now = TimerWheel::now();
+	vector<TcpSocket *> stalled;
+	pthread_mutex_lock(&fullMutex);
+	for(map<TcpSocket *, unsigned long long>::iterator it = fullUsers.begin(); it != fullUsers.end(); ++it)
+	{
+		if(sendStall && now-it->second >= sendStall)
+		{
+			stalled.push_back(it->first);
+		}
+	}
+	pthread_mutex_unlock(&fullMutex);
+	
+	for(unsigned int i=0; i<stalled.size(); ++i)
+	{
+		String user;
+		pthread_mutex_lock(&usersMutex);
+		map<TcpSocket *, String>::iterator it = users_.find(stalled[i]);
+		if(it != users_.end())
+		{
+			user = it->second;
+		}
+		pthread_mutex_unlock(&usersMutex);
+		if(!user.size())
+		{
+			forgetFull(stalled[i]);
+			continue;
+		}
+		EYRE_LOG_WARN("real server read nothing of user "<<user<<" for "<<sendStall<<" msec, kill it.");
+		stats.sendStalls.add();
+		stalled[i]->abort();	// disconnected call back deletes it.
+	}
+	
+	for(map<TcpSocket *, unsigned long long>::iterator it = closing.begin(); it != closing.end();)
+	{
+		if(it->first->connectStatus()==TCP_SOCKET_CONNECTED && (!closeTimeout || now-it->second<closeTimeout*1000ULL))
+		{
+			++it;
+			continue;
+		}
+		delete it->first;
+		closing.erase(it++);
+	}
+	wheel->add(1000, onSendSweep);
+}
+
+// control frame, no user stream.
 void tellToVirtualServer(ByteArray &b)
 {
 	if(vSocket)
 	{
-		pthread_mutex_lock(&tellMutex);
-		if(!(vSocket->write(b)))
+		scheduler->pushControl(b);
+	}
+}
+
+// frame of user id, keep order with other frames of this user.
+void tellToVirtualServer(const String &id, ByteArray &b, unsigned int weight)
+{
+	if(vSocket && linkReady)
+	{
+		scheduler->push(id, b, weight);
+	}
+}
+
+/*
+ * Compress data of user id to packed.
+ * Return false if data should be sent raw.
+ */
+bool packMessage(const String &id, const ByteArray &data, ByteArray &packed)
+{
+	if(!compressEnabled)
+	{
+		return false;
+	}
+	pthread_mutex_lock(&compressMutex);
+	map<String, StreamCompressor *>::iterator it = compressors.find(id);
+	if(it == compressors.end())
+	{
+		it = compressors.insert(pair<String, StreamCompressor *>(id,
+			new StreamCompressor(compressAlgorithm, compressLevel, compressMinSize))).first;
+	}
+	bool result = it->second->compress(data, packed);
+	pthread_mutex_unlock(&compressMutex);
+	return result;
+}
+
+/*
+ * Decompress data of a "M" frame, rawSize 0 means data is stored raw but
+ * still in history of user id.
+ * Return false if compressed data is broken.
+ */
+bool unpackMessage(const String &id, bool compressed, unsigned long long rawSize, ByteArray &data)
+{
+	if(!compressed)
+	{
+		return true;
+	}
+	pthread_mutex_lock(&compressMutex);
+	map<String, StreamDecompressor *>::iterator it = decompressors.find(id);
+	if(it == decompressors.end())
+	{
+		it = decompressors.insert(pair<String, StreamDecompressor *>(id,
+			new StreamDecompressor())).first;
+	}
+	bool result = true;
+	if(rawSize)
+	{
+		ByteArray raw;
+		result = it->second->decompress(data, data.size(), rawSize, raw);
+		data = raw;
+	}
+	else
+	{
+		it->second->update(data);
+	}
+	pthread_mutex_unlock(&compressMutex);
+	return result;
+}
+
+// user id finished, drop its compress history. empty id means all users.
+void forgetCompress(const String &id)
+{
+	pthread_mutex_lock(&compressMutex);
+	for(map<String, StreamCompressor *>::iterator it = compressors.begin();
+		it != compressors.end();)
+	{
+		if(id.size() && it->first!=id)
+		{
+			++it;
+			continue;
+		}
+		delete it->second;
+		compressors.erase(it++);
+	}
+	for(map<String, StreamDecompressor *>::iterator it = decompressors.begin();
+		it != decompressors.end();)
+	{
+		if(id.size() && it->first!=id)
 		{
-			cout<<"tell to virtual server fail!"<<endl;
+			++it;
+			continue;
 		}
-		pthread_mutex_unlock(&tellMutex);
+		delete it->second;
+		decompressors.erase(it++);
 	}
+	pthread_mutex_unlock(&compressMutex);
 }
 
-pthread_mutex_t disconnectMutex;
-void onDisconnected(TcpSocket *tcpSocket)
+/*
+ * frames of the message real server sent to user.
+ * format:
+ * m:id;length#data
+ * or when compression is on:
+ * M:id;length;rawLength#data
+ * rawLength 0 means data is not compressed, but in history.
+ * data is split by scheduler quantum, so a bulk user can not hold the
+ * tunnel and small frames of other users are interleaved.
+ */
+void sendMessageFrames(const String &id, const ByteArray &data, unsigned long long stamp=0)
 {
-	pthread_mutex_lock(&disconnectMutex);
-	if(tcpSocket == vSocket)
+	unsigned int quantum = scheduler->quantum();
+	for(unsigned int offset=0; offset<data.size(); offset+=quantum)
 	{
-		cout<<"proxy server disconnected."<<endl;
-		
-		// kill all virtual user
-		pthread_mutex_lock(&usersMutex);
-		for(map<String, TcpSocket *>::iterator it = users.begin();
-			it != users.end();)
+		ByteArray part = data.mid(offset, quantum);
+		ByteArray packed;
+		ByteArray sendMessage;
+		if(!compressEnabled)
 		{
-			it->second->setDisconnectedCallBack(NULL);
-			TcpSocket *temp = it->second;
-			users_.erase(users_.find(it->second));
-			users.erase(it++);
-			delete temp;
+			sendMessage = "m:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(part.size()), CODEC_UTF8)+"#"+part;
 		}
-		pthread_mutex_unlock(&usersMutex);
+		else if(packMessage(id, part, packed))
+		{
+			sendMessage = "M:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(packed.size()), CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(part.size()), CODEC_UTF8)+"#"+packed;
+		}
+		else
+		{
+			sendMessage = "M:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(part.size()), CODEC_UTF8)+";0#"+part;
+		}
+		scheduler->push(id, sendMessage, tcpWeight, stamp);
+	}
+}
+
+// tell virtual server the message real server sent to user, and keep it until acked.
+void tellMessageToVirtualServer(const String &id, const ByteArray &data, unsigned long long stamp)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->sent.append(data);
+		it->second->active = TimerWheel::now();
+		if(linkReady)
+		{
+			sendMessageFrames(id, data, stamp);
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// call with sessionMutex locked.
+void ackStream(const String &id, Stream *stream)
+{
+	if(!linkReady)
+	{
+		return;
+	}
+	stream->acked = stream->received;
+	ByteArray sendMessage = "k:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+		ByteArray::fromString(String::fromNumber(stream->received), CODEC_UTF8)+"#";
+	tellToVirtualServer(sendMessage);
+}
+
+void onIdleTimeout(TimerWheel *wheel, unsigned long long id, void *arg);
+void onCloseTimeout(TimerWheel *wheel, unsigned long long id, void *arg);
+
+// new user id from virtual server, ack at once so it knows we got "c".
+bool newStream(const String &id)
+{
+	pthread_mutex_lock(&sessionMutex);
+	bool result = (streams.find(id) == streams.end());
+	if(result)
+	{
+		Stream *stream = new Stream;
+		stream->sent.setLimit(replayLimit);
+		stream->received = 0;
+		stream->acked = 0;
+		stream->readDone = false;
+		stream->writeDone = false;
+		stream->active = TimerWheel::now();
+		stream->idleTimer = 0;
+		stream->closeTimer = 0;
+		if(idle)
+		{
+			stream->idleTimer = timers->add(idle*1000, onIdleTimeout);
+			idleTimers[stream->idleTimer] = id;
+		}
+		streams[id] = stream;
+		ackStream(id, stream);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	return result;
+}
+
+// call with sessionMutex locked.
+void deleteStream(Stream *stream)
+{
+	if(stream->idleTimer)
+	{
+		timers->cancel(stream->idleTimer);
+		idleTimers.erase(stream->idleTimer);
+	}
+	if(stream->closeTimer)
+	{
+		timers->cancel(stream->closeTimer);
+		closeTimers.erase(stream->closeTimer);
+	}
+	delete stream;
+}
+
+// call with sessionMutex locked, a way of user id finished.
+void startCloseTimer(const String &id, Stream *stream)
+{
+	if(closeTimeout && !stream->closeTimer)
+	{
+		stream->closeTimer = timers->add(closeTimeout*1000, onCloseTimeout);
+		closeTimers[stream->closeTimer] = id;
+	}
+}
+
+// user id finished here, tell virtual server if the stream was alive.
+void closeStream(const String &id)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		deleteStream(it->second);
+		streams.erase(it);
 		
-		cout<<"ready to reconnect proxy server..."<<endl;
-		vSocket->connectToHost(vHost, vPort);
+		ByteArray sendMessage = "d:"+ByteArray::fromString(id, CODEC_UTF8)+"#";
+		tellToVirtualServer(id, sendMessage, tcpWeight);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// user id finished by virtual server.
+void dropStream(const String &id)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		deleteStream(it->second);
+		streams.erase(it);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// count bytes got of user id, ack them once got enough.
+void onStreamReceived(const String &id, unsigned long long size)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->received += size;
+		it->second->active = TimerWheel::now();
+		if(it->second->received-it->second->acked >= ackBytes)
+		{
+			ackStream(id, it->second);
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// ack all bytes got, so virtual server can free them.
+void flushAcks()
+{
+	pthread_mutex_lock(&sessionMutex);
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+	{
+		if(it->second->received > it->second->acked)
+		{
+			ackStream(it->first, it->second);
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+void onStreamAck(const String &id, unsigned long long offset)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->sent.ack(offset);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// abort the real server connection of user id, or close its stream if there is none.
+void abortUser(const String &id)
+{
+	TcpSocket *target = NULL;
+	pthread_mutex_lock(&usersMutex);
+	map<String, TcpSocket *>::iterator it = users.find(id);
+	if(it != users.end())
+	{
+		target = it->second;
+	}
+	pthread_mutex_unlock(&usersMutex);
+	if(target)
+	{
+		target->abort();	// disconnected call back closes its stream.
 	}
 	else
 	{
-		cout<<"one virtual user disconnect from real server!"<<endl;
-		pthread_mutex_lock(&usersMutex);
-		map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
-		if(it != users_.end())
+		closeStream(id);
+	}
+}
+
+// close the user if it stayed idle, else wait the rest of idle from its last byte.
+void onIdleTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	String user;
+	pthread_mutex_lock(&sessionMutex);
+	map<unsigned long long, String>::iterator t = idleTimers.find(id);
+	if(t != idleTimers.end())
+	{
+		map<String, Stream *>::iterator it = streams.find(t->second);
+		idleTimers.erase(t);
+		if(it != streams.end())
 		{
-			ByteArray message = "d:"+
-				ByteArray::fromString(it->second, CODEC_UTF8)+"#";
-			tellToVirtualServer(message);
-			users.erase(users.find(it->second));
-			users_.erase(it);
+			Stream *stream = it->second;
+			unsigned long long quiet = TimerWheel::now()-stream->active;
+			stream->idleTimer = 0;
+			if(quiet >= idle*1000ULL)
+			{
+				user = it->first;
+			}
+			else
+			{
+				stream->idleTimer = wheel->add(idle*1000ULL-quiet, onIdleTimeout);
+				idleTimers[stream->idleTimer] = it->first;
+			}
 		}
-		delete tcpSocket;
-		pthread_mutex_unlock(&usersMutex);
 	}
-	pthread_mutex_unlock(&disconnectMutex);
+	pthread_mutex_unlock(&sessionMutex);
+	if(user.size())
+	{
+		EYRE_LOG_INFO("user "<<user<<" idle for "<<idle<<" sec, close it.");
+		stats.streamsIdle.add();
+		abortUser(user);
+	}
 }
 
-pthread_mutex_t connectMutex;
-void onConnected(TcpSocket *tcpSocket)
+// user did not finish closing in closeTimeout sec, abort it.
+void onCloseTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	String user;
+	pthread_mutex_lock(&sessionMutex);
+	map<unsigned long long, String>::iterator t = closeTimers.find(id);
+	if(t != closeTimers.end())
+	{
+		map<String, Stream *>::iterator it = streams.find(t->second);
+		closeTimers.erase(t);
+		if(it != streams.end())
+		{
+			it->second->closeTimer = 0;
+			user = it->first;
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	if(user.size())
+	{
+		EYRE_LOG_WARN("user "<<user<<" not closed in "<<closeTimeout<<" sec, abort it.");
+		stats.closeTimeouts.add();
+		abortUser(user);
+	}
+}
+
+/*
+ * Heartbeat, both side ping each other and measure rtt.
+ * format:
+ * ping: a:seq#
+ * pong: A:seq#
+ * Any frame received means the link is alive. When a ping gets nothing
+ * back, probe again after pongTimeout() instead of a whole heart, and
+ * heartMiss such pings in a row means the link is dead.
+ */
+unsigned int heart = 15;	// sec between pings.
+unsigned int heartMiss = 3;
+unsigned long long heartTimer = 0;
+unsigned long long pingSeq = 0;
+bool pingPending = false;
+unsigned long long pingSentAt = 0;		// usec.
+unsigned long long lastReceived = 0;	// usec.
+unsigned int pingMisses = 0;
+long long srtt = -1;	// smoothed rtt usec, -1 means no sample yet.
+long long rttvar = 0;
+pthread_mutex_t heartMutex;
+
+// msec to wait a pong before probe again.
+unsigned int pongTimeout()
+{
+	unsigned int maxTimeout = heart*1000;
+	if(srtt < 0)
+	{
+		return maxTimeout;
+	}
+	unsigned long long timeout = (srtt+4*rttvar)/1000;
+	if(timeout < 200)
+	{
+		timeout = 200;
+	}
+	return timeout<maxTimeout ? timeout : maxTimeout;
+}
+
+void onHeartTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	TcpSocket *link = vSocket;
+	pthread_mutex_lock(&heartMutex);
+	if(id!=heartTimer || !link)
+	{
+		pthread_mutex_unlock(&heartMutex);
+		return;
+	}
+	if(pingPending)
+	{
+		if(lastReceived<pingSentAt && !link->readPaused())	// paused, pong waits unread.
+		{
+			++pingMisses;
+		}
+		else
+		{
+			pingMisses = 0;
+		}
+	}
+	bool dead = (pingMisses >= heartMiss);
+	ByteArray sendMessage;
+	if(dead)
+	{
+		heartTimer = 0;
+	}
+	else
+	{
+		++pingSeq;
+		pingPending = true;
+		pingSentAt = TimerWheel::nowUsec();
+		sendMessage = "a:"+ByteArray::fromString(String::fromNumber(pingSeq), CODEC_UTF8)+"#";
+		heartTimer = timers->add(pingMisses ? pongTimeout() : heart*1000, onHeartTimeout);
+	}
+	pthread_mutex_unlock(&heartMutex);
+	
+	flushAcks();
+
+	if(dead)
+	{
+		EYRE_LOG_WARN("virtual server no response, kill the link.");
+		link->abort();
+		return;
+	}
+	tellToVirtualServer(sendMessage);
+}
+
+void startHeartbeat()
+{
+	pthread_mutex_lock(&heartMutex);
+	if(heartTimer)
+	{
+		timers->cancel(heartTimer);
+	}
+	pingPending = false;
+	pingMisses = 0;
+	srtt = -1;
+	rttvar = 0;
+	lastReceived = TimerWheel::nowUsec();
+	heartTimer = timers->add(heart*1000, onHeartTimeout);
+	pthread_mutex_unlock(&heartMutex);
+}
+
+void stopHeartbeat()
+{
+	pthread_mutex_lock(&heartMutex);
+	if(heartTimer)
+	{
+		timers->cancel(heartTimer);
+		heartTimer = 0;
+	}
+	pingPending = false;
+	pthread_mutex_unlock(&heartMutex);
+}
+
+void onPing(const ByteArray &seq)
+{
+	ByteArray sendMessage = "A:"+seq+"#";
+	tellToVirtualServer(sendMessage);
+}
+
+void onPong(unsigned long long seq)
+{
+	pthread_mutex_lock(&heartMutex);
+	if(!pingPending || seq!=pingSeq)
+	{
+		pthread_mutex_unlock(&heartMutex);
+		return;
+	}
+	long long rtt = TimerWheel::nowUsec()-pingSentAt;
+	if(srtt < 0)
+	{
+		srtt = rtt;
+		rttvar = rtt/2;
+	}
+	else
+	{
+		long long diff = srtt>rtt ? srtt-rtt : rtt-srtt;
+		rttvar = (3*rttvar+diff)/4;
+		srtt = (7*srtt+rtt)/8;
+	}
+	pingPending = false;
+	pingMisses = 0;
+	pthread_mutex_unlock(&heartMutex);
+	EYRE_LOG_DEBUG("virtual server alive, rtt: "<<rtt<<" usec.");
+}
+
+Backoff *reconnectBackoff = NULL;	// delay before connect proxy server again.
+unsigned long long reconnectTimer = 0;
+pthread_mutex_t reconnectMutex;
+
+void scheduleReconnect();
+
+int connectProxyServer()
+{
+	SocketAddress addr;
+	if(!resolver->resolve(vHost, vPort, addr))
+	{
+		EYRE_LOG_WARN("can not resolve proxy server "<<vHost<<".");
+		return TCP_SOCKET_GETADDRINFO_ERROR;
+	}
+	return vSocket->connectToHost(addr);
+}
+
+void onReconnectTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	pthread_mutex_lock(&reconnectMutex);
+	if(id != reconnectTimer)
+	{
+		pthread_mutex_unlock(&reconnectMutex);
+		return;
+	}
+	reconnectTimer = 0;
+	pthread_mutex_unlock(&reconnectMutex);
+	
+	EYRE_LOG_INFO("ready to reconnect proxy server...");
+	stats.linkConnectAt = TimerWheel::nowUsec();
+	if(connectProxyServer())
+	{
+		scheduleReconnect();
+	}
+}
+
+/*
+ * connect proxy server again after a backoff delay, jitter keeps many
+ * clients from coming back at the same time.
+ */
+void scheduleReconnect()
+{
+	pthread_mutex_lock(&reconnectMutex);
+	if(!reconnectTimer)
+	{
+		unsigned int delay = reconnectBackoff->next();
+		reconnectTimer = timers->add(delay, onReconnectTimeout);
+		EYRE_LOG_INFO("reconnect proxy server in "<<delay<<" msec.");
+	}
+	pthread_mutex_unlock(&reconnectMutex);
+}
+
+// kill users in handleEvent, call with messagesMutex locked.
+void postKills(const vector<String> &ids)
+{
+	stats.streamsKilled.add(ids.size());
+	for(unsigned int i=0; i<ids.size(); ++i)
+	{
+		Message m = {"d", ids[i], "", 0};
+		m_messages.push_back(m);
+	}
+}
+
+// call with sessionMutex locked, return ids of users dropped.
+vector<String> endSession()
+{
+	vector<String> ids;
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+	{
+		ids.push_back(it->first);
+		deleteStream(it->second);
+	}
+	streams.clear();
+	resumeOffsets.clear();
+	sessionToken = "";
+	if(graceTimer)
+	{
+		timers->cancel(graceTimer);
+		graceTimer = 0;
+	}
+	return ids;
+}
+
+void onGraceTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	pthread_mutex_lock(&sessionMutex);
+	if(id != graceTimer)
+	{
+		pthread_mutex_unlock(&sessionMutex);
+		return;
+	}
+	graceTimer = 0;
+	vector<String> killed = endSession();
+	pthread_mutex_unlock(&sessionMutex);
+	
+	EYRE_LOG_WARN("virtual server not back in "<<grace<<" sec, kill "<<killed.size()<<" users.");
+	pthread_mutex_lock(&messagesMutex);
+	postKills(killed);
+	pthread_mutex_unlock(&messagesMutex);
+}
+
+/*
+ * virtual server replies token of the session, same as we sent means
+ * the session is resumed, or it is a new one and old users are gone.
+ * called in messageRead, messagesMutex is locked.
+ */
+void onSessionHello(const String &token)
+{
+	vector<String> killed;
+	pthread_mutex_lock(&sessionMutex);
+	if(sessionToken.size() && token==sessionToken)
+	{
+		if(graceTimer)
+		{
+			timers->cancel(graceTimer);
+			graceTimer = 0;
+		}
+		for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+		{
+			ByteArray sendMessage = "r:"+ByteArray::fromString(it->first, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(it->second->received), CODEC_UTF8)+"#";
+			tellToVirtualServer(sendMessage);
+			it->second->acked = it->second->received;
+		}
+		ByteArray sendMessage = "R#";
+		tellToVirtualServer(sendMessage);
+		EYRE_LOG_INFO("session "<<sessionToken<<" resuming, "<<streams.size()<<" users.");
+	}
+	else
+	{
+		killed = endSession();
+		sessionToken = token;
+		linkReady = true;
+		EYRE_LOG_INFO("new session "<<sessionToken<<".");
+		
+		// flow ids are of the old session.
+		pthread_mutex_lock(&flowsMutex);
+		for(map<String, Flow>::iterator it = flows.begin(); it != flows.end(); ++it)
+		{
+			Message m = {"x", it->first, "", 0};
+			m_messages.push_back(m);
+		}
+		pthread_mutex_unlock(&flowsMutex);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	postKills(killed);
+	
+	pthread_mutex_lock(&reconnectMutex);
+	reconnectBackoff->reset();
+	pthread_mutex_unlock(&reconnectMutex);
+}
+
+void onResumeOffset(const String &id, unsigned long long offset)
+{
+	pthread_mutex_lock(&sessionMutex);
+	resumeOffsets[id] = offset;
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+/*
+ * virtual server told all streams it has, send again what it did not get,
+ * and drop users it does not have.
+ * called in messageRead, messagesMutex is locked.
+ */
+void onResumeEnd()
+{
+	vector<String> killed;
+	pthread_mutex_lock(&sessionMutex);
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end();)
+	{
+		map<String, unsigned long long>::iterator offset = resumeOffsets.find(it->first);
+		ByteArray data;
+		if(offset != resumeOffsets.end() && it->second->sent.read(offset->second, data))
+		{
+			sendMessageFrames(it->first, data);
+			if(it->second->readDone)
+			{
+				ByteArray sendMessage = "h:"+ByteArray::fromString(it->first, CODEC_UTF8)+"#";
+				scheduler->push(it->first, sendMessage, tcpWeight);
+			}
+			++it;
+			continue;
+		}
+		if(offset != resumeOffsets.end())
+		{
+			EYRE_LOG_WARN("user "<<it->first<<" can not resume, bytes from "<<offset->second<<" are not kept.");
+			ByteArray sendMessage = "d:"+ByteArray::fromString(it->first, CODEC_UTF8)+"#";
+			scheduler->push(it->first, sendMessage, tcpWeight);
+		}
+		killed.push_back(it->first);
+		deleteStream(it->second);
+		streams.erase(it++);
+	}
+	resumeOffsets.clear();
+	linkReady = true;
+	EYRE_LOG_INFO("session resumed, "<<streams.size()<<" users kept, "<<killed.size()<<" lost.");
+	pthread_mutex_unlock(&sessionMutex);
+	postKills(killed);
+}
+
+pthread_mutex_t disconnectMutex;
+// user id failed to connect real server, forget its socket.
+void forgetUser(const String &id, TcpSocket *target)
+{
+	pthread_mutex_lock(&usersMutex);
+	target->setDisconnectedCallBack(NULL);
+	users_.erase(target);
+	releaseBackend(target);
+	scheduler->setSource(id, NULL);
+	map<String, TcpSocket *>::iterator it = users.find(id);
+	if(it!=users.end() && it->second==target)
+	{
+		users.erase(it);
+	}
+	pthread_mutex_unlock(&usersMutex);
+	forgetFull(target);
+}
+
+void onDisconnected(TcpSocket *tcpSocket)
+{
+	// delete waits read threads of sockets, which may wait usersMutex or disconnectMutex.
+	vector<TcpSocket *> killed;
+	pthread_mutex_lock(&disconnectMutex);
+	if(tcpSocket == vSocket)
+	{
+		EYRE_LOG_INFO("proxy server disconnected.");
+		stopHeartbeat();
+		stats.linkDrops.add();
+		
+		pthread_mutex_lock(&fullMutex);
+		fullUsers.clear();
+		if(pausedLink)
+		{
+			pausedLink->setReadPaused(false, TCP_SOCKET_PAUSE_SEND);	// kept for reconnect.
+			pausedLink = NULL;
+		}
+		pthread_mutex_unlock(&fullMutex);
+		
+		pthread_mutex_lock(&sessionMutex);
+		linkReady = false;
+		scheduler->setTarget(NULL);
+		scheduler->clear();
+		compressEnabled = false;
+		forgetCompress("");
+		head = "";
+		buffer = "";
+		sender = "";
+		restBufferSize = 0;
+		compressedBuffer = false;
+		datagramBuffer = false;
+		resumeOffsets.clear();
+		bool keep = (sessionToken.size() && grace);
+		if(keep)
+		{
+			if(!graceTimer)
+			{
+				graceTimer = timers->add(grace*1000, onGraceTimeout);
+			}
+			EYRE_LOG_INFO("keep "<<streams.size()<<" users for "<<grace<<" sec.");
+		}
+		else
+		{
+			endSession();
+		}
+		pthread_mutex_unlock(&sessionMutex);
+		
+		if(!keep)
+		{
+			// kill all virtual user
+			pthread_mutex_lock(&usersMutex);
+			for(map<String, TcpSocket *>::iterator it = users.begin();
+				it != users.end();)
+			{
+				it->second->setDisconnectedCallBack(NULL);
+				killed.push_back(it->second);
+				users_.erase(users_.find(it->second));
+				releaseBackend(it->second);
+				scheduler->setSource(it->first, NULL);
+				users.erase(it++);
+				stats.streamsKilled.add();
+			}
+			pthread_mutex_unlock(&usersMutex);
+		}
+		
+		scheduleReconnect();
+	}
+	else
+	{
+		EYRE_LOG_INFO("one virtual user disconnect from real server!");
+		pthread_mutex_lock(&usersMutex);
+		map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
+		if(it != users_.end())
+		{
+			stats.streamsClosed.add();
+			if(capture)
+			{
+				capture->write(CAPTURE_CLOSE, CAPTURE_DOWN, it->second);
+			}
+			closeStream(it->second);
+			forgetCompress(it->second);
+			scheduler->setSource(it->second, NULL);
+			users.erase(users.find(it->second));
+			users_.erase(it);
+			releaseBackend(tcpSocket);
+			killed.push_back(tcpSocket);	// not in users means deleted by who took it out.
+		}
+		pthread_mutex_unlock(&usersMutex);
+		forgetFull(tcpSocket);
+	}
+	pthread_mutex_unlock(&disconnectMutex);
+	
+	for(unsigned int i=0; i<killed.size(); ++i)
+	{
+		delete killed[i];
+	}
+}
+
+pthread_mutex_t connectMutex;
+
+// connect of user socket target ended, handleEvent takes it in order with frames of the user.
+void postConnect(TcpSocket *target, const String &type)
+{
+	String id;
+	pthread_mutex_lock(&usersMutex);
+	map<TcpSocket *, String>::iterator it = users_.find(target);
+	if(it != users_.end())
+	{
+		id = it->second;
+	}
+	pthread_mutex_unlock(&usersMutex);
+	if(id.size())
+	{
+		Message m = {type, id, "", TimerWheel::nowUsec()};
+		pthread_mutex_lock(&messagesMutex);
+		m_messages.push_back(m);
+		pthread_mutex_unlock(&messagesMutex);
+	}
+}
+
+void onConnected(TcpSocket *tcpSocket)
+{
+	pthread_mutex_lock(&connectMutex);
+	if(tcpSocket == vSocket)
+	{
+		EYRE_LOG_INFO("proxy server connected.");
+		stats.linkConnects.add();
+		stats.linkConnectUsec = TimerWheel::nowUsec()-stats.linkConnectAt;
+		scheduler->setTarget(vSocket);
+		startHeartbeat();
+		
+		// resume session if we have one.
+		ByteArray sendMessage = "s";
+		pthread_mutex_lock(&sessionMutex);
+		if(sessionToken.size())
+		{
+			sendMessage += ":"+ByteArray::fromString(sessionToken, CODEC_UTF8);
+		}
+		pthread_mutex_unlock(&sessionMutex);
+		sendMessage += "#";
+		tellToVirtualServer(sendMessage);
+		
+		if(compressAlgorithm != COMPRESS_NONE)
+		{
+			/*
+			 * ask virtual server to compress frames.
+			 * format:
+			 * z:algorithm#
+			 */
+			sendMessage = "z:"+ByteArray::fromString(
+				StreamCompressor::algorithmName(compressAlgorithm), CODEC_UTF8)+"#";
+			tellToVirtualServer(sendMessage);
+		}
+	}
+	else
+	{
+		EYRE_LOG_INFO("one virtual user connect to real server succeed.");
+		postConnect(tcpSocket, "connected");
+	}
+	pthread_mutex_unlock(&connectMutex);
+}
+
+/*
+ * virtual server replies which algorithm to compress frames.
+ * format:
+ * z:algorithm#
+ */
+void onCompressNegotiate(const String &name)
+{
+	compressEnabled = (StreamCompressor::algorithmFromName(name) != COMPRESS_NONE);
+	EYRE_LOG_INFO("compression: "<<name<<".");
+}
+
+void messageRead(ByteArray &message)
+{
+	while(message.size())
+	{
+		if(restBufferSize)
+		{
+			unsigned long long len = message.size();
+			if(restBufferSize > len)
+			{
+				buffer += message;
+				message = "";
+				restBufferSize -= len;
+			}
+			else
+			{
+				buffer += message.mid(0, restBufferSize);
+				message = message.mid(restBufferSize);
+				restBufferSize = 0;
+			}
+			if(!restBufferSize && datagramBuffer)
+			{
+				Message m = {"u", sender, buffer, readStamp};
+				pthread_mutex_lock(&messagesMutex);
+				m_messages.push_back(m);
+				pthread_mutex_unlock(&messagesMutex);
+				sender = "";
+				buffer = "";
+				datagramBuffer = false;
+			}
+			else if(!restBufferSize)
+			{
+				Message m = {"m", sender, buffer, readStamp};
+				unsigned long long decodeStart = TimerWheel::nowUsec();
+				bool unpacked = unpackMessage(sender, compressedBuffer, rawBufferSize, m.data);
+				stats.frameDecode.record(TimerWheel::nowUsec()-decodeStart);
+				if(!unpacked)
+				{
+					EYRE_LOG_WARN("broken compressed message of user "<<sender<<", kill it.");
+					stats.brokenFrames.add();
+					m.type = "d";
+					m.data = "";
+					closeStream(sender);
+				}
+				else
+				{
+					onStreamReceived(sender, m.data.size());
+				}
+				pthread_mutex_lock(&messagesMutex);
+				m_messages.push_back(m);
+				pthread_mutex_unlock(&messagesMutex);
+				sender = "";
+				buffer = "";
+				compressedBuffer = false;
+			}
+			else
+			{
+				continue;
+			}
+		}
+		message = head+message;
+		head = "";
+		int endSymPos = message.indexOf("#");
+		if(endSymPos == -1)
+		{
+			head += message;
+			message = "";
+		}
+		else
+		{
+			ByteArray _head = message.mid(0, endSymPos);
+			stats.tunnelFramesIn.add();
+			vector<ByteArray> headInfo = _head.split(":");
+			pthread_mutex_lock(&messagesMutex);
+			if(headInfo[0] == "c")	// client connected
+			{
+				// c:id
+				if(headInfo.size() == 2)
+				{
+					String id = String::fromUtf8(headInfo[1]);
+					if(newStream(id))
+					{
+						Message m = {"c", id, "", 0};
+						m_messages.push_back(m);
+					}
+				}
+			}
+			else if(headInfo[0] == "d")	// client disconnected
+			{
+				// d:id
+				if(headInfo.size() == 2)
+				{
+					stats.streamsEnded.add();
+					String id = String::fromUtf8(headInfo[1]);
+					Message m = {"d", id, "", 0};
+					m_messages.push_back(m);
+				}
+			}
+			else if(headInfo[0] == "h")	// user finished sending
+			{
+				// h:id
+				if(headInfo.size() == 2)
+				{
+					String id = String::fromUtf8(headInfo[1]);
+					Message m = {"h", id, "", 0};
+					m_messages.push_back(m);
+				}
+			}
+			else if(headInfo[0] == "m")	// send message
+			{
+				// m:id;length
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						sender = String::fromUtf8(info[0]);
+						restBufferSize = String::fromUtf8(info[1]).toUInt64();
+					}
+				}
+			}
+			else if(headInfo[0] == "M")	// send compressed message
+			{
+				// M:id;length;rawLength
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 3)
+					{
+						sender = String::fromUtf8(info[0]);
+						restBufferSize = String::fromUtf8(info[1]).toUInt64();
+						rawBufferSize = String::fromUtf8(info[2]).toUInt64();
+						compressedBuffer = true;
+					}
+				}
+			}
+			else if(headInfo[0] == "u")	// datagram
+			{
+				// u:flow;length
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						sender = String::fromUtf8(info[0]);
+						restBufferSize = String::fromUtf8(info[1]).toUInt64();
+						datagramBuffer = true;
+					}
+				}
+			}
+			else if(headInfo[0] == "x")	// flow closed
+			{
+				// x:flow
+				if(headInfo.size() == 2)
+				{
+					Message m = {"x", String::fromUtf8(headInfo[1]), "", 0};
+					m_messages.push_back(m);
+				}
+			}
+			else if(headInfo[0] == "z")	// compression negotiate
+			{
+				// z:algorithm
+				if(headInfo.size() == 2)
+				{
+					onCompressNegotiate(String::fromUtf8(headInfo[1]));
+				}
+			}
+			else if(headInfo[0] == "s")	// session hello
+			{
+				// s:token
+				if(headInfo.size() == 2)
+				{
+					onSessionHello(String::fromUtf8(headInfo[1]));
+				}
+			}
+			else if(headInfo[0] == "k")	// ack
+			{
+				// k:id;offset
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						onStreamAck(String::fromUtf8(info[0]), String::fromUtf8(info[1]).toUInt64());
+					}
+				}
+			}
+			else if(headInfo[0] == "r")	// resume stream
+			{
+				// r:id;offset
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						onResumeOffset(String::fromUtf8(info[0]), String::fromUtf8(info[1]).toUInt64());
+					}
+				}
+			}
+			else if(headInfo[0] == "R")	// resume end
+			{
+				// R
+				onResumeEnd();
+			}
+			else if(headInfo[0] == "a")	// ping
+			{
+				// a or a:seq
+				if(headInfo.size() == 2)
+				{
+					onPing(headInfo[1]);
+				}
+			}
+			else if(headInfo[0] == "A")	// pong
+			{
+				// A:seq
+				if(headInfo.size() == 2)
+				{
+					onPong(String::fromUtf8(headInfo[1]).toUInt64());
+				}
+			}
+			pthread_mutex_unlock(&messagesMutex);
+			message = message.mid(endSymPos+1);
+		}
+	}
+}
+
+void onRead(TcpSocket *tcpSocket, ByteArray data)
+{
+	if(tcpSocket == vSocket)
+	{
+		pthread_mutex_lock(&heartMutex);
+		lastReceived = TimerWheel::nowUsec();
+		readStamp = lastReceived;
+		pthread_mutex_unlock(&heartMutex);
+		stats.tunnelBytesIn.add(data.size());
+		messageRead(data);
+	}
+	else
+	{
+		pthread_mutex_lock(&usersMutex);
+		map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
+		if(it != users_.end())
+		{
+			String id = it->second;
+			unsigned long long stamp = TimerWheel::nowUsec();
+			stats.realBytesIn.add(data.size());
+			if(capture)
+			{
+				capture->write(CAPTURE_DATA, CAPTURE_DOWN, id, data);
+			}
+			if(printMessage)
+			{
+				EYRE_LOG_INFO("real server send user "<<id<<" "<<data.size()<<" bytes.\n"
+					<<Logger::preview(data, previewBytes));
+			}
+			tellMessageToVirtualServer(id, data, stamp);
+		}
+		pthread_mutex_unlock(&usersMutex);
+	}
+}
+
+// replies of real udp service, all a read got, in loop thread.
+void onUdpRead(UdpSocket *udpSocket, const UdpSocket::Datagram *datagrams, unsigned int count)
+{
+	String id;
+	pthread_mutex_lock(&flowsMutex);
+	map<UdpSocket *, String>::iterator it = flows_.find(udpSocket);
+	if(it != flows_.end())
+	{
+		id = it->second;
+		flows[id].active = TimerWheel::now();
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	
+	if(!id.size())
+	{
+		return;	// flow closed.
+	}
+	stats.datagramsIn.add(count);
+	if(!vSocket || !linkReady)
+	{
+		stats.datagramsDropped.add(count);
+		return;
+	}
+	ByteArray prefix = "u:"+ByteArray::fromString(id, CODEC_UTF8)+";";
+	for(unsigned int i=0; i<count; ++i)
+	{
+		ByteArray data(datagrams[i].data, datagrams[i].size);
+		if(printMessage)
+		{
+			EYRE_LOG_INFO("real service send udp flow "<<id<<" "<<data.size()<<" bytes.\n"
+				<<Logger::preview(data, previewBytes));
+		}
+		ByteArray sendMessage = prefix+ByteArray::fromString(String::fromNumber(data.size()), CODEC_UTF8)+"#"+data;
+		tellToVirtualServer("u"+id, sendMessage, udpWeight);
+	}
+}
+
+/*
+ * datagram of udp user, open a socket to real udp service for a new flow.
+ * sent by flushDatagrams(), data must live till then.
+ */
+void sendDatagram(const String &id, const ByteArray &data)
+{
+	UdpSocket *target = NULL;
+	pthread_mutex_lock(&flowsMutex);
+	map<String, Flow>::iterator it = flows.find(id);
+	if(it != flows.end())
+	{
+		it->second.active = TimerWheel::now();
+		target = it->second.socket;
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	
+	if(!target)
+	{
+		if(!rUdpPort)
+		{
+			stats.datagramsDropped.add();
+			return;
+		}
+		target = new UdpSocket();
+		target->setReadBatchCallBack(onUdpRead);
+		if(!target->start(0, rUdpAddr.family()))
+		{
+			EYRE_LOG_WARN("can not open socket for udp flow "<<id<<"!");
+			stats.datagramsDropped.add();
+			delete target;
+			return;
+		}
+		target->setBufferSize(udpBuffer);
+		if(udpOffload)
+		{
+			target->setOffload(true, true);
+		}
+		Flow flow = {target, TimerWheel::now()};
+		pthread_mutex_lock(&flowsMutex);
+		flows[id] = flow;
+		flows_[target] = id;
+		pthread_mutex_unlock(&flowsMutex);
+		stats.flowsOpened.add();
+		EYRE_LOG_DEBUG("new udp flow "<<id<<".");
+	}
+	UdpSocket::Datagram datagram;
+	datagram.data = data;
+	datagram.size = data.size();
+	datagram.addr = rUdpAddr;
+	udpOut.push_back(datagram);
+	udpOutSockets.push_back(target);
+}
+
+// send datagrams of handleEvent, a run of one flow by one sendmmsg.
+void flushDatagrams()
+{
+	for(unsigned int first=0, next=0; first<udpOut.size(); first=next)
+	{
+		while(next<udpOut.size() && udpOutSockets[next]==udpOutSockets[first])
+		{
+			++next;
+		}
+		unsigned int sent = udpOutSockets[first]->send(&udpOut[first], next-first);
+		stats.datagramsOut.add(sent);
+		stats.datagramsDropped.add(next-first-sent);
+	}
+	udpOut.clear();
+	udpOutSockets.clear();
+}
+
+// call in handleEvent or timer, socket is deleted out of flowsMutex.
+void closeFlow(const String &id)
+{
+	UdpSocket *target = NULL;
+	pthread_mutex_lock(&flowsMutex);
+	map<String, Flow>::iterator it = flows.find(id);
+	if(it != flows.end())
+	{
+		target = it->second.socket;
+		flows_.erase(target);
+		flows.erase(it);
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	delete target;
+}
+
+void onFlowSweep(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	unsigned long long now = TimerWheel::now();
+	vector<String> expired;
+	pthread_mutex_lock(&flowsMutex);
+	for(map<String, Flow>::iterator it = flows.begin(); it != flows.end(); ++it)
+	{
+		if(now-it->second.active >= udpIdle*1000ULL)
+		{
+			expired.push_back(it->first);
+		}
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	
+	stats.flowsExpired.add(expired.size());
+	for(unsigned int i=0; i<expired.size(); ++i)
+	{
+		closeFlow(expired[i]);
+		ByteArray sendMessage = "x:"+ByteArray::fromString(expired[i], CODEC_UTF8)+"#";
+		tellToVirtualServer("u"+expired[i], sendMessage, udpWeight);
+	}
+	wheel->add(1000, onFlowSweep);
+}
+
+/*
+ * Real server finished sending (fin), tell virtual server after its datas
+ * so the user reads eof and can still send; close once both ways are done.
+ * format:
+ * h:id#
+ */
+void onReadClosed(TcpSocket *tcpSocket)
+{
+	bool done = true;
+	pthread_mutex_lock(&usersMutex);
+	map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
+	if(it != users_.end())
+	{
+		pthread_mutex_lock(&sessionMutex);
+		map<String, Stream *>::iterator stream = streams.find(it->second);
+		if(stream != streams.end())
+		{
+			stream->second->readDone = true;
+			startCloseTimer(it->second, stream->second);
+			done = stream->second->writeDone;
+			ByteArray sendMessage = "h:"+ByteArray::fromString(it->second, CODEC_UTF8)+"#";
+			tellToVirtualServer(it->second, sendMessage, tcpWeight);	// or sent on resume.
+		}
+		pthread_mutex_unlock(&sessionMutex);
+	}
+	pthread_mutex_unlock(&usersMutex);
+	if(done)
+	{
+		tcpSocket->abortWhenWritten();	// disconnected call back closes the stream.
+	}
+}
+
+// user id finished sending, its datas are written to real server before.
+void finishWrite(const String &id, TcpSocket *target)
+{
+	bool done = false;
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->writeDone = true;
+		startCloseTimer(id, it->second);
+		done = it->second->readDone;
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	target->shutdownWrite();	// after datas posted.
+	if(done)
+	{
+		target->abortWhenWritten();	// disconnected call back closes the stream.
+	}
+}
+
+void onConnectError(TcpSocket *tcpSocket, int errorStatus)
 {
-	pthread_mutex_lock(&connectMutex);
 	if(tcpSocket == vSocket)
 	{
-		cout<<"proxy server connected."<<endl;
+		EYRE_LOG_WARN("connect to proxy server fail.");
+		scheduleReconnect();
 	}
 	else
 	{
-		cout<<"one virtual user connect to real server succeed."<<endl;
+		postConnect(tcpSocket, "connectError");
 	}
-	pthread_mutex_unlock(&connectMutex);
 }
 
-void messageRead(ByteArray &message)
+// post m of user id to real server target, in handleEvent.
+void writeToReal(TcpSocket *target, const Message &m)
 {
-	while(message.size())
+	if(target->post(m.data))
 	{
-		if(restBufferSize)
-		{
-			unsigned long long len = message.size();
-			if(restBufferSize > len)
-			{
-				buffer += message;
-				message = "";
-				restBufferSize -= len;
-			}
-			else
-			{
-				buffer += message.mid(0, restBufferSize);
-				message = message.mid(restBufferSize);
-				restBufferSize = 0;
-			}
-			if(!restBufferSize)
-			{
-				Message m = {"m", sender, buffer};
-				pthread_mutex_lock(&messagesMutex);
-				m_messages.push_back(m);
-				pthread_mutex_unlock(&messagesMutex);
-				sender = "";
-				buffer = "";
-			}
-			else
-			{
-				continue;
-			}
-		}
-		message = head+message;
-		head = "";
-		int endSymPos = message.indexOf("#");
-		if(endSymPos == -1)
+		if(target->queuedBytes() > sendHighWater)
 		{
-			head += message;
-			message = "";
+			userFull(target);
 		}
-		else
+		stats.realBytesOut.add(m.data.size());
+		stats.tunnelToReal.record(TimerWheel::nowUsec()-m.stamp);
+		if(capture)
 		{
-			ByteArray _head = message.mid(0, endSymPos);
-			vector<ByteArray> headInfo = _head.split(":");
-			pthread_mutex_lock(&messagesMutex);
-			if(headInfo[0] == "c")	// client connected
-			{
-				// c:id
-				if(headInfo.size() == 2)
-				{
-					String id = String::fromUtf8(headInfo[1]);
-					Message m = {"c", id, ""};
-					m_messages.push_back(m);
-				}
-			}
-			else if(headInfo[0] == "d")	// client disconnected
-			{
-				// d:id
-				if(headInfo.size() == 2)
-				{
-					String id = String::fromUtf8(headInfo[1]);
-					Message m = {"d", id, ""};
-					m_messages.push_back(m);
-				}
-			}
-			else if(headInfo[0] == "m")	// send message
-			{
-				// m:id;length
-				if(headInfo.size() == 2)
-				{
-					vector<ByteArray> info = headInfo[1].split(";");
-					if(info.size() == 2)
-					{
-						sender = String::fromUtf8(info[0]);
-						restBufferSize = String::fromUtf8(info[1]).toUInt64();
-					}
-				}
-			}
-			else if(headInfo[0] == "a")
-			{
-				// a
-				Message m = {"a", "", ""};
-				m_messages.push_back(m);
-			}
-			pthread_mutex_unlock(&messagesMutex);
-			message = message.mid(endSymPos+1);
+			capture->write(CAPTURE_DATA, CAPTURE_UP, m.id, m.data);
 		}
 	}
 }
 
-void onRead(TcpSocket *tcpSocket, ByteArray data)
+// connect of user id ended, in handleEvent or timer.
+void finishConnect(const String &id, bool connected)
 {
-	if(tcpSocket == vSocket)
+	map<String, Connecting>::iterator it = connecting.find(id);
+	if(it == connecting.end())
 	{
-		messageRead(data);
+		return;	// ended before.
 	}
-	else
+	Connecting c = it->second;
+	connecting.erase(it);
+	timers->cancel(c.timer);
+	connectTimers.erase(c.timer);
+	
+	pthread_mutex_lock(&usersMutex);
+	map<String, TcpSocket *>::iterator u = users.find(id);
+	bool alive = (u!=users.end() && u->second==c.target);
+	pthread_mutex_unlock(&usersMutex);
+	if(!alive)
 	{
-		pthread_mutex_lock(&usersMutex);
-		map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
-		if(it != users_.end())
+		return;	// who took it out of users deleted it.
+	}
+	
+	if(connected)
+	{
+		stats.streamsOpened.add();
+		stats.connect.record(TimerWheel::nowUsec()-c.at);
+		reportBackend(c.backend, true);
+		if(capture)
 		{
-			String id = it->second;
-			unsigned long long len = data.size();
-			if(printMessage)
+			capture->write(CAPTURE_OPEN, CAPTURE_UP, id);
+		}
+		for(unsigned int i=0; i<c.pending.size(); ++i)
+		{
+			if(c.pending[i].type == "h")
 			{
-				cout<<"real server send message to user "<<id<<"."<<endl;
-				cout<<data.toString(CODEC_UTF8)<<endl;
+				finishWrite(id, c.target);	// last of the user, may close it.
+				break;
 			}
-			ByteArray sendMessage = "m:"+ByteArray::fromString(id, CODEC_UTF8)+
-				";"+ByteArray::fromString(String::fromNumber(len), CODEC_UTF8)+
-				"#"+data;
-			tellToVirtualServer(sendMessage);
+			writeToReal(c.target, c.pending[i]);
 		}
-		pthread_mutex_unlock(&usersMutex);
-#ifdef _WIN32
-		Sleep(1);
-#else
-		usleep(1000);
-#endif
+		return;
 	}
+	stats.streamsFailed.add();
+	reportBackend(c.backend, false);
+	
+	forgetUser(id, c.target);
+	closeStream(id);
+	forgetCompress(id);
+	delete c.target;
 }
 
-void onConnectError(TcpSocket *tcpSocket, int errorStatus)
+void onConnectTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
 {
-	if(tcpSocket == vSocket)
+	map<unsigned long long, String>::iterator it = connectTimers.find(id);
+	if(it != connectTimers.end())
 	{
-		cout<<"connect to proxy server fail. ready to reconnect..."<<endl;
-#ifdef _WIN32
-		Sleep(500);
-#else
-		usleep(500000);
-#endif
-		vSocket->connectToHost(vHost, vPort);
+		String user = it->second;
+		EYRE_LOG_WARN("connect to real server timeout!");
+		finishConnect(user, false);
 	}
 }
 
@@ -265,53 +1919,68 @@ void handleEvent()
 		
 		if(m.type == "c")
 		{
-			cout<<"new user "<<m.id<<" connected."<<endl;
+			EYRE_LOG_INFO("new user "<<m.id<<" connected.");
 			TcpSocket *target = new TcpSocket();
+			unsigned long long connectAt = TimerWheel::nowUsec();
 			target->setDisconnectedCallBack(onDisconnected);
 			target->setConnectedCallBack(onConnected);
 			target->setReadCallBack(onRead);
-			if(target->connectToHost(rHost, rPort))
+			target->setReadClosedCallBack(onReadClosed);
+			target->setConnectErrorCallBack(onConnectError);
+			target->setDrainedCallBack(forgetFull, sendLowWater);
+			// known before connected, real server may send first.
+			pthread_mutex_lock(&usersMutex);
+			users[m.id] = target;
+			users_[target] = m.id;
+			pthread_mutex_unlock(&usersMutex);
+			scheduler->setSource(m.id, target);
+			unsigned int backend = takeBackend(target);
+			SocketAddress realAddr;
+			if(!resolver->resolve(backends[backend].host, backends[backend].port, realAddr) ||
+				target->connectToHost(realAddr))
 			{
-				cout<<"can not connect to real server!"<<endl;
+				EYRE_LOG_WARN("can not connect to real server!");
+				stats.streamsFailed.add();
+				reportBackend(backend, false);
 				
-				ByteArray sendMessage = "d:"+
-					ByteArray::fromString(m.id, CODEC_UTF8)+"#";
-				tellToVirtualServer(sendMessage);
+				forgetUser(m.id, target);
+				closeStream(m.id);
+				forgetCompress(m.id);
 				delete target;
 			}
 			else
 			{
-				unsigned int timeout = connectToRealServerTimeout;
-				while(target->connectStatus()==TCP_SOCKET_DISCONNECTED && timeout)
-				{
-					--timeout;
-#ifdef _WIN32
-					Sleep(1);
-#else
-					usleep(1000);
-#endif
-				}
-				if(!timeout)
-				{
-					cout<<"connect to real server timeout!"<<endl;
-					
-					ByteArray sendMessage = "d:"+
-						ByteArray::fromString(m.id, CODEC_UTF8)+"#";
-					tellToVirtualServer(sendMessage);
-					delete target;
-				}
-				else
-				{
-					pthread_mutex_lock(&usersMutex);
-					users[m.id] = target;
-					users_[target] = m.id;
-					pthread_mutex_unlock(&usersMutex);
-				}
+				Connecting c = {target, backend, connectAt,
+					timers->add(connectToRealServerTimeout, onConnectTimeout), vector<Message>()};
+				connecting[m.id] = c;
+				connectTimers[c.timer] = m.id;
 			}
 		}
+		// not frames, posted by connect thread of user sockets.
+		else if(m.type == "connected")
+		{
+			finishConnect(m.id, true);
+		}
+		else if(m.type == "connectError")
+		{
+			EYRE_LOG_WARN("can not connect to real server!");
+			finishConnect(m.id, false);
+		}
 		else if(m.type == "d")
 		{
-			cout<<"user "<<m.id<<" disconnected."<<endl;
+			EYRE_LOG_INFO("user "<<m.id<<" disconnected.");
+			if(capture)
+			{
+				capture->write(CAPTURE_CLOSE, CAPTURE_UP, m.id);
+			}
+			map<String, Connecting>::iterator c = connecting.find(m.id);
+			if(c != connecting.end())
+			{
+				timers->cancel(c->second.timer);
+				connectTimers.erase(c->second.timer);
+				connecting.erase(c);
+			}
+			TcpSocket *target = NULL;
 			pthread_mutex_lock(&usersMutex);
 			map<String, TcpSocket *>::iterator it = users.find(m.id);
 			if(it != users.end())
@@ -319,19 +1988,41 @@ void handleEvent()
 				if(it->second)
 				{
 					users_.erase(users_.find(it->second));
+					releaseBackend(it->second);
+					scheduler->setSource(m.id, NULL);
 					it->second->setDisconnectedCallBack(NULL);
-					delete it->second;
+					target = it->second;
 				}
 				users.erase(it);
 			}
 			pthread_mutex_unlock(&usersMutex);
+			if(target)
+			{
+				forgetFull(target);
+				target->setReadPaused(true);
+				target->abortWhenWritten();	// real server reads datas before.
+				if(target->connectStatus() == TCP_SOCKET_CONNECTED)
+				{
+					closing[target] = TimerWheel::now();	// deleted by onSendSweep.
+					target = NULL;
+				}
+			}
+			delete target;	// out of usersMutex, its read thread may wait it.
+			dropStream(m.id);
+			forgetCompress(m.id);
 		}
 		else if(m.type == "m")
 		{
 			if(printMessage)
 			{
-				cout<<"user "<<m.id<<" send message."<<endl;
-				cout<<m.data.toString(CODEC_UTF8)<<endl;
+				EYRE_LOG_INFO("user "<<m.id<<" send "<<m.data.size()<<" bytes.\n"
+					<<Logger::preview(m.data, previewBytes));
+			}
+			map<String, Connecting>::iterator c = connecting.find(m.id);
+			if(c != connecting.end())
+			{
+				c->second.pending.push_back(m);	// written once connected.
+				continue;
 			}
 			pthread_mutex_lock(&usersMutex);
 			map<String, TcpSocket *>::iterator it = users.find(m.id);
@@ -344,45 +2035,245 @@ void handleEvent()
 			
 			if(target)
 			{
-				target->write(m.data);
-#ifdef _WIN32
-				Sleep(1);
-#else
-				usleep(1000);
-#endif
+				writeToReal(target, m);
+			}
+		}
+		else if(m.type == "h")
+		{
+			map<String, Connecting>::iterator c = connecting.find(m.id);
+			if(c != connecting.end())
+			{
+				c->second.pending.push_back(m);	// after its datas, once connected.
+				continue;
+			}
+			TcpSocket *target = NULL;
+			pthread_mutex_lock(&usersMutex);
+			map<String, TcpSocket *>::iterator it = users.find(m.id);
+			if(it != users.end())
+			{
+				target = it->second;
+			}
+			pthread_mutex_unlock(&usersMutex);
+			if(target)
+			{
+				finishWrite(m.id, target);
 			}
 		}
+		else if(m.type == "u")
+		{
+			if(printMessage)
+			{
+				EYRE_LOG_INFO("udp flow "<<m.id<<" send "<<m.data.size()<<" bytes.\n"
+					<<Logger::preview(m.data, previewBytes));
+			}
+			sendDatagram(m.id, m_messages[i].data);
+		}
+		else if(m.type == "x")
+		{
+			EYRE_LOG_DEBUG("udp flow "<<m.id<<" closed.");
+			flushDatagrams();	// some may go by its socket.
+			closeFlow(m.id);
+		}
 	}
+	flushDatagrams();
 	m_messages.clear();
 	pthread_mutex_unlock(&messagesMutex);
+}
+
+// stats now, in Prometheus text format or json.
+String scrape(bool json)
+{
+	MetricsReport report("tunnel_client_");
+	
+	pthread_mutex_lock(&usersMutex);
+	unsigned int userCount = users.size();
+	pthread_mutex_unlock(&usersMutex);
+	
+	pthread_mutex_lock(&sessionMutex);
+	unsigned int streamCount = streams.size();
+	unsigned long long replayBytes = 0;
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+	{
+		replayBytes += it->second->sent.size();
+	}
+	bool ready = linkReady;
+	pthread_mutex_unlock(&sessionMutex);
+	
+	pthread_mutex_lock(&messagesMutex);
+	unsigned int eventCount = m_messages.size();
+	pthread_mutex_unlock(&messagesMutex);
+	
+	pthread_mutex_lock(&compressMutex);
+	unsigned int compressorCount = compressors.size()+decompressors.size();
+	pthread_mutex_unlock(&compressMutex);
+	
+	pthread_mutex_lock(&heartMutex);
+	long long rtt = srtt;
+	long long rttDeviation = rttvar;
+	pthread_mutex_unlock(&heartMutex);
+	
+	pthread_mutex_lock(&flowsMutex);
+	unsigned int flowCount = flows.size();
+	pthread_mutex_unlock(&flowsMutex);
 	
-	if(vSocket->connectStatus() == TCP_SOCKET_DISCONNECTED)
+	unsigned long long framesOut, bytesOut, writes;
+	scheduler->written(framesOut, bytesOut, writes);
+	
+	report.gauge("link_up", "1 when session is established on the link.", ready);
+	report.gauge("users", "Connections to real server.", userCount);
+	report.gauge("streams", "Streams of the session, kept while link is down.", streamCount);
+	report.counter("streams_opened_total", "Connected to real server.", stats.streamsOpened.value());
+	report.counter("streams_failed_total", "Failed or timeout to connect real server.", stats.streamsFailed.value());
+	report.counter("streams_closed_total", "Real server disconnected.", stats.streamsClosed.value());
+	report.counter("streams_ended_total", "Users disconnected.", stats.streamsEnded.value());
+	report.counter("streams_killed_total", "Streams aborted with session lost.", stats.streamsKilled.value());
+	report.counter("streams_idle_total", "Users closed by idle timeout.", stats.streamsIdle.value());
+	report.counter("streams_close_timeout_total", "Users aborted, not closed in closeTimeout.", stats.closeTimeouts.value());
+	report.counter("real_bytes_in_total", "Bytes read from real server.", stats.realBytesIn.value());
+	report.counter("real_bytes_out_total", "Bytes written to real server.", stats.realBytesOut.value());
+	report.counter("tunnel_bytes_in_total", "Bytes read from virtual server.", stats.tunnelBytesIn.value());
+	report.counter("tunnel_frames_in_total", "Frames read from virtual server.", stats.tunnelFramesIn.value());
+	report.counter("tunnel_bytes_out_total", "Bytes written to virtual server.", bytesOut);
+	report.counter("tunnel_frames_out_total", "Frames written to virtual server.", framesOut);
+	report.counter("tunnel_writes_total", "Gather sends to virtual server.", writes);
+	report.counter("broken_frames_total", "Compressed frames failed to decode.", stats.brokenFrames.value());
+	report.counter("link_drops_total", "Links to proxy server lost.", stats.linkDrops.value());
+	report.counter("link_connects_total", "Links to proxy server made.", stats.linkConnects.value());
+	report.gauge("link_connect_seconds", "Last connect to proxy server.", stats.linkConnectUsec/1e6);
+	report.gauge("udp_flows", "Sockets to real udp service.", flowCount);
+	report.counter("udp_flows_opened_total", "Udp flows opened.", stats.flowsOpened.value());
+	report.counter("udp_flows_expired_total", "Udp flows idle out.", stats.flowsExpired.value());
+	report.counter("real_send_pauses_total", "Virtual server paused, a real server reads too slow.",
+		stats.sendPauses.value());
+	report.counter("real_send_stalls_total", "Users killed, real server read nothing too long.",
+		stats.sendStalls.value());
+	report.counter("udp_datagrams_in_total", "Datagrams read from real udp service.", stats.datagramsIn.value());
+	report.counter("udp_datagrams_out_total", "Datagrams written to real udp service.", stats.datagramsOut.value());
+	report.counter("udp_datagrams_dropped_total", "Datagrams dropped, link down or no udp service.",
+		stats.datagramsDropped.value());
+	report.counter("resolver_hits_total", "Server names answered by cache.", resolver->hits());
+	report.counter("resolver_misses_total", "Server names waited for lookup.", resolver->misses());
+	report.counter("resolver_refreshes_total", "Server names looked up again in background.", resolver->refreshes());
+	report.counter("resolver_failures_total", "Server name lookups failed.", resolver->failures());
+	vector<String> backendLabels;
+	for(unsigned int i=0; i<backends.size(); ++i)
 	{
-#ifdef _WIN32
-		heartRest = heart*100;
-#else
-		heartRest = heart*200;
-#endif
+		backendLabels.push_back(MetricsReport::label("backend",
+			backends[i].host+":"+String::fromNumber((unsigned int) backends[i].port)));
+	}
+	unsigned long long now = TimerWheel::now();
+	pthread_mutex_lock(&backendsMutex);
+	for(unsigned int i=0; i<backends.size(); ++i)	// samples of a name one after another.
+	{
+		report.gauge("backend_up", "Real server up, not backing off.", backends[i].downUntil<=now ? 1 : 0, backendLabels[i]);
+	}
+	for(unsigned int i=0; i<backends.size(); ++i)
+	{
+		report.gauge("backend_active", "Users on real server.", backends[i].active, backendLabels[i]);
+	}
+	for(unsigned int i=0; i<backends.size(); ++i)
+	{
+		report.counter("backend_opened_total", "Users connected to real server.", backends[i].opened, backendLabels[i]);
+	}
+	for(unsigned int i=0; i<backends.size(); ++i)
+	{
+		report.counter("backend_failed_total", "Connects to real server failed or timeout.", backends[i].failed, backendLabels[i]);
+	}
+	pthread_mutex_unlock(&backendsMutex);
+	report.gauge("tunnel_rtt_seconds", "Smoothed ping rtt, -1 without sample.", rtt<0 ? -1 : rtt/1e6);
+	report.gauge("tunnel_rtt_deviation_seconds", "Ping rtt deviation.", rttDeviation/1e6);
+	report.gauge("send_queue_bytes", "Bytes waiting in scheduler.", scheduler->pendingBytes());
+	report.gauge("send_queue_streams", "Streams waiting in scheduler.", scheduler->activeStreams());
+	report.counter("send_queue_pauses_total", "Users paused, too many bytes waiting in scheduler.",
+		scheduler->sourcePauses());
+	report.gauge("event_queue", "Frames decoded, waiting for event loop.", eventCount);
+	report.gauge("replay_bytes", "Bytes kept for resume, until acked.", replayBytes);
+	report.gauge("compressors", "Stream compressors and decompressors.", compressorCount);
+	report.gauge("timers", "Timers waiting.", timers->size());
+	report.summary("real_connect_seconds", "Time to connect real server.", stats.connect, 1e-6);
+	report.summary("frame_decode_seconds", "Time to unpack payload of a frame.", stats.frameDecode, 1e-6);
+	report.summary("real_to_tunnel_seconds", "Read from real server to written to virtual server.",
+		stats.realToTunnel, 1e-6);
+	report.summary("tunnel_to_real_seconds", "Read from virtual server to written to real server.",
+		stats.tunnelToReal, 1e-6);
+	report.summary("loop_seconds", "Event loop iteration, sleep excluded.", stats.loop, 1e-6);
+	report.counter("log_dropped_total", "Log messages dropped with log ring full.", Logger::dropped());
+	report.process();
+	
+	if(json)
+	{
+		return report.toJson().toString();
+	}
+	return report.toPrometheus();
+}
+
+TcpServer *statsServer = NULL;
+map<TcpSocket *, ByteArray> statsRequests;	// input not finished.
+pthread_mutex_t statsMutex;
+
+void onStatsDisconnected(TcpSocket *tcpSocket)
+{
+	pthread_mutex_lock(&statsMutex);
+	statsRequests.erase(tcpSocket);
+	pthread_mutex_unlock(&statsMutex);
+}
+
+/*
+ * http GET on stats port:
+ * GET /metrics, Prometheus text format.
+ * GET /stats, json.
+ */
+void onStatsRead(TcpSocket *tcpSocket, ByteArray data)
+{
+	pthread_mutex_lock(&statsMutex);
+	ByteArray request = statsRequests[tcpSocket]+data;
+	statsRequests[tcpSocket] = request;
+	pthread_mutex_unlock(&statsMutex);
+	
+	ByteArray get = "GET ";
+	if(request.mid(0, get.size()) != get.mid(0, request.size()) || request.size() > 8192)
+	{
+		tcpSocket->abort();
+		return;
+	}
+	if(request.indexOf("\r\n\r\n")==-1 && request.indexOf("\n\n")==-1)
+	{
+		return;	// wait the whole head.
+	}
+	
+	int lineEnd = request.indexOf("\n");
+	vector<ByteArray> line = request.mid(0, lineEnd).split(" ");
+	ByteArray path = line.size()>1 ? line[1] : ByteArray("");
+	ByteArray response;
+	if(path == "/metrics" || path == "/stats")
+	{
+		ByteArray body = ByteArray::fromString(scrape(path == "/stats"), CODEC_UTF8);
+		response = "HTTP/1.0 200 OK\r\nContent-Type: ";
+		response += (path == "/stats") ? "application/json" : "text/plain; version=0.0.4";
+		response += "\r\nContent-Length: "+ByteArray::fromString(String::fromNumber(body.size()), CODEC_UTF8)+
+			"\r\nConnection: close\r\n\r\n"+body;
 	}
 	else
 	{
-		if(heartRest)
-		{
-			--heartRest;
-		}
-		else
-		{
-			ByteArray sendMessage = "a#";
-			tellToVirtualServer(sendMessage);
-			cout<<"send alive package."<<endl;
-#ifdef _WIN32
-			heartRest = heart*100;
-#else
-			heartRest = heart*200;
-#endif
-		}
+		response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
 	}
+	tcpSocket->write(response);
+	tcpSocket->abort();
+}
+
+void onStatsConnecting(TcpServer *server, TcpSocket *client)
+{
+	client->setDisconnectedCallBack(onStatsDisconnected);
+	client->setReadCallBack(onStatsRead);
+}
+
+#ifndef _WIN32
+// quit main loop and exit normally, so captures and profiles are written.
+void onTerminate(int sig)
+{
+	beKilled = true;
 }
+#endif
 
 int main(int argc, char *argv[])
 {
@@ -397,30 +2288,143 @@ int main(int argc, char *argv[])
 		{
 			printMessage = true;
 		}
+		else if(strcmp(argv[i], "--capture")==0 && i+1<argc)
+		{
+			capture = new CaptureWriter();
+			if(!capture->open(argv[++i]))
+			{
+				fprintf(stderr, "can not open capture file %s!\n", argv[i]);
+				return -1;
+			}
+		}
 	}
 	
 	IniSettings config("config.ini", CODEC_UTF8);
 	
 	rHost = config.value("real/host", "0.0.0.0");
 	rPort = config.value("real/port", "0").toUInt();
+	rUdpHost = config.value("real/udpHost", rHost);
+	rUdpPort = config.value("real/udpPort", "0").toUInt();
+	udpIdle = config.value("udp/idle", "60").toUInt();
+	udpOffload = config.value("udp/offload", "1").toUInt();
+	udpBuffer = config.value("udp/buffer", "1048576").toUInt();
+	if(rUdpPort && !UdpSocket::resolve(rUdpHost, rUdpPort, rUdpAddr))
+	{
+		fprintf(stderr, "can not resolve real udp service %s!\n", (const char *) rUdpHost);
+		Logger::stop();
+		return -1;
+	}
 	
 	vHost = config.value("virtual/host", "0.0.0.0");
 	vPort = config.value("virtual/port", "0").toUInt();
 	
+	leastConn = config.value("real/balance", "p2c") == "leastconn";
+	unsigned int downMin = config.value("real/downMin", "1000").toUInt();
+	unsigned int downMax = config.value("real/downMax", "30000").toUInt();
+	parseBackends(config.value("real/backends", ""), rPort, downMin, downMax);
+	if(backends.empty())
+	{
+		addBackend(rHost, rPort, downMin, downMax);
+	}
+	
+	unsigned int resolverTtl = config.value("resolver/ttl", "30").toUInt();
+	int resolverFamily = Resolver::familyFromName(config.value("resolver/family", "ipv4"));
+	
 	connectToRealServerTimeout = config.value("real/connectTimeout", "3000").toUInt();
 	heart = config.value("virtual/heart", "10").toUInt();
+	heartMiss = config.value("virtual/heartMiss", "3").toUInt();
+	unsigned int reconnectMin = config.value("virtual/reconnectMin", "200").toUInt();
+	unsigned int reconnectMax = config.value("virtual/reconnectMax", "30000").toUInt();
+	
+	unsigned int quantum = config.value("scheduler/quantum", "16384").toUInt();
+	tcpWeight = config.value("scheduler/tcpWeight", config.value("scheduler/weight", "1")).toUInt();
+	udpWeight = config.value("scheduler/udpWeight", "1").toUInt();
+	unsigned long long streamHighWater = config.value("scheduler/streamHighWater", "1048576").toUInt64();
+	unsigned long long streamLowWater = config.value("scheduler/streamLowWater", "262144").toUInt64();
+	unsigned long long highWater = config.value("scheduler/highWater", "16777216").toUInt64();
+	unsigned long long lowWater = config.value("scheduler/lowWater", "8388608").toUInt64();
+	unsigned int maxBatch = config.value("scheduler/maxBatch", "65536").toUInt();
+	unsigned int coalesceDelay = config.value("scheduler/coalesceDelay", "0").toUInt();
+	sendHighWater = config.value("sendQueue/highWater", "1048576").toUInt64();
+	sendLowWater = config.value("sendQueue/lowWater", "262144").toUInt64();
+	sendStall = config.value("sendQueue/stall", "5000").toUInt();
+	
+	compressAlgorithm = StreamCompressor::algorithmFromName(config.value("compress/algorithm", "none"));
+	compressLevel = config.value("compress/level", "1").toInt();
+	compressMinSize = config.value("compress/minSize", "64").toUInt();
+	
+	Logger::start(Logger::levelFromName(config.value("log/level", "info")),
+		config.value("log/rate", "20").toUInt());
+	previewBytes = config.value("log/preview", "64").toUInt();
+#ifndef _WIN32
+	EventLoop::setDefaultBackend(EventLoop::backendFromName(config.value("network/backend", "auto")));
+#endif
+#ifndef _WIN32
+	signal(SIGTERM, onTerminate);
+	signal(SIGINT, onTerminate);
+#endif
+	
+	unsigned short statsPort = config.value("stats/port", "0").toUInt();
+	
+	grace = config.value("session/grace", "30").toUInt();
+	replayLimit = config.value("session/replayBuffer", "1048576").toUInt64();
+	idle = config.value("session/idle", "3600").toUInt();
+	closeTimeout = config.value("session/closeTimeout", "60").toUInt();
+	ackBytes = replayLimit/4<65536 ? replayLimit/4 : 65536;
+	if(!ackBytes)
+	{
+		ackBytes = 1;
+	}
 	
-	cout<<"tunnel client running."<<endl;
-	cout<<"real server: (ip: "<<rHost<<", port: "<<rPort<<")."<<endl;
-	cout<<"proxy server: (ip: "<<vHost<<", port: "<<vPort<<")."<<endl;
-	cout<<"connect to real server timeout: "<<connectToRealServerTimeout<<" msec."<<endl;
-	cout<<"heart per "<<heart<<" sec."<<endl;
+	EYRE_LOG_INFO("tunnel client running.");
+	resolver = new Resolver(resolverTtl, resolverFamily);
+	for(unsigned int i=0; i<backends.size(); ++i)
+	{
+		SocketAddress realAddr;
+		if(!resolver->resolve(backends[i].host, backends[i].port, realAddr))
+		{
+			EYRE_LOG_WARN("can not resolve real server "<<backends[i].host<<" now, try again per user.");
+		}
+		EYRE_LOG_INFO("real server: (ip: "<<backends[i].host<<", port: "<<backends[i].port<<").");
+	}
+	if(backends.size() > 1)
+	{
+		EYRE_LOG_INFO("users spread by "<<(leastConn ? "least connections" : "power of two choices")<<".");
+	}
+	EYRE_LOG_INFO("proxy server: (ip: "<<vHost<<", port: "<<vPort<<").");
+	EYRE_LOG_INFO("connect to real server timeout: "<<connectToRealServerTimeout<<" msec.");
+	if(rUdpPort)
+	{
+		EYRE_LOG_INFO("real udp service: (ip: "<<rUdpHost<<", port: "<<rUdpPort<<"), flow idle: "<<udpIdle<<" sec.");
+	}
+	EYRE_LOG_INFO("heart per "<<heart<<" sec, dead after "<<heartMiss<<" miss.");
+	EYRE_LOG_INFO("reconnect after "<<reconnectMin<<" to "<<reconnectMax<<" msec.");
 	
-	pthread_mutex_init(&tellMutex, NULL);
 	pthread_mutex_init(&disconnectMutex, NULL); 
 	pthread_mutex_init(&connectMutex, NULL);
 	pthread_mutex_init(&messagesMutex, NULL);
+	pthread_mutex_init(&compressMutex, NULL);
+	pthread_mutex_init(&heartMutex, NULL);
+	pthread_mutex_init(&sessionMutex, NULL);
+	pthread_mutex_init(&reconnectMutex, NULL);
 	pthread_mutex_init(&usersMutex, NULL);
+	pthread_mutex_init(&statsMutex, NULL);
+	pthread_mutex_init(&fullMutex, NULL);
+	pthread_mutex_init(&flowsMutex, NULL);
+	pthread_mutex_init(&backendsMutex, NULL);
+	
+	timers = new TimerWheel();
+	reconnectBackoff = new Backoff(reconnectMin, reconnectMax);
+	scheduler = new FrameScheduler(quantum);
+	scheduler->setBatch(maxBatch, coalesceDelay);
+	scheduler->setWaterMarks(streamHighWater, streamLowWater, highWater, lowWater);
+	if(capture)
+	{
+		timers->add(1000, onCaptureFlush);
+	}
+	timers->add(1000, onFlowSweep);
+	timers->add(1000, onSendSweep);
+	scheduler->setLatency(&stats.realToTunnel);
 	
 	vSocket = new TcpSocket();
 	
@@ -429,15 +2433,33 @@ int main(int argc, char *argv[])
 	vSocket->setReadCallBack(onRead);
 	vSocket->setConnectErrorCallBack(onConnectError);
 	
-	if(vSocket->connectToHost(vHost, vPort))
+	if(statsPort)
 	{
-		cout<<"connect to proxy server fail!"<<endl;
+		statsServer = new TcpServer();
+		statsServer->setNewConnectingCallBack(onStatsConnecting);
+		if(statsServer->start(statsPort))
+		{
+			fprintf(stderr, "stats server start fail!\n");
+			Logger::stop();
+			return -1;
+		}
+		EYRE_LOG_INFO("stats on port: "<<statsPort<<".");
+	}
+	
+	stats.linkConnectAt = TimerWheel::nowUsec();
+	if(connectProxyServer())
+	{
+		EYRE_LOG_ERROR("connect to proxy server fail!");
+		Logger::stop();
 		return 0;
 	}
 	
-	while(true)
+	while(!beKilled)
 	{
+		unsigned long long loopStart = TimerWheel::nowUsec();
 		handleEvent();
+		timers->tick();
+		stats.loop.record(TimerWheel::nowUsec()-loopStart);
 #ifdef _WIN32
 		Sleep(1);
 #else
@@ -445,5 +2467,16 @@ int main(int argc, char *argv[])
 #endif
 	}
 	
+	EYRE_LOG_INFO("client quit.");
+#ifndef _WIN32
+	EventLoop::stopShared();	//its call backs use the maps freed at exit.
+#endif
+	delete resolver;
+	for(unsigned int i=0; i<backends.size(); ++i)
+	{
+		delete backends[i].backoff;
+	}
+	delete capture;
+	Logger::stop();
 	return 0;
 }
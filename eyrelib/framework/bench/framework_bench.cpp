@@ -0,0 +1,420 @@
+#include "eyre_turing_lib.h"
+#include "general.h"
+#include <iostream>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ * framework-bench: micro benchmarks of ByteArray, String, Json, IniSettings
+ * and kmp search. Every case is run with more iterations until it takes
+ * at least min time, the best of some repeats is reported as ns/op, and
+ * MB/s for cases handling bytes.
+ *
+ * usage: framework-bench [-t minSec] [-r repeats] [-j jsonFile] [filter...]
+ *   filter: only run cases with name containing any of them.
+ */
+
+using namespace std;
+
+typedef void (*BenchRun)(unsigned long long n);
+
+struct BenchCase
+{
+	const char *name;
+	BenchRun run;
+	unsigned long long bytes;	// handled once, 0 if not about bytes.
+};
+
+volatile unsigned long long benchSink = 0;	// results go here, not optimized out.
+
+// bytes of x, rest is filled with pattern and never matches needle.
+ByteArray makeBytes(unsigned int size, char fill='x')
+{
+	ByteArray result(size);
+	string data(size, fill);
+	result.append(data.data(), size);
+	return result;
+}
+
+// json array of objects, about size bytes.
+String makeJsonText(unsigned int size)
+{
+	String text = "[";
+	char item[160];
+	for(unsigned int i=0; text.size()<size; ++i)
+	{
+		snprintf(item, sizeof(item), "%s{\"id\":%u,\"name\":\"user %u\",\"tags\":[\"a\",\"b\"],"
+			"\"score\":%u.5,\"ok\":true,\"note\":null}", i ? "," : "", i, i, i%100);
+		text += item;
+	}
+	text += "]";
+	return text;
+}
+
+const String &jsonText(unsigned int size)
+{
+	static map<unsigned int, String> texts;
+	map<unsigned int, String>::iterator it = texts.find(size);
+	if(it == texts.end())
+	{
+		it = texts.insert(pair<unsigned int, String>(size, makeJsonText(size))).first;
+	}
+	return it->second;
+}
+
+const Json &jsonDocument(unsigned int size)
+{
+	static map<unsigned int, Json *> documents;
+	map<unsigned int, Json *>::iterator it = documents.find(size);
+	if(it == documents.end())
+	{
+		Json *json = new Json(Json::parseFromText(jsonText(size)));
+		it = documents.insert(pair<unsigned int, Json *>(size, json)).first;
+	}
+	return *(it->second);
+}
+
+// ByteArray
+
+template<unsigned int CHUNK, unsigned int TOTAL>
+void byteArrayAppend(unsigned long long n)
+{
+	string chunk(CHUNK, 'a');
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		ByteArray b;
+		for(unsigned int s=0; s<TOTAL; s+=CHUNK)
+		{
+			b.append(chunk.data(), CHUNK);
+		}
+		benchSink += b.size();
+	}
+}
+
+void byteArrayReserveAppend(unsigned long long n)
+{
+	string chunk(16, 'a');
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		ByteArray b(1048576);
+		for(unsigned int s=0; s<1048576; s+=16)
+		{
+			b.append(chunk.data(), 16);
+		}
+		benchSink += b.size();
+	}
+}
+
+void byteArrayMid(unsigned long long n)
+{
+	static ByteArray b = makeBytes(1048576);
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += b.mid((i*4096)%(1048576-1024), 1024).size();
+	}
+}
+
+void byteArraySplit(unsigned long long n)
+{
+	static ByteArray b;
+	if(!b.size())
+	{
+		for(unsigned int i=0; b.size()<65536; ++i)
+		{
+			b.append("key=value;");
+		}
+	}
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += b.split(";").size();
+	}
+}
+
+void byteArrayIndexOfShort(unsigned long long n)
+{
+	static ByteArray b = makeBytes(65536)+"abcd";
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += b.indexOf("abcd");
+	}
+}
+
+// needle of 255 x and one y, text is all x: every position matches long.
+void byteArrayIndexOfLong(unsigned long long n)
+{
+	static ByteArray b = makeBytes(1048576)+makeBytes(255)+"y";
+	static ByteArray needle = makeBytes(255)+"y";
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += b.indexOf(needle);
+	}
+}
+
+void kmpSearchLong(unsigned long long n)
+{
+	static ByteArray b = makeBytes(1048576)+makeBytes(255)+"y";
+	static ByteArray needle = makeBytes(255)+"y";
+	static vector<int> next = kmpGetNext(needle, needle.size());
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += kmpSearch(b, needle, b.size(), needle.size(), next);
+	}
+}
+
+void byteArrayConcat(unsigned long long n)
+{
+	static ByteArray piece = makeBytes(64);
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		ByteArray b = piece+":"+piece+"#"+piece+piece;
+		benchSink += b.size();
+	}
+}
+
+// String
+
+void stringConcat(unsigned long long n)
+{
+	String piece = "hello world, this is a string of 48 characters.";
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		String s = piece+":"+piece+"#"+piece+piece;
+		benchSink += s.size();
+	}
+}
+
+void stringFromInt(unsigned long long n)
+{
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += String::fromNumber((int) i).size();
+	}
+}
+
+void stringFromDouble(unsigned long long n)
+{
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += String::fromNumber(i*0.37).size();
+	}
+}
+
+void stringToInt(unsigned long long n)
+{
+	String s = "1234567";
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += s.toInt();
+	}
+}
+
+void stringToDouble(unsigned long long n)
+{
+	String s = "12345.678";
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += (unsigned long long) s.toDouble();
+	}
+}
+
+// Json
+
+template<unsigned int SIZE>
+void jsonParse(unsigned long long n)
+{
+	const String &text = jsonText(SIZE);
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		Json json = Json::parseFromText(text);
+		benchSink += json.type();
+	}
+}
+
+template<unsigned int SIZE>
+void jsonStringify(unsigned long long n)
+{
+	const Json &json = jsonDocument(SIZE);
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += json.toString().size();
+	}
+}
+
+// IniSettings
+
+void iniValue(unsigned long long n)
+{
+	static IniSettings *settings = NULL;
+	if(!settings)
+	{
+		String text;
+		for(unsigned int p=0; p<20; ++p)
+		{
+			text += "[section"+String::fromNumber(p)+"]\n";
+			for(unsigned int c=0; c<20; ++c)
+			{
+				text += "key"+String::fromNumber(c)+"=value"+String::fromNumber(p*20+c)+"\n";
+			}
+			text += "\n";
+		}
+		FILE *fp = fopen("framework-bench.ini", "w");
+		if(fp)
+		{
+			fwrite((const char *) text, 1, text.size(), fp);
+			fclose(fp);
+		}
+		settings = new IniSettings("framework-bench.ini");
+		remove("framework-bench.ini");
+	}
+	for(unsigned long long i=0; i<n; ++i)
+	{
+		benchSink += settings->value("section10/key10").size();
+	}
+}
+
+BenchCase cases[] = {
+	{"bytearray_append_16b_to_1m", byteArrayAppend<16, 1048576>, 1048576},
+	{"bytearray_append_64k_to_16m", byteArrayAppend<65536, 16777216>, 16777216},
+	{"bytearray_reserve_append_16b_to_1m", byteArrayReserveAppend, 1048576},
+	{"bytearray_mid_1k", byteArrayMid, 1024},
+	{"bytearray_split_64k", byteArraySplit, 65536},
+	{"bytearray_indexof_short_64k", byteArrayIndexOfShort, 65536},
+	{"bytearray_indexof_long_1m", byteArrayIndexOfLong, 1048576},
+	{"kmp_search_long_1m", kmpSearchLong, 1048576},
+	{"bytearray_concat_4x64b", byteArrayConcat, 0},
+	{"string_concat_4x48b", stringConcat, 0},
+	{"string_from_int", stringFromInt, 0},
+	{"string_from_double", stringFromDouble, 0},
+	{"string_to_int", stringToInt, 0},
+	{"string_to_double", stringToDouble, 0},
+	{"json_parse_1k", jsonParse<1024>, 1024},
+	{"json_parse_64k", jsonParse<65536>, 65536},
+	{"json_parse_1m", jsonParse<1048576>, 1048576},
+	{"json_parse_10m", jsonParse<10485760>, 10485760},
+	{"json_stringify_1k", jsonStringify<1024>, 1024},
+	{"json_stringify_64k", jsonStringify<65536>, 65536},
+	{"json_stringify_1m", jsonStringify<1048576>, 1048576},
+	{"json_stringify_10m", jsonStringify<10485760>, 10485760},
+	{"ini_value", iniValue, 0},
+};
+
+// usec of run(n).
+unsigned long long timeOf(BenchRun run, unsigned long long n)
+{
+	unsigned long long begin = TimerWheel::nowUsec();
+	run(n);
+	return TimerWheel::nowUsec()-begin;
+}
+
+bool selected(const char *name, const vector<const char *> &filters)
+{
+	if(filters.empty())
+	{
+		return true;
+	}
+	for(unsigned int i=0; i<filters.size(); ++i)
+	{
+		if(strstr(name, filters[i]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char *argv[])
+{
+	double minTime = 0.2;
+	unsigned int repeats = 3;
+	const char *jsonFile = NULL;
+	vector<const char *> filters;
+	for(int i=1; i<argc; ++i)
+	{
+		if(strcmp(argv[i], "-t")==0 && i+1<argc)
+		{
+			minTime = atof(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-r")==0 && i+1<argc)
+		{
+			repeats = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-j")==0 && i+1<argc)
+		{
+			jsonFile = argv[++i];
+		}
+		else
+		{
+			filters.push_back(argv[i]);
+		}
+	}
+	if(!repeats)
+	{
+		repeats = 1;
+	}
+
+	Json results;
+	results.asObject();
+	printf("%-36s %14s %12s %10s\n", "case", "ns/op", "MB/s", "iterations");
+	for(unsigned int c=0; c<sizeof(cases)/sizeof(cases[0]); ++c)
+	{
+		if(!selected(cases[c].name, filters))
+		{
+			continue;
+		}
+		// warm up and find iterations taking min time.
+		unsigned long long n = 1;
+		unsigned long long used = timeOf(cases[c].run, n);
+		while(used < minTime*1e6)
+		{
+			unsigned long long more = used ? (unsigned long long) (n*minTime*1e6*1.2/used) : n*10;
+			n = more>n*10 ? n*10 : (more>n ? more : n+1);
+			used = timeOf(cases[c].run, n);
+		}
+		for(unsigned int r=1; r<repeats; ++r)
+		{
+			unsigned long long again = timeOf(cases[c].run, n);
+			if(again < used)
+			{
+				used = again;
+			}
+		}
+		double ns = used*1000.0/n;
+		double mbps = cases[c].bytes ? cases[c].bytes/(ns/1e9)/1048576 : 0;
+		if(cases[c].bytes)
+		{
+			printf("%-36s %14.1f %12.1f %10llu\n", cases[c].name, ns, mbps, n);
+		}
+		else
+		{
+			printf("%-36s %14.1f %12s %10llu\n", cases[c].name, ns, "-", n);
+		}
+		fflush(stdout);
+
+		Json result;
+		result.asObject();
+		result.set("ns_per_op", Json(ns));
+		result.set("iterations", Json((double) n));
+		if(cases[c].bytes)
+		{
+			result.set("mb_per_sec", Json(mbps));
+		}
+		results.set(cases[c].name, result);
+	}
+
+	if(jsonFile)
+	{
+		FILE *fp = fopen(jsonFile, "w");
+		if(!fp)
+		{
+			fprintf(stderr, "can not write %s!\n", jsonFile);
+			return -1;
+		}
+		String text = results.toString(true);
+		fwrite((const char *) text, 1, text.size(), fp);
+		fputc('\n', fp);
+		fclose(fp);
+	}
+	return benchSink==1 ? 1 : 0;	// never, keeps benchSink used.
+}
@@ -0,0 +1,41 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+/*
+ * Delays for retry, exponential backoff with decorrelated jitter:
+ * next = random between min and 3 times last, no more than max.
+ * Every Backoff seeds its own random, so many processes started at the
+ * same time still retry at different times. Thread unsafe.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 15:50.
+ */
+
+#define BACKOFF_MIN	200		// msec.
+#define BACKOFF_MAX	30000	// msec.
+
+class Backoff
+{
+public:
+	Backoff(unsigned int min=BACKOFF_MIN, unsigned int max=BACKOFF_MAX);
+	virtual ~Backoff();
+
+	// msec to wait before next retry.
+	unsigned int next();
+
+	// Succeeded, next retry starts from min again.
+	void reset();
+
+	unsigned int min() const;
+	unsigned int max() const;
+
+private:
+	unsigned int m_min;
+	unsigned int m_max;
+	unsigned int m_last;
+	unsigned long long m_random;
+
+	unsigned long long random();
+};
+
+#endif	//BACKOFF_H
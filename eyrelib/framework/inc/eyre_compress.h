@@ -0,0 +1,88 @@
+#ifndef EYRE_COMPRESS_H
+#define EYRE_COMPRESS_H
+
+/*
+ * Streaming compression for a sequence of messages. Thread unsafe.
+ * Compressor and decompressor keep the last 64k of the stream as history,
+ * so a small message can refer to what was sent before and still compress.
+ * The block format is the LZ4 one: token, literals, 2 bytes offset, match.
+ *
+ * Both sides must see the same bytes in the same order: every message the
+ * compressor handled (even if it returned false and the message is sent
+ * raw) must be given to the decompressor, by decompress() or update().
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 11:20.
+ */
+
+#include <vector>
+#include "byte_array.h"
+#include "eyre_string.h"
+
+#define COMPRESS_NONE	0
+#define COMPRESS_LZ		1	// built-in LZ4 block format codec.
+
+#define COMPRESS_LEVEL_MIN	1	// fastest.
+#define COMPRESS_LEVEL_MAX	9	// best ratio.
+
+#define COMPRESS_MIN_SIZE	64	// message smaller than this is never compressed.
+
+typedef int CompressAlgorithm;
+
+class StreamCompressor
+{
+public:
+	StreamCompressor(CompressAlgorithm algorithm=COMPRESS_LZ, int level=COMPRESS_LEVEL_MIN,
+					unsigned int minSize=COMPRESS_MIN_SIZE);
+	virtual ~StreamCompressor();
+
+	/*
+	 * Compress data and replace out with result.
+	 * Return false when data is too small, incompressible, or skipped
+	 * because recent messages were incompressible; send data raw then.
+	 */
+	bool compress(const ByteArray &data, ByteArray &out);
+
+	void reset();
+
+	CompressAlgorithm algorithm() const;
+
+	static CompressAlgorithm algorithmFromName(const String &name);	// "lz" or "none".
+	static String algorithmName(CompressAlgorithm algorithm);
+
+private:
+	CompressAlgorithm m_algorithm;
+	unsigned int m_minSize;
+	unsigned int m_hashBits;
+	unsigned int m_skipTrigger;	// less is faster but misses matches.
+
+	std::vector<char> m_window;	// history and current message.
+	unsigned long long m_windowStart;	// stream offset of m_window[0].
+	std::vector<unsigned long long> m_hashTable;	// stream offset of last 4 bytes has this hash.
+
+	unsigned int m_failures;	// incompressible messages in a row.
+	unsigned int m_skip;		// messages left to send raw without trying.
+
+	void append(const char *data, unsigned int size);
+	unsigned int compressBlock(unsigned int begin, char *out);
+};
+
+class StreamDecompressor
+{
+public:
+	StreamDecompressor();
+	virtual ~StreamDecompressor();
+
+	// rawSize is the size before compressed, return false if data is broken.
+	bool decompress(const char *data, unsigned int size, unsigned int rawSize, ByteArray &out);
+
+	// Message was sent raw, keep history same as compressor.
+	void update(const ByteArray &raw);
+
+	void reset();
+
+private:
+	std::vector<char> m_window;
+};
+
+#endif	//EYRE_COMPRESS_H
@@ -5,9 +5,10 @@
  * json读写能力
  * 非线程安全
  * 内部实现全是深复制，不存在两个及以上json同时引用同一个内存地址的情况
+ * 解析是单遍扫描，子节点直接建在父节点里，不经过复制
  * 
  * 作者: Eyre Turing (Eyre-Turing)
- * 最后编辑于: 2021-09-25 11:24
+ * 最后编辑于: 2026-10-19 22:10
  */
 
 #include <vector>
@@ -27,7 +28,11 @@
 #define JSON_APPEND		1
 #define JSON_UPDATE		2
 
+#define JSON_PARSE_DEPTH	512		// 解析时允许的最大嵌套层数，超过视为文本不正常
+#define JSON_PARSE_KEYS		4096	// 解析时缓存的不同键的最大个数
+
 class JsonArray;
+class JsonParser;
 
 class Json
 {
@@ -70,6 +75,7 @@ public:
 	bool remove(const String &key);						// 删除键值对，this是json对象且key存在则删除并返回true，否则返回false
 	
 	static Json parseFromText(const String &text, size_t beg = 0, size_t *endpos = NULL);	// 从文本解析json，beg为解析开始偏移位置，endpos为解析完毕后的偏移位置（不是相对beg的位置，而是按text的下标位置）
+	static Json parse(const char *data, size_t size, size_t *endpos = NULL);	// 从size字节的原始数据解析json，data不需要以0结尾；文本不正常时返回JSON_NULL，endpos为size
 	String toString(bool fold = false, size_t dep = 0, size_t space = 2) const;		// 输出为字符串，参数fold控制输出文本是否折行美化
 
 	std::vector<String> keys() const;
@@ -120,6 +126,7 @@ public:
 	friend std::ostream &operator<<(std::ostream &out, const Json &json);
 
 	friend class JsonArray;
+	friend class JsonParser;
 
 private:
 	Json *m_parent;
@@ -0,0 +1,96 @@
+#ifndef EYRE_LOG_H
+#define EYRE_LOG_H
+
+/*
+ * Asynchronous log. Messages are put in a lock-free ring and written by
+ * a subthread, so a thread logging never waits for stdout; when the ring
+ * is full the message is dropped and counted.
+ * Every call site is rate limited by itself: more than rate messages in
+ * a second are suppressed, and the next one written tells how many.
+ * Before start() or after stop(), messages are written at once.
+ * Compile need -lpthread.
+ *
+ * Use like cout:
+ * EYRE_LOG_INFO("user "<<id<<" connected.");
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 17:40.
+ */
+
+#include <sstream>
+#include <string>
+#include "eyre_string.h"
+#include "byte_array.h"
+
+#define LOG_LEVEL_ERROR	0	// to stderr.
+#define LOG_LEVEL_WARN	1
+#define LOG_LEVEL_INFO	2
+#define LOG_LEVEL_DEBUG	3
+
+#define LOG_RING_SIZE	4096	// messages waiting for writer, power of 2.
+#define LOG_RATE	20		// messages per sec of one call site, 0 means no limit.
+#define LOG_PREVIEW	64		// bytes of payload preview.
+
+#define EYRE_LOG(level, expr) \
+	do \
+	{ \
+		if(Logger::enabled(level)) \
+		{ \
+			static Logger::Site eyreLogSite = {0, 0, 0}; \
+			unsigned int eyreLogSuppressed; \
+			if(Logger::allow(eyreLogSite, eyreLogSuppressed)) \
+			{ \
+				std::ostringstream eyreLogStream; \
+				eyreLogStream<<expr; \
+				Logger::write(level, eyreLogStream.str(), eyreLogSuppressed); \
+			} \
+		} \
+	} while(0)
+
+#define EYRE_LOG_ERROR(expr)	EYRE_LOG(LOG_LEVEL_ERROR, expr)
+#define EYRE_LOG_WARN(expr)		EYRE_LOG(LOG_LEVEL_WARN, expr)
+#define EYRE_LOG_INFO(expr)		EYRE_LOG(LOG_LEVEL_INFO, expr)
+#define EYRE_LOG_DEBUG(expr)	EYRE_LOG(LOG_LEVEL_DEBUG, expr)
+
+class Logger
+{
+public:
+	struct Site
+	{
+		volatile unsigned long long second;
+		volatile unsigned int count;		// messages in this second.
+		volatile unsigned int suppressed;	// not written since last written.
+	};
+
+	// Start the writer thread.
+	static bool start(int level=LOG_LEVEL_INFO, unsigned int rate=LOG_RATE);
+
+	// Write all waiting messages and quit the writer thread.
+	static void stop();
+
+	static void setLevel(int level);
+	static int level();
+	static bool enabled(int level);
+
+	// false if site is over rate, suppressed is how many were not written before.
+	static bool allow(Site &site, unsigned int &suppressed);
+
+	static void write(int level, const std::string &text, unsigned int suppressed=0);
+
+	// Messages dropped because the ring was full.
+	static unsigned long long dropped();
+
+	// Hex and printable ascii of first limit bytes, 16 bytes a line.
+	static String preview(const ByteArray &data, unsigned int limit=LOG_PREVIEW);
+
+	// "error", "warn", "info" or "debug", unknown name is info.
+	static int levelFromName(const String &name);
+
+	class Thread
+	{
+	public:
+		static void *writeThread(void *arg);
+	};
+};
+
+#endif	//EYRE_LOG_H
@@ -0,0 +1,62 @@
+#ifndef EYRE_METRICS_H
+#define EYRE_METRICS_H
+
+/*
+ * Collect named values at scrape time and print them as Prometheus text
+ * exposition format or as json. Thread unsafe, build one per scrape.
+ * Histograms are printed as summary: quantiles, sum and count.
+ * Samples of one name with labels (like backend="a:80") are added one
+ * after another; json puts them in an object by labels.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 20:25.
+ */
+
+#include <vector>
+#include "eyre_string.h"
+#include "eyre_json.h"
+#include "stat_counter.h"
+
+class MetricsReport
+{
+public:
+	MetricsReport(const String &prefix="");
+	virtual ~MetricsReport();
+
+	// Only grows, name of a counter should end with "_total".
+	void counter(const String &name, const String &help, double value, const String &labels="");
+
+	// Goes up and down.
+	void gauge(const String &name, const String &help, double value, const String &labels="");
+
+	// Label value quoted and escaped, e.g. label("backend", "a:80").
+	static String label(const String &name, const String &value);
+
+	// Values of histogram are multiplied by scale, e.g. 1e-6 for usec to sec.
+	void summary(const String &name, const String &help, const StatHistogram &histogram,
+				double scale=1);
+
+	// Process resident memory, and malloc arena when glibc tells.
+	void process();
+
+	String toPrometheus() const;
+	Json toJson() const;
+
+private:
+	struct Sample
+	{
+		String name;
+		String help;
+		String labels;
+		const char *type;
+		double value;	// sum of a summary.
+		unsigned long long count;
+		double max;
+		std::vector<double> quantiles;	// values at SUMMARY_QUANTILES.
+	};
+
+	String m_prefix;
+	std::vector<Sample> m_samples;
+};
+
+#endif	//EYRE_METRICS_H
@@ -6,5 +6,14 @@
 #include "eyre_file.h"
 #include "ini_settings.h"
 #include "eyre_json.h"
+#include "eyre_compress.h"
+#include "timer_wheel.h"
+#include "replay_buffer.h"
+#include "backoff.h"
+#include "token_bucket.h"
+#include "stat_counter.h"
+#include "eyre_metrics.h"
+#include "eyre_log.h"
+#include "frame_capture.h"
 
 #endif	//EYRE_TURING_LIB_H
@@ -0,0 +1,81 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+/*
+ * Capture of tunnel traffic, for replay offline.
+ * File: "EYRECAP1", then records, numbers are little endian:
+ * time(8, usec since capture start) kind(1) direction(1)
+ * idSize(2) id payloadSize(4) payload
+ * CaptureWriter writes through a big buffer and can be called from any
+ * thread, call flush() now and then so a killed process loses little.
+ * CaptureReader is thread unsafe.
+ * Compile need -lpthread.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 18:10.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+#include "byte_array.h"
+#include "eyre_string.h"
+
+#define CAPTURE_MAGIC	"EYRECAP1"
+#define CAPTURE_BUFFER	1048576	// 1M, bytes buffered before written to file.
+
+#define CAPTURE_OPEN	0	// stream opened.
+#define CAPTURE_DATA	1	// payload of stream.
+#define CAPTURE_CLOSE	2	// stream closed by side of direction.
+
+#define CAPTURE_UP		0	// from user to real server.
+#define CAPTURE_DOWN	1	// from real server to user.
+
+struct CaptureRecord
+{
+	unsigned long long time;	// usec since capture start.
+	int kind;
+	int direction;
+	String id;
+	ByteArray payload;
+};
+
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	virtual ~CaptureWriter();
+
+	bool open(const String &fileName);
+	void close();	// flush and close.
+	void flush();
+	bool isOpen() const;
+
+	void write(int kind, int direction, const String &id, const ByteArray &payload="");
+
+	unsigned long long records() const;
+
+private:
+	FILE *m_file;
+	char *m_buffer;
+	unsigned long long m_start;	// TimerWheel::nowUsec() when opened.
+	unsigned long long m_records;
+	mutable pthread_mutex_t m_mutex;
+};
+
+class CaptureReader
+{
+public:
+	CaptureReader();
+	virtual ~CaptureReader();
+
+	bool open(const String &fileName);
+	void close();
+
+	// false at end of file or a broken record.
+	bool next(CaptureRecord &record);
+
+private:
+	FILE *m_file;
+};
+
+#endif	//FRAME_CAPTURE_H
@@ -0,0 +1,54 @@
+#ifndef REPLAY_BUFFER_H
+#define REPLAY_BUFFER_H
+
+/*
+ * Keep the tail of a byte stream that peer may not have got yet. Thread unsafe.
+ * Bytes are addressed by stream offset, offset 0 is the first byte ever
+ * appended. Peer acks an offset and bytes before it are dropped; when more
+ * than limit bytes are kept, the oldest are dropped too and can not be
+ * read again.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 14:10.
+ */
+
+#include <deque>
+#include "byte_array.h"
+
+#define REPLAY_BUFFER_LIMIT	1048576
+
+class ReplayBuffer
+{
+public:
+	ReplayBuffer(unsigned long long limit=REPLAY_BUFFER_LIMIT);
+	virtual ~ReplayBuffer();
+
+	void append(const ByteArray &data);
+
+	// Peer got all bytes before offset.
+	void ack(unsigned long long offset);
+
+	/*
+	 * Replace out with bytes from offset to end.
+	 * Return false if bytes from offset were dropped, or offset is beyond end.
+	 */
+	bool read(unsigned long long offset, ByteArray &out) const;
+
+	unsigned long long begin() const;	// offset of oldest byte kept.
+	unsigned long long end() const;		// offset after last byte appended.
+	unsigned long long size() const;
+
+	void setLimit(unsigned long long limit);
+	unsigned long long limit() const;
+
+private:
+	std::deque<ByteArray> m_chunks;
+	unsigned int m_skip;	// bytes of m_chunks.front() already dropped.
+	unsigned long long m_begin;
+	unsigned long long m_size;
+	unsigned long long m_limit;
+
+	void dropTo(unsigned long long offset);
+};
+
+#endif	//REPLAY_BUFFER_H
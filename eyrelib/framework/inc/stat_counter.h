@@ -0,0 +1,88 @@
+#ifndef STAT_COUNTER_H
+#define STAT_COUNTER_H
+
+/*
+ * Counters and histograms for hot paths, no lock.
+ * Every thread adds to its own shard (threads more than shards share one
+ * by atomic add), shards are on separate cache lines and merged when read.
+ * StatHistogram buckets values by log2 and 16 linear sub-buckets, like a
+ * HDR histogram of 1 significant digit: error is less than 1/16.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 17:10.
+ */
+
+#include <vector>
+
+#define STAT_CACHE_LINE	64
+#define STAT_SHARDS	16
+
+#define STAT_SUB_BITS	4	// 16 sub-buckets per power of 2.
+#define STAT_MAX_BITS	40	// values from 2^41 are in the last bucket.
+#define STAT_BUCKETS	(((STAT_MAX_BITS-STAT_SUB_BITS+1)<<STAT_SUB_BITS)+(1<<STAT_SUB_BITS))
+
+class StatCounter
+{
+public:
+	StatCounter();
+	virtual ~StatCounter();
+
+	void add(unsigned long long n=1);
+	unsigned long long value() const;
+
+	// Thread's own shard, in [0, STAT_SHARDS).
+	static unsigned int shard();
+
+private:
+	struct Shard
+	{
+		volatile unsigned long long value;
+		char pad[STAT_CACHE_LINE-sizeof(unsigned long long)];
+	};
+
+	Shard m_shards[STAT_SHARDS];
+
+	StatCounter(const StatCounter &);
+	StatCounter &operator=(const StatCounter &);
+};
+
+class StatHistogram
+{
+public:
+	struct Snapshot
+	{
+		unsigned long long count;
+		unsigned long long sum;
+		unsigned long long max;
+		std::vector<unsigned long long> buckets;
+
+		// Highest value q (0 to 1) of the values are no more than.
+		unsigned long long percentile(double q) const;
+	};
+
+	StatHistogram();
+	virtual ~StatHistogram();
+
+	void record(unsigned long long value);
+	Snapshot snapshot() const;
+
+	static unsigned int bucketOf(unsigned long long value);
+	static unsigned long long bucketHigh(unsigned int bucket);	// highest value in bucket.
+
+private:
+	struct Shard
+	{
+		volatile unsigned long long count;
+		volatile unsigned long long sum;
+		volatile unsigned long long max;
+		volatile unsigned long long buckets[STAT_BUCKETS];
+		char pad[STAT_CACHE_LINE];	// keep next shard off our last line.
+	};
+
+	Shard *m_shards;
+
+	StatHistogram(const StatHistogram &);
+	StatHistogram &operator=(const StatHistogram &);
+};
+
+#endif	//STAT_COUNTER_H
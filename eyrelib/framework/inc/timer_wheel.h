@@ -0,0 +1,84 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/*
+ * Timers on a hierarchical wheel, driven by calling tick() from an event loop.
+ * Near timers hash to slots of ticks, far ones to coarser levels and move
+ * down a level when their slot comes round, so add(), cancel() and each
+ * tick cost O(1) however many timers there are.
+ * No thread is created, timeout call back is exec in the thread calling tick().
+ * add() and cancel() can be called from any thread, even in a call back.
+ * Compile need -lpthread.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 21:30.
+ */
+
+#include <vector>
+#include <pthread.h>
+
+#define TIMER_WHEEL_TICK	10	// msec per slot.
+#define TIMER_WHEEL_SLOTS	256	// slots of the nearest level, a tick each.
+#define TIMER_WHEEL_LEVEL_SLOTS	64	// slots of each farther level.
+#define TIMER_WHEEL_LEVELS	4	// 256*64*64*64 ticks, 7.7 days of 10 msec.
+
+class TimerWheel
+{
+public:
+	typedef void (*Timeout)(TimerWheel *wheel, unsigned long long id, void *arg);
+
+	TimerWheel(unsigned int tick=TIMER_WHEEL_TICK);
+	virtual ~TimerWheel();
+
+	// Call timeout(this, id, arg) after delay msec, return timer id (never 0).
+	unsigned long long add(unsigned int delay, Timeout timeout, void *arg=NULL);
+
+	// Return false if the timer has fired or not exist.
+	bool cancel(unsigned long long id);
+
+	// Fire timers expired by now, return how many fired.
+	unsigned int tick();
+
+	unsigned int size() const;
+
+	static unsigned long long now();		// monotonic msec.
+	static unsigned long long nowUsec();	// monotonic usec.
+
+private:
+	/*
+	 * Timers are nodes of a pool, linked in their slot by index.
+	 * Id is generation<<32|index, generation changes when the node is
+	 * freed, so an id of a fired timer never cancels a new one.
+	 */
+	struct Timer
+	{
+		unsigned long long expire;	// in ticks.
+		unsigned int generation;
+		int slot;	// -1 when free.
+		int prev;
+		int next;	// in slot, or next free node.
+		Timeout timeout;
+		void *arg;
+	};
+
+	unsigned int m_tick;
+	std::vector<Timer> m_nodes;
+	std::vector<int> m_heads;	// first node of each slot, nearest level first.
+	int m_free;
+	unsigned int m_size;
+	unsigned long long m_current;	// next tick to handle.
+
+	mutable pthread_mutex_t m_mutex;
+
+	// Need lock m_mutex first.
+	void place(int node);
+	void link(int node, int slot);
+	void unlink(int node);
+	void release(int node);
+	void cascade(int slot);
+
+	TimerWheel(const TimerWheel &);
+	TimerWheel &operator=(const TimerWheel &);
+};
+
+#endif	//TIMER_WHEEL_H
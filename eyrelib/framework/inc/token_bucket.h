@@ -0,0 +1,60 @@
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+/*
+ * Token bucket of bytes per sec, for shaping reads.
+ * A bucket may have a parent, so a stream, its service and all traffic
+ * are limited at once by taking from the chain.
+ * take() counts bytes already read, tokens may go below 0, the reader
+ * stops reading for the msec it returns instead of dropping data.
+ * Rate 0 means unlimited, such a bucket costs no lock.
+ * Compile need -lpthread.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 21:10.
+ */
+
+#include <pthread.h>
+
+#define TOKEN_BUCKET_BURST	100	// msec of rate a bucket holds.
+
+class TokenBucket
+{
+public:
+	TokenBucket(unsigned long long rate=0, unsigned int burst=TOKEN_BUCKET_BURST,
+				TokenBucket *parent=NULL);
+	virtual ~TokenBucket();
+
+	// Take bytes from this and its parents, return msec to wait, 0 means go on.
+	unsigned int take(unsigned long long bytes);
+
+	/*
+	 * Take count only if this and its parents all have it, for things
+	 * refused when over rate, so refused ones do not run into debt.
+	 */
+	bool tryTake(unsigned long long count);
+
+	// msec till this and its parents have tokens again.
+	unsigned int wait();
+
+	unsigned long long rate() const;
+	TokenBucket *parent() const;
+
+private:
+	unsigned long long m_rate;	// bytes per sec.
+	long long m_capacity;	// bytes.
+	long long m_tokens;
+	unsigned long long m_stamp;	// usec tokens were counted to.
+	TokenBucket *m_parent;
+
+	mutable pthread_mutex_t m_mutex;
+
+	// Refill, take bytes and return msec this one waits, need lock m_mutex first.
+	unsigned int update(unsigned long long bytes);
+	void refill();
+
+	TokenBucket(const TokenBucket &);
+	TokenBucket &operator=(const TokenBucket &);
+};
+
+#endif	//TOKEN_BUCKET_H
@@ -0,0 +1,79 @@
+/*
+ * Class Backoff, xorshift random seeded by clock, pid and address.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 15:50.
+ */
+
+#include "backoff.h"
+#include "timer_wheel.h"
+#include "general.h"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+Backoff::Backoff(unsigned int min, unsigned int max)
+{
+	m_min = min ? min : 1;
+	m_max = max<m_min ? m_min : max;
+	m_last = 0;
+	m_random = TimerWheel::nowUsec()^((unsigned long long) getpid()<<32)^
+		(unsigned long long) (size_t) this;
+	if(!m_random)
+	{
+		m_random = 1;
+	}
+
+#if EYRE_DETAIL
+	fprintf(stdout, "Backoff(%p) created.\n", this);
+#endif
+}
+
+Backoff::~Backoff()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "Backoff(%p) destroyed.\n", this);
+#endif
+}
+
+unsigned int Backoff::next()
+{
+	unsigned long long upper = (unsigned long long) (m_last ? m_last : m_min)*3;
+	if(upper > m_max)
+	{
+		upper = m_max;
+	}
+	unsigned int delay = m_min;
+	if(upper > m_min)
+	{
+		delay = m_min+random()%(upper-m_min+1);
+	}
+	m_last = delay;
+	return delay;
+}
+
+void Backoff::reset()
+{
+	m_last = 0;
+}
+
+unsigned int Backoff::min() const
+{
+	return m_min;
+}
+
+unsigned int Backoff::max() const
+{
+	return m_max;
+}
+
+unsigned long long Backoff::random()
+{
+	m_random ^= m_random<<13;
+	m_random ^= m_random>>7;
+	m_random ^= m_random<<17;
+	return m_random;
+}
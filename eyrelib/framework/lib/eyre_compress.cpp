@@ -0,0 +1,363 @@
+/*
+ * Class StreamCompressor and StreamDecompressor, LZ4 block format with
+ * the previous 64k of the stream as dictionary.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 11:20.
+ */
+
+#include "eyre_compress.h"
+#include "general.h"
+#include <string.h>
+
+#define WINDOW_SIZE		65536	//history a match can refer to.
+#define MAX_OFFSET		0xffff
+#define MIN_MATCH		4
+#define LAST_LITERALS	5	//last bytes are always literals.
+#define MF_LIMIT		12	//match can not start in the last bytes.
+#define NO_POS			0xffffffff
+#define MAX_SKIP_SHIFT	6	//skip at most 63 messages after incompressible ones.
+
+static inline unsigned int read32(const unsigned char *p)
+{
+	unsigned int v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline unsigned int hash32(unsigned int v, unsigned int bits)
+{
+	return (v*2654435761U) >> (32-bits);
+}
+
+static unsigned char *writeLength(unsigned char *op, unsigned int len)
+{
+	while(len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char) len;
+	return op;
+}
+
+static unsigned char *writeSequence(unsigned char *op, const unsigned char *literals,
+									unsigned int literalLen, unsigned int offset,
+									unsigned int matchLen)
+{
+	unsigned char *token = op++;
+	unsigned int ml = matchLen-MIN_MATCH;
+	*token = (unsigned char) (((literalLen<15 ? literalLen : 15)<<4) | (ml<15 ? ml : 15));
+	if(literalLen >= 15)
+	{
+		op = writeLength(op, literalLen-15);
+	}
+	memcpy(op, literals, literalLen);
+	op += literalLen;
+	if(matchLen)
+	{
+		*op++ = (unsigned char) (offset&0xff);
+		*op++ = (unsigned char) (offset>>8);
+		if(ml >= 15)
+		{
+			op = writeLength(op, ml-15);
+		}
+	}
+	return op;
+}
+
+//keep the last WINDOW_SIZE bytes once the window doubled, return bytes dropped.
+static unsigned int trimWindow(std::vector<char> &window)
+{
+	if(window.size() <= 2*WINDOW_SIZE)
+	{
+		return 0;
+	}
+	unsigned int drop = window.size()-WINDOW_SIZE;
+	window.erase(window.begin(), window.begin()+drop);
+	return drop;
+}
+
+StreamCompressor::StreamCompressor(CompressAlgorithm algorithm, int level, unsigned int minSize)
+{
+	if(level < COMPRESS_LEVEL_MIN)
+	{
+		level = COMPRESS_LEVEL_MIN;
+	}
+	else if(level > COMPRESS_LEVEL_MAX)
+	{
+		level = COMPRESS_LEVEL_MAX;
+	}
+	m_algorithm = algorithm;
+	m_minSize = minSize;
+	m_hashBits = 11+level;	//level 1 use 16k table, 5 and above 256k.
+	if(m_hashBits > 16)
+	{
+		m_hashBits = 16;
+	}
+	m_skipTrigger = 5+level;
+	m_windowStart = 0;
+	m_failures = 0;
+	m_skip = 0;
+
+#if EYRE_DETAIL
+	fprintf(stdout, "StreamCompressor(%p) created, level: %d.\n", this, level);
+#endif
+}
+
+StreamCompressor::~StreamCompressor()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "StreamCompressor(%p) destroyed.\n", this);
+#endif
+}
+
+void StreamCompressor::reset()
+{
+	m_window.clear();
+	m_hashTable.clear();
+	m_windowStart = 0;
+	m_failures = 0;
+	m_skip = 0;
+}
+
+CompressAlgorithm StreamCompressor::algorithm() const
+{
+	return m_algorithm;
+}
+
+CompressAlgorithm StreamCompressor::algorithmFromName(const String &name)
+{
+	if(name == "lz" || name == "lz4")
+	{
+		return COMPRESS_LZ;
+	}
+	return COMPRESS_NONE;
+}
+
+String StreamCompressor::algorithmName(CompressAlgorithm algorithm)
+{
+	if(algorithm == COMPRESS_LZ)
+	{
+		return "lz";
+	}
+	return "none";
+}
+
+void StreamCompressor::append(const char *data, unsigned int size)
+{
+	m_windowStart += trimWindow(m_window);
+	m_window.insert(m_window.end(), data, data+size);
+}
+
+bool StreamCompressor::compress(const ByteArray &data, ByteArray &out)
+{
+	unsigned int size = data.size();
+	if(m_algorithm == COMPRESS_NONE)
+	{
+		return false;
+	}
+	if(size<m_minSize || m_skip)
+	{
+		if(m_skip)
+		{
+			--m_skip;
+		}
+		append(data, size);
+		return false;
+	}
+
+	if(m_hashTable.empty())
+	{
+		m_hashTable.resize(1<<m_hashBits, NO_POS);
+	}
+	unsigned int begin;
+	append(data, size);
+	begin = m_window.size()-size;
+
+	std::vector<char> buffer(size+size/255+16);
+	unsigned int outSize = compressBlock(begin, &buffer[0]);
+	if(outSize >= size-size/16)	//save less than 1/16, not worth.
+	{
+		if(m_failures < MAX_SKIP_SHIFT)
+		{
+			++m_failures;
+		}
+		m_skip = (1<<m_failures)-1;
+		return false;
+	}
+	m_failures = 0;
+	out = ByteArray(&buffer[0], outSize);
+	return true;
+}
+
+unsigned int StreamCompressor::compressBlock(unsigned int begin, char *out)
+{
+	const unsigned char *src = (const unsigned char *) &m_window[0];
+	unsigned int end = m_window.size();
+	unsigned char *op = (unsigned char *) out;
+	unsigned int anchor = begin;
+	unsigned int ip = begin;
+
+	if(end-begin > MF_LIMIT)
+	{
+		unsigned int matchLimit = end-LAST_LITERALS;
+		unsigned int ipLimit = end-MF_LIMIT;
+		unsigned int searchCount = 1<<m_skipTrigger;
+		while(ip < ipLimit)
+		{
+			unsigned int h = hash32(read32(src+ip), m_hashBits);
+			unsigned int pos = (unsigned int) (m_windowStart+ip);
+			unsigned int candidate = m_hashTable[h];
+			m_hashTable[h] = pos;
+			unsigned int distance = pos-candidate;
+			if(candidate==NO_POS || distance==0 || distance>MAX_OFFSET || distance>ip
+				|| read32(src+ip-distance)!=read32(src+ip))
+			{
+				ip += searchCount++ >> m_skipTrigger;	//step longer when no match for long.
+				continue;
+			}
+			unsigned int ref = ip-distance;
+			while(ip>anchor && ref>0 && src[ip-1]==src[ref-1])
+			{
+				--ip;
+				--ref;
+			}
+			unsigned int len = MIN_MATCH;
+			while(ip+len<matchLimit && src[ref+len]==src[ip+len])
+			{
+				++len;
+			}
+			op = writeSequence(op, src+anchor, ip-anchor, ip-ref, len);
+			ip += len;
+			anchor = ip;
+			searchCount = 1<<m_skipTrigger;
+			if(ip < ipLimit)
+			{
+				m_hashTable[hash32(read32(src+ip-2), m_hashBits)] = (unsigned int) (m_windowStart+ip-2);
+			}
+		}
+	}
+	op = writeSequence(op, src+anchor, end-anchor, 0, 0);	//last literals, no match.
+	return op-(unsigned char *) out;
+}
+
+StreamDecompressor::StreamDecompressor()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "StreamDecompressor(%p) created.\n", this);
+#endif
+}
+
+StreamDecompressor::~StreamDecompressor()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "StreamDecompressor(%p) destroyed.\n", this);
+#endif
+}
+
+void StreamDecompressor::reset()
+{
+	m_window.clear();
+}
+
+void StreamDecompressor::update(const ByteArray &raw)
+{
+	trimWindow(m_window);
+	m_window.insert(m_window.end(), (const char *) raw, ((const char *) raw)+raw.size());
+}
+
+bool StreamDecompressor::decompress(const char *data, unsigned int size, unsigned int rawSize, ByteArray &out)
+{
+	if(!rawSize)
+	{
+		return false;	//never compress an empty message.
+	}
+	trimWindow(m_window);
+	unsigned int begin = m_window.size();
+	m_window.resize(begin+rawSize);
+	char *window = &m_window[0];
+
+	const unsigned char *ip = (const unsigned char *) data;
+	const unsigned char *iend = ip+size;
+	unsigned int op = begin;
+	unsigned int oend = begin+rawSize;
+	bool broken = false;
+	while(ip < iend)
+	{
+		unsigned int token = *ip++;
+		unsigned int literalLen = token>>4;
+		if(literalLen == 15)
+		{
+			unsigned int b;
+			do
+			{
+				if(ip >= iend)
+				{
+					broken = true;
+					break;
+				}
+				b = *ip++;
+				literalLen += b;
+			} while(b == 255);
+		}
+		if(broken || literalLen>(unsigned int) (iend-ip) || literalLen>oend-op)
+		{
+			broken = true;
+			break;
+		}
+		memcpy(window+op, ip, literalLen);
+		ip += literalLen;
+		op += literalLen;
+		if(ip == iend)
+		{
+			break;	//last literals.
+		}
+
+		if(iend-ip < 2)
+		{
+			broken = true;
+			break;
+		}
+		unsigned int offset = ip[0] | (ip[1]<<8);
+		ip += 2;
+		unsigned int matchLen = token&15;
+		if(matchLen == 15)
+		{
+			unsigned int b;
+			do
+			{
+				if(ip >= iend)
+				{
+					broken = true;
+					break;
+				}
+				b = *ip++;
+				matchLen += b;
+			} while(b == 255);
+		}
+		matchLen += MIN_MATCH;
+		if(broken || offset==0 || offset>op || matchLen>oend-op)
+		{
+			broken = true;
+			break;
+		}
+		char *dst = window+op;
+		const char *ref = dst-offset;
+		for(unsigned int i=0; i<matchLen; ++i)	//may overlap, copy by byte.
+		{
+			dst[i] = ref[i];
+		}
+		op += matchLen;
+	}
+	if(broken || op!=oend)
+	{
+		m_window.resize(begin);
+#if EYRE_WARNING
+		fprintf(stderr, "StreamDecompressor(%p) broken data!\n", this);
+#endif
+		return false;
+	}
+	out = ByteArray(window+begin, rawSize);
+	return true;
+}
@@ -1,9 +1,12 @@
 #include "eyre_json.h"
 #include "general.h"
+#include <string>
+#include <string.h>
+#include <stdlib.h>
 
 /*
  * 作者: Eyre Turing (Eyre-Turing)
- * 最后编辑于: 2021/10/04 11:25
+ * 最后编辑于: 2026/10/19 22:10
  */
 
 Json JsonNone = Json::null();
@@ -382,196 +385,393 @@ bool Json::remove(const String &key)
 	return true;
 }
 
-Json Json::parseFromText(const String &text, size_t beg, size_t *endpos)
+/*
+ * 单遍解析器：只从前往后扫描一次原始字节
+ * 每个子节点直接new在父节点的容器里再往里填，不再经过临时Json深复制
+ * 键和文本都解码到同一个反复使用的缓冲里，同名的键只生成一次String
+ */
+class JsonParser
 {
-	size_t len = text.size();
-	for (; beg < len && (text.at(beg) == ' ' || text.at(beg) == '\n' || text.at(beg) == '\r' || text.at(beg) == ','); ++beg);	// 忽略空格、换行、逗号
-	if (beg >= len)	// 没有正文
+public:
+	JsonParser(const char *data, size_t size);
+
+	bool document(Json &json);	// 解析一个完整的json值，失败时偏移移到末尾
+	size_t offset() const;
+
+private:
+	const char *m_beg;
+	const char *m_p;
+	const char *m_end;
+	std::string m_buf;		// 当前键或文本解码后的内容
+	std::map<std::string, String> m_keys;	// 已出现过的键
+	String m_key;			// 键缓存满了以后用这个
+
+	void skip();	// 忽略空格、换行、制表符、逗号
+	bool value(Json &json, size_t depth);
+	bool object(Json &json, size_t depth);
+	bool array(Json &json, size_t depth);
+	bool text();	// 解码 " 开始的文本到m_buf
+	bool number(Json &json);
+	bool word(const char *w, size_t size);
+	const String &key();
+};
+
+JsonParser::JsonParser(const char *data, size_t size)
+{
+	m_beg = data;
+	m_p = data;
+	m_end = data+size;
+}
+
+size_t JsonParser::offset() const
+{
+	return m_p-m_beg;
+}
+
+void JsonParser::skip()
+{
+	for (; m_p < m_end && (*m_p == ' ' || *m_p == '\n' || *m_p == '\r' || *m_p == '\t' || *m_p == ','); ++m_p);
+}
+
+bool JsonParser::document(Json &json)
+{
+	skip();
+	if (m_p >= m_end || !value(json, 0))	// 没有正文或者文本不正常
 	{
-		return JsonNone;
+		m_p = m_end;
+		return false;
 	}
+	return true;
+}
 
-	Json json;
+bool JsonParser::value(Json &json, size_t depth)
+{
+	switch (*m_p)
+	{
+	case '{':
+		return object(json, depth+1);
+	case '[':
+		return array(json, depth+1);
+	case '\"':
+		if (!text())
+		{
+			return false;
+		}
+		json.m_type = JSON_STRING;
+		json.m_strval.append(m_buf.c_str(), CODEC_UTF8);
+		return true;
+	case 't':
+		json.m_type = JSON_BOOLEAN;
+		json.m_bolval = true;
+		return word("true", 4);
+	case 'f':
+		json.m_type = JSON_BOOLEAN;
+		json.m_bolval = false;
+		return word("false", 5);
+	case 'n':
+		return word("null", 4);		// 保持JSON_NONE
+	default:
+		return number(json);
+	}
+}
 
-	/*
-	 * 第一个匹配到的符号有6种情况
-	 * 1、匹配到 { ，表示接下来是一个json数据
-	 * 2、匹配到 [ ，表示接下来是一个列表
-	 * 3、匹配到 " ，表示整个是一个字符串
-	 * 4、匹配到 [0-9] ，表示整个是一个数字
-	 * 5、匹配到 [tf] ，表示整个是一个布尔
-	 * 6、匹配到 n ，表示是一个空json
-	 */
-	if (text.at(beg) == '{')	// 扫描直到遇到 } 完成数据解析（因为用递归的方法去做，所有即使内部也有若干{ }，也是在递归里就完成了，在最外层匹配到的第一个 } 就会是结束标志了）
-	{
-		json.asObject();
-		for (++beg; beg < len && text.at(beg) != '}';)
+bool JsonParser::object(Json &json, size_t depth)
+{
+	if (depth > JSON_PARSE_DEPTH)
+	{
+		return false;
+	}
+	for (++m_p; ; )
+	{
+		skip();
+		if (m_p >= m_end)
 		{
-			if (text.at(beg) != ' ' && text.at(beg) != '\n' && text.at(beg) != '\r' && text.at(beg) != ',')	// 忽略空格、换行、逗号
-			{
-				// 第一个匹配到的符号只可能为 " ，表示接下来是一个键
-				if (text.at(beg) != '\"')
-				{
-					// 出问题了，文本不正常
-					if (endpos)
-					{
-						*endpos = len;
-					}
-					return JsonNone;
-				}
-				size_t e = text.indexOf("\"", beg+1);
-				if (e == -1)	// 双引号不匹配，文本不正常
-				{
-					if (endpos)
-					{
-						*endpos = len;
-					}
-					return JsonNone;
-				}
-				String key = text.mid(beg+1, e-beg-1);	// 得到键
-				e = text.indexOf(":", e+1);	// 找 : 这是值开始的标志
-				if (e == -1)	// 键后面没有 : ，文本不正常
-				{
-					if (endpos)
-					{
-						*endpos = len;
-					}
-					return JsonNone;
-				}
-				json[key] = parseFromText(text, e+1, &beg);		// 这里会刷新beg的值，文本偏移将直接跳转到子json的后面
-			}
-			else
-			{
-				++beg;
-			}
+			return false;
 		}
-		if (endpos)
+		if (*m_p == '}')
 		{
-			*endpos = beg+1;
+			break;
 		}
-	}
-	else if (text.at(beg) == '[')	// 扫描直到遇到 ]
-	{
-		json.asArray();
-		JsonArray jsonArray = json.toArray();
-		for (++beg; beg < len && text.at(beg) != ']';)
+		if (*m_p != '\"' || !text())	// 只可能是键
 		{
-			if (text.at(beg) != ' ' && text.at(beg) != '\n' && text.at(beg) != '\r' && text.at(beg) != ',')	// 忽略空格、换行、逗号
-			{
-				// 直接匹配子json
-				jsonArray.append(parseFromText(text, beg, &beg));
-			}
-			else
-			{
-				++beg;
-			}
+			return false;
 		}
-		if (endpos)
+		const String &k = key();
+		skip();
+		if (m_p >= m_end || *m_p != ':')
 		{
-			*endpos = beg+1;
+			return false;
 		}
-	}
-	else if (text.at(beg) == '\"')	// 匹配直到 " ，遇到转义的双引号要继续往下获取
-	{
-		size_t e;
-		bool en = false;	// 当前文本是否进入转义状态
-		for (e = beg+1; e < len; ++e)
+		++m_p;
+		skip();
+		if (m_p >= m_end)
 		{
-			if (en)	// 转义状态
-			{
-				en = false;	// 转义状态遇到什么字符都不需要理会，取消转义状态即可
-			}
-			else if (text.at(e) == '\\')	// 非转义状态遇到转义标志字符
-			{
-				en = true;	// 进入转义状态
-			}
-			else if (text.at(e) == '\"')	// 非转义状态遇到 "
-			{
-				break;
-			}
+			return false;
 		}
-		if (e >= len)
+		json.m_type = JSON_OBJECT;
+		Json *&child = json.m_objval[k];
+		if (child)	// 重复的键，后面的覆盖前面的
 		{
-			// 双引号不匹配，文本不正常
-			if (endpos)
-			{
-				*endpos = len;
-			}
-			return JsonNone;
+			delete child;
 		}
-		json = descript(text.mid(beg+1, e-beg-1));
-		if (endpos)
+		child = new Json();
+		child->m_parent = &json;
+		if (!value(*child, depth))	// 已经挂在json上，失败时跟着json一起释放
 		{
-			*endpos = e+1;
+			return false;
 		}
 	}
-	else if (text.at(beg) >= '0' && text.at(beg) <= '9')	// 匹配直到任意 [^0-9.]
+	++m_p;
+	return true;
+}
+
+bool JsonParser::array(Json &json, size_t depth)
+{
+	if (depth > JSON_PARSE_DEPTH)
+	{
+		return false;
+	}
+	for (++m_p; ; )
 	{
-		size_t e;
-		for (e = beg; e < len && ((text.at(e) >= '0' && text.at(e) <= '9') || text.at(e) == '.'); ++e);
-		if (e >= len)
+		skip();
+		if (m_p >= m_end)
 		{
-			if (endpos)
-			{
-				*endpos = len;
-			}
-			return JsonNone;
+			return false;
+		}
+		if (*m_p == ']')
+		{
+			break;
 		}
-		json = text.mid(beg, e-beg).toDouble();
-		if (endpos)
+		json.m_type = JSON_ARRAY;
+		Json *child = new Json();
+		child->m_parent = &json;
+		json.m_arrval.push_back(child);
+		if (!value(*child, depth))
 		{
-			*endpos = e+1;
+			return false;
 		}
 	}
-	else if (text.at(beg) == 't')	// 匹配4个字符
+	++m_p;
+	return true;
+}
+
+static bool hex4(const char *p, unsigned int &code)
+{
+	code = 0;
+	for (int i = 0; i < 4; ++i)
 	{
-		if (text.mid(beg, 4) != "true")
+		char c = p[i];
+		code <<= 4;
+		if (c >= '0' && c <= '9')
 		{
-			if (endpos)
-			{
-				*endpos = len;
-			}
-			return JsonNone;
+			code |= c-'0';
 		}
-		json = true;
-		if (endpos)
+		else if (c >= 'a' && c <= 'f')
 		{
-			*endpos = beg+4;
+			code |= c-'a'+10;
 		}
-	}
-	else if (text.at(beg) == 'f')	// 匹配5个字符
-	{
-		if (text.mid(beg, 5) != "false")
+		else if (c >= 'A' && c <= 'F')
 		{
-			if (endpos)
-			{
-				*endpos = len;
-			}
-			return JsonNone;
+			code |= c-'A'+10;
 		}
-		json = false;
-		if (endpos)
+		else
 		{
-			*endpos = beg+5;
+			return false;
 		}
 	}
-	else if (text.at(beg) == 'n')	// 匹配4个字符
+	return true;
+}
+
+static void appendUtf8(std::string &out, unsigned int code)
+{
+	if (code < 0x80)
+	{
+		out += (char) code;
+	}
+	else if (code < 0x800)
+	{
+		out += (char) (0xc0|(code>>6));
+		out += (char) (0x80|(code&0x3f));
+	}
+	else if (code < 0x10000)
+	{
+		out += (char) (0xe0|(code>>12));
+		out += (char) (0x80|((code>>6)&0x3f));
+		out += (char) (0x80|(code&0x3f));
+	}
+	else
+	{
+		out += (char) (0xf0|(code>>18));
+		out += (char) (0x80|((code>>12)&0x3f));
+		out += (char) (0x80|((code>>6)&0x3f));
+		out += (char) (0x80|(code&0x3f));
+	}
+}
+
+bool JsonParser::text()
+{
+	m_buf.clear();
+	for (++m_p; m_p < m_end; )
 	{
-		if (text.mid(beg, 4) != "null")
+		const char *run = m_p;
+		for (; m_p < m_end && *m_p != '\"' && *m_p != '\\'; ++m_p);	// 没有转义的一段整体复制
+		m_buf.append(run, m_p-run);
+		if (m_p >= m_end)
+		{
+			break;
+		}
+		if (*m_p == '\"')
+		{
+			++m_p;
+			return true;
+		}
+		if (++m_p >= m_end)
 		{
-			if (endpos)
+			break;
+		}
+		switch (*m_p++)
+		{
+		case 'r':
+			m_buf += '\r';
+			break;
+		case 'n':
+			m_buf += '\n';
+			break;
+		case 't':
+			m_buf += '\t';
+			break;
+		case 'b':
+			m_buf += '\b';
+			break;
+		case 'f':
+			m_buf += '\f';
+			break;
+		case '\"':
+			m_buf += '\"';
+			break;
+		case '\\':
+			m_buf += '\\';
+			break;
+		case '/':
+			m_buf += '/';
+			break;
+		case 'u':
+		{
+			unsigned int code;
+			if (m_end-m_p < 4 || !hex4(m_p, code))
+			{
+				return false;
+			}
+			m_p += 4;
+			if (code >= 0xd800 && code <= 0xdbff)	// 高位代理，后面应该跟着低位代理
+			{
+				unsigned int low;
+				if (m_end-m_p >= 6 && m_p[0] == '\\' && m_p[1] == 'u' && hex4(m_p+2, low) && low >= 0xdc00 && low <= 0xdfff)
+				{
+					code = 0x10000+((code-0xd800)<<10)+(low-0xdc00);
+					m_p += 6;
+				}
+				else
+				{
+					code = 0xfffd;
+				}
+			}
+			else if (code >= 0xdc00 && code <= 0xdfff)
+			{
+				code = 0xfffd;
+			}
+			if (code)	// String以0结尾，放不下\u0000
 			{
-				*endpos = len;
+				appendUtf8(m_buf, code);
 			}
-			return JsonNone;
+			break;
+		}
+		default:	// 和descript一样，不认识的转义直接丢掉
+			;
 		}
-		json = JsonNone;
-		if (endpos)
+	}
+	return false;	// 双引号不匹配
+}
+
+bool JsonParser::number(Json &json)
+{
+	char buf[64];
+	size_t n = 0;
+	for (; m_p < m_end && ((*m_p >= '0' && *m_p <= '9') || *m_p == '-' || *m_p == '+' || *m_p == '.' || *m_p == 'e' || *m_p == 'E'); ++m_p)
+	{
+		if (n >= sizeof(buf)-1)
 		{
-			*endpos = beg+4;
+			return false;
 		}
+		buf[n++] = *m_p;
+	}
+	if (!n)		// 不是任何一种值的开始
+	{
+		return false;
 	}
+	buf[n] = 0;
+	char *e;
+	json.m_numval = strtod(buf, &e);
+	json.m_type = JSON_NUMBER;
+	return e == buf+n;
+}
 
+bool JsonParser::word(const char *w, size_t size)
+{
+	if ((size_t) (m_end-m_p) < size || memcmp(m_p, w, size) != 0)
+	{
+		return false;
+	}
+	m_p += size;
+	return true;
+}
+
+const String &JsonParser::key()
+{
+	std::map<std::string, String>::iterator it = m_keys.find(m_buf);
+	if (it != m_keys.end())
+	{
+		return it->second;
+	}
+	if (m_keys.size() < JSON_PARSE_KEYS)
+	{
+		it = m_keys.insert(std::pair<std::string, String>(m_buf, String())).first;
+		it->second.append(m_buf.c_str(), CODEC_UTF8);
+		return it->second;
+	}
+	m_key = String();
+	m_key.append(m_buf.c_str(), CODEC_UTF8);
+	return m_key;
+}
+
+Json Json::parse(const char *data, size_t size, size_t *endpos)
+{
+	Json json;
+	JsonParser parser(data, size);
+	if (!parser.document(json))
+	{
+		json.cleanOldTypeData();
+		json.m_type = JSON_NULL;
+	}
+	if (endpos)
+	{
+		*endpos = parser.offset();
+	}
+	return json;
+}
+
+Json Json::parseFromText(const String &text, size_t beg, size_t *endpos)
+{
+	size_t len = text.size();
+	if (beg > len)
+	{
+		beg = len;
+	}
+	Json json = parse((const char *) text+beg, len-beg, endpos);
+	if (endpos)
+	{
+		*endpos += beg;
+	}
 	return json;
 }
 
@@ -992,7 +1192,7 @@ bool JsonArray::remove(size_t index)
 	m_json->m_arrval.erase(m_json->m_arrval.begin()+index);
 	if (size() == 0)
 	{
-		m_json->m_type == JSON_NONE;
+		m_json->m_type = JSON_NONE;		// 没有数据了，状态变更为JSON_NONE
 	}
 	return true;
 }
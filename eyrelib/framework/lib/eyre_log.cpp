@@ -0,0 +1,323 @@
+/*
+ * Class Logger, ring is a bounded multi-producer queue, every cell has a
+ * sequence telling whether it is free for producers or ready for writer.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 17:40.
+ */
+
+#include "eyre_log.h"
+#include "general.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "timer_wheel.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/time.h>
+#endif
+
+struct LogCell
+{
+	volatile unsigned long long sequence;
+	int level;
+	unsigned long long time;	// usec since 1970.
+	char *text;
+};
+
+static LogCell logRing[LOG_RING_SIZE];
+static volatile unsigned long long logEnqueue = 0;
+static unsigned long long logDequeue = 0;	// writer thread only.
+static volatile unsigned long long logDropped = 0;
+static volatile int logLevel = LOG_LEVEL_INFO;
+static volatile unsigned int logRate = LOG_RATE;
+static volatile bool logRunning = false;
+static pthread_t logThread;
+
+static unsigned long long wallUsec()
+{
+#ifdef _WIN32
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((((unsigned long long) ft.dwHighDateTime)<<32)|ft.dwLowDateTime)/10
+		-11644473600000000ULL;	//100ns since 1601 to usec since 1970.
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (unsigned long long) tv.tv_sec*1000000+tv.tv_usec;
+#endif
+}
+
+static void output(int level, unsigned long long usec, const char *text)
+{
+	static const char LEVELS[] = "EWID";
+	time_t sec = usec/1000000;
+	struct tm t;
+#ifdef _WIN32
+	localtime_s(&t, &sec);
+#else
+	localtime_r(&sec, &t);
+#endif
+	FILE *out = (level == LOG_LEVEL_ERROR) ? stderr : stdout;
+	fprintf(out, "%04d-%02d-%02d %02d:%02d:%02d.%03u %c %s\n", t.tm_year+1900, t.tm_mon+1,
+		t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (unsigned int) (usec%1000000/1000),
+		LEVELS[level<0 ? 0 : (level>3 ? 3 : level)], text);
+}
+
+// writer takes next message, false if none ready.
+static bool take(int &level, unsigned long long &usec, char *&text)
+{
+	LogCell &cell = logRing[logDequeue&(LOG_RING_SIZE-1)];
+	if(cell.sequence != logDequeue+1)
+	{
+		return false;
+	}
+	__sync_synchronize();
+	level = cell.level;
+	usec = cell.time;
+	text = cell.text;
+	__sync_synchronize();
+	cell.sequence = logDequeue+LOG_RING_SIZE;
+	++logDequeue;
+	return true;
+}
+
+// write all ready messages, return how many.
+static unsigned int drain()
+{
+	static unsigned long long reported = 0;
+	unsigned int count = 0;
+	int level;
+	unsigned long long usec;
+	char *text;
+	while(take(level, usec, text))
+	{
+		output(level, usec, text);
+		free(text);
+		++count;
+	}
+	unsigned long long dropped = logDropped;
+	if(dropped != reported)
+	{
+		char text[64];
+		sprintf(text, "%llu log messages dropped, log ring is full.", dropped-reported);
+		output(LOG_LEVEL_WARN, wallUsec(), text);
+		reported = dropped;
+		++count;
+	}
+	if(count)
+	{
+		fflush(stdout);
+	}
+	return count;
+}
+
+void *Logger::Thread::writeThread(void *arg)
+{
+	while(logRunning)
+	{
+		if(!drain())
+		{
+#ifdef _WIN32
+			Sleep(1);
+#else
+			usleep(1000);
+#endif
+		}
+	}
+	drain();
+	return NULL;
+}
+
+bool Logger::start(int level, unsigned int rate)
+{
+	logLevel = level;
+	logRate = rate;
+	if(logRunning)
+	{
+		return true;
+	}
+	for(unsigned int i=0; i<LOG_RING_SIZE; ++i)
+	{
+		logRing[i].sequence = logEnqueue+i;	// free for producer of position logEnqueue+i.
+	}
+	logDequeue = logEnqueue;
+	logRunning = true;
+	if(pthread_create(&logThread, NULL, Logger::Thread::writeThread, NULL) != 0)
+	{
+		logRunning = false;
+		fprintf(stderr, "Logger can not create thread!\n");
+		return false;
+	}
+	return true;
+}
+
+void Logger::stop()
+{
+	if(!logRunning)
+	{
+		return;
+	}
+	logRunning = false;
+	pthread_join(logThread, NULL);
+}
+
+void Logger::setLevel(int level)
+{
+	logLevel = level;
+}
+
+int Logger::level()
+{
+	return logLevel;
+}
+
+bool Logger::enabled(int level)
+{
+	return level <= logLevel;
+}
+
+bool Logger::allow(Site &site, unsigned int &suppressed)
+{
+	suppressed = 0;
+	unsigned int rate = logRate;
+	if(!rate)
+	{
+		return true;
+	}
+	unsigned long long now = TimerWheel::now()/1000;
+	unsigned long long second = site.second;
+	if(now != second && __sync_bool_compare_and_swap(&(site.second), second, now))
+	{
+		site.count = 0;
+	}
+	if(__sync_add_and_fetch(&(site.count), 1) > rate)
+	{
+		__sync_fetch_and_add(&(site.suppressed), 1);
+		return false;
+	}
+	suppressed = __sync_lock_test_and_set(&(site.suppressed), 0);
+	return true;
+}
+
+void Logger::write(int level, const std::string &text, unsigned int suppressed)
+{
+	std::string line = text;
+	if(suppressed)
+	{
+		char note[64];
+		sprintf(note, " (%u similar suppressed)", suppressed);
+		line += note;
+	}
+	if(!logRunning)
+	{
+		output(level, wallUsec(), line.c_str());
+		fflush(level == LOG_LEVEL_ERROR ? stderr : stdout);
+		return;
+	}
+
+	unsigned long long pos = logEnqueue;
+	LogCell *cell;
+	while(true)
+	{
+		cell = &logRing[pos&(LOG_RING_SIZE-1)];
+		long long diff = (long long) (cell->sequence-pos);
+		if(diff == 0)
+		{
+			if(__sync_bool_compare_and_swap(&logEnqueue, pos, pos+1))
+			{
+				break;
+			}
+			pos = logEnqueue;
+		}
+		else if(diff < 0)
+		{
+			__sync_fetch_and_add(&logDropped, 1);	// full.
+			return;
+		}
+		else
+		{
+			pos = logEnqueue;	// taken by another thread.
+		}
+	}
+	cell->level = level;
+	cell->time = wallUsec();
+	cell->text = strdup(line.c_str());
+	__sync_synchronize();
+	cell->sequence = pos+1;
+}
+
+unsigned long long Logger::dropped()
+{
+	return logDropped;
+}
+
+String Logger::preview(const ByteArray &data, unsigned int limit)
+{
+	static const char HEX[] = "0123456789abcdef";
+	unsigned int size = data.size()<limit ? data.size() : limit;
+	const char *bytes = data;
+	std::string result;
+	for(unsigned int line=0; line<size; line+=16)
+	{
+		char text[80];
+		unsigned int pos = sprintf(text, "%04x  ", line);
+		for(unsigned int i=line; i<line+16; ++i)
+		{
+			if(i < size)
+			{
+				unsigned char c = bytes[i];
+				text[pos++] = HEX[c>>4];
+				text[pos++] = HEX[c&15];
+			}
+			else
+			{
+				text[pos++] = ' ';
+				text[pos++] = ' ';
+			}
+			text[pos++] = ' ';
+		}
+		text[pos++] = ' ';
+		text[pos++] = '|';
+		for(unsigned int i=line; i<line+16 && i<size; ++i)
+		{
+			unsigned char c = bytes[i];
+			text[pos++] = (c>=0x20 && c<0x7f) ? c : '.';
+		}
+		text[pos++] = '|';
+		text[pos] = 0;
+		if(line)
+		{
+			result += "\n";
+		}
+		result += text;
+	}
+	if(data.size() > size)
+	{
+		char more[64];
+		sprintf(more, "%s... %u more bytes", size ? "\n" : "", data.size()-size);
+		result += more;
+	}
+	return String::fromUtf8(result.c_str());
+}
+
+int Logger::levelFromName(const String &name)
+{
+	if(name == "error")
+	{
+		return LOG_LEVEL_ERROR;
+	}
+	if(name == "warn")
+	{
+		return LOG_LEVEL_WARN;
+	}
+	if(name == "debug")
+	{
+		return LOG_LEVEL_DEBUG;
+	}
+	return LOG_LEVEL_INFO;
+}
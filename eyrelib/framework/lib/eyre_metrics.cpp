@@ -0,0 +1,184 @@
+/*
+ * Class MetricsReport.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 20:25.
+ */
+
+#include "eyre_metrics.h"
+#include "general.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2	//K32GetProcessMemoryInfo in kernel32, no -lpsapi.
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+static const double SUMMARY_QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+static const char *SUMMARY_NAMES[] = {"0.5", "0.9", "0.99", "0.999"};
+static const unsigned int SUMMARY_SIZE = 4;
+
+MetricsReport::MetricsReport(const String &prefix) : m_prefix(prefix)
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "MetricsReport(%p) created.\n", this);
+#endif
+}
+
+MetricsReport::~MetricsReport()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "MetricsReport(%p) destroyed.\n", this);
+#endif
+}
+
+void MetricsReport::counter(const String &name, const String &help, double value, const String &labels)
+{
+	Sample sample = {m_prefix+name, help, labels, "counter", value, 0, 0, std::vector<double>()};
+	m_samples.push_back(sample);
+}
+
+void MetricsReport::gauge(const String &name, const String &help, double value, const String &labels)
+{
+	Sample sample = {m_prefix+name, help, labels, "gauge", value, 0, 0, std::vector<double>()};
+	m_samples.push_back(sample);
+}
+
+String MetricsReport::label(const String &name, const String &value)
+{
+	String result = name+"=\"";
+	for(const char *c=value; *c; ++c)
+	{
+		if(*c=='\\' || *c=='"')
+		{
+			result += '\\';
+		}
+		if(*c == '\n')
+		{
+			result += "\\n";
+			continue;
+		}
+		result += *c;
+	}
+	return result+"\"";
+}
+
+void MetricsReport::summary(const String &name, const String &help,
+							const StatHistogram &histogram, double scale)
+{
+	StatHistogram::Snapshot snapshot = histogram.snapshot();
+	Sample sample = {m_prefix+name, help, "", "summary", snapshot.sum*scale,
+		snapshot.count, snapshot.max*scale, std::vector<double>()};
+	for(unsigned int i=0; i<SUMMARY_SIZE; ++i)
+	{
+		sample.quantiles.push_back(snapshot.percentile(SUMMARY_QUANTILES[i])*scale);
+	}
+	m_samples.push_back(sample);
+}
+
+void MetricsReport::process()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+	{
+		gauge("process_resident_bytes", "Resident memory of this process.", pmc.WorkingSetSize);
+	}
+#else
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if(statm)
+	{
+		unsigned long size, resident;
+		if(fscanf(statm, "%lu %lu", &size, &resident) == 2)
+		{
+			gauge("process_resident_bytes", "Resident memory of this process.",
+				(double) resident*sysconf(_SC_PAGESIZE));
+		}
+		fclose(statm);
+	}
+#endif
+
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=33))
+	struct mallinfo2 info = mallinfo2();
+	gauge("malloc_arena_bytes", "Bytes malloc got from system.", info.arena+info.hblkhd);
+	gauge("malloc_in_use_bytes", "Bytes allocated and not freed.", info.uordblks+info.hblkhd);
+	gauge("malloc_free_bytes", "Bytes free in malloc arena.", info.fordblks);
+#endif
+}
+
+String MetricsReport::toPrometheus() const
+{
+	String result;
+	char value[64];
+	for(unsigned int i=0; i<m_samples.size(); ++i)
+	{
+		const Sample &sample = m_samples[i];
+		if(i==0 || m_samples[i-1].name!=sample.name)	//once for samples of a name.
+		{
+			result += "# HELP "+sample.name+" "+sample.help+"\n";
+			result += "# TYPE "+sample.name+" "+sample.type+"\n";
+		}
+		if(sample.quantiles.size())
+		{
+			for(unsigned int j=0; j<sample.quantiles.size(); ++j)
+			{
+				sprintf(value, "%.15g", sample.quantiles[j]);
+				result += sample.name+"{quantile=\""+SUMMARY_NAMES[j]+"\"} "+value+"\n";
+			}
+			sprintf(value, "%.15g", sample.value);
+			result += sample.name+"_sum "+value+"\n";
+			sprintf(value, "%llu", sample.count);
+			result += sample.name+"_count "+value+"\n";
+			sprintf(value, "%.15g", sample.max);
+			result += "# HELP "+sample.name+"_max Max of "+sample.name+".\n";
+			result += "# TYPE "+sample.name+"_max gauge\n";
+			result += sample.name+"_max "+value+"\n";
+			continue;
+		}
+		sprintf(value, "%.15g", sample.value);
+		if(sample.labels.size())
+		{
+			result += sample.name+"{"+sample.labels+"} "+value+"\n";
+			continue;
+		}
+		result += sample.name+" "+value+"\n";
+	}
+	return result;
+}
+
+Json MetricsReport::toJson() const
+{
+	Json result;
+	result.asObject();
+	for(unsigned int i=0; i<m_samples.size(); ++i)
+	{
+		const Sample &sample = m_samples[i];
+		if(sample.quantiles.size())
+		{
+			Json summary;
+			summary["count"] = (double) sample.count;
+			summary["sum"] = sample.value;
+			summary["max"] = sample.max;
+			for(unsigned int j=0; j<sample.quantiles.size(); ++j)
+			{
+				summary[String("p")+SUMMARY_NAMES[j]] = sample.quantiles[j];
+			}
+			result.set(sample.name, summary);
+			continue;
+		}
+		if(sample.labels.size())
+		{
+			result[sample.name][sample.labels] = sample.value;
+			continue;
+		}
+		result.set(sample.name, Json(sample.value));
+	}
+	return result;
+}
@@ -0,0 +1,215 @@
+/*
+ * Class CaptureWriter and CaptureReader.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 18:10.
+ */
+
+#include "frame_capture.h"
+#include "general.h"
+#include "timer_wheel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static void putNumber(unsigned char *out, unsigned long long value, unsigned int size)
+{
+	for(unsigned int i=0; i<size; ++i)
+	{
+		out[i] = (value>>(8*i))&0xff;
+	}
+}
+
+static unsigned long long getNumber(const unsigned char *in, unsigned int size)
+{
+	unsigned long long value = 0;
+	for(unsigned int i=0; i<size; ++i)
+	{
+		value |= (unsigned long long) in[i]<<(8*i);
+	}
+	return value;
+}
+
+CaptureWriter::CaptureWriter()
+{
+	m_file = NULL;
+	m_buffer = NULL;
+	m_start = 0;
+	m_records = 0;
+	pthread_mutex_init(&m_mutex, NULL);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "CaptureWriter(%p) created.\n", this);
+#endif
+}
+
+CaptureWriter::~CaptureWriter()
+{
+	close();
+	pthread_mutex_destroy(&m_mutex);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "CaptureWriter(%p) destroyed.\n", this);
+#endif
+}
+
+bool CaptureWriter::open(const String &fileName)
+{
+	close();
+	pthread_mutex_lock(&m_mutex);
+	m_file = fopen(fileName, "wb");
+	if(!m_file)
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return false;
+	}
+	m_buffer = (char *) malloc(CAPTURE_BUFFER);
+	if(m_buffer)
+	{
+		setvbuf(m_file, m_buffer, _IOFBF, CAPTURE_BUFFER);
+	}
+	fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), m_file);
+	m_start = TimerWheel::nowUsec();
+	m_records = 0;
+	pthread_mutex_unlock(&m_mutex);
+	return true;
+}
+
+void CaptureWriter::close()
+{
+	pthread_mutex_lock(&m_mutex);
+	if(m_file)
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+	free(m_buffer);
+	m_buffer = NULL;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void CaptureWriter::flush()
+{
+	pthread_mutex_lock(&m_mutex);
+	if(m_file)
+	{
+		fflush(m_file);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool CaptureWriter::isOpen() const
+{
+	return m_file != NULL;
+}
+
+void CaptureWriter::write(int kind, int direction, const String &id, const ByteArray &payload)
+{
+	unsigned long long now = TimerWheel::nowUsec();
+	ByteArray idBytes = ByteArray::fromString(id, CODEC_UTF8);
+	unsigned char head[16];
+	pthread_mutex_lock(&m_mutex);
+	if(!m_file)
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return;
+	}
+	putNumber(head, now>m_start ? now-m_start : 0, 8);
+	head[8] = kind;
+	head[9] = direction;
+	putNumber(head+10, idBytes.size(), 2);
+	fwrite(head, 1, 12, m_file);
+	fwrite((const char *) idBytes, 1, idBytes.size(), m_file);
+	putNumber(head, payload.size(), 4);
+	fwrite(head, 1, 4, m_file);
+	fwrite((const char *) payload, 1, payload.size(), m_file);
+	++m_records;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+unsigned long long CaptureWriter::records() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_records;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+CaptureReader::CaptureReader()
+{
+	m_file = NULL;
+
+#if EYRE_DETAIL
+	fprintf(stdout, "CaptureReader(%p) created.\n", this);
+#endif
+}
+
+CaptureReader::~CaptureReader()
+{
+	close();
+
+#if EYRE_DETAIL
+	fprintf(stdout, "CaptureReader(%p) destroyed.\n", this);
+#endif
+}
+
+bool CaptureReader::open(const String &fileName)
+{
+	close();
+	m_file = fopen(fileName, "rb");
+	if(!m_file)
+	{
+		return false;
+	}
+	char magic[8];
+	if(fread(magic, 1, 8, m_file)!=8 || memcmp(magic, CAPTURE_MAGIC, 8)!=0)
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+void CaptureReader::close()
+{
+	if(m_file)
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+bool CaptureReader::next(CaptureRecord &record)
+{
+	if(!m_file)
+	{
+		return false;
+	}
+	unsigned char head[12];
+	if(fread(head, 1, 12, m_file) != 12)
+	{
+		return false;
+	}
+	record.time = getNumber(head, 8);
+	record.kind = head[8];
+	record.direction = head[9];
+	unsigned int idSize = getNumber(head+10, 2);
+	std::vector<char> id(idSize+1, 0);
+	if(idSize && fread(&id[0], 1, idSize, m_file)!=idSize)
+	{
+		return false;
+	}
+	record.id = String::fromUtf8(&id[0]);
+	if(fread(head, 1, 4, m_file) != 4)
+	{
+		return false;
+	}
+	unsigned int size = getNumber(head, 4);
+	std::vector<char> payload(size+1);
+	if(size && fread(&payload[0], 1, size, m_file)!=size)
+	{
+		return false;
+	}
+	record.payload = ByteArray(&payload[0], size);
+	return true;
+}
@@ -0,0 +1,118 @@
+/*
+ * Class ReplayBuffer, stream tail in chunks as appended.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 14:10.
+ */
+
+#include "replay_buffer.h"
+#include "general.h"
+
+ReplayBuffer::ReplayBuffer(unsigned long long limit)
+{
+	m_skip = 0;
+	m_begin = 0;
+	m_size = 0;
+	m_limit = limit;
+
+#if EYRE_DETAIL
+	fprintf(stdout, "ReplayBuffer(%p) created.\n", this);
+#endif
+}
+
+ReplayBuffer::~ReplayBuffer()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "ReplayBuffer(%p) destroyed.\n", this);
+#endif
+}
+
+void ReplayBuffer::append(const ByteArray &data)
+{
+	if(!data.size())
+	{
+		return;
+	}
+	m_chunks.push_back(data);
+	m_size += data.size();
+	if(m_size > m_limit)
+	{
+		dropTo(end()-m_limit);
+	}
+}
+
+void ReplayBuffer::ack(unsigned long long offset)
+{
+	if(offset > end())
+	{
+		offset = end();
+	}
+	if(offset > m_begin)
+	{
+		dropTo(offset);
+	}
+}
+
+bool ReplayBuffer::read(unsigned long long offset, ByteArray &out) const
+{
+	if(offset<m_begin || offset>end())
+	{
+		return false;
+	}
+	out = "";
+	unsigned long long skip = offset-m_begin+m_skip;
+	for(std::deque<ByteArray>::const_iterator it = m_chunks.begin(); it != m_chunks.end(); ++it)
+	{
+		if(skip >= it->size())
+		{
+			skip -= it->size();
+			continue;
+		}
+		out += skip ? it->mid(skip) : *it;
+		skip = 0;
+	}
+	return true;
+}
+
+unsigned long long ReplayBuffer::begin() const
+{
+	return m_begin;
+}
+
+unsigned long long ReplayBuffer::end() const
+{
+	return m_begin+m_size;
+}
+
+unsigned long long ReplayBuffer::size() const
+{
+	return m_size;
+}
+
+void ReplayBuffer::setLimit(unsigned long long limit)
+{
+	m_limit = limit;
+	if(m_size > m_limit)
+	{
+		dropTo(end()-m_limit);
+	}
+}
+
+unsigned long long ReplayBuffer::limit() const
+{
+	return m_limit;
+}
+
+void ReplayBuffer::dropTo(unsigned long long offset)
+{
+	unsigned long long drop = offset-m_begin;
+	m_begin = offset;
+	m_size -= drop;
+	drop += m_skip;
+	while(m_chunks.size() && drop>=m_chunks.front().size())
+	{
+		drop -= m_chunks.front().size();
+		m_chunks.pop_front();
+	}
+	m_skip = drop;
+}
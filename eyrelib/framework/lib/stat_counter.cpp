@@ -0,0 +1,169 @@
+/*
+ * Class StatCounter and StatHistogram.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 17:10.
+ */
+
+#include "stat_counter.h"
+#include "general.h"
+#include <string.h>
+
+static volatile unsigned int nextShard = 0;
+
+unsigned int StatCounter::shard()
+{
+	static __thread unsigned int index = 0;	// 0 means not given yet.
+	if(!index)
+	{
+		index = __sync_add_and_fetch(&nextShard, 1);
+		if(!index)
+		{
+			index = __sync_add_and_fetch(&nextShard, 1);
+		}
+	}
+	return index%STAT_SHARDS;
+}
+
+StatCounter::StatCounter()
+{
+	memset(m_shards, 0, sizeof(m_shards));
+
+#if EYRE_DETAIL
+	fprintf(stdout, "StatCounter(%p) created.\n", this);
+#endif
+}
+
+StatCounter::~StatCounter()
+{
+#if EYRE_DETAIL
+	fprintf(stdout, "StatCounter(%p) destroyed.\n", this);
+#endif
+}
+
+void StatCounter::add(unsigned long long n)
+{
+	__sync_fetch_and_add(&(m_shards[shard()].value), n);
+}
+
+unsigned long long StatCounter::value() const
+{
+	unsigned long long result = 0;
+	for(unsigned int i=0; i<STAT_SHARDS; ++i)
+	{
+		result += m_shards[i].value;
+	}
+	return result;
+}
+
+unsigned long long StatHistogram::Snapshot::percentile(double q) const
+{
+	if(!count)
+	{
+		return 0;
+	}
+	unsigned long long target = (unsigned long long) (q*count+0.999999);
+	if(target < 1)
+	{
+		target = 1;
+	}
+	unsigned long long seen = 0;
+	for(unsigned int i=0; i<buckets.size(); ++i)
+	{
+		seen += buckets[i];
+		if(seen >= target)
+		{
+			unsigned long long high = bucketHigh(i);
+			return high<max ? high : max;
+		}
+	}
+	return max;
+}
+
+StatHistogram::StatHistogram()
+{
+	m_shards = new Shard[STAT_SHARDS];
+	memset(m_shards, 0, sizeof(Shard)*STAT_SHARDS);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "StatHistogram(%p) created.\n", this);
+#endif
+}
+
+StatHistogram::~StatHistogram()
+{
+	delete[] m_shards;
+
+#if EYRE_DETAIL
+	fprintf(stdout, "StatHistogram(%p) destroyed.\n", this);
+#endif
+}
+
+void StatHistogram::record(unsigned long long value)
+{
+	Shard &s = m_shards[StatCounter::shard()];
+	__sync_fetch_and_add(&(s.buckets[bucketOf(value)]), 1);
+	__sync_fetch_and_add(&(s.count), 1);
+	__sync_fetch_and_add(&(s.sum), value);
+	unsigned long long max = s.max;
+	while(value > max)
+	{
+		unsigned long long old = __sync_val_compare_and_swap(&(s.max), max, value);
+		if(old == max)
+		{
+			break;
+		}
+		max = old;
+	}
+}
+
+StatHistogram::Snapshot StatHistogram::snapshot() const
+{
+	Snapshot result;
+	result.count = 0;
+	result.sum = 0;
+	result.max = 0;
+	result.buckets.assign(STAT_BUCKETS, 0);
+	for(unsigned int i=0; i<STAT_SHARDS; ++i)
+	{
+		const Shard &s = m_shards[i];
+		for(unsigned int j=0; j<STAT_BUCKETS; ++j)
+		{
+			result.buckets[j] += s.buckets[j];
+		}
+		result.count += s.count;
+		result.sum += s.sum;
+		if(s.max > result.max)
+		{
+			result.max = s.max;
+		}
+	}
+	return result;
+}
+
+unsigned int StatHistogram::bucketOf(unsigned long long value)
+{
+	if(value < (1ULL<<STAT_SUB_BITS))
+	{
+		return value;
+	}
+	unsigned int bits = 63-__builtin_clzll(value);
+	if(bits > STAT_MAX_BITS)
+	{
+		return STAT_BUCKETS-1;
+	}
+	unsigned int sub = (value>>(bits-STAT_SUB_BITS))&((1<<STAT_SUB_BITS)-1);
+	return ((bits-STAT_SUB_BITS+1)<<STAT_SUB_BITS)+sub;
+}
+
+unsigned long long StatHistogram::bucketHigh(unsigned int bucket)
+{
+	if(bucket < (1U<<STAT_SUB_BITS))
+	{
+		return bucket;
+	}
+	unsigned int bits = (bucket>>STAT_SUB_BITS)+STAT_SUB_BITS-1;
+	unsigned long long sub = bucket&((1<<STAT_SUB_BITS)-1);
+	unsigned int shift = bits-STAT_SUB_BITS;
+	return (((1ULL<<STAT_SUB_BITS)+sub)<<shift)+(1ULL<<shift)-1;
+}
@@ -0,0 +1,249 @@
+/*
+ * Class TimerWheel, timers hashed to slots of levels by expire tick.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 21:30.
+ */
+
+#include "timer_wheel.h"
+#include "general.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// timer taken out to call, after m_mutex is unlocked.
+struct Fired
+{
+	unsigned long long id;
+	TimerWheel::Timeout timeout;
+	void *arg;
+};
+
+unsigned long long TimerWheel::now()
+{
+	return nowUsec()/1000;
+}
+
+unsigned long long TimerWheel::nowUsec()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (unsigned long long) (counter.QuadPart/frequency.QuadPart)*1000000+
+		(unsigned long long) (counter.QuadPart%frequency.QuadPart)*1000000/frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec*1000000+ts.tv_nsec/1000;
+#endif
+}
+
+TimerWheel::TimerWheel(unsigned int tick)
+{
+	m_tick = tick ? tick : TIMER_WHEEL_TICK;
+	m_heads.resize(TIMER_WHEEL_SLOTS+(TIMER_WHEEL_LEVELS-1)*TIMER_WHEEL_LEVEL_SLOTS, -1);
+	m_free = -1;
+	m_size = 0;
+	m_current = now()/m_tick;
+	pthread_mutex_init(&m_mutex, NULL);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "TimerWheel(%p) created.\n", this);
+#endif
+}
+
+TimerWheel::~TimerWheel()
+{
+	pthread_mutex_destroy(&m_mutex);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "TimerWheel(%p) destroyed.\n", this);
+#endif
+}
+
+unsigned long long TimerWheel::add(unsigned int delay, Timeout timeout, void *arg)
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long expire = (now()+delay+m_tick-1)/m_tick;	//round up, never fire early.
+	if(expire < m_current)
+	{
+		expire = m_current;
+	}
+	int node = m_free;
+	if(node < 0)
+	{
+		Timer t;
+		t.generation = 1;
+		m_nodes.push_back(t);
+		node = m_nodes.size()-1;
+	}
+	else
+	{
+		m_free = m_nodes[node].next;
+	}
+	Timer &t = m_nodes[node];
+	t.expire = expire;
+	t.timeout = timeout;
+	t.arg = arg;
+	place(node);
+	++m_size;
+	unsigned long long id = ((unsigned long long) t.generation<<32)|(unsigned int) node;
+	pthread_mutex_unlock(&m_mutex);
+	return id;
+}
+
+bool TimerWheel::cancel(unsigned long long id)
+{
+	unsigned int node = (unsigned int) (id&0xffffffff);
+	pthread_mutex_lock(&m_mutex);
+	if(node>=m_nodes.size() || m_nodes[node].slot<0 ||
+		m_nodes[node].generation!=(unsigned int) (id>>32))
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return false;
+	}
+	unlink(node);
+	release(node);
+	pthread_mutex_unlock(&m_mutex);
+	return true;
+}
+
+unsigned int TimerWheel::tick()
+{
+	std::vector<Fired> fired;
+
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long target = now()/m_tick;
+	if(!m_size && m_current<=target)
+	{
+		m_current = target+1;	//nothing to move or fire on the way.
+	}
+	while(m_current <= target)
+	{
+		unsigned int index = m_current%TIMER_WHEEL_SLOTS;
+		if(!index)
+		{
+			// nearest level wrapped, bring the next slot of each wrapped level down.
+			unsigned long long unit = TIMER_WHEEL_SLOTS;
+			for(unsigned int level=1; level<TIMER_WHEEL_LEVELS; ++level)
+			{
+				unsigned int n = (m_current/unit)%TIMER_WHEEL_LEVEL_SLOTS;
+				cascade(TIMER_WHEEL_SLOTS+(level-1)*TIMER_WHEEL_LEVEL_SLOTS+n);
+				if(n)
+				{
+					break;
+				}
+				unit *= TIMER_WHEEL_LEVEL_SLOTS;
+			}
+		}
+		// every timer here expires at m_current, or was added late.
+		for(int node = m_heads[index]; node >= 0; node = m_heads[index])
+		{
+			Timer &t = m_nodes[node];
+			Fired f = {((unsigned long long) t.generation<<32)|(unsigned int) node, t.timeout, t.arg};
+			fired.push_back(f);
+			unlink(node);
+			release(node);
+		}
+		++m_current;
+	}
+	pthread_mutex_unlock(&m_mutex);
+
+	for(unsigned int i=0; i<fired.size(); ++i)
+	{
+		fired[i].timeout(this, fired[i].id, fired[i].arg);
+	}
+	return fired.size();
+}
+
+unsigned int TimerWheel::size() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned int result = m_size;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+void TimerWheel::place(int node)
+{
+	Timer &t = m_nodes[node];
+	unsigned long long delta = t.expire-m_current;
+	if(delta < TIMER_WHEEL_SLOTS)
+	{
+		link(node, t.expire%TIMER_WHEEL_SLOTS);
+		return;
+	}
+	unsigned int level = 1;
+	unsigned long long unit = TIMER_WHEEL_SLOTS;	// ticks per slot of level.
+	while(delta>=unit*TIMER_WHEEL_LEVEL_SLOTS && level<TIMER_WHEEL_LEVELS-1)
+	{
+		unit *= TIMER_WHEEL_LEVEL_SLOTS;
+		++level;
+	}
+	unsigned long long expire = t.expire;
+	if(delta >= unit*TIMER_WHEEL_LEVEL_SLOTS)
+	{
+		expire = m_current+unit*TIMER_WHEEL_LEVEL_SLOTS-1;	//farther than the wheel, placed again when reached.
+	}
+	link(node, TIMER_WHEEL_SLOTS+(level-1)*TIMER_WHEEL_LEVEL_SLOTS+
+		(expire/unit)%TIMER_WHEEL_LEVEL_SLOTS);
+}
+
+void TimerWheel::link(int node, int slot)
+{
+	Timer &t = m_nodes[node];
+	t.slot = slot;
+	t.prev = -1;
+	t.next = m_heads[slot];
+	if(t.next >= 0)
+	{
+		m_nodes[t.next].prev = node;
+	}
+	m_heads[slot] = node;
+}
+
+void TimerWheel::unlink(int node)
+{
+	Timer &t = m_nodes[node];
+	if(t.prev >= 0)
+	{
+		m_nodes[t.prev].next = t.next;
+	}
+	else
+	{
+		m_heads[t.slot] = t.next;
+	}
+	if(t.next >= 0)
+	{
+		m_nodes[t.next].prev = t.prev;
+	}
+}
+
+void TimerWheel::release(int node)
+{
+	Timer &t = m_nodes[node];
+	t.slot = -1;
+	if(!++t.generation)
+	{
+		t.generation = 1;
+	}
+	t.next = m_free;
+	m_free = node;
+	--m_size;
+}
+
+void TimerWheel::cascade(int slot)
+{
+	int node = m_heads[slot];
+	m_heads[slot] = -1;
+	while(node >= 0)
+	{
+		int next = m_nodes[node].next;
+		place(node);
+		node = next;
+	}
+}
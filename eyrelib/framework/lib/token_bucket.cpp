@@ -0,0 +1,140 @@
+/*
+ * Class TokenBucket, refilled by monotonic clock when taken.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 21:10.
+ */
+
+#include "token_bucket.h"
+#include "timer_wheel.h"
+#include "general.h"
+#include <vector>
+
+TokenBucket::TokenBucket(unsigned long long rate, unsigned int burst, TokenBucket *parent)
+{
+	m_rate = rate;
+	m_capacity = (long long) (rate*burst/1000);
+	if(m_capacity < 1)
+	{
+		m_capacity = 1;
+	}
+	m_tokens = m_capacity;
+	m_stamp = TimerWheel::nowUsec();
+	m_parent = parent;
+	pthread_mutex_init(&m_mutex, NULL);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "TokenBucket(%p) created.\n", this);
+#endif
+}
+
+TokenBucket::~TokenBucket()
+{
+	pthread_mutex_destroy(&m_mutex);
+
+#if EYRE_DETAIL
+	fprintf(stdout, "TokenBucket(%p) destroyed.\n", this);
+#endif
+}
+
+unsigned int TokenBucket::take(unsigned long long bytes)
+{
+	unsigned int result = 0;
+	for(TokenBucket *bucket=this; bucket; bucket=bucket->m_parent)
+	{
+		if(!bucket->m_rate)
+		{
+			continue;
+		}
+		pthread_mutex_lock(&(bucket->m_mutex));
+		unsigned int delay = bucket->update(bytes);
+		pthread_mutex_unlock(&(bucket->m_mutex));
+		if(delay > result)
+		{
+			result = delay;
+		}
+	}
+	return result;
+}
+
+bool TokenBucket::tryTake(unsigned long long count)
+{
+	std::vector<TokenBucket *> limited;
+	for(TokenBucket *bucket=this; bucket; bucket=bucket->m_parent)
+	{
+		if(bucket->m_rate)
+		{
+			limited.push_back(bucket);
+		}
+	}
+	//locked from child to parent, as every caller does.
+	bool result = true;
+	for(unsigned int i=0; i<limited.size(); ++i)
+	{
+		pthread_mutex_lock(&(limited[i]->m_mutex));
+		limited[i]->refill();
+		if(limited[i]->m_tokens < (long long) count)
+		{
+			result = false;
+		}
+	}
+	for(unsigned int i=0; i<limited.size(); ++i)
+	{
+		if(result)
+		{
+			limited[i]->m_tokens -= (long long) count;
+		}
+		pthread_mutex_unlock(&(limited[i]->m_mutex));
+	}
+	return result;
+}
+
+unsigned int TokenBucket::wait()
+{
+	return take(0);
+}
+
+unsigned long long TokenBucket::rate() const
+{
+	return m_rate;
+}
+
+TokenBucket *TokenBucket::parent() const
+{
+	return m_parent;
+}
+
+unsigned int TokenBucket::update(unsigned long long bytes)
+{
+	refill();
+	m_tokens -= (long long) bytes;
+	if(m_tokens >= 0)
+	{
+		return 0;
+	}
+	return (unsigned int) (((unsigned long long) -m_tokens*1000+m_rate-1)/m_rate);
+}
+
+void TokenBucket::refill()
+{
+	unsigned long long now = TimerWheel::nowUsec();
+	unsigned long long elapsed = now-m_stamp;
+	if(elapsed >= (unsigned long long) (m_capacity-m_tokens)*1000000/m_rate)	//debt is paid too.
+	{
+		m_tokens = m_capacity;
+		m_stamp = now;
+	}
+	else
+	{
+		long long added = (long long) (elapsed*m_rate/1000000);
+		if(added)
+		{
+			m_stamp += added*1000000/m_rate;	//part of a token left counts next time.
+			m_tokens += added;
+			if(m_tokens > m_capacity)
+			{
+				m_tokens = m_capacity;
+			}
+		}
+	}
+}
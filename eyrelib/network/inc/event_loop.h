@@ -0,0 +1,163 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+/*
+ * One thread waits on many sockets and calls back when they have something.
+ * Backend is io_uring (multishot accept and recv into a provided buffer ring,
+ * one io_uring_enter per batch), or epoll if the kernel lacks it.
+ * All call back is exec in the loop thread, datas of one socket came in the
+ * same batch are joined and given by one Read call back.
+ * Linux only, Windows sockets keep their select threads.
+ * Compile need -lpthread.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 22:40.
+ */
+
+#ifndef _WIN32
+
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include "byte_array.h"
+#include "eyre_string.h"
+
+#define EVENT_LOOP_AUTO		0	// io_uring if kernel supports, else epoll.
+#define EVENT_LOOP_URING	1
+#define EVENT_LOOP_EPOLL	2
+
+#define EVENT_LOOP_BUFFER_SIZE	16384	// 16k, a buffer of the ring, also epoll once recv.
+#define EVENT_LOOP_BUFFERS		64		// buffers in the ring, power of 2.
+#define EVENT_LOOP_ONCE_READ	65536	// 64k, epoll reads at most from a socket each wake.
+
+class EventLoop
+{
+public:
+	// data is empty when peer closed or error, no more Read of the watch after.
+	typedef void (*Read)(void *owner, ByteArray &data);
+	typedef void (*Accept)(void *owner, int sockfd);
+	typedef void (*Ready)(void *owner);	// readable, owner reads by itself.
+	typedef void (*Writable)(void *owner);	// can be written, or failed.
+
+	struct Watch;
+
+	EventLoop(int backend=EVENT_LOOP_AUTO);
+	virtual ~EventLoop();	// stop, watches left are dropped without call back.
+
+	//return false if no backend can start.
+	bool start();
+	void stop();
+
+	/*
+	 * Can be called from any thread, return NULL if error.
+	 * Sockfd should be blocking, writes to it are still done by the owner.
+	 */
+	Watch *watchRead(int sockfd, Read read, void *owner);
+	Watch *watchAccept(int sockfd, Accept accept, void *owner);
+	Watch *watchReady(int sockfd, Ready ready, void *owner);
+
+	/*
+	 * No call back of watch starts after return, watch is freed by loop.
+	 * One may be running in loop thread now, waitIdle(owner) before free owner.
+	 * Close sockfd after unwatch.
+	 */
+	void unwatch(Watch *watch);
+
+	/*
+	 * Stop or go on waiting sockfd, can be called from any thread.
+	 * Datas already read are still given, the rest stay in the kernel,
+	 * so a paused TCP peer is held back by flow control.
+	 */
+	void pause(Watch *watch, bool paused);
+
+	/*
+	 * Call writable once sockfd of watch can be written, one time, ask
+	 * again for the next. Can be called from any thread, asking while a
+	 * wait is on is ignored. Epoll waits EPOLLOUT, io_uring a POLLOUT poll.
+	 */
+	void waitWritable(Watch *watch, Writable writable);
+
+	//return at once if called in loop thread.
+	void waitIdle(void *owner) const;
+
+	/*
+	 * In a Read call back of empty data, true if peer finished sending
+	 * (eof), so the socket can still be written; false if it failed.
+	 */
+	bool peerClosed() const;
+
+	bool inLoopThread() const;
+	int backend() const;	// the one in use after start().
+
+	//a started loop for client sockets, created on first use.
+	static EventLoop *shared();
+	static void stopShared();	// before exit, no call back of client sockets after.
+
+	//backend of loops created after, include shared().
+	static void setDefaultBackend(int backend);
+	static int backendFromName(const String &name);	// "auto", "uring" or "epoll".
+	static String backendName(int backend);
+
+	class Thread
+	{
+	public:
+		static void *loopThread(void *s);
+	};
+
+private:
+	struct Uring;
+
+	int m_backend;
+	volatile bool m_running;
+	bool m_started;
+	int m_startResult;	// 0 waiting, 1 succeed, -1 fail.
+	pthread_t m_thread;
+	bool m_hasThread;	// m_thread is valid, till joined.
+
+	int m_wakefd;	// eventfd, wakes loop for new commands.
+	int m_epfd;
+	Uring *m_uring;
+	char *m_buffer;	// epoll recv buffer.
+
+	mutable pthread_mutex_t m_mutex;
+	mutable pthread_cond_t m_cond;
+	void *m_current;	// owner whose call back is running.
+	bool m_eof;	// closed watch being called back ended by eof, loop thread only.
+
+	std::set<Watch *> m_watches;
+	std::vector<Watch *> m_added;	// wait loop to arm them.
+	std::vector<Watch *> m_removed;	// wait loop to cancel and free them.
+	std::vector<Watch *> m_paused;	// paused or resumed, wait loop to cancel or arm them.
+	std::vector<Watch *> m_writes;	// wait writable, wait loop to arm them.
+	std::vector<Watch *> m_busy;	// have call back in this batch, loop thread only.
+	std::vector<Watch *> m_rearm;	// multishot ended, loop thread only.
+
+	static int defaultBackend;
+
+	Watch *watch(int sockfd, int type, Read read, Accept accept, Ready ready, void *owner);
+	void wake();
+	bool enter(Watch *watch);	// begin a call back, false if unwatched.
+	void leave();
+	void dispatch();
+	void takeCommands();
+	void freeWatch(Watch *watch);
+
+	bool setupUring();
+	void closeUring();
+	void runUring();
+	bool armUring(Watch *watch);
+	bool armWritable(Watch *watch);
+	bool cancelUring(Watch *watch, unsigned long long tag);
+	bool armWake();
+	void reapUring();
+
+	bool setupEpoll();
+	void closeEpoll();
+	void runEpoll();
+	void readEpoll(Watch *watch);
+	void updateEpoll(Watch *watch);	// events wanted changed, with m_mutex locked.
+};
+
+#endif	//_WIN32
+
+#endif	//EVENT_LOOP_H
@@ -1,8 +1,12 @@
 #ifndef EYRE_TURING_NETWORK_H 
 #define EYRE_TURING_NETWORK_H
 
+#include "socket_address.h"
 #include "tcp_server.h"
 #include "tcp_socket.h"
 #include "udp_socket.h"
+#include "resolver.h"
+#include "event_loop.h"
+#include "frame_scheduler.h"
 
 #endif	//EYRE_TURING_NETWORK_H
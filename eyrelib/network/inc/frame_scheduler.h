@@ -0,0 +1,166 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+/*
+ * Weighted fair scheduler for frames written to one TcpSocket.
+ * Every stream has its own queue, queues are served by deficit round-robin,
+ * so a stream sending bulk data can not starve the small frames of others.
+ * Frames are written by a subthread, push() never blocks on the socket,
+ * and frames ready together are gathered into one send.
+ * Too many bytes waiting pause the sockets frames are read from.
+ * Compile need -lpthread.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 22:20.
+ */
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "byte_array.h"
+#include "eyre_string.h"
+#include "stat_counter.h"
+
+#define FRAME_SCHEDULER_QUANTUM	16384	// 16k, bytes a weight 1 stream can send per round.
+#define FRAME_SCHEDULER_MAX_BATCH	65536	// 64k, bytes one send gathers at most.
+
+class TcpSocket;
+#include "tcp_socket.h"
+
+class FrameScheduler
+{
+public:
+	FrameScheduler(unsigned int quantum=FRAME_SCHEDULER_QUANTUM);
+	virtual ~FrameScheduler();
+
+	/*
+	 * Set the socket frames write to, NULL means stop writing.
+	 * Pending frames are kept, use clear() to drop them; frames of a
+	 * failed write are kept too, and wait here till target is set again.
+	 * Will wait the frame being written now finish before return.
+	 */
+	void setTarget(TcpSocket *target);
+	TcpSocket *target() const;
+
+	void setQuantum(unsigned int quantum);
+	unsigned int quantum() const;
+
+	/*
+	 * maxBatch: bytes one send gathers at most, a bigger frame still
+	 * be sent alone.
+	 * coalesceDelay: microseconds to wait for more frames before send,
+	 * 0 means send as soon as the frames ready now are gathered.
+	 */
+	void setBatch(unsigned int maxBatch, unsigned int coalesceDelay=0);
+
+	/*
+	 * Frames of the same stream are written in push order.
+	 * A frame bigger than quantum*weight still be written, but it will
+	 * wait some rounds, so better split payload by quantum() before push.
+	 * stamp: TimerWheel::nowUsec() when payload of frame was received,
+	 * 0 means not measured.
+	 */
+	bool push(const String &stream, const ByteArray &frame, unsigned int weight=1,
+			unsigned long long stamp=0);
+
+	// Control frame is written before any stream's frame.
+	bool pushControl(const ByteArray &frame);
+
+	/*
+	 * Socket the frames of stream are read from, its read is paused while
+	 * too many bytes wait, see setWaterMarks(). NULL forgets it, do it
+	 * before the socket is freed, a pause of it is left as it is.
+	 */
+	void setSource(const String &stream, TcpSocket *source);
+
+	/*
+	 * Sources of a stream waiting more than streamHigh bytes, or all when
+	 * streams together wait more than high, are paused, and go on reading
+	 * once under streamLow and low. 0 high means no limit.
+	 */
+	void setWaterMarks(unsigned long long streamHigh, unsigned long long streamLow,
+					unsigned long long high, unsigned long long low);
+
+	void clear();
+
+	unsigned long long pendingBytes() const;
+	unsigned int activeStreams() const;
+	unsigned long long sourcePauses() const;	// times a source paused by water marks.
+
+	// Record usec from stamp to written of every stamped frame, NULL means not.
+	void setLatency(StatHistogram *latency);
+
+	// Totals written to targets, for stats.
+	void written(unsigned long long &frames, unsigned long long &bytes,
+				unsigned long long &writes) const;
+
+	class Thread
+	{
+	public:
+		static void *writeThread(void *s);
+	};
+
+private:
+	struct Frame
+	{
+		ByteArray data;
+		unsigned long long stamp;
+	};
+
+	struct Stream
+	{
+		std::deque<Frame> frames;
+		unsigned int weight;
+		unsigned long long bytes;	// of frames.
+		unsigned long long deficit;
+		bool inTurn;	// got this round's quantum already.
+	};
+
+	struct Source
+	{
+		TcpSocket *socket;
+		bool paused;
+	};
+
+	std::map<String, Stream> m_streams;
+	std::map<String, Source> m_sources;
+	std::deque<String> m_active;	// streams have frames, in round-robin order.
+	std::deque<ByteArray> m_control;
+	unsigned long long m_pendingBytes;
+	unsigned long long m_writtenFrames;
+	unsigned long long m_writtenBytes;
+	unsigned long long m_writes;	// gather sends.
+	unsigned long long m_streamHigh;
+	unsigned long long m_streamLow;
+	unsigned long long m_high;
+	unsigned long long m_low;
+	bool m_over;	// all streams together are over the water marks.
+	unsigned long long m_sourcePauses;
+	StatHistogram *m_latency;
+
+	unsigned int m_quantum;
+	unsigned int m_maxBatch;
+	unsigned int m_coalesceDelay;
+	TcpSocket *m_target;
+	TcpSocket *m_failed;	// target a write failed to, not written again.
+	bool m_writing;
+	bool m_running;
+
+	mutable pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+	pthread_t m_writeThread;
+
+	// Pop next frame to write, stream is "" for control, need lock m_mutex first.
+	bool pick(ByteArray &frame, unsigned long long &stamp, String &stream);
+
+	// Put frames picked but not written back in front, need lock m_mutex first.
+	void unpick(const std::vector<ByteArray> &frames, const std::vector<unsigned long long> &stamps,
+				const std::vector<String> &streams);
+
+	// Pause or resume by water marks, need lock m_mutex first.
+	void pressure(const String &stream);
+	void pressureAll();
+};
+
+#endif	//FRAME_SCHEDULER_H
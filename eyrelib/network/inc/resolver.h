@@ -0,0 +1,89 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+/*
+ * Cache of host names, so a connect does not wait for DNS.
+ * A name is looked up by getaddrinfo (so /etc/hosts works) the first time
+ * it is asked, later answers come from the cache and go round robin over
+ * all its addresses. Asked after ttl sec, the cached addresses are still
+ * answered while a subthread looks the name up again; if that fails they
+ * are kept and it is tried again RESOLVER_RETRY sec later.
+ * A numeric ip is of its own family, a name is looked up by family; with
+ * AF_UNSPEC, IPv6 and IPv4 addresses take turns.
+ * Compile need -lpthread.
+ * MinGW compile need -lws2_32.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 20:05.
+ */
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include "socket_address.h"
+
+#define RESOLVER_TTL	30	// sec.
+#define RESOLVER_RETRY	5	// sec.
+
+class Resolver
+{
+public:
+	Resolver(unsigned int ttl=RESOLVER_TTL, int family=AF_INET);
+	virtual ~Resolver();
+
+	/*
+	 * Set addr to next address of host, with port.
+	 * Waits only when host is not cached, return false if it can not be resolved.
+	 */
+	bool resolve(const String &host, unsigned short port, SocketAddress &addr);
+
+	// Addresses of host in cache, port 0.
+	std::vector<SocketAddress> addresses(const String &host) const;
+
+	unsigned long long hits() const;		// answered by cache.
+	unsigned long long misses() const;		// waited for a lookup.
+	unsigned long long refreshes() const;	// looked up again by subthread.
+	unsigned long long failures() const;	// lookups failed.
+
+	static int familyFromName(const String &name);	// "ipv4", "ipv6" or "any".
+
+	// Blocking getaddrinfo, addresses in order, families take turns.
+	static bool lookup(const String &host, int family, std::vector<SocketAddress> &result);
+
+	class Thread
+	{
+	public:
+		static void *refreshThread(void *s);
+	};
+
+private:
+	struct Entry
+	{
+		std::vector<SocketAddress> addrs;
+		unsigned int next;	// round robin.
+		unsigned long long expire;	// msec, refresh after.
+		bool refreshing;
+	};
+
+	unsigned int m_ttl;
+	int m_family;
+	std::map<String, Entry> m_entries;
+	unsigned long long m_hits;
+	unsigned long long m_misses;
+	unsigned long long m_refreshes;
+	unsigned long long m_failures;
+
+	std::vector<String> m_pending;	// expired names asked, for subthread.
+	bool m_quit;
+	bool m_hasThread;
+	pthread_t m_thread;
+	mutable pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+
+	void refresh(const String &host);
+
+	Resolver(const Resolver &);
+	Resolver &operator=(const Resolver &);
+};
+
+#endif	//RESOLVER_H
@@ -0,0 +1,82 @@
+#ifndef SOCKET_ADDRESS_H
+#define SOCKET_ADDRESS_H
+
+/*
+ * Binary address of an IPv4 or IPv6 socket, a value of 32 bytes.
+ * Take it once (at accept, or from recvmmsg), then copy, compare and use
+ * it as a map key as is; only ip() and toString() format it, call them
+ * when logging.
+ * A v4-mapped address (::ffff:a.b.c.d) of a dual-stack socket is kept so
+ * replies can be sent to it, but it is formatted as its IPv4 address.
+ * MinGW compile need -lws2_32.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 20:05.
+ */
+
+#ifdef _WIN32
+#include <winsock.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif	//_WIN32
+
+#include "eyre_string.h"
+
+class SocketAddress
+{
+public:
+	SocketAddress();	// invalid, family() is AF_UNSPEC.
+	SocketAddress(const struct sockaddr *addr, socklen_t length);
+
+	/*
+	 * addr is an IPv4 address in host order like INADDR_ANY.
+	 * For AF_INET6, INADDR_ANY is :: (a dual-stack socket takes IPv4 too),
+	 * INADDR_LOOPBACK is ::1, others are v4-mapped.
+	 */
+	SocketAddress(int family, unsigned long addr, unsigned short port);
+
+	// Numeric ip of either family, no name lookup; invalid if ip is not.
+	static SocketAddress fromIp(const char *ip, unsigned short port);
+
+	// Address of the peer of a connected socket, one getpeername().
+	static SocketAddress peerOf(int sockfd);
+
+	// Family of host if it is a numeric ip, else family, to resolve host by.
+	static int familyOf(const char *host, int family=AF_INET);
+
+	bool isValid() const;
+	int family() const;
+	unsigned short port() const;
+	void setPort(unsigned short port);
+	bool isV4Mapped() const;
+
+	const struct sockaddr *addr() const;
+	socklen_t length() const;
+
+	// For a read to fill: pass addr() and capacity(), then setLength().
+	struct sockaddr *addr();
+	static socklen_t capacity();
+	void setLength(socklen_t length);
+
+	String ip() const;
+	String toString() const;	// ip:port, or [ip]:port of IPv6.
+
+	int compare(const SocketAddress &other) const;
+	bool operator==(const SocketAddress &other) const;
+	bool operator!=(const SocketAddress &other) const;
+	bool operator<(const SocketAddress &other) const;
+
+private:
+	union
+	{
+		struct sockaddr sa;
+		struct sockaddr_in v4;
+		struct sockaddr_in6 v6;
+	} m_addr;
+	socklen_t m_length;
+};
+
+#endif	//SOCKET_ADDRESS_H
@@ -4,11 +4,13 @@
 /*
  * For start a tcp server easily.
  * All message is ByteArray, so need Eyre Turing lib framework.
+ * Linux waits clients by an EventLoop (io_uring or epoll), Windows by select.
+ * Family AF_INET6 listens dual-stack, IPv4 clients come as v4-mapped.
  * Compile need -lpthread.
  * MinGW compile need -lws2_32.
  *
  * Author: Eyre Turing.
- * Last edit: 2021-06-13 18:02.
+ * Last edit: 2026-10-19 21:10.
  */
 
 #ifdef _WIN32
@@ -16,10 +18,12 @@
 #include <queue>
 #else
 #include <sys/socket.h>
+#include "event_loop.h"
 #endif
 
 #include <map>
 #include <pthread.h>
+#include "socket_address.h"
 
 #define TCP_SERVER_CLOSED	0
 #define TCP_SERVER_RUNNING	1
@@ -30,6 +34,8 @@
 #define TCP_SERVER_LISTEN_ERROR		(-3)
 #define TCP_SERVER_CREATETHREAD_ERROR	(-4)
 
+#define TCP_SERVER_BACKLOG	SOMAXCONN	// kernel caps it by net.core.somaxconn.
+
 class TcpSocket;
 #include "tcp_socket.h"
 
@@ -44,7 +50,9 @@ public:
 	virtual ~TcpServer();
 	
 	//return error type, if return TCP_SERVER_READYTORUN {aka 0} is succeed.
-	int start(unsigned short port, int family=AF_INET, unsigned long addr=INADDR_ANY, int backlog=5);
+	int start(unsigned short port, int family=AF_INET, unsigned long addr=INADDR_ANY,
+			int backlog=TCP_SERVER_BACKLOG);
+	int start(const SocketAddress &local, int backlog=TCP_SERVER_BACKLOG);
 	void abort();
 	
 	void setNewConnectingCallBack(NewConnecting newConnecting);
@@ -53,11 +61,13 @@ public:
 
 	int runStatus() const;
 	
+#ifdef _WIN32
 	class Thread
 	{
 	public:
 		static void *selectThread(void *s);
 	};
+#endif
 	
 	friend class TcpSocket;
 	
@@ -74,15 +84,20 @@ private:
 	std::queue<int> m_waitForRemoveSockfds;
 	pthread_mutex_t m_waitForRemoveSockfdsMutex;
 	SOCKET m_sockfd;
-#else
-	int m_sockfd;
-#endif
-	int m_runStatus;
 	
 	fd_set m_readfds;
 	pthread_mutex_t m_readfdsMutex;
 	
 	pthread_t m_listenThread;
+#else
+	int m_sockfd;
+	
+	EventLoop *m_loop;	// accepts and reads clients, created by first start().
+	EventLoop::Watch *m_watch;
+	
+	static void onLoopAccept(void *owner, int sockfd);
+#endif
+	int m_runStatus;
 	
 	NewConnecting m_onNewConnecting;
 	StartSucceed m_onStartSucceed;
@@ -97,27 +112,27 @@ private:
 	
 	/*
 	 * Will create a TcpSocket* which use clientSockfd to send an recv message,
+	 * peer is kept by it as its peerAddress(),
 	 * and add pair(clientSockfd, created TcpSocket*) to m_clientMap.
-	 * And add clientSockfd to m_readfds.
+	 * And add clientSockfd to m_readfds (watch it by m_loop on Linux).
 	 */
 #ifdef _WIN32
-	TcpSocket *appendClient(SOCKET clientSockfd);
+	TcpSocket *appendClient(SOCKET clientSockfd, const SocketAddress &peer);
+	pthread_mutex_t m_readfdsMutexInAppend;
 #else
-	TcpSocket *appendClient(int clientSockfd);
+	TcpSocket *appendClient(int clientSockfd, const SocketAddress &peer);
 #endif
-	pthread_mutex_t m_readfdsMutexInAppend;
 	
 	/*
 	 * Will close clientSockfd, remove clientSockfd from m_readfds
-	 * and call back onDisconnected.
-	 * Note: this function don't auto delete the TcpSocket*.
+	 * (unwatch it on Linux), call back onDisconnected and delete the TcpSocket*.
 	 */
 #ifdef _WIN32
 	bool removeClient(SOCKET clientSockfd);
+	pthread_mutex_t m_readfdsMutexInRemove;
 #else
 	bool removeClient(int clientSockfd);
 #endif
-	pthread_mutex_t m_readfdsMutexInRemove;
 };
 
 #endif	//TCP_SERVER_H
@@ -8,7 +8,7 @@
  * MinGW compile need -lws2_32.
  *
  * Author: Eyre Turing.
- * Last edit: 2021-06-23 17:45.
+ * Last edit: 2026-10-19 22:40.
  */
 
 #ifdef _WIN32
@@ -16,10 +16,14 @@
 #else
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include "event_loop.h"
 #endif	//_WIN32
 
 #include <pthread.h>
+#include <vector>
+#include <deque>
 #include "byte_array.h"
+#include "socket_address.h"
 
 #define TCP_SOCKET_DISCONNECTED	0
 #define TCP_SOCKET_CONNECTED		1
@@ -31,6 +35,11 @@
 #define TCP_SOCKET_CREATETHREAD_ERROR	(-4)
 #define TCP_SOCKET_ISSERVER_ERROR	(-5)	//aka this is serve's socket, peer is client, can't connect to other server.
 
+//who paused reading, read goes on only when none of them is left.
+#define TCP_SOCKET_PAUSE_OWNER		1	//aka the default, shaping of the owner.
+#define TCP_SOCKET_PAUSE_BACKLOG	2	//frames read wait too much to be sent on, see FrameScheduler.
+#define TCP_SOCKET_PAUSE_SEND		4	//where the datas read go is not draining.
+
 class TcpServer;
 #include "tcp_server.h"
 
@@ -41,26 +50,87 @@ public:
 	typedef void (*Connected)(TcpSocket *s);
 	typedef void (*Read)(TcpSocket *s, ByteArray data);
 	typedef void (*ConnectError)(TcpSocket *s, int errorStatus);
+	typedef void (*ReadClosed)(TcpSocket *s);
+	typedef void (*Drained)(TcpSocket *s);
 	
 	TcpSocket();
 	virtual ~TcpSocket();
 	
-	//will return error type, if return TCP_SOCKET_READYTOCONNECT {aka 0} is succeed.
+	/*
+	 * Will return error type, if return TCP_SOCKET_READYTOCONNECT {aka 0} is succeed.
+	 * A numeric ip connects by its own family, a name is resolved by family.
+	 */
 	int connectToHost(const char *addr, unsigned short port, int family=AF_INET);
 
+	// No lookup, addr is resolved before, see Resolver.
+	int connectToHost(const SocketAddress &addr);
+
 	//if this is a server's socket connect from a client, the function will `delete this`.
 	void abort();
 	
 	bool write(const ByteArray &data);
 	bool write(const char *data, unsigned int size=0xffffffff);
 	
+	/*
+	 * Write all datas by one gather send (Windows join them and send),
+	 * so many small frames cost only one system call.
+	 */
+	bool write(const std::vector<ByteArray> &datas);
+	
+	/*
+	 * Queue data and send what the socket takes now, never blocks.
+	 * The rest is sent in the loop thread as the peer reads it.
+	 * Return false if not connected or send failed, owner aborts then.
+	 * Do not mix it with write() on one socket.
+	 */
+	bool post(const ByteArray &data);
+	
+	// Bytes posted and not sent yet.
+	unsigned long long queuedBytes() const;
+	
+	/*
+	 * drained is called in the loop thread when the queue falls to
+	 * lowWater, once each time it was over it.
+	 */
+	void setDrainedCallBack(Drained drained, unsigned long long lowWater=0);
+	
+	/*
+	 * Send fin after datas written, peer reads eof but can still send,
+	 * reading here goes on. abort() closes the socket when both are done.
+	 * Datas posted are sent before the fin.
+	 */
+	bool shutdownWrite();
+	
+	// abort() now, or once datas posted are all sent.
+	void abortWhenWritten();
+	
 	void setDisconnectedCallBack(Disconnected disconnected);
 	void setConnectedCallBack(Connected connected);
 	void setReadCallBack(Read read);
 	void setConnectErrorCallBack(ConnectError connectError);
 	
+	/*
+	 * Peer finished sending (fin). With this call back set, the socket
+	 * stays connected for writes and Disconnected is not called for the
+	 * eof; without it eof disconnects as an error does.
+	 */
+	void setReadClosedCallBack(ReadClosed readClosed);
+	
 	int connectStatus() const;
 
+	/*
+	 * Paused, no Read call back till resumed, peer is held back by TCP
+	 * flow control. Can be called from any thread, even in Read.
+	 * Each reason pauses and resumes by itself, TCP_SOCKET_PAUSE_*.
+	 */
+	void setReadPaused(bool paused, unsigned int reason=TCP_SOCKET_PAUSE_OWNER);
+	bool readPaused() const;
+
+	/*
+	 * Peer is kept when accepted or connected, no system call here.
+	 * getPeerIp() formats it each call, use it for logging only.
+	 */
+	const SocketAddress &peerAddress() const;
 	String getPeerIp() const;
 	unsigned short getPeerPort() const;
 	
@@ -75,7 +145,9 @@ public:
 	{
 	public:
 		static void *connectThread(void *s);
+#ifdef _WIN32
 		static void *readThread(void *s);
+#endif
 	};
 	
 	friend class TcpServer;
@@ -89,16 +161,44 @@ private:
 #else
 	int m_sockfd;
 #endif
-	struct addrinfo *m_res;
+	SocketAddress m_peer;	// connect to, or accepted from.
 	int m_connectStatus;
+	unsigned int m_connection;	// count of connectToHost, read thread of an old connection quits.
+	volatile unsigned int m_pauseReasons;	// TCP_SOCKET_PAUSE_* bits, 0 is reading.
+	pthread_mutex_t m_pauseMutex;	// keeps the loop told in the order reasons change.
 	
 	pthread_t m_connectThread;
+#ifdef _WIN32
+	volatile unsigned int m_threads;	// read threads not quit, destructor waits them.
+	bool *m_destroyed;	// set by read thread, tells it this is deleted in its call back.
 	pthread_t m_readThread;
+#else
+	EventLoop *m_loop;	// reads this, EventLoop::shared() or loop of m_server.
+	EventLoop::Watch *m_watch;
+	
+	static void onLoopRead(void *owner, ByteArray &data);
+#endif
 	
 	Disconnected m_onDisconnected;
 	Connected m_onConnected;
 	Read m_onRead;
 	ConnectError m_onConnectError;
+	ReadClosed m_onReadClosed;
+	Drained m_onDrained;
+	unsigned long long m_drainLowWater;
+	
+#ifndef _WIN32
+	std::deque<ByteArray> m_sendQueue;	// posted, not sent yet.
+	unsigned int m_sendOffset;	// sent of the front one.
+	volatile unsigned long long m_queuedBytes;
+	bool m_drainArmed;	// over m_drainLowWater since Drained called.
+	bool m_finPending;	// fin sent when the queue is.
+	bool m_abortPending;
+	pthread_mutex_t m_sendMutex;
+	
+	static void onLoopWritable(void *owner);
+	bool sendQueued();	// with m_sendMutex locked, false if send failed.
+#endif
 	
 	TcpServer *m_server;
 	
@@ -2,11 +2,16 @@
 #define UDP_SOCKET_H
 
 /*
+ * The call back function `Read` will exec in a subthread,
+ * the thread of EventLoop::shared() on Linux.
+ * Linux reads by recvmmsg into pooled buffers and sends by sendmmsg,
+ * ReadBatch gets all datagrams of a read with binary address, no copy.
+ * Family AF_INET6 binds dual-stack, IPv4 peers come as v4-mapped.
  * Compile need -lpthread.
  * MinGW compile need -lws2_32.
- * 
+ *
  * Author: Eyre Turing.
- * Last edit: 2021-01-10 14:51.
+ * Last edit: 2026-10-19 20:45.
  */
 
 #ifdef _WIN32
@@ -18,32 +23,83 @@
 
 #include <pthread.h>
 #include "byte_array.h"
+#include "socket_address.h"
+
+#ifndef _WIN32
+#include "event_loop.h"
+#endif
+
+#define UDP_SOCKET_BATCH	64		// datagrams one recvmmsg or sendmmsg at most.
+#define UDP_SOCKET_SLOT		65536	// 64k, a pooled receive buffer, fits a GRO read.
 
 class UdpSocket
 {
 public:
+	struct Datagram
+	{
+		const char *data;
+		unsigned int size;
+		SocketAddress addr;	// from when read, to when send.
+	};
+
 	typedef void (*Read)(UdpSocket *s, String ip, unsigned short port, ByteArray data);
-	
+
+	// datagrams and their data are only valid in the call back.
+	typedef void (*ReadBatch)(UdpSocket *s, const Datagram *datagrams, unsigned int count);
+
 	UdpSocket();
 	virtual ~UdpSocket();
-	
+
+	//port 0 binds a free port, for a socket sends first and reads replies.
 	bool start(unsigned short port, int family=AF_INET, unsigned long addr=INADDR_ANY);
 	void unbind();
-	
+
 	bool send(const char *addr, unsigned short port, const ByteArray &data) const;
 	bool send(const char *addr, unsigned short port,
 				const char *data, unsigned int size=0xffffffff) const;
-	
+	bool send(const SocketAddress &to, const char *data, unsigned int size) const;
+
+	/*
+	 * Return how many datagrams sent, in order.
+	 * With GSO on, a run of datagrams to the same addr and size (the last
+	 * one can be shorter) goes as segments of one message.
+	 */
+	unsigned int send(const Datagram *datagrams, unsigned int count);
+
+	/*
+	 * Linux only, call after start(), return false if kernel has not.
+	 * gro: kernel joins datagrams of a peer, they are split again before
+	 * call back. gso: see send(datagrams, count).
+	 */
+	bool setOffload(bool gro, bool gso);
+
+	// SO_RCVBUF and SO_SNDBUF, kernel caps them by rmem_max and wmem_max.
+	bool setBufferSize(unsigned int bytes);
+
+	// ReadBatch is used if set, else Read of every datagram.
 	void setReadCallBack(Read read);
-	
+	void setReadBatchCallBack(ReadBatch read);
+
 	bool isBound() const;
-	
+
+	// No Read call back till resumed, datagrams wait in SO_RCVBUF.
+	void setReadPaused(bool paused);
+	bool readPaused() const;
+
+	/*
+	 * Resolve addr once, then send by binary address.
+	 * A numeric ip keeps its family, a name is resolved by family.
+	 */
+	static bool resolve(const char *addr, unsigned short port, SocketAddress &to, int family=AF_INET);
+
+#ifdef _WIN32
 	class Thread
 	{
 	public:
 		static void *readThread(void *s);
 	};
-	
+#endif
+
 private:
 #ifdef _WIN32
 	WSADATA m_wsadata;
@@ -53,10 +109,23 @@ private:
 #endif
 	bool m_isBound;
 	unsigned short m_port;
-	
+	bool m_gro;
+	bool m_gso;
+	volatile bool m_readPaused;
+
+#ifdef _WIN32
 	pthread_t m_readThread;
-	
+#else
+	EventLoop *m_loop;
+	EventLoop::Watch *m_watch;
+
+	static void onLoopReady(void *owner);
+#endif
+
 	Read m_onRead;
+	ReadBatch m_onReadBatch;
+
+	void deliver(const Datagram *datagrams, unsigned int count);
 };
 
 #endif	//UDP_SOCKET_H
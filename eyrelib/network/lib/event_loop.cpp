@@ -0,0 +1,1384 @@
+/*
+ * Class EventLoop, sockets of many owners waited by one thread.
+ * io_uring is used by raw system calls, no liburing needed.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 22:40.
+ */
+
+#ifndef _WIN32
+
+#include "event_loop.h"
+#include "debug_settings.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+//multishot recv came with kernel 6.0, setup flags below with 6.1.
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_SETUP_DEFER_TASKRUN) && defined(__NR_io_uring_setup)
+#define HAVE_URING	1
+#else
+#define HAVE_URING	0
+#endif
+
+#define WATCH_READ		0
+#define WATCH_ACCEPT	1
+#define WATCH_READY		2
+
+//low bits of user_data, Watch is aligned.
+#define TAG_WATCH	1
+#define TAG_WAKE	2
+#define TAG_CANCEL	3
+#define TAG_WRITE	4
+#define TAG_MASK	7ULL
+
+#define URING_ENTRIES		256
+#define URING_CQ_ENTRIES	4096
+#define BUFFER_GROUP		0
+#define EPOLL_EVENTS		256
+
+struct EventLoop::Watch
+{
+	int sockfd;
+	int type;
+	Read read;
+	Accept accept;
+	Ready ready;
+	Writable writable;
+	void *owner;
+
+	bool unwatched;	// by owner, set with m_mutex locked.
+	bool dropped;	// taken from m_removed by loop, free when not armed.
+	bool closed;	// eof or error, no more recv.
+	bool eof;	// closed by peer finished sending.
+	bool armed;		// io_uring request in flight.
+	bool cancelling;
+	bool paused;	// by owner, set with m_mutex locked.
+	bool busy;		// in m_busy.
+	bool readable;
+	bool told;	// closed is given by empty Read.
+	bool wantWrite;	// waiting writable, set with m_mutex locked.
+	bool writeArmed;	// io_uring poll of writable in flight.
+	bool writeCancelling;
+	bool canWrite;	// writable to call back in this batch.
+	unsigned int events;	// epoll events added, 0 if not in epoll.
+	ByteArray pending;	// datas came in this batch.
+};
+
+#if HAVE_URING
+struct EventLoop::Uring
+{
+	int fd;
+	int enterFd;	// index of registered ring fd, or fd.
+	unsigned int enterFlags;
+
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int *sqArray;
+	unsigned int sqMask;
+	unsigned int sqEntries;
+	unsigned int sqLocalTail;
+	unsigned int sqSubmitted;
+
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int cqMask;
+	struct io_uring_cqe *cqes;
+
+	struct io_uring_buf *bufRing;	// tail is bufRing[0].resv.
+	size_t bufRingSize;
+	char *buffers;
+	unsigned short bufTail;
+
+	bool wakeArmed;
+
+	struct io_uring_sqe *getSqe();
+	int submit(unsigned int wait);	// return -errno if error.
+	void addBuffer(unsigned short bid);
+	void publishBuffers();
+};
+
+struct io_uring_sqe *EventLoop::Uring::getSqe()
+{
+	if(sqLocalTail-__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+	{
+		submit(0);	//full, give them to kernel first.
+		if(sqLocalTail-__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+		{
+			return NULL;
+		}
+	}
+	unsigned int index = sqLocalTail&sqMask;
+	struct io_uring_sqe *sqe = sqes+index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqArray[index] = index;
+	++sqLocalTail;
+	return sqe;
+}
+
+int EventLoop::Uring::submit(unsigned int wait)
+{
+	unsigned int toSubmit = sqLocalTail-sqSubmitted;
+	if(toSubmit==0 && wait==0)
+	{
+		return 0;
+	}
+	__atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+	int result = syscall(__NR_io_uring_enter, enterFd, toSubmit, wait,
+						(wait ? IORING_ENTER_GETEVENTS : 0)|enterFlags, NULL, 0);
+	if(result < 0)
+	{
+		return -errno;
+	}
+	sqSubmitted += result;
+	return result;
+}
+
+void EventLoop::Uring::addBuffer(unsigned short bid)
+{
+	//not io_uring_buf_ring::bufs, its flex array is moved by c++.
+	struct io_uring_buf *buf = bufRing+(bufTail&(EVENT_LOOP_BUFFERS-1));
+	buf->addr = (unsigned long long) (buffers+(unsigned long) bid*EVENT_LOOP_BUFFER_SIZE);
+	buf->len = EVENT_LOOP_BUFFER_SIZE;
+	buf->bid = bid;
+	++bufTail;
+}
+
+void EventLoop::Uring::publishBuffers()
+{
+	__atomic_store_n(&(bufRing[0].resv), bufTail, __ATOMIC_RELEASE);
+}
+#else
+struct EventLoop::Uring
+{
+};
+#endif	//HAVE_URING
+
+int EventLoop::defaultBackend = EVENT_LOOP_AUTO;
+
+static pthread_mutex_t sharedMutex = PTHREAD_MUTEX_INITIALIZER;
+static EventLoop *sharedLoop = NULL;
+
+void *EventLoop::Thread::loopThread(void *s)
+{
+	EventLoop *loop = (EventLoop *) s;
+
+	bool succeed = false;
+	if(loop->m_backend != EVENT_LOOP_EPOLL)
+	{
+		succeed = loop->setupUring();
+		if(succeed)
+		{
+			loop->m_backend = EVENT_LOOP_URING;
+		}
+		else if(loop->m_backend == EVENT_LOOP_URING)
+		{
+			fprintf(stderr, "EventLoop(%p) io_uring not supported, use epoll.\n", loop);
+		}
+	}
+	if(!succeed)
+	{
+		succeed = loop->setupEpoll();
+		loop->m_backend = EVENT_LOOP_EPOLL;
+	}
+
+	pthread_mutex_lock(&(loop->m_mutex));
+	loop->m_startResult = succeed ? 1 : -1;
+	pthread_cond_broadcast(&(loop->m_cond));
+	pthread_mutex_unlock(&(loop->m_mutex));
+	if(!succeed)
+	{
+		return NULL;
+	}
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "EventLoop(%p) run with %s.\n", loop, loop->m_uring ? "io_uring" : "epoll");
+#endif
+
+	if(loop->m_uring)
+	{
+		loop->runUring();
+		loop->closeUring();
+	}
+	else
+	{
+		loop->runEpoll();
+		loop->closeEpoll();
+	}
+	return NULL;
+}
+
+EventLoop::EventLoop(int backend)
+{
+	m_backend = backend==EVENT_LOOP_AUTO ? defaultBackend : backend;
+	m_running = false;
+	m_started = false;
+	m_hasThread = false;
+	m_startResult = 0;
+	m_wakefd = -1;
+	m_epfd = -1;
+	m_uring = NULL;
+	m_buffer = NULL;
+	m_current = NULL;
+	m_eof = false;
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "EventLoop(%p) created.\n", this);
+#endif
+}
+
+EventLoop::~EventLoop()
+{
+	stop();
+	for(std::set<Watch *>::iterator it=m_watches.begin(); it!=m_watches.end(); ++it)
+	{
+		delete *it;
+	}
+	if(m_wakefd >= 0)
+	{
+		close(m_wakefd);
+	}
+	pthread_mutex_destroy(&m_mutex);
+	pthread_cond_destroy(&m_cond);
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "EventLoop(%p) destroyed.\n", this);
+#endif
+}
+
+bool EventLoop::start()
+{
+	if(m_started)
+	{
+		return true;
+	}
+	if(m_wakefd < 0)
+	{
+		m_wakefd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+		if(m_wakefd < 0)
+		{
+			fprintf(stderr, "EventLoop(%p) eventfd() error: %s\n", this, strerror(errno));
+			return false;
+		}
+	}
+	m_running = true;
+	m_startResult = 0;
+	if(pthread_create(&m_thread, NULL, EventLoop::Thread::loopThread, this) != 0)
+	{
+		m_running = false;
+		fprintf(stderr, "EventLoop(%p) can not create thread!\n", this);
+		return false;
+	}
+	m_hasThread = true;
+	pthread_mutex_lock(&m_mutex);
+	while(m_startResult == 0)
+	{
+		pthread_cond_wait(&m_cond, &m_mutex);
+	}
+	pthread_mutex_unlock(&m_mutex);
+	if(m_startResult < 0)
+	{
+		m_running = false;
+		pthread_join(m_thread, NULL);
+		m_hasThread = false;
+		fprintf(stderr, "EventLoop(%p) no backend can start!\n", this);
+		return false;
+	}
+	m_started = true;
+	return true;
+}
+
+void EventLoop::stop()
+{
+	if(!m_started)
+	{
+		return ;
+	}
+	bool self = inLoopThread();
+	m_running = false;
+	wake();
+	if(self)
+	{
+		pthread_detach(m_thread);	//quits after this call back.
+	}
+	else
+	{
+		pthread_join(m_thread, NULL);
+		m_hasThread = false;
+	}
+	m_started = false;
+}
+
+EventLoop::Watch *EventLoop::watchRead(int sockfd, Read read, void *owner)
+{
+	return watch(sockfd, WATCH_READ, read, NULL, NULL, owner);
+}
+
+EventLoop::Watch *EventLoop::watchAccept(int sockfd, Accept accept, void *owner)
+{
+	return watch(sockfd, WATCH_ACCEPT, NULL, accept, NULL, owner);
+}
+
+EventLoop::Watch *EventLoop::watchReady(int sockfd, Ready ready, void *owner)
+{
+	return watch(sockfd, WATCH_READY, NULL, NULL, ready, owner);
+}
+
+EventLoop::Watch *EventLoop::watch(int sockfd, int type, Read read, Accept accept, Ready ready, void *owner)
+{
+	if(!m_started)
+	{
+		return NULL;
+	}
+	Watch *w = new Watch;
+	w->sockfd = sockfd;
+	w->type = type;
+	w->read = read;
+	w->accept = accept;
+	w->ready = ready;
+	w->writable = NULL;
+	w->owner = owner;
+	w->unwatched = false;
+	w->dropped = false;
+	w->closed = false;
+	w->eof = false;
+	w->armed = false;
+	w->cancelling = false;
+	w->paused = false;
+	w->busy = false;
+	w->readable = false;
+	w->told = false;
+	w->wantWrite = false;
+	w->writeArmed = false;
+	w->writeCancelling = false;
+	w->canWrite = false;
+	w->events = 0;
+
+	pthread_mutex_lock(&m_mutex);
+	m_watches.insert(w);
+	if(m_backend == EVENT_LOOP_EPOLL)
+	{
+		if(type == WATCH_ACCEPT)
+		{
+			fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL)|O_NONBLOCK);	//accept till EAGAIN.
+		}
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = w;
+		if(m_epfd<0 || epoll_ctl(m_epfd, EPOLL_CTL_ADD, sockfd, &event)!=0)
+		{
+			m_watches.erase(w);
+			pthread_mutex_unlock(&m_mutex);
+			fprintf(stderr, "EventLoop(%p) epoll_ctl() error: %s\n", this, strerror(errno));
+			delete w;
+			return NULL;
+		}
+		w->events = EPOLLIN;
+		pthread_mutex_unlock(&m_mutex);
+	}
+	else
+	{
+		m_added.push_back(w);
+		pthread_mutex_unlock(&m_mutex);
+		if(!inLoopThread())
+		{
+			wake();
+		}
+	}
+	return w;
+}
+
+void EventLoop::unwatch(Watch *watch)
+{
+	if(!watch)
+	{
+		return ;
+	}
+	pthread_mutex_lock(&m_mutex);
+	if(watch->unwatched)
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return ;
+	}
+	watch->unwatched = true;
+	if(m_backend==EVENT_LOOP_EPOLL && m_epfd>=0)
+	{
+		epoll_ctl(m_epfd, EPOLL_CTL_DEL, watch->sockfd, NULL);	//fails if closed already.
+	}
+	m_removed.push_back(watch);
+	pthread_mutex_unlock(&m_mutex);
+	if(m_backend==EVENT_LOOP_URING && !inLoopThread())
+	{
+		wake();
+	}
+}
+
+void EventLoop::pause(Watch *watch, bool paused)
+{
+	if(!watch)
+	{
+		return ;
+	}
+	pthread_mutex_lock(&m_mutex);
+	//owner may pause a watch the loop freed meanwhile.
+	if(m_watches.find(watch)==m_watches.end() || watch->unwatched || watch->paused==paused)
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return ;
+	}
+	watch->paused = paused;
+	if(m_backend == EVENT_LOOP_EPOLL)
+	{
+		updateEpoll(watch);
+		pthread_mutex_unlock(&m_mutex);
+		return ;
+	}
+	m_paused.push_back(watch);
+	pthread_mutex_unlock(&m_mutex);
+	if(!inLoopThread())
+	{
+		wake();
+	}
+}
+
+void EventLoop::waitWritable(Watch *watch, Writable writable)
+{
+	if(!watch)
+	{
+		return ;
+	}
+	pthread_mutex_lock(&m_mutex);
+	if(m_watches.find(watch)==m_watches.end() || watch->unwatched || watch->wantWrite)
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return ;
+	}
+	watch->writable = writable;
+	watch->wantWrite = true;
+	if(m_backend == EVENT_LOOP_EPOLL)
+	{
+		updateEpoll(watch);
+		pthread_mutex_unlock(&m_mutex);
+		return ;
+	}
+	m_writes.push_back(watch);
+	pthread_mutex_unlock(&m_mutex);
+	if(!inLoopThread())
+	{
+		wake();
+	}
+}
+
+void EventLoop::waitIdle(void *owner) const
+{
+	if(inLoopThread())
+	{
+		return ;
+	}
+	pthread_mutex_lock(&m_mutex);
+	while(m_current == owner)
+	{
+		pthread_cond_wait(&m_cond, &m_mutex);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool EventLoop::inLoopThread() const
+{
+	//not by m_running, call backs still running after stop() must know their thread.
+	return m_hasThread && pthread_equal(pthread_self(), m_thread);
+}
+
+bool EventLoop::peerClosed() const
+{
+	return m_eof;
+}
+
+int EventLoop::backend() const
+{
+	return m_backend;
+}
+
+EventLoop *EventLoop::shared()
+{
+	pthread_mutex_lock(&sharedMutex);
+	if(sharedLoop == NULL)
+	{
+		EventLoop *loop = new EventLoop();
+		if(loop->start())
+		{
+			sharedLoop = loop;
+		}
+		else
+		{
+			delete loop;
+		}
+	}
+	pthread_mutex_unlock(&sharedMutex);
+	return sharedLoop;
+}
+
+void EventLoop::stopShared()
+{
+	pthread_mutex_lock(&sharedMutex);
+	if(sharedLoop)
+	{
+		sharedLoop->stop();
+	}
+	pthread_mutex_unlock(&sharedMutex);
+}
+
+void EventLoop::setDefaultBackend(int backend)
+{
+	defaultBackend = backend;
+}
+
+int EventLoop::backendFromName(const String &name)
+{
+	if(name == "uring" || name == "io_uring")
+	{
+		return EVENT_LOOP_URING;
+	}
+	if(name == "epoll")
+	{
+		return EVENT_LOOP_EPOLL;
+	}
+	return EVENT_LOOP_AUTO;
+}
+
+String EventLoop::backendName(int backend)
+{
+	if(backend == EVENT_LOOP_URING)
+	{
+		return "io_uring";
+	}
+	if(backend == EVENT_LOOP_EPOLL)
+	{
+		return "epoll";
+	}
+	return "auto";
+}
+
+void EventLoop::wake()
+{
+	unsigned long long one = 1;
+	if(write(m_wakefd, &one, sizeof(one)) < 0)
+	{
+		//counter full means loop is waked already.
+	}
+}
+
+bool EventLoop::enter(Watch *watch)
+{
+	pthread_mutex_lock(&m_mutex);
+	if(watch->unwatched)
+	{
+		pthread_mutex_unlock(&m_mutex);
+		return false;
+	}
+	m_current = watch->owner;
+	pthread_mutex_unlock(&m_mutex);
+	return true;
+}
+
+void EventLoop::leave()
+{
+	pthread_mutex_lock(&m_mutex);
+	m_current = NULL;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void EventLoop::dispatch()
+{
+	for(unsigned int i=0; i<m_busy.size(); ++i)
+	{
+		Watch *w = m_busy[i];
+		w->busy = false;
+		if(w->canWrite)
+		{
+			w->canWrite = false;
+			if(enter(w))
+			{
+				w->writable(w->owner);
+				leave();
+			}
+		}
+		if(w->type == WATCH_READ)
+		{
+			if(w->pending.size())
+			{
+				if(enter(w))
+				{
+					w->read(w->owner, w->pending);
+					leave();
+				}
+				w->pending = ByteArray();
+			}
+			if(w->closed && !w->told)
+			{
+				w->told = true;
+				ByteArray empty;
+				if(enter(w))
+				{
+					m_eof = w->eof;
+					w->read(w->owner, empty);
+					m_eof = false;
+					leave();
+				}
+			}
+		}
+		else if(w->readable)
+		{
+			w->readable = false;
+			if(enter(w))
+			{
+				w->ready(w->owner);
+				leave();
+			}
+		}
+	}
+	m_busy.clear();
+}
+
+void EventLoop::takeCommands()
+{
+	std::vector<Watch *> added, removed, paused, writes;
+	pthread_mutex_lock(&m_mutex);
+	added.swap(m_added);
+	removed.swap(m_removed);
+	paused.swap(m_paused);
+	writes.swap(m_writes);
+	pthread_mutex_unlock(&m_mutex);
+
+#if HAVE_URING
+	if(m_uring)
+	{
+		std::vector<Watch *> rearm;
+		rearm.swap(m_rearm);
+		rearm.insert(rearm.end(), added.begin(), added.end());
+		for(unsigned int i=0; i<rearm.size(); ++i)
+		{
+			Watch *w = rearm[i];
+			if(w->unwatched || w->closed || w->armed || w->paused)
+			{
+				continue;
+			}
+			if(!armUring(w))
+			{
+				m_rearm.push_back(w);	//queue full, next time.
+			}
+		}
+		for(unsigned int i=0; i<paused.size(); ++i)
+		{
+			Watch *w = paused[i];
+			if(w->unwatched || w->closed)
+			{
+				continue;
+			}
+			if(!w->paused)
+			{
+				if(!w->armed && !armUring(w))
+				{
+					m_rearm.push_back(w);
+				}
+				continue;	//cancel in flight ends, then it is armed again.
+			}
+			if(w->armed && !w->cancelling)
+			{
+				w->cancelling = cancelUring(w, TAG_WATCH);
+				if(!w->cancelling)
+				{
+					pthread_mutex_lock(&m_mutex);
+					m_paused.push_back(w);
+					pthread_mutex_unlock(&m_mutex);
+				}
+			}
+		}
+		for(unsigned int i=0; i<writes.size(); ++i)
+		{
+			Watch *w = writes[i];
+			if(w->unwatched || w->writeArmed)
+			{
+				continue;
+			}
+			if(!armWritable(w))
+			{
+				pthread_mutex_lock(&m_mutex);
+				m_writes.push_back(w);	//queue full, next time.
+				pthread_mutex_unlock(&m_mutex);
+			}
+		}
+		for(unsigned int i=0; i<removed.size(); ++i)
+		{
+			Watch *w = removed[i];
+			w->dropped = true;
+			if(!w->armed && !w->writeArmed)
+			{
+				freeWatch(w);
+				continue;
+			}
+			if(w->armed && !w->cancelling)
+			{
+				w->cancelling = cancelUring(w, TAG_WATCH);
+			}
+			if(w->writeArmed && !w->writeCancelling)
+			{
+				w->writeCancelling = cancelUring(w, TAG_WRITE);
+			}
+			if((w->armed && !w->cancelling) || (w->writeArmed && !w->writeCancelling))
+			{
+				pthread_mutex_lock(&m_mutex);
+				m_removed.push_back(w);	//queue full, next time.
+				pthread_mutex_unlock(&m_mutex);
+			}
+		}
+		return ;
+	}
+#endif
+
+	for(unsigned int i=0; i<removed.size(); ++i)
+	{
+		freeWatch(removed[i]);
+	}
+}
+
+void EventLoop::freeWatch(Watch *watch)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_watches.erase(watch);
+	pthread_mutex_unlock(&m_mutex);
+	delete watch;
+}
+
+bool EventLoop::setupUring()
+{
+#if HAVE_URING
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_SUBMIT_ALL|IORING_SETUP_SINGLE_ISSUER|
+					IORING_SETUP_DEFER_TASKRUN|IORING_SETUP_CQSIZE;
+	params.cq_entries = URING_CQ_ENTRIES;
+	int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if(fd < 0)
+	{
+#if NETWORK_DETAIL
+		fprintf(stdout, "EventLoop(%p) io_uring_setup() error: %s\n", this, strerror(errno));
+#endif
+		return false;
+	}
+
+	Uring *u = new Uring;
+	memset(u, 0, sizeof(Uring));
+	u->fd = fd;
+	u->enterFd = fd;
+	m_uring = u;
+
+	u->sqRingSize = params.sq_off.array+params.sq_entries*sizeof(unsigned int);
+	u->cqRingSize = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if(u->cqRingSize > u->sqRingSize)
+		{
+			u->sqRingSize = u->cqRingSize;
+		}
+		u->cqRingSize = u->sqRingSize;
+	}
+	u->sqRing = mmap(NULL, u->sqRingSize, PROT_READ|PROT_WRITE,
+					MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if(u->sqRing == MAP_FAILED)
+	{
+		u->sqRing = NULL;
+		closeUring();
+		return false;
+	}
+	if(params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		u->cqRing = u->sqRing;
+	}
+	else
+	{
+		u->cqRing = mmap(NULL, u->cqRingSize, PROT_READ|PROT_WRITE,
+						MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if(u->cqRing == MAP_FAILED)
+		{
+			u->cqRing = NULL;
+			closeUring();
+			return false;
+		}
+	}
+	u->sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+	u->sqes = (struct io_uring_sqe *) mmap(NULL, u->sqesSize, PROT_READ|PROT_WRITE,
+										MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED)
+	{
+		u->sqes = NULL;
+		closeUring();
+		return false;
+	}
+
+	char *sq = (char *) u->sqRing;
+	u->sqHead = (unsigned int *) (sq+params.sq_off.head);
+	u->sqTail = (unsigned int *) (sq+params.sq_off.tail);
+	u->sqArray = (unsigned int *) (sq+params.sq_off.array);
+	u->sqMask = *(unsigned int *) (sq+params.sq_off.ring_mask);
+	u->sqEntries = *(unsigned int *) (sq+params.sq_off.ring_entries);
+	u->sqLocalTail = *(u->sqTail);
+	u->sqSubmitted = u->sqLocalTail;
+	char *cq = (char *) u->cqRing;
+	u->cqHead = (unsigned int *) (cq+params.cq_off.head);
+	u->cqTail = (unsigned int *) (cq+params.cq_off.tail);
+	u->cqMask = *(unsigned int *) (cq+params.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) (cq+params.cq_off.cqes);
+
+	//registered ring fd, io_uring_enter need not look up the fd each time.
+	struct io_uring_rsrc_update update;
+	memset(&update, 0, sizeof(update));
+	update.offset = (unsigned int) -1;
+	update.data = fd;
+	if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_RING_FDS, &update, 1) == 1)
+	{
+		u->enterFd = update.offset;
+		u->enterFlags = IORING_ENTER_REGISTERED_RING;
+	}
+
+	//buffers registered as a ring, kernel picks one for each recv.
+	u->bufRingSize = EVENT_LOOP_BUFFERS*sizeof(struct io_uring_buf);
+	void *bufRing = mmap(NULL, u->bufRingSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	void *buffers = mmap(NULL, (size_t) EVENT_LOOP_BUFFERS*EVENT_LOOP_BUFFER_SIZE,
+						PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	u->bufRing = bufRing==MAP_FAILED ? NULL : (struct io_uring_buf *) bufRing;
+	u->buffers = buffers==MAP_FAILED ? NULL : (char *) buffers;
+	if(u->bufRing==NULL || u->buffers==NULL)
+	{
+		closeUring();
+		return false;
+	}
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long) u->bufRing;
+	reg.ring_entries = EVENT_LOOP_BUFFERS;
+	reg.bgid = BUFFER_GROUP;
+	if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+	{
+#if NETWORK_DETAIL
+		fprintf(stdout, "EventLoop(%p) register buffer ring error: %s\n", this, strerror(errno));
+#endif
+		closeUring();
+		return false;
+	}
+	for(unsigned short bid=0; bid<EVENT_LOOP_BUFFERS; ++bid)
+	{
+		u->addBuffer(bid);
+	}
+	u->publishBuffers();
+
+	if(!armWake())
+	{
+		closeUring();
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void EventLoop::closeUring()
+{
+#if HAVE_URING
+	Uring *u = m_uring;
+	if(u == NULL)
+	{
+		return ;
+	}
+	close(u->fd);
+	if(u->buffers)
+	{
+		munmap(u->buffers, (size_t) EVENT_LOOP_BUFFERS*EVENT_LOOP_BUFFER_SIZE);
+	}
+	if(u->bufRing)
+	{
+		munmap(u->bufRing, u->bufRingSize);
+	}
+	if(u->sqes)
+	{
+		munmap(u->sqes, u->sqesSize);
+	}
+	if(u->cqRing && u->cqRing!=u->sqRing)
+	{
+		munmap(u->cqRing, u->cqRingSize);
+	}
+	if(u->sqRing)
+	{
+		munmap(u->sqRing, u->sqRingSize);
+	}
+	delete u;
+	m_uring = NULL;
+#endif
+}
+
+void EventLoop::runUring()
+{
+#if HAVE_URING
+	while(m_running)
+	{
+		takeCommands();
+		if(!m_uring->wakeArmed)
+		{
+			armWake();
+		}
+
+		//submit all and wait, one system call each batch.
+		int result = m_uring->submit(1);
+		if(result<0 && result!=-EINTR && result!=-EBUSY && result!=-EAGAIN)
+		{
+			fprintf(stderr, "EventLoop(%p) io_uring_enter() error: %s\n", this, strerror(-result));
+			break;
+		}
+		reapUring();
+	}
+#endif
+}
+
+bool EventLoop::armUring(Watch *watch)
+{
+#if HAVE_URING
+	struct io_uring_sqe *sqe = m_uring->getSqe();
+	if(sqe == NULL)
+	{
+		return false;
+	}
+	sqe->fd = watch->sockfd;
+	sqe->user_data = (unsigned long long) watch|TAG_WATCH;
+	if(watch->type == WATCH_READ)
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = BUFFER_GROUP;
+	}
+	else if(watch->type == WATCH_ACCEPT)
+	{
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	}
+	else
+	{
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+	}
+	watch->armed = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool EventLoop::armWritable(Watch *watch)
+{
+#if HAVE_URING
+	struct io_uring_sqe *sqe = m_uring->getSqe();
+	if(sqe == NULL)
+	{
+		return false;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = watch->sockfd;
+	sqe->poll32_events = POLLOUT;	//one shot.
+	sqe->user_data = (unsigned long long) watch|TAG_WRITE;
+	watch->writeArmed = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool EventLoop::cancelUring(Watch *watch, unsigned long long tag)
+{
+#if HAVE_URING
+	struct io_uring_sqe *sqe = m_uring->getSqe();
+	if(sqe == NULL)
+	{
+		return false;
+	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (unsigned long long) watch|tag;
+	sqe->user_data = TAG_CANCEL;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool EventLoop::armWake()
+{
+#if HAVE_URING
+	struct io_uring_sqe *sqe = m_uring->getSqe();
+	if(sqe == NULL)
+	{
+		return false;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = m_wakefd;
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = TAG_WAKE;
+	m_uring->wakeArmed = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void EventLoop::reapUring()
+{
+#if HAVE_URING
+	Uring *u = m_uring;
+	std::vector<Watch *> dead;
+	bool recycled = false;
+	unsigned int head = *(u->cqHead);
+	unsigned int tail = __atomic_load_n(u->cqTail, __ATOMIC_ACQUIRE);
+	for(; head!=tail; ++head)
+	{
+		struct io_uring_cqe *cqe = u->cqes+(head&u->cqMask);
+		unsigned long long tag = cqe->user_data&TAG_MASK;
+		bool more = cqe->flags&IORING_CQE_F_MORE;
+		if(tag == TAG_WAKE)
+		{
+			unsigned long long value;
+			if(read(m_wakefd, &value, sizeof(value)) < 0)
+			{
+				//waked by other.
+			}
+			if(!more)
+			{
+				u->wakeArmed = false;
+			}
+			continue;
+		}
+		if(tag == TAG_WRITE)
+		{
+			Watch *w = (Watch *) (cqe->user_data&~TAG_MASK);
+			w->writeArmed = false;
+			w->writeCancelling = false;
+			if(w->dropped)
+			{
+				if(!w->armed)
+				{
+					dead.push_back(w);
+				}
+				continue;
+			}
+			if(cqe->res != -ECANCELED)
+			{
+				pthread_mutex_lock(&m_mutex);
+				w->wantWrite = false;
+				pthread_mutex_unlock(&m_mutex);
+				w->canWrite = true;
+				if(!w->busy)
+				{
+					w->busy = true;
+					m_busy.push_back(w);
+				}
+			}
+			continue;
+		}
+		if(tag != TAG_WATCH)
+		{
+			continue;	//result of cancel.
+		}
+
+		Watch *w = (Watch *) (cqe->user_data&~TAG_MASK);
+		int res = cqe->res;
+		if(w->type == WATCH_READ)
+		{
+			if(cqe->flags & IORING_CQE_F_BUFFER)
+			{
+				unsigned short bid = cqe->flags>>IORING_CQE_BUFFER_SHIFT;
+				if(res > 0)
+				{
+					w->pending.append(u->buffers+(unsigned long) bid*EVENT_LOOP_BUFFER_SIZE, res);
+				}
+				u->addBuffer(bid);
+				recycled = true;
+			}
+			if(res==0 || (res<0 && res!=-ENOBUFS && res!=-ECANCELED))
+			{
+				w->closed = true;
+				w->eof = (res == 0);
+			}
+			if((w->pending.size() || w->closed) && !w->busy)
+			{
+				w->busy = true;
+				m_busy.push_back(w);
+			}
+		}
+		else if(w->type == WATCH_ACCEPT)
+		{
+			if(res >= 0)
+			{
+				if(enter(w))
+				{
+					w->accept(w->owner, res);
+					leave();
+				}
+				else
+				{
+					close(res);
+				}
+			}
+		}
+		else if(res != -ECANCELED)
+		{
+			if(res < 0)
+			{
+				w->closed = true;	//owner's recv gets the error.
+			}
+			w->readable = true;
+			if(!w->busy)
+			{
+				w->busy = true;
+				m_busy.push_back(w);
+			}
+		}
+
+		if(!more)
+		{
+			//multishot ended: eof, error, no buffer or cancelled.
+			w->armed = false;
+			if(w->dropped)
+			{
+				if(!w->writeArmed)
+				{
+					dead.push_back(w);
+				}
+			}
+			else
+			{
+				w->cancelling = false;	//by pause, a later pause cancels again.
+				if(!w->closed)
+				{
+					m_rearm.push_back(w);	//skipped while paused.
+				}
+			}
+		}
+	}
+	__atomic_store_n(u->cqHead, tail, __ATOMIC_RELEASE);
+	if(recycled)
+	{
+		u->publishBuffers();
+	}
+
+	dispatch();
+	for(unsigned int i=0; i<dead.size(); ++i)
+	{
+		freeWatch(dead[i]);
+	}
+#endif
+}
+
+bool EventLoop::setupEpoll()
+{
+	m_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(m_epfd < 0)
+	{
+		fprintf(stderr, "EventLoop(%p) epoll_create1() error: %s\n", this, strerror(errno));
+		return false;
+	}
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;	//wake fd.
+	if(epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakefd, &event) != 0)
+	{
+		closeEpoll();
+		return false;
+	}
+	m_buffer = new char[EVENT_LOOP_BUFFER_SIZE];
+	return true;
+}
+
+void EventLoop::closeEpoll()
+{
+	pthread_mutex_lock(&m_mutex);
+	if(m_epfd >= 0)
+	{
+		close(m_epfd);
+		m_epfd = -1;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	delete[] m_buffer;
+	m_buffer = NULL;
+}
+
+void EventLoop::runEpoll()
+{
+	struct epoll_event events[EPOLL_EVENTS];
+	while(m_running)
+	{
+		takeCommands();
+		int count = epoll_wait(m_epfd, events, EPOLL_EVENTS, -1);
+		if(count < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			fprintf(stderr, "EventLoop(%p) epoll_wait() error: %s\n", this, strerror(errno));
+			break;
+		}
+		for(int i=0; i<count; ++i)
+		{
+			Watch *w = (Watch *) events[i].data.ptr;
+			if(w == NULL)
+			{
+				unsigned long long value;
+				if(read(m_wakefd, &value, sizeof(value)) < 0)
+				{
+					//waked by other.
+				}
+				continue;
+			}
+			if(w->unwatched)
+			{
+				continue;
+			}
+			if((events[i].events&(EPOLLOUT|EPOLLERR|EPOLLHUP)) && w->wantWrite)
+			{
+				pthread_mutex_lock(&m_mutex);
+				w->wantWrite = false;
+				updateEpoll(w);
+				pthread_mutex_unlock(&m_mutex);
+				w->canWrite = true;
+				if(!w->busy)
+				{
+					w->busy = true;
+					m_busy.push_back(w);
+				}
+			}
+			if(w->paused || w->closed || !(events[i].events&(EPOLLIN|EPOLLERR|EPOLLHUP)))
+			{
+				continue;	//paused by a call back of this batch, or only writable.
+			}
+			if(w->type == WATCH_READ)
+			{
+				readEpoll(w);
+			}
+			else if(w->type == WATCH_ACCEPT)
+			{
+				int sockfd;
+				while((sockfd=accept(w->sockfd, NULL, NULL)) >= 0)
+				{
+					if(enter(w))
+					{
+						w->accept(w->owner, sockfd);
+						leave();
+					}
+					else
+					{
+						close(sockfd);
+						break;
+					}
+				}
+			}
+			else if(!w->busy)
+			{
+				w->readable = true;
+				w->busy = true;
+				m_busy.push_back(w);
+			}
+		}
+		dispatch();
+	}
+}
+
+void EventLoop::readEpoll(Watch *watch)
+{
+	unsigned int total = 0;
+	while(total < EVENT_LOOP_ONCE_READ)
+	{
+		ssize_t size = recv(watch->sockfd, m_buffer, EVENT_LOOP_BUFFER_SIZE, MSG_DONTWAIT);
+		if(size > 0)
+		{
+			watch->pending.append(m_buffer, size);
+			total += size;
+			if(size < EVENT_LOOP_BUFFER_SIZE)
+			{
+				break;	//most likely drained, level triggered wakes again if not.
+			}
+			continue;
+		}
+		if(size<0 && errno==EINTR)
+		{
+			continue;
+		}
+		if(size<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+		{
+			break;
+		}
+		pthread_mutex_lock(&m_mutex);
+		watch->closed = true;	//with lock, pause() never adds it again.
+		watch->eof = (size == 0);
+		updateEpoll(watch);	//eof stays readable, only writable is waited now.
+		pthread_mutex_unlock(&m_mutex);
+		break;
+	}
+	if((watch->pending.size() || watch->closed) && !watch->busy)
+	{
+		watch->busy = true;
+		m_busy.push_back(watch);
+	}
+}
+
+void EventLoop::updateEpoll(Watch *watch)
+{
+	unsigned int events = 0;
+	if(!watch->paused && !watch->closed)
+	{
+		events |= EPOLLIN;
+	}
+	if(watch->wantWrite)
+	{
+		events |= EPOLLOUT;
+	}
+	if(events==watch->events || m_epfd<0 || watch->unwatched)
+	{
+		return ;
+	}
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = events;
+	event.data.ptr = watch;
+	int op = watch->events==0 ? EPOLL_CTL_ADD : (events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL);
+	epoll_ctl(m_epfd, op, watch->sockfd, &event);
+	watch->events = events;
+}
+
+#endif	//_WIN32
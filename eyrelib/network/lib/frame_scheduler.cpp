@@ -0,0 +1,489 @@
+/*
+ * Class FrameScheduler queue frames by stream and write them with
+ * deficit round-robin in a subthread, gathering ready frames into one send.
+ * Sources are paused by water marks after push, resumed after pick.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 22:20.
+ */
+
+#include "frame_scheduler.h"
+#include "debug_settings.h"
+#include "timer_wheel.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+//absolute time usec later, for pthread_cond_timedwait.
+static void deadlineAfter(struct timespec &deadline, unsigned int usec)
+{
+#ifdef _WIN32
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	unsigned long long now = ((((unsigned long long) ft.dwHighDateTime)<<32)|ft.dwLowDateTime)/10
+		-11644473600000000ULL;	//100ns since 1601 to usec since 1970.
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	unsigned long long now = (unsigned long long) tv.tv_sec*1000000+tv.tv_usec;
+#endif
+	now += usec;
+	deadline.tv_sec = now/1000000;
+	deadline.tv_nsec = (now%1000000)*1000;
+}
+
+void *FrameScheduler::Thread::writeThread(void *s)
+{
+	FrameScheduler *scheduler = (FrameScheduler *) s;
+	ByteArray frame;
+	unsigned long long stamp;
+	String stream;
+	std::vector<ByteArray> batch;
+	std::vector<unsigned long long> stamps;
+	std::vector<String> streams;
+
+	pthread_mutex_lock(&(scheduler->m_mutex));
+	while(scheduler->m_running)
+	{
+		if(!(scheduler->m_target) || scheduler->m_target==scheduler->m_failed ||
+			!(scheduler->pick(frame, stamp, stream)))
+		{
+			pthread_cond_wait(&(scheduler->m_cond), &(scheduler->m_mutex));
+			continue;
+		}
+		TcpSocket *target = scheduler->m_target;
+
+		//gather ready frames, wait coalesceDelay once if not full.
+		batch.clear();
+		batch.push_back(frame);
+		stamps.clear();
+		stamps.push_back(stamp);
+		streams.clear();
+		streams.push_back(stream);
+		unsigned int batchSize = frame.size();
+		bool waited = (scheduler->m_coalesceDelay == 0);
+		while(batchSize < scheduler->m_maxBatch)
+		{
+			if(scheduler->pick(frame, stamp, stream))
+			{
+				batch.push_back(frame);
+				stamps.push_back(stamp);
+				streams.push_back(stream);
+				batchSize += frame.size();
+			}
+			else if(!waited)
+			{
+				struct timespec deadline;
+				deadlineAfter(deadline, scheduler->m_coalesceDelay);
+				pthread_cond_timedwait(&(scheduler->m_cond), &(scheduler->m_mutex), &deadline);
+				waited = true;
+				if(scheduler->m_target != target)
+				{
+					break;
+				}
+			}
+			else
+			{
+				break;
+			}
+		}
+		if(scheduler->m_target != target)
+		{
+			scheduler->unpick(batch, stamps, streams);	//target changed while waiting, frames go to the new one.
+			continue;
+		}
+		scheduler->m_writing = true;
+		StatHistogram *latency = scheduler->m_latency;
+		pthread_mutex_unlock(&(scheduler->m_mutex));
+
+		bool written = target->write(batch);
+		if(!written)
+		{
+#if NETWORK_DETAIL
+			fprintf(stderr, "FrameScheduler(%p) write to %p fail.\n", scheduler, target);
+#endif
+		}
+		else if(latency)
+		{
+			unsigned long long now = TimerWheel::nowUsec();
+			for(unsigned int i=0; i<stamps.size(); ++i)
+			{
+				if(stamps[i])
+				{
+					latency->record(now>stamps[i] ? now-stamps[i] : 0);
+				}
+			}
+		}
+
+		pthread_mutex_lock(&(scheduler->m_mutex));
+		if(written)
+		{
+			scheduler->m_writtenFrames += batch.size();
+			scheduler->m_writtenBytes += batchSize;
+			++(scheduler->m_writes);
+		}
+		else
+		{
+			scheduler->unpick(batch, stamps, streams);
+			if(scheduler->m_target == target)
+			{
+				scheduler->m_failed = target;
+			}
+		}
+		scheduler->m_writing = false;
+		pthread_cond_broadcast(&(scheduler->m_cond));
+	}
+	pthread_mutex_unlock(&(scheduler->m_mutex));
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "FrameScheduler(%p) write thread quit.\n", scheduler);
+#endif
+	return NULL;
+}
+
+FrameScheduler::FrameScheduler(unsigned int quantum)
+{
+	m_quantum = quantum ? quantum : FRAME_SCHEDULER_QUANTUM;
+	m_maxBatch = FRAME_SCHEDULER_MAX_BATCH;
+	m_coalesceDelay = 0;
+	m_target = NULL;
+	m_failed = NULL;
+	m_writing = false;
+	m_running = true;
+	m_pendingBytes = 0;
+	m_writtenFrames = 0;
+	m_writtenBytes = 0;
+	m_writes = 0;
+	m_latency = NULL;
+	m_streamHigh = 0;
+	m_streamLow = 0;
+	m_high = 0;
+	m_low = 0;
+	m_over = false;
+	m_sourcePauses = 0;
+
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+
+	if(pthread_create(&m_writeThread, NULL, FrameScheduler::Thread::writeThread, this) != 0)
+	{
+		m_running = false;
+		fprintf(stderr, "FrameScheduler(%p) can not create thread!\n", this);
+	}
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "FrameScheduler(%p) created.\n", this);
+#endif
+}
+
+FrameScheduler::~FrameScheduler()
+{
+	pthread_mutex_lock(&m_mutex);
+	bool running = m_running;
+	m_running = false;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	if(running)
+	{
+		pthread_join(m_writeThread, NULL);
+	}
+
+	pthread_mutex_destroy(&m_mutex);
+	pthread_cond_destroy(&m_cond);
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "FrameScheduler(%p) destroyed.\n", this);
+#endif
+}
+
+void FrameScheduler::setTarget(TcpSocket *target)
+{
+	pthread_mutex_lock(&m_mutex);
+	while(m_writing)
+	{
+		pthread_cond_wait(&m_cond, &m_mutex);
+	}
+	m_target = target;
+	m_failed = NULL;
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+TcpSocket *FrameScheduler::target() const
+{
+	return m_target;
+}
+
+void FrameScheduler::setQuantum(unsigned int quantum)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_quantum = quantum ? quantum : FRAME_SCHEDULER_QUANTUM;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+unsigned int FrameScheduler::quantum() const
+{
+	return m_quantum;
+}
+
+void FrameScheduler::setBatch(unsigned int maxBatch, unsigned int coalesceDelay)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_maxBatch = maxBatch ? maxBatch : FRAME_SCHEDULER_MAX_BATCH;
+	m_coalesceDelay = coalesceDelay;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool FrameScheduler::push(const String &stream, const ByteArray &frame, unsigned int weight,
+						unsigned long long stamp)
+{
+	pthread_mutex_lock(&m_mutex);
+	std::map<String, Stream>::iterator it = m_streams.find(stream);
+	if(it == m_streams.end())
+	{
+		Stream s;
+		s.bytes = 0;
+		s.deficit = 0;
+		s.inTurn = false;
+		it = m_streams.insert(std::pair<String, Stream>(stream, s)).first;
+		m_active.push_back(stream);
+	}
+	it->second.weight = weight ? weight : 1;
+	Frame f = {frame, stamp};
+	it->second.frames.push_back(f);
+	it->second.bytes += frame.size();
+	m_pendingBytes += frame.size();
+	pressureAll();
+	pressure(stream);
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	return true;
+}
+
+bool FrameScheduler::pushControl(const ByteArray &frame)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_control.push_back(frame);
+	m_pendingBytes += frame.size();
+	pressureAll();
+	pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	return true;
+}
+
+void FrameScheduler::clear()
+{
+	pthread_mutex_lock(&m_mutex);
+	m_streams.clear();
+	m_active.clear();
+	m_control.clear();
+	m_pendingBytes = 0;
+	m_over = false;
+	for(std::map<String, Source>::iterator it = m_sources.begin(); it != m_sources.end(); ++it)
+	{
+		pressure(it->first);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void FrameScheduler::setSource(const String &stream, TcpSocket *source)
+{
+	pthread_mutex_lock(&m_mutex);
+	if(source)
+	{
+		Source s = {source, false};
+		m_sources[stream] = s;
+		pressure(stream);
+	}
+	else
+	{
+		m_sources.erase(stream);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void FrameScheduler::setWaterMarks(unsigned long long streamHigh, unsigned long long streamLow,
+								unsigned long long high, unsigned long long low)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_streamHigh = streamHigh;
+	m_streamLow = streamLow<streamHigh ? streamLow : streamHigh;
+	m_high = high;
+	m_low = low<high ? low : high;
+	m_over = (m_high && m_pendingBytes>m_high);
+	for(std::map<String, Source>::iterator it = m_sources.begin(); it != m_sources.end(); ++it)
+	{
+		pressure(it->first);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+unsigned long long FrameScheduler::sourcePauses() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_sourcePauses;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+unsigned long long FrameScheduler::pendingBytes() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_pendingBytes;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+void FrameScheduler::setLatency(StatHistogram *latency)
+{
+	pthread_mutex_lock(&m_mutex);
+	m_latency = latency;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void FrameScheduler::written(unsigned long long &frames, unsigned long long &bytes,
+							unsigned long long &writes) const
+{
+	pthread_mutex_lock(&m_mutex);
+	frames = m_writtenFrames;
+	bytes = m_writtenBytes;
+	writes = m_writes;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+unsigned int FrameScheduler::activeStreams() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned int result = m_active.size();
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+bool FrameScheduler::pick(ByteArray &frame, unsigned long long &stamp, String &stream)
+{
+	if(!m_control.empty())
+	{
+		frame = m_control.front();
+		stamp = 0;
+		stream = "";
+		m_control.pop_front();
+		m_pendingBytes -= frame.size();
+		return true;
+	}
+
+	while(!m_active.empty())
+	{
+		std::map<String, Stream>::iterator it = m_streams.find(m_active.front());
+		Stream &s = it->second;
+		if(!s.inTurn)
+		{
+			s.deficit += (unsigned long long) m_quantum*s.weight;
+			s.inTurn = true;
+		}
+		if(s.frames.front().data.size() <= s.deficit)
+		{
+			frame = s.frames.front().data;
+			stamp = s.frames.front().stamp;
+			s.frames.pop_front();
+			s.bytes -= frame.size();
+			s.deficit -= frame.size();
+			m_pendingBytes -= frame.size();
+			stream = m_active.front();
+			if(s.frames.empty())
+			{
+				m_streams.erase(it);
+				m_active.pop_front();
+			}
+			pressureAll();
+			pressure(stream);
+			return true;
+		}
+		// this stream used up its quantum, next round.
+		s.inTurn = false;
+		m_active.push_back(m_active.front());
+		m_active.pop_front();
+	}
+	return false;
+}
+
+void FrameScheduler::pressure(const String &stream)
+{
+	std::map<String, Source>::iterator it = m_sources.find(stream);
+	if(it == m_sources.end())
+	{
+		return;
+	}
+	Source &source = it->second;
+	bool paused = m_over;
+	if(!paused && m_streamHigh)
+	{
+		std::map<String, Stream>::iterator s = m_streams.find(stream);
+		unsigned long long bytes = (s!=m_streams.end() ? s->second.bytes : 0);
+		paused = (bytes > (source.paused ? m_streamLow : m_streamHigh));
+	}
+	if(paused != source.paused)
+	{
+		source.paused = paused;
+		source.socket->setReadPaused(paused, TCP_SOCKET_PAUSE_BACKLOG);
+		if(paused)
+		{
+			++m_sourcePauses;
+		}
+	}
+}
+
+void FrameScheduler::pressureAll()
+{
+	bool over = (m_high && m_pendingBytes>(m_over ? m_low : m_high));
+	if(over == m_over)
+	{
+		return;
+	}
+	m_over = over;
+	for(std::map<String, Source>::iterator it = m_sources.begin(); it != m_sources.end(); ++it)
+	{
+		pressure(it->first);
+	}
+}
+
+void FrameScheduler::unpick(const std::vector<ByteArray> &frames, const std::vector<unsigned long long> &stamps,
+							const std::vector<String> &streams)
+{
+	for(unsigned int i=frames.size(); i>0; --i)
+	{
+		const ByteArray &frame = frames[i-1];
+		m_pendingBytes += frame.size();
+		if(streams[i-1].size() == 0)
+		{
+			m_control.push_front(frame);
+			continue;
+		}
+		std::map<String, Stream>::iterator it = m_streams.find(streams[i-1]);
+		if(it == m_streams.end())
+		{
+			Stream s;
+			s.weight = 1;	//set again by next push of it.
+			s.bytes = 0;
+			s.deficit = 0;
+			s.inTurn = false;
+			it = m_streams.insert(std::pair<String, Stream>(streams[i-1], s)).first;
+			m_active.push_front(streams[i-1]);
+		}
+		Frame f = {frame, stamps[i-1]};
+		it->second.frames.push_front(f);
+		it->second.bytes += frame.size();
+	}
+	pressureAll();
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		if(streams[i].size())
+		{
+			pressure(streams[i]);
+		}
+	}
+}
@@ -0,0 +1,265 @@
+/*
+ * Class Resolver, cached getaddrinfo refreshed by a subthread.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 20:05.
+ */
+
+#include "resolver.h"
+#include "debug_settings.h"
+#include "timer_wheel.h"
+
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+void *Resolver::Thread::refreshThread(void *s)
+{
+	Resolver *resolver = (Resolver *) s;
+	pthread_mutex_lock(&(resolver->m_mutex));
+	while(!resolver->m_quit)
+	{
+		if(resolver->m_pending.empty())
+		{
+			pthread_cond_wait(&(resolver->m_cond), &(resolver->m_mutex));
+			continue;
+		}
+		String host = resolver->m_pending.back();
+		resolver->m_pending.pop_back();
+		pthread_mutex_unlock(&(resolver->m_mutex));
+		resolver->refresh(host);
+		pthread_mutex_lock(&(resolver->m_mutex));
+	}
+	pthread_mutex_unlock(&(resolver->m_mutex));
+	return NULL;
+}
+
+Resolver::Resolver(unsigned int ttl, int family)
+{
+	m_ttl = ttl;
+	m_family = family;
+	m_hits = 0;
+	m_misses = 0;
+	m_refreshes = 0;
+	m_failures = 0;
+	m_quit = false;
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	m_hasThread = pthread_create(&m_thread, NULL, Resolver::Thread::refreshThread, this) == 0;
+	if(!m_hasThread)
+	{
+		fprintf(stderr, "Resolver(%p) can not create thread, refresh in caller!\n", this);
+	}
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "Resolver(%p) created.\n", this);
+#endif
+}
+
+Resolver::~Resolver()
+{
+	if(m_hasThread)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_quit = true;
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+		pthread_join(m_thread, NULL);	//waits a lookup running.
+	}
+	pthread_mutex_destroy(&m_mutex);
+	pthread_cond_destroy(&m_cond);
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "Resolver(%p) destroyed.\n", this);
+#endif
+}
+
+bool Resolver::resolve(const String &host, unsigned short port, SocketAddress &addr)
+{
+	unsigned long long now = TimerWheel::now();
+	pthread_mutex_lock(&m_mutex);
+	std::map<String, Entry>::iterator it = m_entries.find(host);
+	if(it == m_entries.end())
+	{
+		++m_misses;
+		pthread_mutex_unlock(&m_mutex);
+
+		std::vector<SocketAddress> addrs;
+		bool found = lookup(host, m_family, addrs);
+
+		pthread_mutex_lock(&m_mutex);
+		if(!found)
+		{
+			++m_failures;
+			pthread_mutex_unlock(&m_mutex);
+			return false;
+		}
+		Entry &entry = m_entries[host];	//other caller may add it meanwhile, value inited.
+		entry.addrs = addrs;
+		entry.expire = now+m_ttl*1000ULL;
+		it = m_entries.find(host);
+	}
+	else
+	{
+		++m_hits;
+		Entry &entry = it->second;
+		if(entry.expire<=now && !entry.refreshing)
+		{
+			entry.refreshing = true;
+			if(m_hasThread)
+			{
+				m_pending.push_back(host);
+				pthread_cond_signal(&m_cond);
+			}
+			else
+			{
+				pthread_mutex_unlock(&m_mutex);
+				refresh(host);
+				pthread_mutex_lock(&m_mutex);
+				it = m_entries.find(host);
+			}
+		}
+	}
+	Entry &entry = it->second;
+	addr = entry.addrs[entry.next++%entry.addrs.size()];
+	pthread_mutex_unlock(&m_mutex);
+	addr.setPort(port);
+	return true;
+}
+
+void Resolver::refresh(const String &host)
+{
+	std::vector<SocketAddress> addrs;
+	bool found = lookup(host, m_family, addrs);
+	unsigned long long now = TimerWheel::now();
+
+	pthread_mutex_lock(&m_mutex);
+	Entry &entry = m_entries[host];
+	++m_refreshes;
+	if(found)
+	{
+		entry.addrs = addrs;	//next goes on, wraps by size.
+		entry.expire = now+m_ttl*1000ULL;
+	}
+	else
+	{
+		++m_failures;
+		entry.expire = now+RESOLVER_RETRY*1000ULL;	//keep old ones meanwhile.
+	}
+	entry.refreshing = false;
+	pthread_mutex_unlock(&m_mutex);
+
+#if NETWORK_DETAIL
+	fprintf(stdout, "Resolver(%p) refresh %s: %u addresses.\n", this, (const char *) host, (unsigned int) addrs.size());
+#endif
+}
+
+std::vector<SocketAddress> Resolver::addresses(const String &host) const
+{
+	std::vector<SocketAddress> result;
+	pthread_mutex_lock(&m_mutex);
+	std::map<String, Entry>::const_iterator it = m_entries.find(host);
+	if(it != m_entries.end())
+	{
+		result = it->second.addrs;
+	}
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+unsigned long long Resolver::hits() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_hits;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+unsigned long long Resolver::misses() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_misses;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+unsigned long long Resolver::refreshes() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_refreshes;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+unsigned long long Resolver::failures() const
+{
+	pthread_mutex_lock(&m_mutex);
+	unsigned long long result = m_failures;
+	pthread_mutex_unlock(&m_mutex);
+	return result;
+}
+
+int Resolver::familyFromName(const String &name)
+{
+	if(name == "ipv6")
+	{
+		return AF_INET6;
+	}
+	if(name == "any")
+	{
+		return AF_UNSPEC;
+	}
+	return AF_INET;
+}
+
+bool Resolver::lookup(const String &host, int family, std::vector<SocketAddress> &result)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = SocketAddress::familyOf(host, family);
+	hints.ai_socktype = SOCK_STREAM;	//one record per address.
+	if(getaddrinfo(host, NULL, &hints, &res) != 0)
+	{
+		return false;
+	}
+	bool v6First = res->ai_family == AF_INET6;	//the family getaddrinfo prefers.
+	std::vector<SocketAddress> v6, v4;
+	for(struct addrinfo *ai=res; ai; ai=ai->ai_next)
+	{
+		SocketAddress addr(ai->ai_addr, ai->ai_addrlen);
+		if(addr.family() == AF_INET6)
+		{
+			v6.push_back(addr);
+		}
+		else if(addr.family() == AF_INET)
+		{
+			v4.push_back(addr);
+		}
+	}
+	freeaddrinfo(res);
+
+	//families take turns, so a broken one fails every other connect, not all.
+	result.clear();
+	for(unsigned int i=0; i<v6.size() || i<v4.size(); ++i)
+	{
+		if(v6First && i<v6.size())
+		{
+			result.push_back(v6[i]);
+		}
+		if(i < v4.size())
+		{
+			result.push_back(v4[i]);
+		}
+		if(!v6First && i<v6.size())
+		{
+			result.push_back(v6[i]);
+		}
+	}
+	return !result.empty();
+}
@@ -0,0 +1,251 @@
+/*
+ * Class SocketAddress, binary IPv4 or IPv6 address of a socket.
+ *
+ * Author: Eyre Turing.
+ * Last edit: 2026-10-19 20:05.
+ */
+
+#include "socket_address.h"
+
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+
+#include <string.h>
+
+static const unsigned char v4MappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+SocketAddress::SocketAddress()
+{
+	memset(&m_addr, 0, sizeof(m_addr));
+	m_addr.sa.sa_family = AF_UNSPEC;
+	m_length = 0;
+}
+
+SocketAddress::SocketAddress(const struct sockaddr *addr, socklen_t length)
+{
+	memset(&m_addr, 0, sizeof(m_addr));
+	if(!addr || length>sizeof(m_addr) ||
+		(addr->sa_family!=AF_INET && addr->sa_family!=AF_INET6))
+	{
+		m_addr.sa.sa_family = AF_UNSPEC;
+		m_length = 0;
+		return;
+	}
+	memcpy(&m_addr, addr, length);
+	m_length = length;
+}
+
+SocketAddress::SocketAddress(int family, unsigned long addr, unsigned short port)
+{
+	memset(&m_addr, 0, sizeof(m_addr));
+	if(family == AF_INET6)
+	{
+		m_addr.v6.sin6_family = AF_INET6;
+		m_addr.v6.sin6_port = htons(port);
+		if(addr == INADDR_LOOPBACK)
+		{
+			m_addr.v6.sin6_addr.s6_addr[15] = 1;
+		}
+		else if(addr != INADDR_ANY)
+		{
+			unsigned long net = htonl(addr);
+			memcpy(m_addr.v6.sin6_addr.s6_addr, v4MappedPrefix, sizeof(v4MappedPrefix));
+			memcpy(m_addr.v6.sin6_addr.s6_addr+12, &net, 4);
+		}
+		m_length = sizeof(m_addr.v6);
+	}
+	else
+	{
+		m_addr.v4.sin_family = AF_INET;
+		m_addr.v4.sin_port = htons(port);
+		m_addr.v4.sin_addr.s_addr = htonl(addr);
+		m_length = sizeof(m_addr.v4);
+	}
+}
+
+SocketAddress SocketAddress::fromIp(const char *ip, unsigned short port)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_flags = AI_NUMERICHOST;
+	if(!ip || getaddrinfo(ip, NULL, &hints, &res)!=0)
+	{
+		return SocketAddress();
+	}
+	SocketAddress result(res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	result.setPort(port);
+	return result;
+}
+
+SocketAddress SocketAddress::peerOf(int sockfd)
+{
+	SocketAddress result;
+#ifdef _WIN32
+	int length = capacity();
+#else
+	socklen_t length = capacity();
+#endif
+	if(getpeername(sockfd, result.addr(), &length) == 0)
+	{
+		result.setLength(length);
+	}
+	return result;
+}
+
+int SocketAddress::familyOf(const char *host, int family)
+{
+	SocketAddress numeric = fromIp(host, 0);
+	return numeric.isValid() ? numeric.family() : family;
+}
+
+bool SocketAddress::isValid() const
+{
+	return m_length != 0;
+}
+
+int SocketAddress::family() const
+{
+	return m_length ? m_addr.sa.sa_family : AF_UNSPEC;
+}
+
+unsigned short SocketAddress::port() const
+{
+	switch(family())
+	{
+	case AF_INET:
+		return ntohs(m_addr.v4.sin_port);
+	case AF_INET6:
+		return ntohs(m_addr.v6.sin6_port);
+	default:
+		return 0;
+	}
+}
+
+void SocketAddress::setPort(unsigned short port)
+{
+	if(family() == AF_INET6)
+	{
+		m_addr.v6.sin6_port = htons(port);
+	}
+	else if(family() == AF_INET)
+	{
+		m_addr.v4.sin_port = htons(port);
+	}
+}
+
+bool SocketAddress::isV4Mapped() const
+{
+	return family()==AF_INET6 &&
+		memcmp(m_addr.v6.sin6_addr.s6_addr, v4MappedPrefix, sizeof(v4MappedPrefix))==0;
+}
+
+const struct sockaddr *SocketAddress::addr() const
+{
+	return &m_addr.sa;
+}
+
+socklen_t SocketAddress::length() const
+{
+	return m_length;
+}
+
+struct sockaddr *SocketAddress::addr()
+{
+	return &m_addr.sa;
+}
+
+socklen_t SocketAddress::capacity()
+{
+	return sizeof(((SocketAddress *) 0)->m_addr);
+}
+
+void SocketAddress::setLength(socklen_t length)
+{
+	if(length>capacity() || (m_addr.sa.sa_family!=AF_INET && m_addr.sa.sa_family!=AF_INET6))
+	{
+		length = 0;
+	}
+	m_length = length;
+}
+
+String SocketAddress::ip() const
+{
+	char host[NI_MAXHOST];
+	if(isV4Mapped())
+	{
+		struct sockaddr_in v4;
+		memset(&v4, 0, sizeof(v4));
+		v4.sin_family = AF_INET;
+		memcpy(&v4.sin_addr, m_addr.v6.sin6_addr.s6_addr+12, 4);
+		if(getnameinfo((const struct sockaddr *) &v4, sizeof(v4), host, sizeof(host), NULL, 0, NI_NUMERICHOST) != 0)
+		{
+			return "";
+		}
+		return String(host, CODEC_UTF8);
+	}
+	if(!isValid() || getnameinfo(addr(), m_length, host, sizeof(host), NULL, 0, NI_NUMERICHOST)!=0)
+	{
+		return "";
+	}
+	return String(host, CODEC_UTF8);
+}
+
+String SocketAddress::toString() const
+{
+	if(!isValid())
+	{
+		return "";
+	}
+	if(family()==AF_INET6 && !isV4Mapped())
+	{
+		return "["+ip()+"]:"+String::fromNumber((unsigned int) port());
+	}
+	return ip()+":"+String::fromNumber((unsigned int) port());
+}
+
+int SocketAddress::compare(const SocketAddress &other) const
+{
+	if(family() != other.family())
+	{
+		return family()<other.family() ? -1 : 1;
+	}
+	if(port() != other.port())
+	{
+		return port()<other.port() ? -1 : 1;
+	}
+	switch(family())
+	{
+	case AF_INET:
+		return memcmp(&m_addr.v4.sin_addr, &other.m_addr.v4.sin_addr, sizeof(m_addr.v4.sin_addr));
+	case AF_INET6:
+	{
+		int result = memcmp(&m_addr.v6.sin6_addr, &other.m_addr.v6.sin6_addr, sizeof(m_addr.v6.sin6_addr));
+		if(result == 0 && m_addr.v6.sin6_scope_id != other.m_addr.v6.sin6_scope_id)
+		{
+			result = m_addr.v6.sin6_scope_id<other.m_addr.v6.sin6_scope_id ? -1 : 1;
+		}
+		return result;
+	}
+	default:
+		return 0;
+	}
+}
+
+bool SocketAddress::operator==(const SocketAddress &other) const
+{
+	return compare(other) == 0;
+}
+
+bool SocketAddress::operator!=(const SocketAddress &other) const
+{
+	return compare(other) != 0;
+}
+
+bool SocketAddress::operator<(const SocketAddress &other) const
+{
+	return compare(other) < 0;
+}
@@ -1,9 +1,10 @@
 /*
  * Class TcpServer can start a tcp server.
  * The call back function `NewConnecting` will catch tcp client connect event.
+ * Call backs of a server and its clients are exec in one subthread.
  *
  * Author: Eyre Turing.
- * Last edit: 2021-10-09 17:47.
+ * Last edit: 2026-10-19 23:00.
  */
 
 #include "tcp_server.h"
@@ -11,7 +12,6 @@
 
 #ifndef _WIN32
 #include <netinet/in.h>
-#include <sys/ioctl.h>
 #include <unistd.h>
 #endif
 
@@ -19,8 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define READBUFFER_SIZE	1024
-
+#ifdef _WIN32
 void *TcpServer::Thread::selectThread(void *s)
 {
 	TcpServer *tcpServer = (TcpServer *) s;
@@ -28,15 +27,9 @@ void *TcpServer::Thread::selectThread(void *s)
 	fd_set &readfds = tcpServer->m_readfds;
 	fd_set testfds;
 	
-	struct sockaddr_in clientAddr;
+	SocketAddress clientAddr;
 	int clientSockfd, result, nread;
-#ifdef _WIN32
 	int clientLen;
-#else
-	unsigned int clientLen;
-#endif
-	
-	char readBuffer[READBUFFER_SIZE+1];
 	
 	tcpServer->m_runStatus = TCP_SERVER_RUNNING;
 
@@ -47,7 +40,6 @@ void *TcpServer::Thread::selectThread(void *s)
 	
 	while(tcpServer->m_runStatus == TCP_SERVER_RUNNING)
 	{
-#ifdef _WIN32
 		//remove each tcpServer->m_waitForRemoveSockfds.
 		pthread_mutex_lock(&(tcpServer->m_waitForRemoveSockfdsMutex));
 		while(!(tcpServer->m_waitForRemoveSockfds.empty()))
@@ -58,24 +50,16 @@ void *TcpServer::Thread::selectThread(void *s)
 			tcpServer->m_waitForRemoveSockfds.pop();
 		}
 		pthread_mutex_unlock(&(tcpServer->m_waitForRemoveSockfdsMutex));
-#endif
 		testfds = readfds;
 		
 #if NETWORK_DETAIL
 		fprintf(stdout, "server wait.\n");
 #endif
 
-#ifdef _WIN32
 		TIMEVAL timeout;
 		timeout.tv_sec = NETWORK_TIMEOUT;
 		timeout.tv_usec = 0;
 		result = select(0, &testfds, NULL, NULL, &timeout);
-#else
-		struct timeval timeout;
-		timeout.tv_sec = NETWORK_TIMEOUT;
-		timeout.tv_usec = 0;
-		result = select(FD_SETSIZE, &testfds, (fd_set *) 0, (fd_set *) 0, &timeout);
-#endif
 		if(result < 0)
 		{
 			perror("select");
@@ -95,29 +79,19 @@ void *TcpServer::Thread::selectThread(void *s)
 #endif
 		
 		pthread_mutex_lock(&(tcpServer->m_readfdsMutex));
-#ifdef _WIN32
 		for(int fd=0; fd<readfds.fd_count; ++fd)
-#else
-		for(int fd=0; fd<FD_SETSIZE; ++fd)
-#endif
 		{
-#ifdef _WIN32
 			SOCKET &curSockfd = readfds.fd_array[fd];
-#else
-			int &curSockfd = fd;
-#endif
 			if(FD_ISSET(curSockfd, &testfds))
 			{
 				//client connect.
 				if(curSockfd == tcpServer->m_sockfd)
 				{
-					clientLen = sizeof(clientAddr);
-					clientSockfd = accept(tcpServer->m_sockfd,
-										(struct sockaddr *) &clientAddr,
-										&clientLen);
-					
+					clientLen = SocketAddress::capacity();
+					clientSockfd = accept(tcpServer->m_sockfd, clientAddr.addr(), &clientLen);
+					clientAddr.setLength(clientLen);
 					
-					TcpSocket *tcpSocket = tcpServer->appendClient(clientSockfd);
+					TcpSocket *tcpSocket = tcpServer->appendClient(clientSockfd, clientAddr);
 					
 					if(tcpServer->m_onNewConnecting)
 					{
@@ -126,16 +100,11 @@ void *TcpServer::Thread::selectThread(void *s)
 				}
 				else	//client message.
 				{
-#ifdef _WIN32
 					std::map<SOCKET, TcpSocket *>::iterator it = tcpServer->m_clientMap.find(curSockfd);
-#else
-					std::map<int, TcpSocket *>::iterator it = tcpServer->m_clientMap.find(curSockfd);
-#endif
 
 					if(it != tcpServer->m_clientMap.end())
 					{
 						TcpSocket *tcpSocket = it->second;
-#ifdef _WIN32
 						char *recvBuffer = tcpSocket->recvBuffer;
 						//pthread_mutex_lock(&(tcpSocket->m_readWriteMutex)); 
 						nread = recv(it->first, recvBuffer, tcpSocket->recvBufferSize, 0);
@@ -148,52 +117,24 @@ void *TcpServer::Thread::selectThread(void *s)
 								tcpSocket->m_onRead(tcpSocket, ByteArray(recvBuffer, nread));
 							}
 						}
-						else
+						else if(nread==0 && tcpSocket->m_onReadClosed)
 						{
-							tcpServer->removeClient(curSockfd);
+							//eof stays readable, stop selecting it, writes go on.
+							FD_CLR(curSockfd, &readfds);
 							--fd;
-						}
-#else
-						//pthread_mutex_lock(&(tcpSocket->m_readWriteMutex));
-						ioctl(curSockfd, FIONREAD, &nread);
-						if(nread > 0)
-						{
-							ByteArray recvData;
-							while(nread > 0)
-							{
-								int recvSize = recv(curSockfd, readBuffer, READBUFFER_SIZE, 0);
-								recvData.append(readBuffer, recvSize);
-								nread -= recvSize;
-							}
-							//pthread_mutex_unlock(&(tcpSocket->m_readWriteMutex));
-							if(tcpSocket->m_onRead)
-							{
-								tcpSocket->m_onRead(tcpSocket, recvData);
-							}
+							tcpSocket->m_onReadClosed(tcpSocket);
 						}
 						else
 						{
-							//pthread_mutex_unlock(&(tcpSocket->m_readWriteMutex));
 							tcpServer->removeClient(curSockfd);
+							--fd;
 						}
-#endif
 					}
 					else
 					{
-						//nread = recv(curSockfd, readBuffer, READBUFFER_SIZE, 0);
-						
-						//if(nread <= 0)
-						//{
-#ifdef _WIN32
 						closesocket(curSockfd);
-#else
-						close(curSockfd);
-#endif
 						FD_CLR(curSockfd, &readfds);
-#ifdef _WIN32
 						--fd;
-#endif
-						//}
 					}
 				}
 			}
@@ -205,6 +146,18 @@ void *TcpServer::Thread::selectThread(void *s)
 	
 	return NULL;
 }
+#else
+void TcpServer::onLoopAccept(void *owner, int sockfd)
+{
+	TcpServer *tcpServer = (TcpServer *) owner;
+	//multishot accept gives no address, ask once here, never per use.
+	TcpSocket *tcpSocket = tcpServer->appendClient(sockfd, SocketAddress::peerOf(sockfd));
+	if(tcpServer->m_onNewConnecting)
+	{
+		tcpServer->m_onNewConnecting(tcpServer, tcpSocket);
+	}
+}
+#endif
 
 TcpServer::TcpServer()
 {
@@ -213,19 +166,22 @@ TcpServer::TcpServer()
 	m_onClosed = NULL;
 	m_runStatus = TCP_SERVER_CLOSED;
 	
+#ifdef _WIN32
 	FD_ZERO(&m_readfds);
 	
-#ifdef _WIN32
 	if(WSAStartup(MAKEWORD(1, 1), &m_wsadata) == SOCKET_ERROR)
 	{
 		fprintf(stderr, "TcpServer(%p) WSAStartup() fail!\n", this);
 	}
 	pthread_mutex_init(&m_waitForRemoveSockfdsMutex, NULL);
-#endif
 	pthread_mutex_init(&m_readfdsMutex, NULL);
-	pthread_mutex_init(&m_clientMapMutex, NULL);
 	pthread_mutex_init(&m_readfdsMutexInAppend, NULL);
 	pthread_mutex_init(&m_readfdsMutexInRemove, NULL);
+#else
+	m_loop = NULL;
+	m_watch = NULL;
+#endif
+	pthread_mutex_init(&m_clientMapMutex, NULL);
 	
 #if NETWORK_DETAIL
 	fprintf(stdout, "TcpServer(%p) created.\n", this);
@@ -238,11 +194,13 @@ TcpServer::~TcpServer()
 #ifdef _WIN32
 	WSACleanup();
 	pthread_mutex_destroy(&m_waitForRemoveSockfdsMutex);
-#endif
 	pthread_mutex_destroy(&m_readfdsMutex);
-	pthread_mutex_destroy(&m_clientMapMutex);
 	pthread_mutex_destroy(&m_readfdsMutexInAppend);
 	pthread_mutex_destroy(&m_readfdsMutexInRemove);
+#else
+	delete m_loop;
+#endif
+	pthread_mutex_destroy(&m_clientMapMutex);
 	
 #if NETWORK_DETAIL
 	fprintf(stdout, "TcpServer(%p) destroyed.\n", this);
@@ -250,9 +208,14 @@ TcpServer::~TcpServer()
 }
 
 int TcpServer::start(unsigned short port, int family, unsigned long addr, int backlog)
+{
+	return start(SocketAddress(family, addr, port), backlog);
+}
+
+int TcpServer::start(const SocketAddress &local, int backlog)
 {
 	abort();
-	if((m_sockfd=socket(family, SOCK_STREAM, 0)) < 0)
+	if((m_sockfd=socket(local.family(), SOCK_STREAM, 0)) < 0)
 	{
 		fprintf(stderr, "TcpServer(%p) socket() fail!\n", this);
 		return TCP_SERVER_SOCKETFD_ERROR;
@@ -262,16 +225,9 @@ int TcpServer::start(unsigned short port, int family, unsigned long addr, int ba
 	fprintf(stdout, "TcpServer(%p) m_sockfd created.\n", this);
 #endif 
 	
-	struct sockaddr_in serverAddr;
-	
-	memset(&serverAddr, 0, sizeof(serverAddr));
-	serverAddr.sin_family = family;
-	serverAddr.sin_addr.s_addr = htonl(addr);
-	serverAddr.sin_port = htons(port);
-
 	// 套接字关闭则立即解除端口占用
-	char reuseaddr = 1;
-	if (setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuseaddr, sizeof(reuseaddr)) < 0)
+	int reuseaddr = 1;
+	if (setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, (const char *) &reuseaddr, sizeof(reuseaddr)) < 0)
 	{
 #ifdef _WIN32
 		closesocket(m_sockfd);
@@ -282,7 +238,15 @@ int TcpServer::start(unsigned short port, int family, unsigned long addr, int ba
 		return TCP_SERVER_BIND_ERROR;
 	}
 	
-	if(bind(m_sockfd, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) != 0)
+	// dual-stack, not all systems default to it.
+	int v6only = 0;
+	if(local.family()==AF_INET6 &&
+		setsockopt(m_sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (const char *) &v6only, sizeof(v6only)) < 0)
+	{
+		fprintf(stderr, "TcpServer(%p) set dual-stack fail, IPv6 only.\n", this);
+	}
+	
+	if(bind(m_sockfd, local.addr(), local.length()) != 0)
 	{
 #ifdef _WIN32
 		closesocket(m_sockfd);
@@ -312,6 +276,7 @@ int TcpServer::start(unsigned short port, int family, unsigned long addr, int ba
 	fprintf(stdout, "TcpServer(%p) set listen.\n", this);
 #endif
 	
+#ifdef _WIN32
 	FD_ZERO(&m_readfds);
 	FD_SET(m_sockfd, &m_readfds);
 	
@@ -321,15 +286,34 @@ int TcpServer::start(unsigned short port, int family, unsigned long addr, int ba
 	
 	if(pthread_create(&m_listenThread, NULL, TcpServer::Thread::selectThread, this) != 0)
 	{
-#ifdef _WIN32
 		closesocket(m_sockfd);
+		fprintf(stderr, "TcpServer(%p) can not create thread!\n", this);
+		return TCP_SERVER_CREATETHREAD_ERROR;
+	}
 #else
+	if(m_loop == NULL)
+	{
+		m_loop = new EventLoop();
+		if(!m_loop->start())
+		{
+			delete m_loop;
+			m_loop = NULL;
+		}
+	}
+	if(m_loop==NULL || (m_watch=m_loop->watchAccept(m_sockfd, TcpServer::onLoopAccept, this))==NULL)
+	{
 		close(m_sockfd);
-#endif
-		fprintf(stderr, "TcpServer(%p) can not create thread!\n", this);
+		fprintf(stderr, "TcpServer(%p) can not start event loop!\n", this);
 		return TCP_SERVER_CREATETHREAD_ERROR;
 	}
 	
+	m_runStatus = TCP_SERVER_RUNNING;
+	if(m_onStartSucceed)
+	{
+		m_onStartSucceed(this);
+	}
+#endif
+	
 #if NETWORK_DETAIL
 	fprintf(stdout, "TcpServer(%p) started.\n", this);
 #endif
@@ -343,31 +327,40 @@ void TcpServer::abort()
 		return ;
 	}
 	m_runStatus = TCP_SERVER_CLOSED;
+#ifdef _WIN32
 	pthread_mutex_lock(&m_readfdsMutex);
 	pthread_mutex_lock(&m_clientMapMutex);
-#ifdef _WIN32
 	for(std::map<SOCKET, TcpSocket *>::iterator it=m_clientMap.begin();
-#else
-	for(std::map<int, TcpSocket *>::iterator it=m_clientMap.begin();
-#endif
 		it!=m_clientMap.end(); ++it)
 	{
-#ifdef _WIN32
 		closesocket(it->first);
-#else
-		close(it->first);
-#endif
 		delete it->second;
 	}
 	m_clientMap.erase(m_clientMap.begin(), m_clientMap.end());
 	pthread_mutex_unlock(&m_clientMapMutex);
 	FD_ZERO(&m_readfds);
-#ifdef _WIN32
 	closesocket(m_sockfd);
+	pthread_mutex_unlock(&m_readfdsMutex);
 #else
+	//loop thread is kept for next start(), only stops calling back.
+	m_loop->unwatch(m_watch);
+	m_watch = NULL;
+	std::map<int, TcpSocket *> clients;
+	pthread_mutex_lock(&m_clientMapMutex);
+	clients.swap(m_clientMap);
+	pthread_mutex_unlock(&m_clientMapMutex);
+	for(std::map<int, TcpSocket *>::iterator it=clients.begin(); it!=clients.end(); ++it)
+	{
+		m_loop->unwatch(it->second->m_watch);
+		close(it->first);
+	}
+	for(std::map<int, TcpSocket *>::iterator it=clients.begin(); it!=clients.end(); ++it)
+	{
+		m_loop->waitIdle(it->second);	//its call back may be running, out of m_clientMapMutex.
+		delete it->second;
+	}
 	close(m_sockfd);
 #endif
-	pthread_mutex_unlock(&m_readfdsMutex);
 	
 	if(m_onClosed)
 	{
@@ -380,14 +373,16 @@ void TcpServer::abort()
 }
 
 #ifdef _WIN32
-TcpSocket *TcpServer::appendClient(SOCKET clientSockfd)
+TcpSocket *TcpServer::appendClient(SOCKET clientSockfd, const SocketAddress &peer)
 #else
-TcpSocket *TcpServer::appendClient(int clientSockfd)
+TcpSocket *TcpServer::appendClient(int clientSockfd, const SocketAddress &peer)
 #endif
 {
+#ifdef _WIN32
 	pthread_mutex_lock(&m_readfdsMutexInAppend);
 	FD_SET(clientSockfd, &m_readfds);
 	pthread_mutex_unlock(&m_readfdsMutexInAppend);
+#endif
 	pthread_mutex_lock(&m_clientMapMutex);
 #ifdef _WIN32
 	std::map<SOCKET, TcpSocket *>::iterator it = m_clientMap.find(clientSockfd);
@@ -400,7 +395,12 @@ TcpSocket *TcpServer::appendClient(int clientSockfd)
 		return it->second;
 	}
 	TcpSocket *tcpSocket = new TcpSocket(this, clientSockfd);
+	tcpSocket->m_peer = peer;
 	m_clientMap[clientSockfd] = tcpSocket;
+#ifndef _WIN32
+	tcpSocket->m_loop = m_loop;
+	tcpSocket->m_watch = m_loop->watchRead(clientSockfd, TcpSocket::onLoopRead, tcpSocket);
+#endif
 	pthread_mutex_unlock(&m_clientMapMutex);
 	return tcpSocket;
 }
@@ -430,10 +430,9 @@ bool TcpServer::removeClient(int clientSockfd)
 	m_waitForRemoveSockfds.push(clientSockfd);
 	pthread_mutex_unlock(&m_waitForRemoveSockfdsMutex);
 #else
+	m_loop->unwatch(tcpSocket->m_watch);
+	tcpSocket->m_watch = NULL;
 	close(clientSockfd);
-	pthread_mutex_lock(&m_readfdsMutexInRemove);
-	FD_CLR(clientSockfd, &m_readfds);
-	pthread_mutex_unlock(&m_readfdsMutexInRemove);
 #endif
 	tcpSocket->m_connectStatus = TCP_SOCKET_DISCONNECTED;
 	if(tcpSocket->m_onDisconnected)
@@ -442,6 +441,9 @@ bool TcpServer::removeClient(int clientSockfd)
 	}
 	m_clientMap.erase(it);
 	pthread_mutex_unlock(&m_clientMapMutex);
+#ifndef _WIN32
+	m_loop->waitIdle(tcpSocket);	//aborted out of loop thread, its call back may be running.
+#endif
 	delete tcpSocket;
 	return true;
 }
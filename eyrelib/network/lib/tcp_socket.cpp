@@ -1,9 +1,10 @@
 /*
  * Class TcpSocket can connect to server and send, recive data.
- * The call back function `Read` will exec in a subthread.
+ * The call back function `Read` will exec in a subthread,
+ * the thread of EventLoop::shared() on Linux.
  *
  * Author: Eyre Turing.
- * Last edit: 2021-06-23 17:47.
+ * Last edit: 2026-10-19 22:40.
  */
 
 #include "tcp_socket.h"
@@ -13,7 +14,7 @@
 #include <ws2tcpip.h>
 #else
 #include <netinet/in.h>
-#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <netdb.h>
 #endif	//_WIN32
@@ -23,21 +24,16 @@
 #include <errno.h>
 #include "eyre_string.h"
 
-#define ONCE_READ	1024
+#define ONCE_WRITE_IOV	64	//iovec count once sendmsg.
 
 void *TcpSocket::Thread::connectThread(void *s)
 {
 	TcpSocket *tcpSocket = (TcpSocket *) s;
 	
-	if(connect(tcpSocket->m_sockfd, tcpSocket->m_res->ai_addr, tcpSocket->m_res->ai_addrlen) < 0)
+	if(connect(tcpSocket->m_sockfd, tcpSocket->m_peer.addr(), tcpSocket->m_peer.length()) < 0)
 	{
 		int errorStatus = errno;
 		fprintf(stderr, "connectThread error: %s\n", strerror(errorStatus));
-		if(tcpSocket->m_res)
-		{
-			freeaddrinfo(tcpSocket->m_res);
-			tcpSocket->m_res = NULL;
-		}
 #ifdef _WIN32
 		closesocket(tcpSocket->m_sockfd);
 #else
@@ -52,8 +48,32 @@ void *TcpSocket::Thread::connectThread(void *s)
 	{
 		tcpSocket->m_connectStatus = TCP_SOCKET_CONNECTED;
 		
-		if(pthread_create(&(tcpSocket->m_readThread), NULL,
-						TcpSocket::Thread::readThread, s) != 0)
+		bool reading;
+#ifdef _WIN32
+		__sync_fetch_and_add(&(tcpSocket->m_threads), 1);
+		reading = pthread_create(&(tcpSocket->m_readThread), NULL,
+								TcpSocket::Thread::readThread, s) == 0;
+		if(reading)
+		{
+			pthread_detach(tcpSocket->m_readThread);
+		}
+		else
+		{
+			__sync_fetch_and_sub(&(tcpSocket->m_threads), 1);
+		}
+#else
+		tcpSocket->m_loop = EventLoop::shared();
+		tcpSocket->m_watch = tcpSocket->m_loop ?
+			tcpSocket->m_loop->watchRead(tcpSocket->m_sockfd, TcpSocket::onLoopRead, tcpSocket) : NULL;
+		reading = tcpSocket->m_watch != NULL;
+		pthread_mutex_lock(&(tcpSocket->m_pauseMutex));
+		if(reading && tcpSocket->m_pauseReasons)
+		{
+			tcpSocket->m_loop->pause(tcpSocket->m_watch, true);
+		}
+		pthread_mutex_unlock(&(tcpSocket->m_pauseMutex));
+#endif
+		if(!reading)
 		{
 			tcpSocket->abort();
 			if(tcpSocket->m_onConnectError)
@@ -61,45 +81,57 @@ void *TcpSocket::Thread::connectThread(void *s)
 				tcpSocket->m_onConnectError(tcpSocket, TCP_SOCKET_CREATETHREAD_ERROR);
 			}
 		}
-		else if(tcpSocket->m_onConnected)
+		else
 		{
-			tcpSocket->m_onConnected(tcpSocket);
+			if(tcpSocket->m_onConnected)
+			{
+				tcpSocket->m_onConnected(tcpSocket);
+			}
 		}
 	}
 	
 	return NULL;
 }
 
+#ifdef _WIN32
 void *TcpSocket::Thread::readThread(void *s)
 {
 	TcpSocket *tcpSocket = (TcpSocket *) s;
 	
+	//socket fd of this connection, m_sockfd changes when connect again.
+	SOCKET sockfd = tcpSocket->m_sockfd;
+	bool destroyed = false;
+	tcpSocket->m_destroyed = &destroyed;
+	
 	fd_set readfds, testfds;
 	FD_ZERO(&readfds);
-	FD_SET(tcpSocket->m_sockfd, &readfds);
+	FD_SET(sockfd, &readfds);
 	
-	char buffer[ONCE_READ];
 	int size, result;
-	while(tcpSocket->m_connectStatus == TCP_SOCKET_CONNECTED)
+	unsigned int connection = tcpSocket->m_connection;
+	while(tcpSocket->m_connectStatus==TCP_SOCKET_CONNECTED && tcpSocket->m_connection==connection)
 	{
+		if(tcpSocket->m_pauseReasons)
+		{
+			Sleep(1);
+			continue;
+		}
 		testfds = readfds;
 		
 #if NETWORK_DETAIL
 		fprintf(stdout, "tcpSocket(%p) wait.\n", tcpSocket);
 #endif
 		
-#ifdef _WIN32
 		TIMEVAL timeout;
 		timeout.tv_sec = NETWORK_TIMEOUT;
 		timeout.tv_usec = 0;
 		result = select(0, &testfds, NULL, NULL, &timeout);
-#else
-		struct timeval timeout;
-		timeout.tv_sec = NETWORK_TIMEOUT;
-		timeout.tv_usec = 0;
-		result = select(FD_SETSIZE, &testfds, (fd_set *) 0, (fd_set *) 0, &timeout);
-#endif
 
+		if(tcpSocket->m_connection!=connection || tcpSocket->m_connectStatus!=TCP_SOCKET_CONNECTED)
+		{
+			break;	//aborted (and maybe connect again) in other thread, not ours now.
+		}
+		
 		if(result < 0)
 		{
 			perror("select");
@@ -115,15 +147,14 @@ void *TcpSocket::Thread::readThread(void *s)
 			continue;
 		}
 		
-		if(!FD_ISSET(tcpSocket->m_sockfd, &testfds))
+		if(!FD_ISSET(sockfd, &testfds))
 		{
 			fprintf(stderr, "tcpSocket(%p) select unknow error!\n", tcpSocket);
 			continue;
 		}
 		
-#ifdef _WIN32
 		//pthread_mutex_lock(&(tcpSocket->m_readWriteMutex));
-		size = recv(tcpSocket->m_sockfd, tcpSocket->recvBuffer, tcpSocket->recvBufferSize, 0);
+		size = recv(sockfd, tcpSocket->recvBuffer, tcpSocket->recvBufferSize, 0);
 		//pthread_mutex_unlock(&(tcpSocket->m_readWriteMutex));
 		if(size > 0)
 		{
@@ -131,57 +162,175 @@ void *TcpSocket::Thread::readThread(void *s)
 			{
 				tcpSocket->m_onRead(tcpSocket, ByteArray(tcpSocket->recvBuffer, size));
 			}
+			if(destroyed)
+			{
+				return NULL;
+			}
+		}
+		else if(size==0 && tcpSocket->m_onReadClosed)
+		{
+			tcpSocket->m_onReadClosed(tcpSocket);	//writes go on, owner aborts when done.
+			if(destroyed)
+			{
+				return NULL;
+			}
+			break;
 		}
 		else
 		{
 			tcpSocket->abort();
+			break;	//disconnected call back may connect again.
 		}
+	}
+	if(destroyed)
+	{
+		return NULL;	//deleted in disconnected call back.
+	}
+	if(tcpSocket->m_destroyed == &destroyed)
+	{
+		tcpSocket->m_destroyed = NULL;
+	}
+	__sync_fetch_and_sub(&(tcpSocket->m_threads), 1);
+	return NULL;
+}
 #else
-		//pthread_mutex_lock(&(tcpSocket->m_readWriteMutex));
-		ioctl(tcpSocket->m_sockfd, FIONREAD, &size);
-		if(size > 0)
+void TcpSocket::onLoopRead(void *owner, ByteArray &data)
+{
+	TcpSocket *tcpSocket = (TcpSocket *) owner;
+	if(data.size() == 0)
+	{
+		if(tcpSocket->m_onReadClosed && tcpSocket->m_loop->peerClosed())
+		{
+			tcpSocket->m_onReadClosed(tcpSocket);	//writes go on, owner aborts when done.
+			return ;
+		}
+		tcpSocket->abort();	//disconnected call back may connect again.
+		return ;
+	}
+	if(tcpSocket->m_onRead)
+	{
+		tcpSocket->m_onRead(tcpSocket, data);
+	}
+}
+
+void TcpSocket::onLoopWritable(void *owner)
+{
+	TcpSocket *tcpSocket = (TcpSocket *) owner;
+	pthread_mutex_lock(&(tcpSocket->m_sendMutex));
+	bool sent = tcpSocket->sendQueued();
+	bool empty = tcpSocket->m_sendQueue.empty();
+	bool drained = false;
+	if(tcpSocket->m_drainArmed && tcpSocket->m_queuedBytes<=tcpSocket->m_drainLowWater)
+	{
+		tcpSocket->m_drainArmed = false;
+		drained = true;
+	}
+	if(sent && empty && tcpSocket->m_finPending)
+	{
+		tcpSocket->m_finPending = false;
+		shutdown(tcpSocket->m_sockfd, SHUT_WR);
+	}
+	bool abort = !sent || (empty && tcpSocket->m_abortPending);
+	pthread_mutex_unlock(&(tcpSocket->m_sendMutex));
+	if(drained && tcpSocket->m_onDrained)
+	{
+		tcpSocket->m_onDrained(tcpSocket);
+	}
+	if(abort)
+	{
+		tcpSocket->abort();	//may delete it, last.
+	}
+}
+
+bool TcpSocket::sendQueued()
+{
+	struct iovec iov[ONCE_WRITE_IOV];
+	while(m_sendQueue.size())
+	{
+		int count = 0;
+		for(std::deque<ByteArray>::iterator it = m_sendQueue.begin();
+			it!=m_sendQueue.end() && count<ONCE_WRITE_IOV; ++it)
 		{
-			ByteArray recvData;
-			while(size > 0)
+			iov[count].iov_base = (void *) ((const char *) *it);
+			iov[count].iov_len = it->size();
+			++count;
+		}
+		iov[0].iov_base = ((char *) iov[0].iov_base)+m_sendOffset;
+		iov[0].iov_len -= m_sendOffset;
+		
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t sendSize = sendmsg(m_sockfd, &msg, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if(sendSize < 0)
+		{
+			if(errno == EINTR)
 			{
-				int recvSize = recv(tcpSocket->m_sockfd, buffer, ONCE_READ, 0);
-				recvData.append(buffer, recvSize);
-				size -= recvSize;
+				continue;
 			}
-			//pthread_mutex_unlock(&(tcpSocket->m_readWriteMutex));
-			if(tcpSocket->m_onRead)
+			if(errno==EAGAIN || errno==EWOULDBLOCK)
 			{
-				tcpSocket->m_onRead(tcpSocket, recvData);
+				if(m_loop)
+				{
+					m_loop->waitWritable(m_watch, TcpSocket::onLoopWritable);
+				}
+				return true;
 			}
+			return false;
 		}
-		else
+		m_queuedBytes -= sendSize;
+		while(sendSize > 0)
 		{
-			//pthread_mutex_unlock(&(tcpSocket->m_readWriteMutex));
-			tcpSocket->abort();
-		} 
-#endif
+			size_t rest = m_sendQueue.front().size()-m_sendOffset;
+			if((size_t) sendSize < rest)
+			{
+				m_sendOffset += sendSize;
+				break;
+			}
+			sendSize -= rest;
+			m_sendQueue.pop_front();
+			m_sendOffset = 0;
+		}
 	}
-	return NULL;
+	return true;
 }
+#endif
 
 TcpSocket::TcpSocket()
 {
-	m_res = NULL;
 	m_server = NULL;
 	
 	m_onDisconnected = NULL;
 	m_onConnected = NULL;
 	m_onRead = NULL;
 	m_onConnectError = NULL;
+	m_onReadClosed = NULL;
+	m_onDrained = NULL;
+	m_drainLowWater = 0;
 	
 	m_connectStatus = TCP_SOCKET_DISCONNECTED;
+	m_connection = 0;
+	m_pauseReasons = 0;
+	pthread_mutex_init(&m_pauseMutex, NULL);
 	
 #ifdef _WIN32
+	m_threads = 0;
+	m_destroyed = NULL;
 	if(WSAStartup(MAKEWORD(1, 1), &m_wsadata) == SOCKET_ERROR)
 	{
 		fprintf(stderr, "TcpSocket(%p) WSAStartup() fail!\n", this);
 	}
 	recvBuffer = NULL;
+#else
+	m_loop = NULL;
+	m_watch = NULL;
+	m_sendOffset = 0;
+	m_queuedBytes = 0;
+	m_drainArmed = false;
+	m_finPending = false;
+	m_abortPending = false;
+	pthread_mutex_init(&m_sendMutex, NULL);
 #endif
 
 #if NETWORK_DETAIL
@@ -191,21 +340,36 @@ TcpSocket::TcpSocket()
 	//pthread_mutex_init(&m_readWriteMutex, NULL);
 }
 
-TcpSocket::TcpSocket(TcpServer *server, int sockfd) : m_server(server), m_sockfd(sockfd)
+TcpSocket::TcpSocket(TcpServer *server, int sockfd) : m_sockfd(sockfd), m_server(server)
 {
-	m_res = NULL;
-	
 	m_onDisconnected = NULL;
 	m_onConnected = NULL;
 	m_onRead = NULL;
 	m_onConnectError = NULL;
+	m_onReadClosed = NULL;
+	m_onDrained = NULL;
+	m_drainLowWater = 0;
 	
 	m_connectStatus = TCP_SOCKET_CONNECTED;
+	m_connection = 0;
+	m_pauseReasons = 0;
+	pthread_mutex_init(&m_pauseMutex, NULL);
 	
 #ifdef _WIN32
+	m_threads = 0;
+	m_destroyed = NULL;
 	int optLen = sizeof(recvBufferSize);
 	getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (char *) &recvBufferSize, &optLen);
 	recvBuffer = (char *) malloc(recvBufferSize+1);
+#else
+	m_loop = NULL;	//set by server.
+	m_watch = NULL;
+	m_sendOffset = 0;
+	m_queuedBytes = 0;
+	m_drainArmed = false;
+	m_finPending = false;
+	m_abortPending = false;
+	pthread_mutex_init(&m_sendMutex, NULL);
 #endif
 
 #if NETWORK_DETAIL
@@ -220,6 +384,26 @@ TcpSocket::~TcpSocket()
 	if(!m_server)
 	{
 		abort();
+		
+#ifdef _WIN32
+		//read thread may be still in select, wait it quit before memory freed.
+		unsigned int self = 0;
+		if(m_destroyed && pthread_equal(pthread_self(), m_readThread))
+		{
+			*m_destroyed = true;	//deleted in its own call back.
+			self = 1;
+		}
+		while(m_threads > self)
+		{
+			Sleep(1);
+		}
+#else
+		//read call back may be running in loop thread, wait it before memory freed.
+		if(m_loop)
+		{
+			m_loop->waitIdle(this);
+		}
+#endif
 	}
 #ifdef _WIN32
 	free(recvBuffer);
@@ -233,6 +417,10 @@ TcpSocket::~TcpSocket()
 	fprintf(stdout, "TcpSocket(%p) destroyed.\n", this);
 #endif
 
+	pthread_mutex_destroy(&m_pauseMutex);
+#ifndef _WIN32
+	pthread_mutex_destroy(&m_sendMutex);
+#endif
 	//pthread_mutex_destroy(&m_readWriteMutex);
 }
 
@@ -243,26 +431,40 @@ int TcpSocket::connectToHost(const char *addr, unsigned short port, int family)
 		fprintf(stderr, "warning: this(%p) is a server socket, can not connect to other server!\n", this);
 		return TCP_SOCKET_ISSERVER_ERROR;
 	}
-	abort();
-	struct addrinfo hints = {0};
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	struct addrinfo *res = NULL;
 	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_family = family;
-	int getErr = getaddrinfo(addr, String::fromNumber(port), &hints, &m_res);
+	hints.ai_family = SocketAddress::familyOf(addr, family);
+	int getErr = getaddrinfo(addr, String::fromNumber(port), &hints, &res);
 	if(getErr)
 	{
-		m_res = NULL;
 		fprintf(stderr, "TcpSocket(%p)::connectToHost getaddrinfo() error: %s\n",
 				this, gai_strerror(getErr));
 		return TCP_SOCKET_GETADDRINFO_ERROR;
 	}
-	m_sockfd = socket(m_res->ai_family, m_res->ai_socktype, m_res->ai_protocol);
+	SocketAddress peer(res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	return connectToHost(peer);
+}
+
+int TcpSocket::connectToHost(const SocketAddress &addr)
+{
+	if(m_server)
+	{
+		fprintf(stderr, "warning: this(%p) is a server socket, can not connect to other server!\n", this);
+		return TCP_SOCKET_ISSERVER_ERROR;
+	}
+	if(!addr.isValid())
+	{
+		return TCP_SOCKET_GETADDRINFO_ERROR;
+	}
+	abort();
+	++m_connection;
+	m_peer = addr;
+	m_sockfd = socket(addr.family(), SOCK_STREAM, 0);
 	if(m_sockfd < 0)
 	{
-		if(m_res)
-		{
-			freeaddrinfo(m_res);
-			m_res = NULL;
-		}
 		fprintf(stderr, "TcpSocket(%p)::connectToHost socket() error: %s\n",
 				this, strerror(errno));
 		return TCP_SOCKET_SOCKETFD_ERROR;
@@ -303,11 +505,6 @@ int TcpSocket::connectToHost(const char *addr, unsigned short port, int family)
 	
 	if(pthread_create(&m_connectThread, NULL, TcpSocket::Thread::connectThread, this) != 0)
 	{
-		if(m_res)
-		{
-			freeaddrinfo(m_res);
-			m_res = NULL;
-		}
 #ifdef _WIN32
 		closesocket(m_sockfd);
 #else
@@ -327,11 +524,17 @@ void TcpSocket::abort()
 		return ;
 	}
 	
-	if(m_res)
-	{
-		freeaddrinfo(m_res);
-		m_res = NULL;
-	}
+#ifndef _WIN32
+	pthread_mutex_lock(&m_sendMutex);
+	m_connectStatus = TCP_SOCKET_DISCONNECTED;	//post() sends no more to the socket closed here.
+	m_sendQueue.clear();
+	m_sendOffset = 0;
+	m_queuedBytes = 0;
+	m_drainArmed = false;
+	m_finPending = false;
+	m_abortPending = false;
+	pthread_mutex_unlock(&m_sendMutex);
+#endif
 	
 	if(m_server)
 	{
@@ -339,13 +542,23 @@ void TcpSocket::abort()
 	}
 	else
 	{
+		m_connectStatus = TCP_SOCKET_DISCONNECTED;
+		
 #ifdef _WIN32
+		//wake read thread in select, close alone does not.
+		shutdown(m_sockfd, SD_BOTH);
 		closesocket(m_sockfd);
 #else
+		if(m_loop)
+		{
+			m_loop->unwatch(m_watch);
+			m_watch = NULL;
+		}
+		//io_uring holds the socket till recv cancelled, shutdown sends fin now.
+		shutdown(m_sockfd, SHUT_RDWR);
 		close(m_sockfd);
 #endif	//_WIN32
 
-		m_connectStatus = TCP_SOCKET_DISCONNECTED;
 		if(m_onDisconnected)
 		{
 			m_onDisconnected(this);
@@ -377,6 +590,17 @@ void TcpSocket::setConnectErrorCallBack(ConnectError connectError)
 	m_onConnectError = connectError;
 }
 
+void TcpSocket::setReadClosedCallBack(ReadClosed readClosed)
+{
+	m_onReadClosed = readClosed;
+}
+
+void TcpSocket::setDrainedCallBack(Drained drained, unsigned long long lowWater)
+{
+	m_onDrained = drained;
+	m_drainLowWater = lowWater;
+}
+
 bool TcpSocket::write(const ByteArray &data)
 {
 	return write(data, data.size());
@@ -394,45 +618,174 @@ bool TcpSocket::write(const char *data, unsigned int size)
 	return result;
 }
 
-int TcpSocket::connectStatus() const
+bool TcpSocket::write(const std::vector<ByteArray> &datas)
 {
-	return m_connectStatus;
+#ifdef _WIN32
+	ByteArray all;
+	for(unsigned int i=0; i<datas.size(); ++i)
+	{
+		all.append(datas[i]);
+	}
+	return write(all);
+#else
+	struct iovec iov[ONCE_WRITE_IOV];
+	unsigned int i = 0;
+	while(i < datas.size())
+	{
+		int count = 0;
+		while(count<ONCE_WRITE_IOV && i<datas.size())
+		{
+			if(datas[i].size())
+			{
+				iov[count].iov_base = (void *) ((const char *) datas[i]);
+				iov[count].iov_len = datas[i].size();
+				++count;
+			}
+			++i;
+		}
+		
+		//send the iovecs, continue from where a partial send stopped.
+		int first = 0;
+		while(first < count)
+		{
+			struct msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov+first;
+			msg.msg_iovlen = count-first;
+			ssize_t sendSize = sendmsg(m_sockfd, &msg, MSG_NOSIGNAL);
+			if(sendSize < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+				return false;
+			}
+			while(first<count && (size_t) sendSize>=iov[first].iov_len)
+			{
+				sendSize -= iov[first].iov_len;
+				++first;
+			}
+			if(first < count)
+			{
+				iov[first].iov_base = ((char *) iov[first].iov_base)+sendSize;
+				iov[first].iov_len -= sendSize;
+			}
+		}
+	}
+	return true;
+#endif
 }
 
-String TcpSocket::getPeerIp() const
+bool TcpSocket::post(const ByteArray &data)
 {
-	struct sockaddr_in addr;
 #ifdef _WIN32
-	int len = sizeof(addr);
+	return write(data);
 #else
-	unsigned int len = sizeof(addr);
-#endif
-	if(getpeername(m_sockfd, (struct sockaddr *) &addr, &len) == 0)
+	pthread_mutex_lock(&m_sendMutex);
+	if(m_connectStatus!=TCP_SOCKET_CONNECTED || m_finPending || m_abortPending)
 	{
-		return String(inet_ntoa(addr.sin_addr), CODEC_UTF8);
+		pthread_mutex_unlock(&m_sendMutex);
+		return false;
 	}
-	else
+	if(data.size())
 	{
-		return "";
+		m_sendQueue.push_back(data);
+		m_queuedBytes += data.size();
 	}
+	bool result = sendQueued();
+	if(m_queuedBytes > m_drainLowWater)
+	{
+		m_drainArmed = true;
+	}
+	pthread_mutex_unlock(&m_sendMutex);
+	return result;
+#endif
 }
 
-unsigned short TcpSocket::getPeerPort() const
+unsigned long long TcpSocket::queuedBytes() const
 {
-	struct sockaddr_in addr;
 #ifdef _WIN32
-	int len = sizeof(addr);
+	return 0;
 #else
-	unsigned int len = sizeof(addr);
+	return m_queuedBytes;
 #endif
-	if(getpeername(m_sockfd, (struct sockaddr *) &addr, &len) == 0)
+}
+
+bool TcpSocket::shutdownWrite()
+{
+	if(m_connectStatus != TCP_SOCKET_CONNECTED)
 	{
-		return ntohs(addr.sin_port);
+		return false;
 	}
-	else
+#ifdef _WIN32
+	return shutdown(m_sockfd, SD_SEND) == 0;
+#else
+	pthread_mutex_lock(&m_sendMutex);
+	if(m_sendQueue.size())
+	{
+		m_finPending = true;	//sent in loop thread after the queue.
+		pthread_mutex_unlock(&m_sendMutex);
+		return true;
+	}
+	bool result = shutdown(m_sockfd, SHUT_WR) == 0;
+	pthread_mutex_unlock(&m_sendMutex);
+	return result;
+#endif
+}
+
+void TcpSocket::abortWhenWritten()
+{
+#ifndef _WIN32
+	pthread_mutex_lock(&m_sendMutex);
+	if(m_sendQueue.size())
 	{
-		return 0;
+		m_abortPending = true;	//aborted in loop thread after the queue.
+		pthread_mutex_unlock(&m_sendMutex);
+		return ;
 	}
+	pthread_mutex_unlock(&m_sendMutex);
+#endif
+	abort();
+}
+
+int TcpSocket::connectStatus() const
+{
+	return m_connectStatus;
+}
+
+void TcpSocket::setReadPaused(bool paused, unsigned int reason)
+{
+	pthread_mutex_lock(&m_pauseMutex);
+	unsigned int reasons = paused ? (m_pauseReasons|reason) : (m_pauseReasons&~reason);
+#ifndef _WIN32
+	if(m_loop && (reasons!=0)!=(m_pauseReasons!=0))
+	{
+		m_loop->pause(m_watch, reasons!=0);	//NULL or freed watch is ignored.
+	}
+#endif
+	m_pauseReasons = reasons;
+	pthread_mutex_unlock(&m_pauseMutex);
+}
+
+bool TcpSocket::readPaused() const
+{
+	return m_pauseReasons != 0;
+}
+
+const SocketAddress &TcpSocket::peerAddress() const
+{
+	return m_peer;
+}
+
+String TcpSocket::getPeerIp() const
+{
+	return m_peer.ip();
+}
+
+unsigned short TcpSocket::getPeerPort() const
+{
+	return m_peer.port();
 }
 
 TcpServer *TcpSocket::server() const
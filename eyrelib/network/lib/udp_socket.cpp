@@ -1,6 +1,9 @@
 /*
+ * Class UdpSocket binds a port, sends and recives datagrams.
+ * Linux reads by EventLoop::shared(), Windows by a read thread.
+ *
  * Author: Eyre Turing.
- * Last edit: 2021-01-11 16:55.
+ * Last edit: 2026-10-19 20:45.
  */
 
 #include "udp_socket.h"
@@ -15,26 +18,57 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <vector>
 
 #include "eyre_string.h"
 
 #define DGRAM_MAX_SIZE	 102400	//set max is 100k, although one udp dgram real max size is 64k.
 
+#ifndef _WIN32
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103	//linux 4.18.
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO		104	//linux 5.0.
+#endif
+
+#define GSO_MAX_BYTES		65000	//payload of one message with segments.
+#define GSO_MAX_SEGMENTS	64
+
+//recvmmsg buffers, only the loop thread of EventLoop::shared() uses them.
+struct RecvPool
+{
+	struct mmsghdr msgs[UDP_SOCKET_BATCH];
+	struct iovec iovs[UDP_SOCKET_BATCH];
+	SocketAddress addrs[UDP_SOCKET_BATCH];
+	char controls[UDP_SOCKET_BATCH][CMSG_SPACE(sizeof(int))];
+	std::vector<UdpSocket::Datagram> datagrams;	//more than msgs when GRO splits.
+	char *buffers;
+};
+static RecvPool *recvPool = NULL;
+#endif	//_WIN32
+
+#ifdef _WIN32
 void *UdpSocket::Thread::readThread(void *s)
 {
 	UdpSocket *udpSocket = (UdpSocket *) s;
 	char buffer[DGRAM_MAX_SIZE];
 	int size;
-	struct sockaddr from;
-#ifdef _WIN32
-	int len = sizeof(from);
-#else
-	unsigned int len = sizeof(from);
-#endif
-	struct sockaddr_in sin;
+	int len;
+	Datagram datagram;
 	while(udpSocket->m_isBound)
 	{
-		size = recvfrom(udpSocket->m_sockfd, buffer, DGRAM_MAX_SIZE, 0, &from, &len);
+		if(udpSocket->m_readPaused)
+		{
+			Sleep(1);
+			continue;
+		}
+		len = SocketAddress::capacity();
+		size = recvfrom(udpSocket->m_sockfd, buffer, DGRAM_MAX_SIZE, 0, datagram.addr.addr(), &len);
 		if(size < 0)
 		{
 #if NETWORK_DETAIL
@@ -42,24 +76,130 @@ void *UdpSocket::Thread::readThread(void *s)
 #endif 
 			continue ;
 		}
-		if(udpSocket->m_onRead)
-		{
-			memcpy(&sin, &from, sizeof(sin));
-			udpSocket->m_onRead(udpSocket, String(inet_ntoa(sin.sin_addr), CODEC_UTF8), ntohs(sin.sin_port), ByteArray(buffer, size));
-		}
+		datagram.data = buffer;
+		datagram.size = size;
+		datagram.addr.setLength(len);
+		udpSocket->deliver(&datagram, 1);
 	}
 #if NETWORK_DETAIL
 	fprintf(stdout, "UdpSocket(%p) read thread quit.\n", udpSocket);
 #endif
 	return NULL;
 }
+#else
+//poll of io_uring fires once per arrival, so read till EAGAIN.
+void UdpSocket::onLoopReady(void *owner)
+{
+	UdpSocket *udpSocket = (UdpSocket *) owner;
+	if(!recvPool)
+	{
+		recvPool = new RecvPool;
+		recvPool->buffers = new char[UDP_SOCKET_BATCH*UDP_SOCKET_SLOT];
+		for(int i=0; i<UDP_SOCKET_BATCH; ++i)
+		{
+			recvPool->iovs[i].iov_base = recvPool->buffers+i*UDP_SOCKET_SLOT;
+			recvPool->iovs[i].iov_len = UDP_SOCKET_SLOT;
+			recvPool->msgs[i].msg_hdr.msg_name = recvPool->addrs[i].addr();
+			recvPool->msgs[i].msg_hdr.msg_iov = &recvPool->iovs[i];
+			recvPool->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+	}
+	RecvPool *pool = recvPool;
+	std::vector<Datagram> &datagrams = pool->datagrams;
+	while(udpSocket->m_isBound && !udpSocket->m_readPaused)
+	{
+		bool gro = udpSocket->m_gro;
+		for(int i=0; i<UDP_SOCKET_BATCH; ++i)
+		{
+			struct msghdr &hdr = pool->msgs[i].msg_hdr;
+			hdr.msg_namelen = SocketAddress::capacity();
+			hdr.msg_control = gro ? pool->controls[i] : NULL;
+			hdr.msg_controllen = gro ? sizeof(pool->controls[i]) : 0;
+			hdr.msg_flags = 0;
+		}
+		int count = recvmmsg(udpSocket->m_sockfd, pool->msgs, UDP_SOCKET_BATCH, MSG_DONTWAIT, NULL);
+		if(count < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue ;
+			}
+			break;	//EAGAIN, or error of a datagram sent before, wait next.
+		}
+		datagrams.clear();
+		for(int i=0; i<count; ++i)
+		{
+			const char *data = (const char *) pool->iovs[i].iov_base;
+			unsigned int size = pool->msgs[i].msg_len;
+			unsigned int segment = size;
+			struct msghdr &hdr = pool->msgs[i].msg_hdr;
+			pool->addrs[i].setLength(hdr.msg_namelen);
+			for(struct cmsghdr *cmsg = gro ? CMSG_FIRSTHDR(&hdr) : NULL; cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+			{
+				if(cmsg->cmsg_level==SOL_UDP && cmsg->cmsg_type==UDP_GRO)
+				{
+					int gsoSize;
+					memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+					if(gsoSize > 0)
+					{
+						segment = gsoSize;
+					}
+				}
+			}
+			unsigned int offset = 0;
+			do
+			{
+				Datagram datagram;
+				datagram.data = data+offset;
+				datagram.size = size-offset<segment ? size-offset : segment;
+				datagram.addr = pool->addrs[i];
+				datagrams.push_back(datagram);
+				offset += segment;
+			}
+			while(offset < size);
+		}
+		udpSocket->deliver(&datagrams[0], datagrams.size());
+		if(count < UDP_SOCKET_BATCH)
+		{
+			break;	//queue was emptied.
+		}
+	}
+}
+#endif	//_WIN32
+
+void UdpSocket::deliver(const Datagram *datagrams, unsigned int count)
+{
+	if(m_onReadBatch)
+	{
+		m_onReadBatch(this, datagrams, count);
+		return;
+	}
+	if(!m_onRead)
+	{
+		return;
+	}
+	for(unsigned int i=0; i<count; ++i)
+	{
+		m_onRead(this, datagrams[i].addr.ip(), datagrams[i].addr.port(),
+				ByteArray(datagrams[i].data, datagrams[i].size));
+	}
+}
 
 UdpSocket::UdpSocket()
 {
 	m_isBound = false;
 	m_port = 0;
+	m_gro = false;
+	m_gso = false;
+	m_readPaused = false;
 	
 	m_onRead = NULL;
+	m_onReadBatch = NULL;
+	
+#ifndef _WIN32
+	m_loop = NULL;
+	m_watch = NULL;
+#endif
 	
 #ifdef _WIN32
 	if(WSAStartup(MAKEWORD(1, 1), &m_wsadata) == SOCKET_ERROR)
@@ -89,17 +229,18 @@ UdpSocket::~UdpSocket()
 bool UdpSocket::start(unsigned short port, int family, unsigned long addr)
 {
 	unbind();
-	struct sockaddr_in socketAddr;
-	memset(&socketAddr, 0, sizeof(socketAddr));
-	socketAddr.sin_family = family;
-	socketAddr.sin_addr.s_addr = htonl(addr);
-	socketAddr.sin_port = htons(port);
-	m_sockfd = socket(family, SOCK_DGRAM, 0);
+	SocketAddress local(family, addr, port);
+	m_sockfd = socket(local.family(), SOCK_DGRAM, 0);
 	if(m_sockfd < 0)
 	{
 		return false;
 	}
-	if(bind(m_sockfd, (struct sockaddr *) &socketAddr, sizeof(socketAddr)) != 0)
+	int v6only = 0;	//dual-stack.
+	if(local.family() == AF_INET6)
+	{
+		setsockopt(m_sockfd, IPPROTO_IPV6, IPV6_V6ONLY, (const char *) &v6only, sizeof(v6only));
+	}
+	if(bind(m_sockfd, local.addr(), local.length()) != 0)
 	{
 #ifdef _WIN32
 		closesocket(m_sockfd);
@@ -112,35 +253,38 @@ bool UdpSocket::start(unsigned short port, int family, unsigned long addr)
 	
 #ifdef _WIN32
 	int timeout = NETWORK_TIMEOUT*1000;
-#else
-	struct timeval timeout;
-	timeout.tv_sec = NETWORK_TIMEOUT;
-	timeout.tv_usec = 0;
-#endif
 	
 	if(setsockopt(m_sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *) &timeout, sizeof(timeout)) < 0)
 	{
-#ifdef _WIN32
 		closesocket(m_sockfd);
-#else
-		close(m_sockfd);
-#endif
 		fprintf(stderr, "UdpSocket(%p) set no block error!\n", this);
 		return false;
 	}
 	
+	m_isBound = true;
 	if(pthread_create(&m_readThread, NULL, UdpSocket::Thread::readThread, this) != 0)
 	{
-#ifdef _WIN32
+		m_isBound = false;
 		closesocket(m_sockfd);
+		fprintf(stderr, "UdpSocket(%p) can not create thread!\n", this);
+		return false;
+	}
 #else
+	m_loop = EventLoop::shared();
+	m_watch = m_loop ? m_loop->watchReady(m_sockfd, UdpSocket::onLoopReady, this) : NULL;
+	if(!m_watch)
+	{
 		close(m_sockfd);
-#endif
-		fprintf(stderr, "UdpSocket(%p) can not create thread!\n", this);
+		fprintf(stderr, "UdpSocket(%p) can not watch by event loop!\n", this);
 		return false;
 	}
-	
+	if(m_readPaused)
+	{
+		m_loop->pause(m_watch, true);
+	}
 	m_isBound = true;
+#endif
+	
 	m_port = port;
 	
 	return true;
@@ -155,10 +299,15 @@ void UdpSocket::unbind()
 #ifdef _WIN32
 	closesocket(m_sockfd);
 #else
+	m_loop->unwatch(m_watch);
+	m_watch = NULL;
+	m_loop->waitIdle(this);
 	close(m_sockfd);
 #endif
 	m_isBound = false;
 	m_port = 0;
+	m_gro = false;
+	m_gso = false;
 }
 
 bool UdpSocket::send(const char *addr, unsigned short port, const ByteArray &data) const
@@ -173,7 +322,8 @@ bool UdpSocket::send(const char *addr, unsigned short port,
 	{
 		size = strlen(data);
 	}
-	struct addrinfo hints = {0};
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
 	struct addrinfo *res = NULL;
 	hints.ai_socktype = SOCK_DGRAM;
 	if(getaddrinfo(addr, String::fromNumber(port), &hints, &res) != 0)
@@ -186,12 +336,175 @@ bool UdpSocket::send(const char *addr, unsigned short port,
 	return sendsize>=0;
 }
 
+bool UdpSocket::send(const SocketAddress &to, const char *data, unsigned int size) const
+{
+	return sendto(m_sockfd, data, size, 0, to.addr(), to.length()) >= 0;
+}
+
+unsigned int UdpSocket::send(const Datagram *datagrams, unsigned int count)
+{
+#ifdef _WIN32
+	unsigned int sent = 0;
+	while(sent<count && send(datagrams[sent].addr, datagrams[sent].data, datagrams[sent].size))
+	{
+		++sent;
+	}
+	return sent;
+#else
+	struct mmsghdr msgs[UDP_SOCKET_BATCH];
+	struct iovec iovs[UDP_SOCKET_BATCH];
+	char controls[UDP_SOCKET_BATCH][CMSG_SPACE(sizeof(unsigned short))];
+	unsigned int firsts[UDP_SOCKET_BATCH+1];	//first datagram of each message.
+	unsigned int sent = 0;
+	while(sent < count)
+	{
+		unsigned int messages = 0;
+		unsigned int next = sent;
+		while(next<count && next-sent<UDP_SOCKET_BATCH)	//an iov per datagram, messages fewer.
+		{
+			unsigned int first = next;
+			unsigned int segment = datagrams[first].size;
+			unsigned int bytes = segment;
+			iovs[next-sent].iov_base = (void *) datagrams[next].data;
+			iovs[next-sent].iov_len = datagrams[next].size;
+			++next;
+			while(m_gso && segment && next<count && next-sent<UDP_SOCKET_BATCH &&
+				next-first<GSO_MAX_SEGMENTS && bytes+datagrams[next].size<=GSO_MAX_BYTES &&
+				datagrams[next].size<=segment && datagrams[next].addr==datagrams[first].addr)
+			{
+				iovs[next-sent].iov_base = (void *) datagrams[next].data;
+				iovs[next-sent].iov_len = datagrams[next].size;
+				bytes += datagrams[next].size;
+				if(datagrams[next++].size < segment)
+				{
+					break;	//shorter one must be the last segment.
+				}
+			}
+			struct msghdr &hdr = msgs[messages].msg_hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.msg_name = (void *) datagrams[first].addr.addr();
+			hdr.msg_namelen = datagrams[first].addr.length();
+			hdr.msg_iov = &iovs[first-sent];
+			hdr.msg_iovlen = next-first;
+			if(next-first > 1)
+			{
+				hdr.msg_control = controls[messages];
+				hdr.msg_controllen = sizeof(controls[messages]);
+				struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+				cmsg->cmsg_level = SOL_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned short));
+				unsigned short gsoSize = segment;
+				memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+			}
+			firsts[messages++] = first;
+		}
+		firsts[messages] = next;
+		
+		int result = sendmmsg(m_sockfd, msgs, messages, 0);
+		if(result < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			if(m_gso && (errno==EIO || errno==EINVAL || errno==ENOPROTOOPT))
+			{
+				m_gso = false;	//device can not, send them one by one.
+				continue;
+			}
+			break;
+		}
+		sent = firsts[result];
+		if(result == 0)
+		{
+			break;
+		}
+	}
+	return sent;
+#endif
+}
+
+bool UdpSocket::setOffload(bool gro, bool gso)
+{
+#ifdef _WIN32
+	return !gro && !gso;
+#else
+	if(!m_isBound)
+	{
+		return false;
+	}
+	bool result = true;
+	int on = gro ? 1 : 0;
+	if(setsockopt(m_sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0)
+	{
+		result = !gro;
+		gro = false;
+	}
+	m_gro = gro;
+	
+	int segment = 0;	//probe, 0 keeps size per message.
+	if(gso && setsockopt(m_sockfd, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) < 0)
+	{
+		result = false;
+		gso = false;
+	}
+	m_gso = gso;
+	return result;
+#endif
+}
+
+bool UdpSocket::setBufferSize(unsigned int bytes)
+{
+	int size = bytes;
+	return m_isBound &&
+		setsockopt(m_sockfd, SOL_SOCKET, SO_RCVBUF, (char *) &size, sizeof(size)) == 0 &&
+		setsockopt(m_sockfd, SOL_SOCKET, SO_SNDBUF, (char *) &size, sizeof(size)) == 0;
+}
+
 void UdpSocket::setReadCallBack(Read read)
 {
 	m_onRead = read;
 }
 
+void UdpSocket::setReadBatchCallBack(ReadBatch read)
+{
+	m_onReadBatch = read;
+}
+
 bool UdpSocket::isBound() const
 {
 	return m_isBound; 
 }
+
+void UdpSocket::setReadPaused(bool paused)
+{
+	m_readPaused = paused;
+#ifndef _WIN32
+	if(m_loop)
+	{
+		m_loop->pause(m_watch, paused);
+	}
+#endif
+}
+
+bool UdpSocket::readPaused() const
+{
+	return m_readPaused;
+}
+
+bool UdpSocket::resolve(const char *addr, unsigned short port, SocketAddress &to, int family)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	struct addrinfo *res = NULL;
+	hints.ai_family = SocketAddress::familyOf(addr, family);
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(addr, String::fromNumber((unsigned int) port), &hints, &res) != 0)
+	{
+		return false;
+	}
+	to = SocketAddress(res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	return to.isValid();
+}
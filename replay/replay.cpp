@@ -0,0 +1,443 @@
+#include "eyre_turing_lib.h"
+#include "eyre_turing_network.h"
+#include <iostream>
+#include <map>
+#include <deque>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * tunnel-replay: replay a capture (server or client --capture file)
+ * against a tunnel server/client pair on this host.
+ * It acts as the users, connecting the user port of the server, and as
+ * the real server, listening the port the client connects. Streams are
+ * opened in captured order, and a connection accepted on real port
+ * belongs to the oldest stream not accepted yet.
+ * Every payload is sent when its captured time comes (divided by speed),
+ * latency is from written on one side to read on the other side.
+ *
+ * usage: tunnel-replay [-s speed|max] [-u userPort] [-r realPort] [-t timeout] file
+ */
+
+using namespace std;
+
+struct Op
+{
+	unsigned long long due;	// usec after replay start.
+	ByteArray data;
+	bool close;
+};
+
+struct Mark
+{
+	unsigned long long end;	// stream offset after this write.
+	unsigned long long at;	// usec written.
+};
+
+struct Side
+{
+	TcpSocket *socket;
+	bool ready;		// connected and not closed.
+	bool closed;
+	deque<Op> ops;	// to write from this side.
+	unsigned long long sent;
+	unsigned long long total;	// bytes this side writes in capture.
+	unsigned long long received;	// bytes read from the other side.
+	deque<Mark> marks;	// writes of this side, not read by the other side yet.
+};
+
+struct ReplayStream
+{
+	String id;
+	unsigned long long open;	// usec after replay start.
+	bool opened;
+	Side user;	// writes CAPTURE_UP.
+	Side real;	// writes CAPTURE_DOWN.
+};
+
+vector<ReplayStream *> streams;	// in open order.
+map<TcpSocket *, ReplayStream *> sockets;
+deque<ReplayStream *> waitingReal;	// opened by user, real server not accepted yet.
+pthread_mutex_t replayMutex;
+
+StatHistogram upLatency;	// user to real server.
+StatHistogram downLatency;	// real server to user.
+unsigned long long replayStart = 0;
+unsigned long long strangers = 0;	// accepted on real port without stream.
+
+const char *userHost = "127.0.0.1";
+unsigned short userPort = 6678;
+unsigned short realPort = 8000;
+
+// call with replayMutex locked, other side got size bytes written by side.
+void onArrived(Side &side, Side &other, unsigned long long size, StatHistogram &latency)
+{
+	unsigned long long now = TimerWheel::nowUsec();
+	other.received += size;
+	while(side.marks.size() && side.marks.front().end<=other.received)
+	{
+		latency.record(now-side.marks.front().at);
+		side.marks.pop_front();
+	}
+}
+
+void onRead(TcpSocket *tcpSocket, ByteArray data)
+{
+	pthread_mutex_lock(&replayMutex);
+	map<TcpSocket *, ReplayStream *>::iterator it = sockets.find(tcpSocket);
+	if(it != sockets.end())
+	{
+		ReplayStream *stream = it->second;
+		if(tcpSocket == stream->user.socket)
+		{
+			onArrived(stream->real, stream->user, data.size(), downLatency);
+		}
+		else
+		{
+			onArrived(stream->user, stream->real, data.size(), upLatency);
+		}
+	}
+	pthread_mutex_unlock(&replayMutex);
+}
+
+void onConnected(TcpSocket *tcpSocket)
+{
+	pthread_mutex_lock(&replayMutex);
+	map<TcpSocket *, ReplayStream *>::iterator it = sockets.find(tcpSocket);
+	if(it != sockets.end())
+	{
+		it->second->user.ready = true;
+	}
+	pthread_mutex_unlock(&replayMutex);
+}
+
+void onDisconnected(TcpSocket *tcpSocket)
+{
+	pthread_mutex_lock(&replayMutex);
+	map<TcpSocket *, ReplayStream *>::iterator it = sockets.find(tcpSocket);
+	if(it != sockets.end())
+	{
+		ReplayStream *stream = it->second;
+		Side &side = (tcpSocket == stream->user.socket) ? stream->user : stream->real;
+		side.ready = false;
+		side.closed = true;
+		if(&side == &(stream->real))
+		{
+			side.socket = NULL;	// deleted by server.
+		}
+		sockets.erase(it);
+	}
+	pthread_mutex_unlock(&replayMutex);
+}
+
+void onNewConnecting(TcpServer *server, TcpSocket *client)
+{
+	pthread_mutex_lock(&replayMutex);
+	if(waitingReal.empty())
+	{
+		++strangers;
+		pthread_mutex_unlock(&replayMutex);
+		client->abort();
+		return;
+	}
+	ReplayStream *stream = waitingReal.front();
+	waitingReal.pop_front();
+	stream->real.socket = client;
+	stream->real.ready = true;
+	sockets[client] = stream;
+	client->setDisconnectedCallBack(onDisconnected);
+	client->setReadCallBack(onRead);
+	pthread_mutex_unlock(&replayMutex);
+}
+
+void initSide(Side &side)
+{
+	side.socket = NULL;
+	side.ready = false;
+	side.closed = false;
+	side.sent = 0;
+	side.total = 0;
+	side.received = 0;
+}
+
+// read capture, due time of records divided by speed, 0 speed means no wait.
+bool load(const String &fileName, double speed)
+{
+	CaptureReader reader;
+	if(!reader.open(fileName))
+	{
+		return false;
+	}
+	map<String, ReplayStream *> byId;
+	CaptureRecord record;
+	bool first = true;
+	unsigned long long base = 0;
+	while(reader.next(record))
+	{
+		if(first)
+		{
+			base = record.time;
+			first = false;
+		}
+		unsigned long long due = speed>0 ? (unsigned long long) ((record.time-base)/speed) : 0;
+		map<String, ReplayStream *>::iterator it = byId.find(record.id);
+		if(record.kind == CAPTURE_OPEN)
+		{
+			if(it != byId.end())
+			{
+				continue;
+			}
+			ReplayStream *stream = new ReplayStream;
+			stream->id = record.id;
+			stream->open = due;
+			stream->opened = false;
+			initSide(stream->user);
+			initSide(stream->real);
+			byId[record.id] = stream;
+			streams.push_back(stream);
+			continue;
+		}
+		if(it == byId.end())
+		{
+			continue;	// opened before capture started.
+		}
+		Side &side = (record.direction == CAPTURE_UP) ? it->second->user : it->second->real;
+		if(side.ops.size() && side.ops.back().close)
+		{
+			continue;	// already closed.
+		}
+		Op op = {due, record.payload, record.kind == CAPTURE_CLOSE};
+		side.ops.push_back(op);
+		side.total += record.payload.size();
+	}
+	return true;
+}
+
+/*
+ * call with replayMutex locked, take what side can do now.
+ * Close waits other side wrote what it wrote before the close in capture,
+ * and both directions are all read, so no byte is lost by it.
+ */
+bool takeDue(ReplayStream *stream, Side &side, Side &other, unsigned long long now, Op &op)
+{
+	if(!side.ready || side.ops.empty() || side.ops.front().due>now)
+	{
+		return false;
+	}
+	op = side.ops.front();
+	if(op.close)
+	{
+		if(other.ops.size() && !other.ops.front().close && other.ops.front().due<=op.due)
+		{
+			return false;
+		}
+		if(stream->user.received<stream->real.sent || stream->real.received<stream->user.sent)
+		{
+			return false;
+		}
+		side.ready = false;
+	}
+	else
+	{
+		side.sent += op.data.size();
+		Mark mark = {side.sent, TimerWheel::nowUsec()};
+		side.marks.push_back(mark);
+	}
+	side.ops.pop_front();
+	return true;
+}
+
+// call with replayMutex locked.
+bool finished(ReplayStream *stream)
+{
+	return stream->opened && stream->user.ops.empty() && stream->real.ops.empty() &&
+		stream->user.received>=stream->real.total && stream->real.received>=stream->user.total;
+}
+
+/*
+ * one round: open streams and write ops due now.
+ * Return false when all streams finished.
+ */
+bool step()
+{
+	unsigned long long now = TimerWheel::nowUsec()-replayStart;
+	vector< pair<TcpSocket *, Op> > writes;
+	vector<TcpSocket *> connects;
+	bool done = true;
+
+	pthread_mutex_lock(&replayMutex);
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		ReplayStream *stream = streams[i];
+		if(!stream->opened)
+		{
+			done = false;
+			if(stream->open > now)
+			{
+				break;	// streams are in open order.
+			}
+			stream->opened = true;
+			stream->user.socket = new TcpSocket();
+			stream->user.socket->setConnectedCallBack(onConnected);
+			stream->user.socket->setDisconnectedCallBack(onDisconnected);
+			stream->user.socket->setReadCallBack(onRead);
+			sockets[stream->user.socket] = stream;
+			waitingReal.push_back(stream);
+			connects.push_back(stream->user.socket);
+			continue;
+		}
+		Op op;
+		while(takeDue(stream, stream->user, stream->real, now, op))
+		{
+			writes.push_back(pair<TcpSocket *, Op>(stream->user.socket, op));
+		}
+		while(takeDue(stream, stream->real, stream->user, now, op))
+		{
+			writes.push_back(pair<TcpSocket *, Op>(stream->real.socket, op));
+		}
+		if(!finished(stream))
+		{
+			done = false;
+		}
+	}
+	pthread_mutex_unlock(&replayMutex);
+
+	// socket calls may call back, never with replayMutex locked.
+	for(unsigned int i=0; i<connects.size(); ++i)
+	{
+		if(connects[i]->connectToHost(userHost, userPort))
+		{
+			fprintf(stderr, "can not connect user port %u!\n", userPort);
+		}
+	}
+	for(unsigned int i=0; i<writes.size(); ++i)
+	{
+		if(writes[i].second.close)
+		{
+			writes[i].first->abort();
+		}
+		else
+		{
+			writes[i].first->write(writes[i].second.data);
+		}
+	}
+	return !done;
+}
+
+void printLatency(const char *name, const StatHistogram &histogram)
+{
+	StatHistogram::Snapshot s = histogram.snapshot();
+	printf("%s latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f (%llu writes).\n", name,
+		s.percentile(0.5)/1000.0, s.percentile(0.9)/1000.0, s.percentile(0.99)/1000.0,
+		s.max/1000.0, s.count);
+}
+
+int main(int argc, char *argv[])
+{
+	double speed = 1;
+	unsigned int timeout = 60;
+	const char *fileName = NULL;
+	for(int i=1; i<argc; ++i)
+	{
+		if(strcmp(argv[i], "-s")==0 && i+1<argc)
+		{
+			++i;
+			speed = strcmp(argv[i], "max")==0 ? 0 : atof(argv[i]);
+		}
+		else if(strcmp(argv[i], "-u")==0 && i+1<argc)
+		{
+			userPort = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-r")==0 && i+1<argc)
+		{
+			realPort = atoi(argv[++i]);
+		}
+		else if(strcmp(argv[i], "-t")==0 && i+1<argc)
+		{
+			timeout = atoi(argv[++i]);
+		}
+		else
+		{
+			fileName = argv[i];
+		}
+	}
+	if(!fileName)
+	{
+		fprintf(stderr, "usage: %s [-s speed|max] [-u userPort] [-r realPort] [-t timeout] file\n", argv[0]);
+		return -1;
+	}
+
+	pthread_mutex_init(&replayMutex, NULL);
+	if(!load(fileName, speed))
+	{
+		fprintf(stderr, "can not read capture %s!\n", fileName);
+		return -1;
+	}
+	unsigned long long upBytes = 0, downBytes = 0;
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		upBytes += streams[i]->user.total;
+		downBytes += streams[i]->real.total;
+	}
+	cout<<"replay "<<streams.size()<<" streams, "<<upBytes<<" bytes up, "<<downBytes
+		<<" bytes down, speed "<<(speed>0 ? String::fromNumber(speed) : String("max"))<<"."<<endl;
+
+	TcpServer *realServer = new TcpServer();
+	realServer->setNewConnectingCallBack(onNewConnecting);
+	if(realServer->start(realPort, AF_INET, INADDR_ANY, 128))
+	{
+		fprintf(stderr, "real server start fail!\n");
+		delete realServer;
+		return -1;
+	}
+
+	replayStart = TimerWheel::nowUsec();
+	unsigned long long deadline = replayStart+(unsigned long long) timeout*1000000;
+	bool timedOut = false;
+	while(step())
+	{
+		if(TimerWheel::nowUsec() > deadline)
+		{
+			timedOut = true;
+			break;
+		}
+#ifdef _WIN32
+		Sleep(1);
+#else
+		usleep(200);
+#endif
+	}
+	double elapsed = (TimerWheel::nowUsec()-replayStart)/1e6;
+
+	pthread_mutex_lock(&replayMutex);
+	unsigned int unfinished = 0;
+	unsigned long long upGot = 0, downGot = 0;
+	for(unsigned int i=0; i<streams.size(); ++i)
+	{
+		if(!finished(streams[i]))
+		{
+			++unfinished;
+		}
+		upGot += streams[i]->real.received;
+		downGot += streams[i]->user.received;
+	}
+	pthread_mutex_unlock(&replayMutex);
+
+	printf("elapsed %.3f sec%s.\n", elapsed, timedOut ? " (timeout)" : "");
+	printf("up %llu/%llu bytes, down %llu/%llu bytes, %.3f MB/s.\n", upGot, upBytes, downGot, downBytes,
+		elapsed>0 ? (upGot+downGot)/elapsed/1048576 : 0.0);
+	printLatency("up", upLatency);
+	printLatency("down", downLatency);
+	printf("streams %u, unfinished %u, unexpected connections %llu.\n",
+		(unsigned int) streams.size(), unfinished, strangers);
+
+	delete realServer;
+	return unfinished ? 1 : 0;
+}
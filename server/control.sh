@@ -48,6 +48,25 @@ check_range() {
 	return 0
 }
 
+# 保存[listen]配置段，保留其他配置段（如[scheduler]）及[listen]中界面不改的项（如udp、ipv6、backlog）
+save_listen() {
+	local others=$(awk '/^\[/{skip=($0 ~ /^\[listen\]/)} !skip' "$1")
+	local rest=$(awk '/^\[/{inside=($0 ~ /^\[listen\]/); next} inside && NF && !/^(client|user|manager|title)=/' "$1")
+	echo "[listen]" >"$1"
+	echo "client=$2" >>"$1"
+	echo "user=$3" >>"$1"
+	echo "manager=$4" >>"$1"
+	if [ -n "$rest" ]; then
+		echo "$rest" >>"$1"
+	fi
+	echo "title=$5" >>"$1"
+	if [ -n "$others" ]; then
+		echo "" >>"$1"
+		echo "$others" >>"$1"
+	fi
+	return 0
+}
+
 main() {
 	# 配置文件名
 	local ini="config.ini"
@@ -92,13 +111,13 @@ main() {
 		
 		case $choice in
 			'restart')
-				eval "echo \"q\" >&${sockfd}"
+				eval "echo \"kill\" >&${sockfd}"
 				eval "cat <&${sockfd}"	# 等待服务关闭
 				
 				nohup ./server --title "${title}" &>/dev/null &
 				;;
 			'stop')
-				eval "echo \"q\" >&${sockfd}"
+				eval "echo \"kill\" >&${sockfd}"
 				eval "cat <&${sockfd}"	# 等待服务关闭
 				;;
 			'settings')
@@ -135,11 +154,7 @@ main() {
 				fi
 				
 				# 修改配置
-				echo "[listen]" >"$ini"
-				echo "client=${client}" >>"$ini"
-				echo "user=${user}" >>"$ini"
-				echo "manager=${manager}" >>"$ini"
-				echo "title=${title}" >>"$ini"
+				save_listen "$ini" "$client" "$user" "$manager" "$title"
 				
 				continue
 				;;
@@ -174,11 +189,7 @@ main() {
 				fi
 				
 				# 修改配置
-				echo "[listen]" >"$ini"
-				echo "client=${client}" >>"$ini"
-				echo "user=${user}" >>"$ini"
-				echo "manager=${manager}" >>"$ini"
-				echo "title=${title}" >>"$ini"
+				save_listen "$ini" "$client" "$user" "$manager" "$title"
 				
 				continue
 				;;
@@ -3,7 +3,11 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <stdio.h>
 #include <string.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -14,7 +18,8 @@
 /*
  * 添加了控制窗口支持（不支持Windows）
  * 可以在本级目录下使用: ./control.sh 控制本服务
- * 本代码主要添加了管理端口，可以使用管理端口关闭该服务（管理端口连接发送 任何信息 即可关闭服务 ）
+ * 本代码主要添加了管理端口，可以使用管理端口关闭该服务（管理端口连接发送 kill 一行即可关闭服务，其他信息只断开该连接）
+ * 统计在[stats] port端口提供: GET /metrics (Prometheus) 或 GET /stats (json)，port为0则不提供
  */
 
 using namespace std;
@@ -23,44 +28,1603 @@ TcpServer *serverToClient = NULL;
 TcpServer *serverToUser = NULL;
 #ifndef _WIN32
 TcpServer *manager = NULL;	// 服务管理
-bool beKilled = false;	// 被管理端口叫关闭
+volatile bool beKilled = false;	// 被管理端口叫关闭，或收到SIGTERM/SIGINT
 #endif
 
 TcpSocket *virtualClient = NULL;
 
 map<String, TcpSocket *> users;
+map<TcpSocket *, String> users_;
 pthread_mutex_t usersMutex;
+unsigned long long nextUserId = 0;	// id of user, never reused.
 
 ByteArray head;
 ByteArray buffer;
 String sender;
 unsigned long long restBufferSize = 0;
+bool compressedBuffer = false;	// buffer is a "M" frame.
+bool datagramBuffer = false;	// buffer is a "u" frame.
+unsigned long long rawBufferSize = 0;
 
 struct Message
 {
 	String type;
 	String id;
 	ByteArray data;
+	unsigned long long stamp;	// usec data was read from virtual client.
 };
 vector<Message> m_messages;
 pthread_mutex_t messagesMutex;
 
 bool printMessage = false;
+unsigned int previewBytes = LOG_PREVIEW;	// bytes of payload printed with -p.
+CaptureWriter *capture = NULL;	// --capture file, streams recorded for tunnel-replay.
+
+void onCaptureFlush(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	capture->flush();
+	wheel->add(1000, onCaptureFlush);
+}
+
+CompressAlgorithm compressAlgorithm = COMPRESS_NONE;
+int compressLevel = COMPRESS_LEVEL_MIN;
+unsigned int compressMinSize = COMPRESS_MIN_SIZE;
+bool compressEnabled = false;	// negotiated with virtual client.
+map<String, StreamCompressor *> compressors;		// per user, frames we send.
+map<String, StreamDecompressor *> decompressors;	// per user, frames we receive.
+pthread_mutex_t compressMutex;
+
+FrameScheduler *scheduler = NULL;	// write frames to virtual client fairly.
+unsigned int tcpWeight = 1;	// scheduler weight of each tcp user stream.
+unsigned int udpWeight = 1;	// scheduler weight of each udp flow.
+
+/*
+ * Session, a short drop of the link to virtual client does not kill users.
+ * format:
+ * hello: s:token# (virtual client sends s# for a new session)
+ * ack: k:id;offset#
+ * resume: r:id;offset# for every stream, then R#
+ * Each side keeps bytes it sent of a stream until peer acks them, on resume
+ * both sides tell how many bytes they got and send the rest again.
+ * Users are kept grace sec after the link drops.
+ */
+struct Stream
+{
+	ReplayBuffer sent;	// bytes sent to virtual client, until acked.
+	unsigned long long received;	// bytes got from virtual client.
+	unsigned long long acked;		// received bytes we acked.
+	bool known;	// virtual client acked this stream, so it got "c".
+	unsigned long long active;	// msec a byte went either way.
+	unsigned long long idleTimer;
+	bool readDone;	// user finished sending, "h" sent after its datas.
+	bool writeDone;	// real server finished, user got fin.
+	unsigned long long closeTimer;	// deadline once a way finished.
+};
+map<String, Stream *> streams;
+pthread_mutex_t sessionMutex;
+String sessionToken;
+bool linkReady = false;	// session is established on current link.
+map<String, unsigned long long> resumeOffsets;	// bytes virtual client got, when resuming.
+unsigned int grace = 30;	// sec to keep users without link.
+unsigned long long graceTimer = 0;
+unsigned long long replayLimit = REPLAY_BUFFER_LIMIT;	// bytes kept per stream.
+unsigned long long ackBytes = 65536;	// ack once got this many bytes.
+
+/*
+ * A user nothing went to or from for idle sec is closed, so half-open
+ * ones do not pile up. Each stream has one timer, moved on only when it
+ * fires, bytes just stamp active.
+ */
+unsigned int idle = 3600;	// sec, 0 never.
+map<unsigned long long, String> idleTimers;	// timer to its user.
+
+/*
+ * Once a way of a user finished (fin or abortWhenWritten), the rest must
+ * close in closeTimeout sec, else a peer that never reads or never sends
+ * fin holds it forever. The user is aborted when its timer fires.
+ */
+unsigned int closeTimeout = 60;	// sec, 0 never.
+map<unsigned long long, String> closeTimers;	// timer to its user.
+
+TimerWheel *timers = NULL;
+
+/*
+ * Stats, scraped from stats port by a http GET:
+ * /metrics for Prometheus text format, /stats for json.
+ * Counters and histograms take no lock, threads forwarding data never
+ * wait each other for stats. Times are in usec.
+ */
+struct Stats
+{
+	StatCounter userBytesIn;	// read from users.
+	StatCounter userBytesOut;	// written to users.
+	StatCounter tunnelBytesIn;	// read from virtual client.
+	StatCounter tunnelFramesIn;
+	StatCounter streamsOpened;
+	StatCounter streamsRejected;	// no session when user came.
+	StatCounter streamsClosed;	// user disconnected.
+	StatCounter streamsEnded;	// real server disconnected.
+	StatCounter streamsKilled;	// lost with session or broken frame.
+	StatCounter streamsIdle;	// closed by idle timeout.
+	StatCounter closeTimeouts;	// aborted, not closed in closeTimeout.
+	StatCounter halfCloses;	// one way finished while the other goes on.
+	StatCounter brokenFrames;
+	StatCounter linkDrops;
+	StatCounter sessions;
+	StatCounter resumes;
+	StatCounter datagramsIn;	// read from udp users.
+	StatCounter datagramsOut;	// written to udp users.
+	StatCounter datagramsDropped;	// link down or flow unknown.
+	StatCounter flowsOpened;
+	StatCounter flowsExpired;
+	StatCounter shapePauses;	// reads paused by rate limits.
+	StatCounter sendPauses;	// virtual client paused, a user reads too slow.
+	StatCounter sendStalls;	// users killed, full too long.
+	StatCounter refusedRate;	// users refused by admission control, by reason.
+	StatCounter refusedStreams;
+	StatCounter refusedIp;
+	StatCounter refusedPending;
+	StatHistogram frameDecode;	// unpack payload of a frame.
+	StatHistogram userToTunnel;	// read from user to written to virtual client.
+	StatHistogram tunnelToUser;	// read from virtual client to written to user.
+	StatHistogram loop;	// event loop iteration.
+};
+Stats stats;
+unsigned long long readStamp = 0;	// usec of data messageRead() is handling.
 
 void onNewConnection(TcpServer *server, TcpSocket *client);
 void onStartSucceed(TcpServer *server);
 void onClosed(TcpServer *Server);
 void onDisconnected(TcpSocket *tcpSocket);
 void onRead(TcpSocket *tcpSocket, ByteArray data);
+void onReadClosed(TcpSocket *tcpSocket);
+void forgetShape(TcpSocket *user);
+void releaseUser(TcpSocket *user);
+
+/*
+ * Datas to a user are posted to its socket and sent as the user reads,
+ * decoding never waits a user. A user with more than sendHighWater bytes
+ * waiting pauses reading virtual client till it drains to sendLowWater.
+ * All users wait then, so one full for sendStall msec is killed.
+ */
+unsigned long long sendHighWater = 1048576;
+unsigned long long sendLowWater = 262144;
+unsigned int sendStall = 5000;	// msec, 0 never.
+map<TcpSocket *, unsigned long long> fullUsers;	// to msec full since.
+TcpSocket *pausedLink = NULL;	// virtual client paused for fullUsers.
+pthread_mutex_t fullMutex;
+
+// queue of user passed high water, in thread decoding virtual client.
+void userFull(TcpSocket *user)
+{
+	pthread_mutex_lock(&fullMutex);
+	if(fullUsers.find(user) == fullUsers.end())
+	{
+		fullUsers[user] = TimerWheel::now();
+		stats.sendPauses.add();
+	}
+	if(pausedLink != virtualClient)
+	{
+		if(pausedLink)
+		{
+			pausedLink->setReadPaused(false, TCP_SOCKET_PAUSE_SEND);	// link of before.
+		}
+		pausedLink = virtualClient;
+		if(pausedLink)
+		{
+			pausedLink->setReadPaused(true, TCP_SOCKET_PAUSE_SEND);
+		}
+	}
+	pthread_mutex_unlock(&fullMutex);
+}
+
+// user drained or gone, virtual client goes on when no user is full.
+void forgetFull(TcpSocket *user)
+{
+	pthread_mutex_lock(&fullMutex);
+	fullUsers.erase(user);
+	if(fullUsers.empty() && pausedLink)
+	{
+		pausedLink->setReadPaused(false, TCP_SOCKET_PAUSE_SEND);
+		pausedLink = NULL;
+	}
+	pthread_mutex_unlock(&fullMutex);
+}
+
+void onSendSweep(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	unsigned long long now = TimerWheel::now();
+	vector<TcpSocket *> stalled;
+	pthread_mutex_lock(&fullMutex);
+	for(map<TcpSocket *, unsigned long long>::iterator it = fullUsers.begin(); it != fullUsers.end(); ++it)
+	{
+		if(now-it->second >= sendStall)
+		{
+			stalled.push_back(it->first);
+		}
+	}
+	pthread_mutex_unlock(&fullMutex);
+	
+	for(unsigned int i=0; i<stalled.size(); ++i)
+	{
+		String user;
+		pthread_mutex_lock(&usersMutex);
+		map<TcpSocket *, String>::iterator it = users_.find(stalled[i]);
+		if(it != users_.end())
+		{
+			user = it->second;
+		}
+		pthread_mutex_unlock(&usersMutex);
+		if(!user.size())
+		{
+			forgetFull(stalled[i]);
+			continue;
+		}
+		EYRE_LOG_WARN("user "<<user<<" read nothing for "<<sendStall<<" msec, kill it.");
+		stats.sendStalls.add();
+		stalled[i]->abort();	// disconnected call back forgets it.
+	}
+	wheel->add(1000, onSendSweep);
+}
 
-pthread_mutex_t tellMutex;
+// control frame, no user stream.
 void tellToVirtualClient(ByteArray &b)
 {
 	if(virtualClient)
 	{
-		pthread_mutex_lock(&tellMutex);
-		virtualClient->write(b);
-		pthread_mutex_unlock(&tellMutex);
+		scheduler->pushControl(b);
+	}
+}
+
+// frame of user id, keep order with other frames of this user.
+void tellToVirtualClient(const String &id, ByteArray &b, unsigned int weight)
+{
+	if(virtualClient && linkReady)
+	{
+		scheduler->push(id, b, weight);
+	}
+}
+
+/*
+ * Compress data of user id to packed.
+ * Return false if data should be sent raw.
+ */
+bool packMessage(const String &id, const ByteArray &data, ByteArray &packed)
+{
+	if(!compressEnabled)
+	{
+		return false;
+	}
+	pthread_mutex_lock(&compressMutex);
+	map<String, StreamCompressor *>::iterator it = compressors.find(id);
+	if(it == compressors.end())
+	{
+		it = compressors.insert(pair<String, StreamCompressor *>(id,
+			new StreamCompressor(compressAlgorithm, compressLevel, compressMinSize))).first;
+	}
+	bool result = it->second->compress(data, packed);
+	pthread_mutex_unlock(&compressMutex);
+	return result;
+}
+
+/*
+ * Decompress data of a "M" frame, rawSize 0 means data is stored raw but
+ * still in history of user id.
+ * Return false if compressed data is broken.
+ */
+bool unpackMessage(const String &id, bool compressed, unsigned long long rawSize, ByteArray &data)
+{
+	if(!compressed)
+	{
+		return true;
+	}
+	pthread_mutex_lock(&compressMutex);
+	map<String, StreamDecompressor *>::iterator it = decompressors.find(id);
+	if(it == decompressors.end())
+	{
+		it = decompressors.insert(pair<String, StreamDecompressor *>(id,
+			new StreamDecompressor())).first;
+	}
+	bool result = true;
+	if(rawSize)
+	{
+		ByteArray raw;
+		result = it->second->decompress(data, data.size(), rawSize, raw);
+		data = raw;
+	}
+	else
+	{
+		it->second->update(data);
+	}
+	pthread_mutex_unlock(&compressMutex);
+	return result;
+}
+
+// user id finished, drop its compress history. empty id means all users.
+void forgetCompress(const String &id)
+{
+	pthread_mutex_lock(&compressMutex);
+	for(map<String, StreamCompressor *>::iterator it = compressors.begin();
+		it != compressors.end();)
+	{
+		if(id.size() && it->first!=id)
+		{
+			++it;
+			continue;
+		}
+		delete it->second;
+		compressors.erase(it++);
+	}
+	for(map<String, StreamDecompressor *>::iterator it = decompressors.begin();
+		it != decompressors.end();)
+	{
+		if(id.size() && it->first!=id)
+		{
+			++it;
+			continue;
+		}
+		delete it->second;
+		decompressors.erase(it++);
+	}
+	pthread_mutex_unlock(&compressMutex);
+}
+
+/*
+ * frames of the message user sent.
+ * format:
+ * m:id;length#data
+ * or when compression is on:
+ * M:id;length;rawLength#data
+ * rawLength 0 means data is not compressed, but in history.
+ * data is split by scheduler quantum, so a bulk user can not hold the
+ * tunnel and small frames of other users are interleaved.
+ */
+void sendMessageFrames(const String &id, const ByteArray &data, unsigned long long stamp=0)
+{
+	unsigned int quantum = scheduler->quantum();
+	for(unsigned int offset=0; offset<data.size(); offset+=quantum)
+	{
+		ByteArray part = data.mid(offset, quantum);
+		ByteArray packed;
+		ByteArray sendMessage;
+		if(!compressEnabled)
+		{
+			sendMessage = "m:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(part.size()), CODEC_UTF8)+"#"+part;
+		}
+		else if(packMessage(id, part, packed))
+		{
+			sendMessage = "M:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(packed.size()), CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(part.size()), CODEC_UTF8)+"#"+packed;
+		}
+		else
+		{
+			sendMessage = "M:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(part.size()), CODEC_UTF8)+";0#"+part;
+		}
+		scheduler->push(id, sendMessage, tcpWeight, stamp);
+	}
+}
+
+// tell virtual client the message user sent, and keep it until acked.
+void tellMessageToVirtualClient(const String &id, const ByteArray &data, unsigned long long stamp)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->sent.append(data);
+		it->second->active = TimerWheel::now();
+		if(virtualClient && linkReady)
+		{
+			sendMessageFrames(id, data, stamp);
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+void onIdleTimeout(TimerWheel *wheel, unsigned long long id, void *arg);
+void onCloseTimeout(TimerWheel *wheel, unsigned long long id, void *arg);
+
+unsigned int unackedOpens = 0;	// streams virtual client has not acked, with sessionMutex locked.
+
+// call with sessionMutex locked.
+void newStream(const String &id)
+{
+	Stream *stream = new Stream;
+	stream->sent.setLimit(replayLimit);
+	stream->received = 0;
+	stream->acked = 0;
+	stream->known = false;
+	stream->active = TimerWheel::now();
+	stream->idleTimer = 0;
+	stream->readDone = false;
+	stream->writeDone = false;
+	stream->closeTimer = 0;
+	if(idle)
+	{
+		stream->idleTimer = timers->add(idle*1000, onIdleTimeout);
+		idleTimers[stream->idleTimer] = id;
+	}
+	streams[id] = stream;
+	++unackedOpens;
+}
+
+// call with sessionMutex locked.
+void deleteStream(Stream *stream)
+{
+	if(!stream->known)
+	{
+		--unackedOpens;
+	}
+	if(stream->idleTimer)
+	{
+		timers->cancel(stream->idleTimer);
+		idleTimers.erase(stream->idleTimer);
+	}
+	if(stream->closeTimer)
+	{
+		timers->cancel(stream->closeTimer);
+		closeTimers.erase(stream->closeTimer);
+	}
+	delete stream;
+}
+
+// call with sessionMutex locked, a way of user id finished.
+void startCloseTimer(const String &id, Stream *stream)
+{
+	if(closeTimeout && !stream->closeTimer)
+	{
+		stream->closeTimer = timers->add(closeTimeout*1000, onCloseTimeout);
+		closeTimers[stream->closeTimer] = id;
+	}
+}
+
+// call with sessionMutex unlocked.
+void startCloseTimer(const String &id)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		startCloseTimer(id, it->second);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// user id finished, tell virtual client if the stream was alive.
+void closeStream(const String &id)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		deleteStream(it->second);
+		streams.erase(it);
+		
+		/*
+		 * tell virtual client that user disconnected.
+		 * format:
+		 * d:id#
+		 */
+		ByteArray sendMessage = "d:"+ByteArray::fromString(id, CODEC_UTF8)+"#";
+		tellToVirtualClient(id, sendMessage, tcpWeight);
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// call with sessionMutex locked.
+void ackStream(const String &id, Stream *stream)
+{
+	if(!linkReady)
+	{
+		return;
+	}
+	stream->acked = stream->received;
+	ByteArray sendMessage = "k:"+ByteArray::fromString(id, CODEC_UTF8)+";"+
+		ByteArray::fromString(String::fromNumber(stream->received), CODEC_UTF8)+"#";
+	tellToVirtualClient(sendMessage);
+}
+
+// count bytes got of user id, ack them once got enough.
+void onStreamReceived(const String &id, unsigned long long size)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->received += size;
+		it->second->active = TimerWheel::now();
+		if(it->second->received-it->second->acked >= ackBytes)
+		{
+			ackStream(id, it->second);
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// ack all bytes got, so virtual client can free them.
+void flushAcks()
+{
+	pthread_mutex_lock(&sessionMutex);
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+	{
+		if(it->second->received > it->second->acked)
+		{
+			ackStream(it->first, it->second);
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+void onStreamAck(const String &id, unsigned long long offset)
+{
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator it = streams.find(id);
+	if(it != streams.end())
+	{
+		it->second->sent.ack(offset);
+		if(!it->second->known)
+		{
+			it->second->known = true;
+			--unackedOpens;
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+/*
+ * Heartbeat, both side ping each other and measure rtt.
+ * format:
+ * ping: a:seq#
+ * pong: A:seq#
+ * Any frame received means the link is alive. When a ping gets nothing
+ * back, probe again after pongTimeout() instead of a whole heart, and
+ * heartMiss such pings in a row means the link is dead.
+ */
+unsigned int heart = 15;	// sec between pings.
+unsigned int heartMiss = 3;
+unsigned long long heartTimer = 0;
+unsigned long long pingSeq = 0;
+bool pingPending = false;
+unsigned long long pingSentAt = 0;		// usec.
+unsigned long long lastReceived = 0;	// usec.
+unsigned int pingMisses = 0;
+long long srtt = -1;	// smoothed rtt usec, -1 means no sample yet.
+long long rttvar = 0;
+pthread_mutex_t heartMutex;
+
+// msec to wait a pong before probe again.
+unsigned int pongTimeout()
+{
+	unsigned int maxTimeout = heart*1000;
+	if(srtt < 0)
+	{
+		return maxTimeout;
+	}
+	unsigned long long timeout = (srtt+4*rttvar)/1000;
+	if(timeout < 200)
+	{
+		timeout = 200;
+	}
+	return timeout<maxTimeout ? timeout : maxTimeout;
+}
+
+void onHeartTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	TcpSocket *link = virtualClient;
+	pthread_mutex_lock(&heartMutex);
+	if(id!=heartTimer || !link)
+	{
+		pthread_mutex_unlock(&heartMutex);
+		return;
+	}
+	if(pingPending)
+	{
+		if(lastReceived<pingSentAt && !link->readPaused())	// paused, pong waits unread.
+		{
+			++pingMisses;
+		}
+		else
+		{
+			pingMisses = 0;
+		}
+	}
+	bool dead = (pingMisses >= heartMiss);
+	ByteArray sendMessage;
+	if(dead)
+	{
+		heartTimer = 0;
+	}
+	else
+	{
+		++pingSeq;
+		pingPending = true;
+		pingSentAt = TimerWheel::nowUsec();
+		sendMessage = "a:"+ByteArray::fromString(String::fromNumber(pingSeq), CODEC_UTF8)+"#";
+		heartTimer = timers->add(pingMisses ? pongTimeout() : heart*1000, onHeartTimeout);
+	}
+	pthread_mutex_unlock(&heartMutex);
+	
+	flushAcks();
+
+	if(dead)
+	{
+		EYRE_LOG_WARN("virtual client no response, kill the link.");
+		link->abort();
+		return;
+	}
+	tellToVirtualClient(sendMessage);
+}
+
+void startHeartbeat()
+{
+	pthread_mutex_lock(&heartMutex);
+	if(heartTimer)
+	{
+		timers->cancel(heartTimer);
+	}
+	pingPending = false;
+	pingMisses = 0;
+	srtt = -1;
+	rttvar = 0;
+	lastReceived = TimerWheel::nowUsec();
+	heartTimer = timers->add(heart*1000, onHeartTimeout);
+	pthread_mutex_unlock(&heartMutex);
+}
+
+void stopHeartbeat()
+{
+	pthread_mutex_lock(&heartMutex);
+	if(heartTimer)
+	{
+		timers->cancel(heartTimer);
+		heartTimer = 0;
+	}
+	pingPending = false;
+	pthread_mutex_unlock(&heartMutex);
+}
+
+void onPing(const ByteArray &seq)
+{
+	ByteArray sendMessage = "A:"+seq+"#";
+	tellToVirtualClient(sendMessage);
+}
+
+void onPong(unsigned long long seq)
+{
+	pthread_mutex_lock(&heartMutex);
+	if(!pingPending || seq!=pingSeq)
+	{
+		pthread_mutex_unlock(&heartMutex);
+		return;
+	}
+	long long rtt = TimerWheel::nowUsec()-pingSentAt;
+	if(srtt < 0)
+	{
+		srtt = rtt;
+		rttvar = rtt/2;
+	}
+	else
+	{
+		long long diff = srtt>rtt ? srtt-rtt : rtt-srtt;
+		rttvar = (3*rttvar+diff)/4;
+		srtt = (7*srtt+rtt)/8;
+	}
+	pingPending = false;
+	pingMisses = 0;
+	pthread_mutex_unlock(&heartMutex);
+	EYRE_LOG_DEBUG("virtual client alive, rtt: "<<rtt<<" usec.");
+}
+
+// 16 random bytes in hex, whoever knows the token takes over the session.
+String newSessionToken()
+{
+	unsigned char bytes[16];
+	bool got = false;
+#ifndef _WIN32
+	FILE *random = fopen("/dev/urandom", "rb");
+	if(random)
+	{
+		got = (fread(bytes, 1, sizeof(bytes), random) == sizeof(bytes));
+		fclose(random);
+	}
+#endif
+	if(!got)
+	{
+		EYRE_LOG_WARN("can not read /dev/urandom, session token is guessable.");
+		unsigned long long seed = TimerWheel::nowUsec()^((unsigned long long) time(NULL)<<24);
+		for(unsigned int i=0; i<sizeof(bytes); ++i)
+		{
+			bytes[i] = (unsigned char) (rand()^(seed>>(i%8*8)));
+		}
+	}
+	char token[sizeof(bytes)*2+1];
+	for(unsigned int i=0; i<sizeof(bytes); ++i)
+	{
+		sprintf(token+i*2, "%02x", bytes[i]);
+	}
+	return String::fromUtf8(token);
+}
+
+// abort users without telling virtual client, it does not have them.
+void killUsers(const vector<String> &ids)
+{
+	vector<TcpSocket *> killed;
+	pthread_mutex_lock(&usersMutex);
+	for(unsigned int i=0; i<ids.size(); ++i)
+	{
+		map<String, TcpSocket *>::iterator it = users.find(ids[i]);
+		if(it == users.end())
+		{
+			continue;
+		}
+		TcpSocket *user = it->second;
+		users_.erase(user);
+		users.erase(it);
+		releaseUser(user);
+		forgetShape(user);
+		forgetFull(user);
+		scheduler->setSource(ids[i], NULL);
+		user->setDisconnectedCallBack(NULL);
+		killed.push_back(user);
+		forgetCompress(ids[i]);
+		stats.streamsKilled.add();
+	}
+	pthread_mutex_unlock(&usersMutex);
+	
+	// abort waits call backs of the user, which may wait usersMutex.
+	for(unsigned int i=0; i<killed.size(); ++i)
+	{
+		killed[i]->abort();
+	}
+}
+
+// close the user if it stayed idle, else wait the rest of idle from its last byte.
+void onIdleTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	String user;
+	pthread_mutex_lock(&sessionMutex);
+	map<unsigned long long, String>::iterator t = idleTimers.find(id);
+	if(t != idleTimers.end())
+	{
+		map<String, Stream *>::iterator it = streams.find(t->second);
+		idleTimers.erase(t);
+		if(it != streams.end())
+		{
+			Stream *stream = it->second;
+			unsigned long long quiet = TimerWheel::now()-stream->active;
+			stream->idleTimer = 0;
+			if(quiet >= idle*1000ULL)
+			{
+				user = it->first;
+			}
+			else
+			{
+				stream->idleTimer = wheel->add(idle*1000ULL-quiet, onIdleTimeout);
+				idleTimers[stream->idleTimer] = it->first;
+			}
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	if(!user.size())
+	{
+		return;
+	}
+	
+	TcpSocket *temp = NULL;
+	pthread_mutex_lock(&usersMutex);
+	map<String, TcpSocket *>::iterator it = users.find(user);
+	if(it != users.end())
+	{
+		temp = it->second;
+	}
+	pthread_mutex_unlock(&usersMutex);
+	if(temp)
+	{
+		EYRE_LOG_INFO("user "<<user<<" idle for "<<idle<<" sec, close it.");
+		stats.streamsIdle.add();
+		temp->abort();	// disconnected call back closes its stream.
+	}
+	else
+	{
+		closeStream(user);
+	}
+}
+
+// user did not finish closing in closeTimeout sec, abort it.
+void onCloseTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	String user;
+	pthread_mutex_lock(&sessionMutex);
+	map<unsigned long long, String>::iterator t = closeTimers.find(id);
+	if(t != closeTimers.end())
+	{
+		map<String, Stream *>::iterator it = streams.find(t->second);
+		closeTimers.erase(t);
+		if(it != streams.end())
+		{
+			it->second->closeTimer = 0;
+			user = it->first;
+		}
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	if(!user.size())
+	{
+		return;
+	}
+	
+	TcpSocket *temp = NULL;
+	pthread_mutex_lock(&usersMutex);
+	map<String, TcpSocket *>::iterator it = users.find(user);
+	if(it != users.end())
+	{
+		temp = it->second;
+	}
+	pthread_mutex_unlock(&usersMutex);
+	EYRE_LOG_WARN("user "<<user<<" not closed in "<<closeTimeout<<" sec, abort it.");
+	stats.closeTimeouts.add();
+	if(temp)
+	{
+		temp->abort();	// disconnected call back closes its stream.
+	}
+	else
+	{
+		closeStream(user);
+	}
+}
+
+// call with sessionMutex locked, return ids of users dropped.
+vector<String> endSession()
+{
+	vector<String> ids;
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+	{
+		ids.push_back(it->first);
+		deleteStream(it->second);
+	}
+	streams.clear();
+	resumeOffsets.clear();
+	sessionToken = "";
+	if(graceTimer)
+	{
+		timers->cancel(graceTimer);
+		graceTimer = 0;
+	}
+	return ids;
+}
+
+void onGraceTimeout(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	pthread_mutex_lock(&sessionMutex);
+	if(id != graceTimer)
+	{
+		pthread_mutex_unlock(&sessionMutex);
+		return;
+	}
+	graceTimer = 0;
+	vector<String> killed = endSession();
+	pthread_mutex_unlock(&sessionMutex);
+	
+	EYRE_LOG_WARN("virtual client not back in "<<grace<<" sec, kill "<<killed.size()<<" users.");
+	killUsers(killed);
+}
+
+// link to virtual client is gone, keep users grace sec if session can resume.
+void onLinkLost()
+{
+	stopHeartbeat();
+	stats.linkDrops.add();
+	
+	pthread_mutex_lock(&fullMutex);
+	fullUsers.clear();
+	if(pausedLink)
+	{
+		pausedLink->setReadPaused(false, TCP_SOCKET_PAUSE_SEND);
+		pausedLink = NULL;
+	}
+	pthread_mutex_unlock(&fullMutex);
+	
+	pthread_mutex_lock(&sessionMutex);
+	linkReady = false;
+	scheduler->setTarget(NULL);
+	scheduler->clear();
+	compressEnabled = false;
+	forgetCompress("");
+	head = "";
+	buffer = "";
+	sender = "";
+	restBufferSize = 0;
+	compressedBuffer = false;
+	datagramBuffer = false;
+	resumeOffsets.clear();
+	vector<String> killed;
+	if(sessionToken.size() && grace)
+	{
+		if(!graceTimer)
+		{
+			graceTimer = timers->add(grace*1000, onGraceTimeout);
+		}
+		EYRE_LOG_INFO("keep "<<streams.size()<<" users for "<<grace<<" sec.");
+	}
+	else
+	{
+		killed = endSession();
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	
+	if(killed.size())
+	{
+		killUsers(killed);
+		EYRE_LOG_INFO("kill all user, now user count: "<<users.size());
+	}
+}
+
+/*
+ * virtual client says hello with token of its session, resume the session
+ * if it is ours, or start a new one and kill users of the old.
+ */
+void onSessionHello(const String &token)
+{
+	vector<String> killed;
+	pthread_mutex_lock(&sessionMutex);
+	if(sessionToken.size() && token==sessionToken)
+	{
+		if(graceTimer)
+		{
+			timers->cancel(graceTimer);
+			graceTimer = 0;
+		}
+		ByteArray sendMessage = "s:"+ByteArray::fromString(sessionToken, CODEC_UTF8)+"#";
+		tellToVirtualClient(sendMessage);
+		for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+		{
+			sendMessage = "r:"+ByteArray::fromString(it->first, CODEC_UTF8)+";"+
+				ByteArray::fromString(String::fromNumber(it->second->received), CODEC_UTF8)+"#";
+			tellToVirtualClient(sendMessage);
+			it->second->acked = it->second->received;
+		}
+		sendMessage = "R#";
+		tellToVirtualClient(sendMessage);
+		EYRE_LOG_INFO("session "<<sessionToken<<" resuming, "<<streams.size()<<" users.");
+	}
+	else
+	{
+		killed = endSession();
+		sessionToken = newSessionToken();
+		ByteArray sendMessage = "s:"+ByteArray::fromString(sessionToken, CODEC_UTF8)+"#";
+		tellToVirtualClient(sendMessage);
+		linkReady = true;
+		stats.sessions.add();
+		EYRE_LOG_INFO("new session "<<sessionToken<<".");
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	killUsers(killed);
+}
+
+void onResumeOffset(const String &id, unsigned long long offset)
+{
+	pthread_mutex_lock(&sessionMutex);
+	resumeOffsets[id] = offset;
+	pthread_mutex_unlock(&sessionMutex);
+}
+
+// call with sessionMutex locked.
+bool replayStream(const String &id, Stream *stream, unsigned long long offset)
+{
+	ByteArray data;
+	if(!stream->sent.read(offset, data))
+	{
+		return false;
+	}
+	sendMessageFrames(id, data);
+	if(stream->readDone)
+	{
+		ByteArray sendMessage = "h:"+ByteArray::fromString(id, CODEC_UTF8)+"#";
+		scheduler->push(id, sendMessage, tcpWeight);
+	}
+	return true;
+}
+
+// virtual client told all streams it has, send again what it did not get.
+void onResumeEnd()
+{
+	vector<String> killed;
+	pthread_mutex_lock(&sessionMutex);
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end();)
+	{
+		map<String, unsigned long long>::iterator offset = resumeOffsets.find(it->first);
+		bool resumed = false;
+		if(offset != resumeOffsets.end())
+		{
+			resumed = replayStream(it->first, it->second, offset->second);
+			if(!resumed)
+			{
+				EYRE_LOG_WARN("user "<<it->first<<" can not resume, bytes from "<<offset->second<<" are not kept.");
+				ByteArray sendMessage = "d:"+ByteArray::fromString(it->first, CODEC_UTF8)+"#";
+				scheduler->push(it->first, sendMessage, tcpWeight);
+			}
+			resumeOffsets.erase(offset);
+		}
+		else if(!it->second->known && it->second->sent.begin()==0)
+		{
+			// virtual client never got "c", tell it again.
+			ByteArray sendMessage = "c:"+ByteArray::fromString(it->first, CODEC_UTF8)+"#";
+			scheduler->push(it->first, sendMessage, tcpWeight);
+			resumed = replayStream(it->first, it->second, 0);
+		}
+		if(resumed)
+		{
+			++it;
+		}
+		else
+		{
+			killed.push_back(it->first);
+			deleteStream(it->second);
+			streams.erase(it++);
+		}
+	}
+	// virtual client still has users we do not.
+	for(map<String, unsigned long long>::iterator it = resumeOffsets.begin();
+		it != resumeOffsets.end(); ++it)
+	{
+		ByteArray sendMessage = "d:"+ByteArray::fromString(it->first, CODEC_UTF8)+"#";
+		scheduler->push(it->first, sendMessage, tcpWeight);
+	}
+	resumeOffsets.clear();
+	linkReady = true;
+	stats.resumes.add();
+	EYRE_LOG_INFO("session resumed, "<<streams.size()<<" users kept, "<<killed.size()<<" lost.");
+	pthread_mutex_unlock(&sessionMutex);
+	killUsers(killed);
+}
+
+/*
+ * UDP service, datagrams of udp users are tunnelled as flows.
+ * format:
+ * datagram: u:flow;length#data
+ * flow closed: x:flow#
+ * A flow is one (ip, port) of user, its id is never reused. Datagrams are
+ * not kept for resume, they are dropped while the link is down.
+ * Either side drops a flow idle udpIdle sec and tells the other.
+ */
+struct Flow
+{
+	SocketAddress addr;	// of udp user.
+	unsigned long long active;	// msec of last datagram.
+};
+UdpSocket *udpServer = NULL;
+map<String, Flow> flows;	// by flow id.
+map<SocketAddress, String> flows_;	// flow id by addr of udp user.
+pthread_mutex_t flowsMutex;
+unsigned long long nextFlowId = 0;
+unsigned int udpIdle = 60;	// sec.
+vector<UdpSocket::Datagram> udpOut;	// to udp users, sent in one batch by handleEvent.
+
+/*
+ * Shaping of what users send, token buckets of bytes per sec in a tree:
+ * all users, then the tcp or udp service, then each tcp user.
+ * A reader over its rate is paused till the buckets refill, the kernel
+ * buffer fills and holds the user back, nothing is dropped here.
+ * All rates 0 (the default) means no bucket is taken at all.
+ */
+bool shaping = false;
+TokenBucket *shapeAll = NULL;
+TokenBucket *shapeTcp = NULL;
+TokenBucket *shapeUdp = NULL;
+unsigned long long userRate = 0;	// bytes per sec of a tcp user.
+unsigned int shapeBurst = TOKEN_BUCKET_BURST;
+struct Shape
+{
+	TokenBucket *bucket;
+	unsigned long long timer;	// resumes the paused user, 0 if reading.
+};
+map<TcpSocket *, Shape> shapes;	// by tcp user.
+unsigned long long udpShapeTimer = 0;
+pthread_mutex_t shapeMutex;
+
+void newShape(TcpSocket *user)
+{
+	if(!shaping)
+	{
+		return;
+	}
+	Shape shape = {new TokenBucket(userRate, shapeBurst, shapeTcp), 0};
+	pthread_mutex_lock(&shapeMutex);
+	shapes[user] = shape;
+	pthread_mutex_unlock(&shapeMutex);
+}
+
+void forgetShape(TcpSocket *user)
+{
+	if(!shaping)
+	{
+		return;
+	}
+	pthread_mutex_lock(&shapeMutex);
+	map<TcpSocket *, Shape>::iterator it = shapes.find(user);
+	if(it != shapes.end())
+	{
+		if(it->second.timer)
+		{
+			timers->cancel(it->second.timer);
+		}
+		delete it->second.bucket;
+		shapes.erase(it);
+	}
+	pthread_mutex_unlock(&shapeMutex);
+}
+
+// user is gone when its timer is canceled or found no more.
+void onShapeResume(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	TcpSocket *user = (TcpSocket *) arg;
+	pthread_mutex_lock(&shapeMutex);
+	map<TcpSocket *, Shape>::iterator it = shapes.find(user);
+	if(it!=shapes.end() && it->second.timer==id)
+	{
+		unsigned int delay = it->second.bucket->wait();	//others may take the parents meanwhile.
+		if(delay)
+		{
+			it->second.timer = wheel->add(delay, onShapeResume, user);
+		}
+		else
+		{
+			it->second.timer = 0;
+			user->setReadPaused(false);
+		}
+	}
+	pthread_mutex_unlock(&shapeMutex);
+}
+
+// in Read call back of user, bytes are read already.
+void shapeRead(TcpSocket *user, unsigned long long bytes)
+{
+	pthread_mutex_lock(&shapeMutex);
+	map<TcpSocket *, Shape>::iterator it = shapes.find(user);
+	if(it != shapes.end())
+	{
+		unsigned int delay = it->second.bucket->take(bytes);
+		if(delay && !it->second.timer)
+		{
+			user->setReadPaused(true);
+			it->second.timer = timers->add(delay, onShapeResume, user);
+			stats.shapePauses.add();
+		}
+	}
+	pthread_mutex_unlock(&shapeMutex);
+}
+
+void onUdpShapeResume(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	pthread_mutex_lock(&shapeMutex);
+	if(udpShapeTimer == id)
+	{
+		unsigned int delay = shapeUdp->wait();
+		if(delay)
+		{
+			udpShapeTimer = wheel->add(delay, onUdpShapeResume);
+		}
+		else
+		{
+			udpShapeTimer = 0;
+			udpServer->setReadPaused(false);
+		}
+	}
+	pthread_mutex_unlock(&shapeMutex);
+}
+
+// datagrams of udp users, all a read got, in loop thread.
+void onUdpRead(UdpSocket *udpSocket, const UdpSocket::Datagram *datagrams, unsigned int count)
+{
+	if(!virtualClient || !linkReady)
+	{
+		stats.datagramsDropped.add(count);
+		return;
+	}
+	vector<String> ids(count);
+	unsigned long long now = TimerWheel::now();
+	pthread_mutex_lock(&flowsMutex);
+	for(unsigned int i=0; i<count; ++i)
+	{
+		map<SocketAddress, String>::iterator it = flows_.find(datagrams[i].addr);
+		if(it == flows_.end())
+		{
+			ids[i] = String::fromNumber(++nextFlowId);
+			Flow flow = {datagrams[i].addr, now};
+			flows[ids[i]] = flow;
+			flows_[datagrams[i].addr] = ids[i];
+			stats.flowsOpened.add();
+			EYRE_LOG_DEBUG("udp user "<<datagrams[i].addr.toString()<<" is flow "<<ids[i]<<".");
+		}
+		else
+		{
+			ids[i] = it->second;
+			flows[ids[i]].active = now;
+		}
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	
+	stats.datagramsIn.add(count);
+	if(shaping)
+	{
+		unsigned long long bytes = 0;
+		for(unsigned int i=0; i<count; ++i)
+		{
+			bytes += datagrams[i].size;
+		}
+		pthread_mutex_lock(&shapeMutex);
+		unsigned int delay = shapeUdp->take(bytes);
+		if(delay && !udpShapeTimer)
+		{
+			udpSocket->setReadPaused(true);
+			udpShapeTimer = timers->add(delay, onUdpShapeResume);
+			stats.shapePauses.add();
+		}
+		pthread_mutex_unlock(&shapeMutex);
+	}
+	for(unsigned int i=0; i<count; ++i)
+	{
+		ByteArray data(datagrams[i].data, datagrams[i].size);
+		if(printMessage)
+		{
+			EYRE_LOG_INFO("udp flow "<<ids[i]<<" send "<<data.size()<<" bytes.\n"<<Logger::preview(data, previewBytes));
+		}
+		ByteArray sendMessage = "u:"+ByteArray::fromString(ids[i], CODEC_UTF8)+";"+
+			ByteArray::fromString(String::fromNumber(data.size()), CODEC_UTF8)+"#"+data;
+		tellToVirtualClient("u"+ids[i], sendMessage, udpWeight);
+	}
+}
+
+/*
+ * datagram virtual client got from real service, back to its udp user
+ * by flushDatagrams(), data must live till then.
+ */
+void sendDatagram(const String &id, const ByteArray &data)
+{
+	UdpSocket::Datagram datagram;
+	pthread_mutex_lock(&flowsMutex);
+	map<String, Flow>::iterator it = flows.find(id);
+	bool found = (it != flows.end());
+	if(found)
+	{
+		it->second.active = TimerWheel::now();
+		datagram.addr = it->second.addr;
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	
+	if(!found)
+	{
+		stats.datagramsDropped.add();
+		return;
+	}
+	datagram.data = data;
+	datagram.size = data.size();
+	udpOut.push_back(datagram);
+}
+
+void flushDatagrams()
+{
+	if(!udpOut.size())
+	{
+		return;
+	}
+	unsigned int sent = udpServer->send(&udpOut[0], udpOut.size());
+	stats.datagramsOut.add(sent);
+	stats.datagramsDropped.add(udpOut.size()-sent);
+	udpOut.clear();
+}
+
+// virtual client dropped flow id idle.
+void closeFlow(const String &id)
+{
+	pthread_mutex_lock(&flowsMutex);
+	map<String, Flow>::iterator it = flows.find(id);
+	if(it != flows.end())
+	{
+		flows_.erase(it->second.addr);
+		flows.erase(it);
+		stats.flowsExpired.add();
+	}
+	pthread_mutex_unlock(&flowsMutex);
+}
+
+void onFlowSweep(TimerWheel *wheel, unsigned long long id, void *arg)
+{
+	unsigned long long now = TimerWheel::now();
+	vector<String> expired;
+	pthread_mutex_lock(&flowsMutex);
+	for(map<String, Flow>::iterator it = flows.begin(); it != flows.end();)
+	{
+		if(now-it->second.active < udpIdle*1000ULL)
+		{
+			++it;
+			continue;
+		}
+		expired.push_back(it->first);
+		flows_.erase(it->second.addr);
+		flows.erase(it++);
+	}
+	pthread_mutex_unlock(&flowsMutex);
+	
+	stats.flowsExpired.add(expired.size());
+	for(unsigned int i=0; i<expired.size(); ++i)
+	{
+		ByteArray sendMessage = "x:"+ByteArray::fromString(expired[i], CODEC_UTF8)+"#";
+		tellToVirtualClient("u"+expired[i], sendMessage, udpWeight);
+	}
+	wheel->add(1000, onFlowSweep);
+}
+
+// stats now, in Prometheus text format or json.
+String scrape(bool json)
+{
+	MetricsReport report("tunnel_server_");
+	
+	pthread_mutex_lock(&usersMutex);
+	unsigned int userCount = users.size();
+	pthread_mutex_unlock(&usersMutex);
+	
+	pthread_mutex_lock(&sessionMutex);
+	unsigned int streamCount = streams.size();
+	unsigned long long replayBytes = 0;
+	for(map<String, Stream *>::iterator it = streams.begin(); it != streams.end(); ++it)
+	{
+		replayBytes += it->second->sent.size();
+	}
+	bool ready = linkReady;
+	pthread_mutex_unlock(&sessionMutex);
+	
+	pthread_mutex_lock(&messagesMutex);
+	unsigned int eventCount = m_messages.size();
+	pthread_mutex_unlock(&messagesMutex);
+	
+	pthread_mutex_lock(&compressMutex);
+	unsigned int compressorCount = compressors.size()+decompressors.size();
+	pthread_mutex_unlock(&compressMutex);
+	
+	pthread_mutex_lock(&heartMutex);
+	long long rtt = srtt;
+	long long rttDeviation = rttvar;
+	pthread_mutex_unlock(&heartMutex);
+	
+	pthread_mutex_lock(&flowsMutex);
+	unsigned int flowCount = flows.size();
+	pthread_mutex_unlock(&flowsMutex);
+	
+	unsigned long long framesOut, bytesOut, writes;
+	scheduler->written(framesOut, bytesOut, writes);
+	
+	report.gauge("link_up", "1 when session is established on the link.", ready);
+	report.gauge("users", "Users connected.", userCount);
+	report.gauge("streams", "Streams of the session, kept while link is down.", streamCount);
+	report.counter("streams_opened_total", "Users accepted.", stats.streamsOpened.value());
+	report.counter("streams_rejected_total", "Users refused without session.", stats.streamsRejected.value());
+	report.counter("streams_closed_total", "Users disconnected.", stats.streamsClosed.value());
+	report.counter("streams_ended_total", "Streams real server disconnected.", stats.streamsEnded.value());
+	report.counter("streams_killed_total", "Streams aborted with session lost.", stats.streamsKilled.value());
+	report.counter("streams_idle_total", "Users closed by idle timeout.", stats.streamsIdle.value());
+	report.counter("streams_close_timeout_total", "Users aborted, not closed in closeTimeout.", stats.closeTimeouts.value());
+	report.counter("streams_half_closed_total", "Streams one way finished first.", stats.halfCloses.value());
+	report.counter("user_bytes_in_total", "Bytes read from users.", stats.userBytesIn.value());
+	report.counter("user_bytes_out_total", "Bytes written to users.", stats.userBytesOut.value());
+	report.counter("tunnel_bytes_in_total", "Bytes read from virtual client.", stats.tunnelBytesIn.value());
+	report.counter("tunnel_frames_in_total", "Frames read from virtual client.", stats.tunnelFramesIn.value());
+	report.counter("tunnel_bytes_out_total", "Bytes written to virtual client.", bytesOut);
+	report.counter("tunnel_frames_out_total", "Frames written to virtual client.", framesOut);
+	report.counter("tunnel_writes_total", "Gather sends to virtual client.", writes);
+	report.counter("broken_frames_total", "Compressed frames failed to decode.", stats.brokenFrames.value());
+	report.counter("link_drops_total", "Links to virtual client lost.", stats.linkDrops.value());
+	report.counter("sessions_total", "Sessions started.", stats.sessions.value());
+	report.counter("resumes_total", "Sessions resumed after link drop.", stats.resumes.value());
+	report.gauge("udp_flows", "Udp users seen in idle time.", flowCount);
+	report.counter("udp_flows_opened_total", "Udp users came.", stats.flowsOpened.value());
+	report.counter("udp_flows_expired_total", "Udp users idle out.", stats.flowsExpired.value());
+	report.counter("udp_datagrams_in_total", "Datagrams read from udp users.", stats.datagramsIn.value());
+	report.counter("udp_datagrams_out_total", "Datagrams written to udp users.", stats.datagramsOut.value());
+	report.counter("udp_datagrams_dropped_total", "Datagrams dropped, link down or flow gone.",
+		stats.datagramsDropped.value());
+	report.gauge("tunnel_rtt_seconds", "Smoothed ping rtt, -1 without sample.", rtt<0 ? -1 : rtt/1e6);
+	report.gauge("tunnel_rtt_deviation_seconds", "Ping rtt deviation.", rttDeviation/1e6);
+	report.gauge("send_queue_bytes", "Bytes waiting in scheduler.", scheduler->pendingBytes());
+	report.gauge("send_queue_streams", "Streams waiting in scheduler.", scheduler->activeStreams());
+	report.counter("send_queue_pauses_total", "Users paused, too many bytes waiting in scheduler.",
+		scheduler->sourcePauses());
+	report.gauge("event_queue", "Frames decoded, waiting for event loop.", eventCount);
+	report.gauge("replay_bytes", "Bytes kept for resume, until acked.", replayBytes);
+	report.gauge("compressors", "Stream compressors and decompressors.", compressorCount);
+	report.gauge("timers", "Timers waiting.", timers->size());
+	report.counter("shape_pauses_total", "Reads paused by rate limits.", stats.shapePauses.value());
+	report.counter("user_send_pauses_total", "Virtual client paused, a user reads too slow.",
+		stats.sendPauses.value());
+	report.counter("user_send_stalls_total", "Users killed, read nothing too long.", stats.sendStalls.value());
+	report.counter("streams_refused_total", "Users refused by admission control.",
+		stats.refusedRate.value(), MetricsReport::label("reason", "rate"));
+	report.counter("streams_refused_total", "Users refused by admission control.",
+		stats.refusedStreams.value(), MetricsReport::label("reason", "streams"));
+	report.counter("streams_refused_total", "Users refused by admission control.",
+		stats.refusedIp.value(), MetricsReport::label("reason", "ip"));
+	report.counter("streams_refused_total", "Users refused by admission control.",
+		stats.refusedPending.value(), MetricsReport::label("reason", "pending"));
+	report.summary("frame_decode_seconds", "Time to unpack payload of a frame.", stats.frameDecode, 1e-6);
+	report.summary("user_to_tunnel_seconds", "Read from user to written to virtual client.",
+		stats.userToTunnel, 1e-6);
+	report.summary("tunnel_to_user_seconds", "Read from virtual client to written to user.",
+		stats.tunnelToUser, 1e-6);
+	report.summary("loop_seconds", "Event loop iteration, sleep excluded.", stats.loop, 1e-6);
+	report.counter("log_dropped_total", "Log messages dropped with log ring full.", Logger::dropped());
+	report.process();
+	
+	if(json)
+	{
+		return report.toJson().toString();
+	}
+	return report.toPrometheus();
+}
+
+TcpServer *statsServer = NULL;
+map<TcpSocket *, ByteArray> statsRequests;	// input not finished.
+pthread_mutex_t statsMutex;
+
+void onStatsDisconnected(TcpSocket *tcpSocket)
+{
+	pthread_mutex_lock(&statsMutex);
+	statsRequests.erase(tcpSocket);
+	pthread_mutex_unlock(&statsMutex);
+}
+
+/*
+ * http GET on stats port:
+ * GET /metrics, Prometheus text format.
+ * GET /stats, json.
+ */
+void onStatsRead(TcpSocket *tcpSocket, ByteArray data)
+{
+	pthread_mutex_lock(&statsMutex);
+	ByteArray request = statsRequests[tcpSocket]+data;
+	statsRequests[tcpSocket] = request;
+	pthread_mutex_unlock(&statsMutex);
+	
+	ByteArray get = "GET ";
+	if(request.mid(0, get.size()) != get.mid(0, request.size()) || request.size() > 8192)
+	{
+		tcpSocket->abort();
+		return;
+	}
+	if(request.indexOf("\r\n\r\n")==-1 && request.indexOf("\n\n")==-1)
+	{
+		return;	// wait the whole head.
+	}
+	
+	int lineEnd = request.indexOf("\n");
+	vector<ByteArray> line = request.mid(0, lineEnd).split(" ");
+	ByteArray path = line.size()>1 ? line[1] : ByteArray("");
+	ByteArray response;
+	if(path == "/metrics" || path == "/stats")
+	{
+		ByteArray body = ByteArray::fromString(scrape(path == "/stats"), CODEC_UTF8);
+		response = "HTTP/1.0 200 OK\r\nContent-Type: ";
+		response += (path == "/stats") ? "application/json" : "text/plain; version=0.0.4";
+		response += "\r\nContent-Length: "+ByteArray::fromString(String::fromNumber(body.size()), CODEC_UTF8)+
+			"\r\nConnection: close\r\n\r\n"+body;
+	}
+	else
+	{
+		response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	}
+	tcpSocket->write(response);
+	tcpSocket->abort();
+}
+
+void onStatsConnecting(TcpServer *server, TcpSocket *client)
+{
+	client->setDisconnectedCallBack(onStatsDisconnected);
+	client->setReadCallBack(onStatsRead);
+}
+
+#ifndef _WIN32
+map<TcpSocket *, ByteArray> managerRequests;	// input of manager not finished.
+pthread_mutex_t managerMutex;
+
+/*
+ * Manager sends the line "kill" to stop the service.
+ * Other input, a port scan or a probe, only loses its connection.
+ */
+void onManagerRead(TcpSocket *tcpSocket, const ByteArray &data)
+{
+	pthread_mutex_lock(&managerMutex);
+	ByteArray request = managerRequests[tcpSocket]+data;
+	managerRequests[tcpSocket] = request;
+	pthread_mutex_unlock(&managerMutex);
+	
+	if(request == "kill\n" || request == "kill\r\n")
+	{
+		EYRE_LOG_INFO("be killed.");
+		beKilled = true;
+		tcpSocket->abort();
+		return;
+	}
+	ByteArray command = "kill\r\n";
+	if(request.size()>=command.size() || request != command.mid(0, request.size()))
+	{
+		EYRE_LOG_DEBUG("unknown input of manager, drop it.");
+		tcpSocket->abort();
+	}
+}
+#endif
+
+/*
+ * Admission control of users, checked when accepted, before anything
+ * is kept or sent to virtual client for them. 0 means no limit.
+ * maxStreams: users at once, maxPerIp: users at once from one ip.
+ * rate: accepts per sec, burst msec of them may come at once.
+ * maxPending: users virtual client has not acked "c" of, so opens do not
+ * pile up on a slow or stuck link.
+ */
+unsigned int maxStreams = 0;
+unsigned int maxPerIp = 0;
+unsigned int maxPending = 0;
+TokenBucket *acceptRate = NULL;
+map<SocketAddress, unsigned int> usersPerIp;	// port 0, with usersMutex locked.
+
+SocketAddress ipOf(TcpSocket *user)
+{
+	SocketAddress ip = user->peerAddress();
+	ip.setPort(0);
+	return ip;
+}
+
+// return reason user is refused, or NULL and user is counted.
+const char *admitUser(TcpSocket *user)
+{
+	if(acceptRate && !acceptRate->tryTake(1))
+	{
+		stats.refusedRate.add();
+		return "accept rate";
+	}
+	const char *reason = NULL;
+	pthread_mutex_lock(&usersMutex);
+	map<SocketAddress, unsigned int>::iterator it = maxPerIp ? usersPerIp.find(ipOf(user)) : usersPerIp.end();
+	if(maxStreams && users.size()>=maxStreams)
+	{
+		stats.refusedStreams.add();
+		reason = "max streams";
+	}
+	else if(maxPerIp && it!=usersPerIp.end() && it->second>=maxPerIp)
+	{
+		stats.refusedIp.add();
+		reason = "max streams per ip";
+	}
+	else if(maxPending)
+	{
+		pthread_mutex_lock(&sessionMutex);
+		if(unackedOpens >= maxPending)
+		{
+			stats.refusedPending.add();
+			reason = "max pending opens";
+		}
+		pthread_mutex_unlock(&sessionMutex);
+	}
+	if(!reason && maxPerIp)
+	{
+		++usersPerIp[ipOf(user)];
+	}
+	pthread_mutex_unlock(&usersMutex);
+	return reason;
+}
+
+// user admitted is gone, call with usersMutex locked.
+void releaseUser(TcpSocket *user)
+{
+	if(!maxPerIp)
+	{
+		return;
+	}
+	map<SocketAddress, unsigned int>::iterator it = usersPerIp.find(ipOf(user));
+	if(it!=usersPerIp.end() && --it->second==0)
+	{
+		usersPerIp.erase(it);
 	}
 }
 
@@ -70,58 +1634,95 @@ void onNewConnecting(TcpServer *server, TcpSocket *client)
 	pthread_mutex_lock(&serverConnectMutex);
 	if(server == serverToClient)
 	{
-		cout<<"virtual server is connected. virtual client coming now."<<endl;
+		EYRE_LOG_INFO("virtual server is connected. virtual client coming now from "
+			<<client->peerAddress().toString()<<".");
 		if(virtualClient)
 		{
-			cout<<"virtual client connected before. "
-				"kill and new virtual client connect."<<endl;
+			EYRE_LOG_INFO("virtual client connected before. "
+				"kill and new virtual client connect.");
 			virtualClient->setDisconnectedCallBack(NULL);
+			onLinkLost();
 			virtualClient->abort();
 		}
 		virtualClient = client;
+		scheduler->setTarget(client);
+		startHeartbeat();
 		client->setDisconnectedCallBack(onDisconnected);
 		client->setReadCallBack(onRead);
 	}
 	else if(server == serverToUser)
 	{
-		char id[32];
-		sprintf(id, "%p", client);
+		const char *refused = admitUser(client);
+		if(refused)
+		{
+			EYRE_LOG_WARN("user from "<<client->peerAddress().toString()<<" refused, "<<refused<<".");
+			client->abort();
+			pthread_mutex_unlock(&serverConnectMutex);
+			return;
+		}
+		String id = String::fromNumber(++nextUserId);
 		
-		cout<<"proxy server is connected. user "<<id<<" coming now."<<endl;
+		EYRE_LOG_INFO("proxy server is connected. user "<<id<<" coming now from "
+			<<client->peerAddress().toString()<<".");
 		
 		/*
 		 * tell virtual client that user connected.
 		 * format:
 		 * c:id#
+		 * while the link is down in grace, user waits and "c" is sent on resume.
 		 */
-		if(virtualClient)
+		pthread_mutex_lock(&usersMutex);
+		users[id] = client;
+		users_[client] = id;
+		pthread_mutex_unlock(&usersMutex);
+		
+		pthread_mutex_lock(&sessionMutex);
+		bool accepted = (sessionToken.size() != 0);
+		if(accepted)
 		{
-			pthread_mutex_lock(&usersMutex);
-			users[String::fromUtf8(id)] = client;
-			pthread_mutex_unlock(&usersMutex);
+			newStream(id);
+			ByteArray sendMessage = "c:"+ByteArray::fromString(id, CODEC_UTF8)+"#";
+			tellToVirtualClient(id, sendMessage, tcpWeight);
+		}
+		pthread_mutex_unlock(&sessionMutex);
+		
+		if(accepted)
+		{
+			stats.streamsOpened.add();
+			if(capture)
+			{
+				capture->write(CAPTURE_OPEN, CAPTURE_UP, id);
+			}
+			newShape(client);
+			scheduler->setSource(id, client);
+			client->setDrainedCallBack(forgetFull, sendLowWater);
 			client->setDisconnectedCallBack(onDisconnected);
 			client->setReadCallBack(onRead);
+			client->setReadClosedCallBack(onReadClosed);
 			
-			cout<<"now user count: "<<users.size()<<endl;
-		
-			ByteArray sendMessage = "c:"+ByteArray(id)+"#";
-			tellToVirtualClient(sendMessage);
-			cout<<"told to virtual client."<<endl;
+			EYRE_LOG_INFO("now user count: "<<users.size());
+			EYRE_LOG_DEBUG("told to virtual client.");
 		}
 		else
 		{
-			cout<<"but virtual client disconnect. kill this user."<<endl;
+			EYRE_LOG_WARN("but virtual client disconnect. kill this user.");
+			stats.streamsRejected.add();
+			pthread_mutex_lock(&usersMutex);
+			users.erase(id);
+			users_.erase(client);
+			releaseUser(client);
+			pthread_mutex_unlock(&usersMutex);
 			client->abort();
 		}
 	}
 	else
 	{
 #ifdef _WIN32
-		cout<<"unknow server is connected."<<endl;
+		EYRE_LOG_INFO("unknow server is connected.");
 #else
 		if(server == manager)
 		{
-			cout<<"manager comming."<<endl;
+			EYRE_LOG_DEBUG("manager comming.");
 			client->setDisconnectedCallBack(onDisconnected);
 			client->setReadCallBack(onRead);
 		}
@@ -136,20 +1737,20 @@ void onStartSucceed(TcpServer *server)
 	pthread_mutex_lock(&serverStartMutex);
 	if(server == serverToClient)
 	{
-		cout<<"virtual server started."<<endl;
+		EYRE_LOG_INFO("virtual server started.");
 	}
 	else if(server == serverToUser)
 	{
-		cout<<"proxy server started."<<endl;
+		EYRE_LOG_INFO("proxy server started.");
 	}
 	else
 	{
 #ifdef _WIN32
-		cout<<"unknow server started."<<endl;
+		EYRE_LOG_INFO("unknow server started.");
 #else
 		if(server == manager)
 		{
-			cout<<"proxy manager started."<<endl;
+			EYRE_LOG_INFO("proxy manager started.");
 		}
 #endif
 	}
@@ -162,51 +1763,155 @@ void onClosed(TcpServer *server)
 }
 
 pthread_mutex_t socketDisconnectMutex;
+/*
+ * User finished sending (fin), tell virtual client after its datas so
+ * real server reads eof and can still reply; close once both ways are done.
+ * format:
+ * h:id#
+ */
+void onReadClosed(TcpSocket *tcpSocket)
+{
+	String id;
+	pthread_mutex_lock(&usersMutex);
+	map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
+	if(it != users_.end())
+	{
+		id = it->second;
+	}
+	pthread_mutex_unlock(&usersMutex);
+	
+	bool done = true;
+	pthread_mutex_lock(&sessionMutex);
+	map<String, Stream *>::iterator stream = streams.find(id);
+	if(stream != streams.end())
+	{
+		stream->second->readDone = true;
+		stream->second->active = TimerWheel::now();
+		startCloseTimer(id, stream->second);
+		done = stream->second->writeDone;
+		if(!done)
+		{
+			stats.halfCloses.add();
+		}
+		ByteArray sendMessage = "h:"+ByteArray::fromString(id, CODEC_UTF8)+"#";
+		tellToVirtualClient(id, sendMessage, tcpWeight);	// or sent by replayStream on resume.
+	}
+	pthread_mutex_unlock(&sessionMutex);
+	if(done)
+	{
+		tcpSocket->abortWhenWritten();
+	}
+	else
+	{
+		EYRE_LOG_DEBUG("user "<<id<<" finished sending.");
+	}
+}
+
 void onDisconnected(TcpSocket *tcpSocket)
 {
 	pthread_mutex_lock(&socketDisconnectMutex);
 	if(tcpSocket == virtualClient)
 	{
-		cout<<"virtual client disconnected."<<endl;
+		EYRE_LOG_INFO("virtual client disconnected.");
 		virtualClient = NULL;
-		
-		// kill all user
-		pthread_mutex_lock(&usersMutex);
-		for(map<String, TcpSocket *>::iterator it = users.begin();
-			it != users.end();)
-		{
-			it->second->setDisconnectedCallBack(NULL);
-			it->second->abort();
-			users.erase(it++);
-		}
-		pthread_mutex_unlock(&usersMutex);
-		cout<<"kill all user, now user count: "<<users.size()<<endl;
+		onLinkLost();
 	}
 	else
 	{
-		char id[32];
-		sprintf(id, "%p", tcpSocket);
+		String id;
 		pthread_mutex_lock(&usersMutex);
-		users.erase(users.find(id));
+		map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
+		if(it != users_.end())
+		{
+			id = it->second;
+			users.erase(id);
+			users_.erase(it);
+			releaseUser(tcpSocket);
+		}
 		pthread_mutex_unlock(&usersMutex);
+		forgetShape(tcpSocket);
+		forgetFull(tcpSocket);
 		
-		cout<<"user "<<id<<" disconnected. now user count: "
-			<<users.size()<<endl;
+#ifndef _WIN32
+		pthread_mutex_lock(&managerMutex);
+		managerRequests.erase(tcpSocket);
+		pthread_mutex_unlock(&managerMutex);
+#endif
 		
-		if(virtualClient)
+		if(id.size())
 		{
-			/*
-			 * tell virtual client that user disconnected.
-			 * format:
-			 * d:id#
-			 */
-			ByteArray sendMessage = "d:"+ByteArray(id)+"#";
-			tellToVirtualClient(sendMessage);
+			stats.streamsClosed.add();
+			if(capture)
+			{
+				capture->write(CAPTURE_CLOSE, CAPTURE_UP, id);
+			}
+			scheduler->setSource(id, NULL);
+			forgetCompress(id);
+			closeStream(id);
+			
+			EYRE_LOG_INFO("user "<<id<<" disconnected. now user count: "
+				<<users.size());
 		}
 	}
 	pthread_mutex_unlock(&socketDisconnectMutex);
 }
 
+/*
+ * virtual client asks to compress frames, reply the algorithm both
+ * side use, or none.
+ * format:
+ * z:algorithm#
+ */
+void onCompressNegotiate(const String &name)
+{
+	CompressAlgorithm algorithm = StreamCompressor::algorithmFromName(name);
+	if(algorithm != compressAlgorithm)
+	{
+		algorithm = COMPRESS_NONE;
+	}
+	ByteArray sendMessage = "z:"+ByteArray::fromString(
+		StreamCompressor::algorithmName(algorithm), CODEC_UTF8)+"#";
+	tellToVirtualClient(sendMessage);
+	compressEnabled = (algorithm != COMPRESS_NONE);
+	EYRE_LOG_INFO("compression: "<<StreamCompressor::algorithmName(algorithm)<<".");
+}
+
+/*
+ * Datas of user id, posted from the thread decoding them and sent as the
+ * user reads, a slow user never blocks decoding. Control frames of the
+ * user are decoded after, "d" and "h" wait its datas sent.
+ */
+void writeToUser(const String &id, const ByteArray &data, unsigned long long stamp)
+{
+	if(printMessage)
+	{
+		EYRE_LOG_INFO("real server send user "<<id<<" "<<data.size()<<" bytes.\n"
+			<<Logger::preview(data, previewBytes));
+	}
+	bool posted = false;
+	pthread_mutex_lock(&usersMutex);	// user is not deleted while posting.
+	map<String, TcpSocket *>::iterator it = users.find(id);
+	if(it != users.end())
+	{
+		posted = it->second->post(data);
+		if(posted && it->second->queuedBytes()>sendHighWater)
+		{
+			userFull(it->second);
+		}
+	}
+	pthread_mutex_unlock(&usersMutex);
+	
+	if(posted)
+	{
+		stats.userBytesOut.add(data.size());
+		stats.tunnelToUser.record(TimerWheel::nowUsec()-stamp);
+		if(capture)
+		{
+			capture->write(CAPTURE_DATA, CAPTURE_DOWN, id, data);
+		}
+	}
+}
+
 void messageRead(ByteArray &message)
 {
 	while(message.size())
@@ -226,14 +1931,38 @@ void messageRead(ByteArray &message)
 				message = message.mid(restBufferSize);
 				restBufferSize = 0;
 			}
-			if(!restBufferSize)
+			if(!restBufferSize && datagramBuffer)
 			{
-				Message m = {"m", sender, buffer};
+				Message m = {"u", sender, buffer, readStamp};
 				pthread_mutex_lock(&messagesMutex);
 				m_messages.push_back(m);
 				pthread_mutex_unlock(&messagesMutex);
 				sender = "";
 				buffer = "";
+				datagramBuffer = false;
+			}
+			else if(!restBufferSize)
+			{
+				unsigned long long decodeStart = TimerWheel::nowUsec();
+				bool unpacked = unpackMessage(sender, compressedBuffer, rawBufferSize, buffer);
+				stats.frameDecode.record(TimerWheel::nowUsec()-decodeStart);
+				if(!unpacked)
+				{
+					EYRE_LOG_WARN("broken compressed message of user "<<sender<<", kill it.");
+					stats.brokenFrames.add();
+					Message m = {"d", sender, "", 0};
+					pthread_mutex_lock(&messagesMutex);
+					m_messages.push_back(m);
+					pthread_mutex_unlock(&messagesMutex);
+				}
+				else
+				{
+					onStreamReceived(sender, buffer.size());
+					writeToUser(sender, buffer, readStamp);
+				}
+				sender = "";
+				buffer = "";
+				compressedBuffer = false;
 			}
 			else
 			{
@@ -251,6 +1980,7 @@ void messageRead(ByteArray &message)
 		else
 		{
 			ByteArray _head = message.mid(0, endSymPos);
+			stats.tunnelFramesIn.add();
 			vector<ByteArray> headInfo = _head.split(":");
 			pthread_mutex_lock(&messagesMutex);
 			if(headInfo[0] == "c")	// client connected
@@ -259,7 +1989,7 @@ void messageRead(ByteArray &message)
 				if(headInfo.size() == 2)
 				{
 					String id = String::fromUtf8(headInfo[1]);
-					Message m = {"c", id, ""};
+					Message m = {"c", id, "", 0};
 					m_messages.push_back(m);
 				}
 			}
@@ -269,7 +1999,17 @@ void messageRead(ByteArray &message)
 				if(headInfo.size() == 2)
 				{
 					String id = String::fromUtf8(headInfo[1]);
-					Message m = {"d", id, ""};
+					Message m = {"d", id, "", 0};
+					m_messages.push_back(m);
+				}
+			}
+			else if(headInfo[0] == "h")	// real server finished sending
+			{
+				// h:id
+				if(headInfo.size() == 2)
+				{
+					String id = String::fromUtf8(headInfo[1]);
+					Message m = {"h", id, "", 0};
 					m_messages.push_back(m);
 				}
 			}
@@ -286,11 +2026,101 @@ void messageRead(ByteArray &message)
 					}
 				}
 			}
-			else if(headInfo[0] == "a")
+			else if(headInfo[0] == "M")	// send compressed message
 			{
-				// a
-				Message m = {"a", "", ""};
-				m_messages.push_back(m);
+				// M:id;length;rawLength
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 3)
+					{
+						sender = String::fromUtf8(info[0]);
+						restBufferSize = String::fromUtf8(info[1]).toUInt64();
+						rawBufferSize = String::fromUtf8(info[2]).toUInt64();
+						compressedBuffer = true;
+					}
+				}
+			}
+			else if(headInfo[0] == "u")	// datagram
+			{
+				// u:flow;length
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						sender = String::fromUtf8(info[0]);
+						restBufferSize = String::fromUtf8(info[1]).toUInt64();
+						datagramBuffer = true;
+					}
+				}
+			}
+			else if(headInfo[0] == "x")	// flow closed
+			{
+				// x:flow
+				if(headInfo.size() == 2)
+				{
+					Message m = {"x", String::fromUtf8(headInfo[1]), "", 0};
+					m_messages.push_back(m);
+				}
+			}
+			else if(headInfo[0] == "z")	// compression negotiate
+			{
+				// z:algorithm
+				if(headInfo.size() == 2)
+				{
+					onCompressNegotiate(String::fromUtf8(headInfo[1]));
+				}
+			}
+			else if(headInfo[0] == "s")	// session hello
+			{
+				// s or s:token
+				onSessionHello(headInfo.size()==2 ? String::fromUtf8(headInfo[1]) : String());
+			}
+			else if(headInfo[0] == "k")	// ack
+			{
+				// k:id;offset
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						onStreamAck(String::fromUtf8(info[0]), String::fromUtf8(info[1]).toUInt64());
+					}
+				}
+			}
+			else if(headInfo[0] == "r")	// resume stream
+			{
+				// r:id;offset
+				if(headInfo.size() == 2)
+				{
+					vector<ByteArray> info = headInfo[1].split(";");
+					if(info.size() == 2)
+					{
+						onResumeOffset(String::fromUtf8(info[0]), String::fromUtf8(info[1]).toUInt64());
+					}
+				}
+			}
+			else if(headInfo[0] == "R")	// resume end
+			{
+				// R
+				onResumeEnd();
+			}
+			else if(headInfo[0] == "a")	// ping
+			{
+				// a or a:seq
+				if(headInfo.size() == 2)
+				{
+					onPing(headInfo[1]);
+				}
+			}
+			else if(headInfo[0] == "A")	// pong
+			{
+				// A:seq
+				if(headInfo.size() == 2)
+				{
+					onPong(String::fromUtf8(headInfo[1]).toUInt64());
+				}
 			}
 			pthread_mutex_unlock(&messagesMutex);
 			message = message.mid(endSymPos+1);
@@ -302,34 +2132,45 @@ void onRead(TcpSocket *tcpSocket, ByteArray data)
 {
 	if(tcpSocket == virtualClient)
 	{
+		pthread_mutex_lock(&heartMutex);
+		lastReceived = TimerWheel::nowUsec();
+		readStamp = lastReceived;
+		pthread_mutex_unlock(&heartMutex);
+		stats.tunnelBytesIn.add(data.size());
 		messageRead(data);
 	}
 	else if (tcpSocket->server() == serverToUser)
 	{
-		char id[32];
-		sprintf(id, "%p", tcpSocket);
-		unsigned long long len = data.size();
+		String id;
+		pthread_mutex_lock(&usersMutex);
+		map<TcpSocket *, String>::iterator it = users_.find(tcpSocket);
+		if(it != users_.end())
+		{
+			id = it->second;
+		}
+		pthread_mutex_unlock(&usersMutex);
+		unsigned long long stamp = TimerWheel::nowUsec();
+		stats.userBytesIn.add(data.size());
+		if(capture)
+		{
+			capture->write(CAPTURE_DATA, CAPTURE_UP, id, data);
+		}
 		if(printMessage)
 		{
-			cout<<"user "<<id<<" send message."<<endl;
-			cout<<data.toString(CODEC_UTF8)<<endl;
+			EYRE_LOG_INFO("user "<<id<<" send "<<data.size()<<" bytes.\n"<<Logger::preview(data, previewBytes));
+		}
+		tellMessageToVirtualClient(id, data, stamp);
+		if(shaping)
+		{
+			shapeRead(tcpSocket, data.size());
 		}
-		ByteArray sendMessage = "m:"+ByteArray(id)+";"+
-			ByteArray::fromString(String::fromNumber(len), CODEC_UTF8)+"#"+data;
-		tellToVirtualClient(sendMessage);
-#ifdef _WIN32
-		Sleep(1);
-#else
-		usleep(1000);
-#endif
 	}
 	else
 	{
 #ifdef _WIN32
-		cout << "receive message but unknow sender." << endl;
+		EYRE_LOG_WARN("receive message but unknow sender.");
 #else
-		cout << "be killed." << endl;
-		beKilled = true;
+		onManagerRead(tcpSocket, data);
 #endif
 	}
 }
@@ -341,58 +2182,84 @@ bool handleEvent()
 	for(unsigned int i=0; i<len; ++i)
 	{
 		Message m = m_messages[i];
-		if(m.type == "m")
+		if(m.type == "d")
 		{
-			if(printMessage)
+			EYRE_LOG_INFO("virtual client disconnect from real server.");
+			stats.streamsEnded.add();
+			if(capture)
 			{
-				cout<<"real server send message to user "<<m.id<<"."<<endl;
-				cout<<m.data.toString(CODEC_UTF8)<<endl;
+				capture->write(CAPTURE_CLOSE, CAPTURE_DOWN, m.id);
 			}
+			TcpSocket *temp = NULL;
 			pthread_mutex_lock(&usersMutex);
 			map<String, TcpSocket *>::iterator it = users.find(m.id);
-			TcpSocket *target = NULL; 
 			if(it != users.end())
 			{
-				target = it->second;
+				temp = it->second;
+				//if(it->second)
+				//{
+				//	it->second->abort();
+				//}
+				//users.erase(it);
 			}
 			pthread_mutex_unlock(&usersMutex);
-			
-			if(target)
+			if(temp)
 			{
-				target->write(m.data);
+				temp->abortWhenWritten();	// user reads datas before.
+				startCloseTimer(m.id);
 			}
-#ifdef _WIN32
-			Sleep(1);
-#else
-			usleep(1000);
-#endif
 		}
-		else if(m.type == "a")
+		else if(m.type == "h")
 		{
-			cout<<"virtual client alive."<<endl;
-		}
-		else if(m.type == "d")
-		{
-			cout<<"virtual client disconnect from real server."<<endl;
+			// after datas of the user written, so the user reads all before eof.
 			TcpSocket *temp = NULL;
 			pthread_mutex_lock(&usersMutex);
 			map<String, TcpSocket *>::iterator it = users.find(m.id);
 			if(it != users.end())
 			{
 				temp = it->second;
-				//if(it->second)
-				//{
-				//	it->second->abort();
-				//}
-				//users.erase(it);
 			}
 			pthread_mutex_unlock(&usersMutex);
+			bool done = false;
+			pthread_mutex_lock(&sessionMutex);
+			map<String, Stream *>::iterator stream = streams.find(m.id);
+			if(stream != streams.end())
+			{
+				stream->second->writeDone = true;
+				stream->second->active = TimerWheel::now();
+				startCloseTimer(m.id, stream->second);
+				done = stream->second->readDone;
+				if(!done)
+				{
+					stats.halfCloses.add();
+				}
+			}
+			pthread_mutex_unlock(&sessionMutex);
 			if(temp)
 			{
-				temp->abort();
+				temp->shutdownWrite();
+				if(done)
+				{
+					temp->abortWhenWritten();
+				}
+			}
+		}
+		else if(m.type == "u")
+		{
+			if(printMessage)
+			{
+				EYRE_LOG_INFO("real service send udp flow "<<m.id<<" "<<m.data.size()<<" bytes.\n"
+					<<Logger::preview(m.data, previewBytes));
 			}
+			sendDatagram(m.id, m_messages[i].data);
+		}
+		else if(m.type == "x")
+		{
+			EYRE_LOG_DEBUG("udp flow "<<m.id<<" closed by virtual client.");
+			closeFlow(m.id);
 		}
 	}
+	flushDatagrams();
 	m_messages.clear();
 	pthread_mutex_unlock(&messagesMutex);
 	
@@ -403,6 +2270,30 @@ bool handleEvent()
 #endif
 }
 
+int listenFamily = AF_INET6;	// AF_INET6 is dual-stack.
+int listenBacklog = TCP_SERVER_BACKLOG;	// connects waiting accept, a burst of users is not reset.
+
+// falls back to IPv4 only once, if the host has no IPv6.
+int startListen(TcpServer *server, unsigned short port)
+{
+	int result = server->start(port, listenFamily, INADDR_ANY, listenBacklog);
+	if(result==TCP_SERVER_SOCKETFD_ERROR && listenFamily==AF_INET6)
+	{
+		EYRE_LOG_WARN("IPv6 is not supported, listen on IPv4 only.");
+		listenFamily = AF_INET;
+		result = server->start(port, listenFamily, INADDR_ANY, listenBacklog);
+	}
+	return result;
+}
+
+#ifndef _WIN32
+// quit main loop and exit normally, so captures and profiles are written.
+void onTerminate(int sig)
+{
+	beKilled = true;
+}
+#endif
+
 int main(int argc, char *argv[])
 {
 	for(int i=1; i<argc; ++i)
@@ -416,22 +2307,132 @@ int main(int argc, char *argv[])
 		{
 			printMessage = true;
 		}
+		else if(strcmp(argv[i], "--capture")==0 && i+1<argc)
+		{
+			capture = new CaptureWriter();
+			if(!capture->open(argv[++i]))
+			{
+				fprintf(stderr, "can not open capture file %s!\n", argv[i]);
+				return -1;
+			}
+		}
 	}
 	
 	IniSettings config("config.ini", CODEC_UTF8);
 	
 	unsigned short portForClient = config.value("listen/client", "0").toUInt();
 	unsigned short portForUser = config.value("listen/user", "0").toUInt();
+	unsigned short portForUdp = config.value("listen/udp", "0").toUInt();	// 0 means no udp service.
+	listenFamily = config.value("listen/ipv6", "1").toUInt() ? AF_INET6 : AF_INET;
+	udpIdle = config.value("udp/idle", "60").toUInt();
+	bool udpOffload = config.value("udp/offload", "1").toUInt();
+	unsigned int udpBuffer = config.value("udp/buffer", "1048576").toUInt();	// a burst waits loop here.
+	
+	unsigned long long allRate = config.value("shape/rate", "0").toUInt64();
+	unsigned long long tcpRate = config.value("shape/tcpRate", "0").toUInt64();
+	unsigned long long udpRate = config.value("shape/udpRate", "0").toUInt64();
+	userRate = config.value("shape/userRate", "0").toUInt64();
+	shapeBurst = config.value("shape/burst", "100").toUInt();
+	shaping = allRate || tcpRate || udpRate || userRate;
+	
+	listenBacklog = config.value("listen/backlog", String::fromNumber((unsigned int) TCP_SERVER_BACKLOG)).toUInt();
+	maxStreams = config.value("admit/maxStreams", "0").toUInt();
+	maxPerIp = config.value("admit/maxPerIp", "0").toUInt();
+	maxPending = config.value("admit/maxPending", "0").toUInt();
+	unsigned int acceptsPerSec = config.value("admit/rate", "0").toUInt();
+	unsigned int acceptBurst = config.value("admit/burst", "1000").toUInt();
+	
+	unsigned int quantum = config.value("scheduler/quantum", "16384").toUInt();
+	tcpWeight = config.value("scheduler/tcpWeight", config.value("scheduler/weight", "1")).toUInt();
+	udpWeight = config.value("scheduler/udpWeight", "1").toUInt();
+	unsigned long long streamHighWater = config.value("scheduler/streamHighWater", "1048576").toUInt64();
+	unsigned long long streamLowWater = config.value("scheduler/streamLowWater", "262144").toUInt64();
+	unsigned long long highWater = config.value("scheduler/highWater", "16777216").toUInt64();
+	unsigned long long lowWater = config.value("scheduler/lowWater", "8388608").toUInt64();
+	heart = config.value("heart/interval", "15").toUInt();
+	heartMiss = config.value("heart/miss", "3").toUInt();
+	unsigned int maxBatch = config.value("scheduler/maxBatch", "65536").toUInt();
+	unsigned int coalesceDelay = config.value("scheduler/coalesceDelay", "0").toUInt();
+	sendHighWater = config.value("sendQueue/highWater", "1048576").toUInt64();
+	sendLowWater = config.value("sendQueue/lowWater", "262144").toUInt64();
+	sendStall = config.value("sendQueue/stall", "5000").toUInt();
+	
+	compressAlgorithm = StreamCompressor::algorithmFromName(config.value("compress/algorithm", "none"));
+	compressLevel = config.value("compress/level", "1").toInt();
+	compressMinSize = config.value("compress/minSize", "64").toUInt();
+	
+	Logger::start(Logger::levelFromName(config.value("log/level", "info")),
+		config.value("log/rate", "20").toUInt());
+	previewBytes = config.value("log/preview", "64").toUInt();
+#ifndef _WIN32
+	EventLoop::setDefaultBackend(EventLoop::backendFromName(config.value("network/backend", "auto")));
+#endif
+#ifndef _WIN32
+	signal(SIGTERM, onTerminate);
+	signal(SIGINT, onTerminate);
+#endif
 	
-	cout<<"tunnel server running."<<endl;
-	cout<<"port for client: "<<portForClient<<", port for user: "<<portForUser<<"."<<endl;
+	grace = config.value("session/grace", "30").toUInt();
+	replayLimit = config.value("session/replayBuffer", "1048576").toUInt64();
+	idle = config.value("session/idle", "3600").toUInt();
+	closeTimeout = config.value("session/closeTimeout", "60").toUInt();
+	unsigned short statsPort = config.value("stats/port", "0").toUInt();
+	ackBytes = replayLimit/4<65536 ? replayLimit/4 : 65536;
+	if(!ackBytes)
+	{
+		ackBytes = 1;
+	}
+	
+	EYRE_LOG_INFO("tunnel server running.");
+	EYRE_LOG_INFO("port for client: "<<portForClient<<", port for user: "<<portForUser<<".");
 	
 	pthread_mutex_init(&serverStartMutex, NULL);
 	pthread_mutex_init(&serverConnectMutex, NULL);
 	pthread_mutex_init(&socketDisconnectMutex, NULL);
-	pthread_mutex_init(&tellMutex, NULL);
 	pthread_mutex_init(&usersMutex, NULL);
 	pthread_mutex_init(&messagesMutex, NULL);
+	pthread_mutex_init(&compressMutex, NULL);
+	pthread_mutex_init(&heartMutex, NULL);
+	pthread_mutex_init(&sessionMutex, NULL);
+	pthread_mutex_init(&flowsMutex, NULL);
+	pthread_mutex_init(&shapeMutex, NULL);
+	pthread_mutex_init(&statsMutex, NULL);
+	pthread_mutex_init(&fullMutex, NULL);
+#ifndef _WIN32
+	pthread_mutex_init(&managerMutex, NULL);
+#endif
+	srand(time(NULL));
+	
+	timers = new TimerWheel();
+	if(acceptsPerSec)
+	{
+		acceptRate = new TokenBucket(acceptsPerSec, acceptBurst);
+	}
+	if(maxStreams || maxPerIp || maxPending || acceptsPerSec)
+	{
+		EYRE_LOG_INFO("admit users (0 unlimited), at once: "<<maxStreams<<", per ip: "<<maxPerIp
+			<<", pending opens: "<<maxPending<<", per sec: "<<acceptsPerSec<<".");
+	}
+	if(shaping)
+	{
+		shapeAll = new TokenBucket(allRate, shapeBurst);
+		shapeTcp = new TokenBucket(tcpRate, shapeBurst, shapeAll);
+		shapeUdp = new TokenBucket(udpRate, shapeBurst, shapeAll);
+		EYRE_LOG_INFO("shape bytes/sec (0 unlimited), all: "<<allRate<<", tcp: "<<tcpRate<<", udp: "<<udpRate
+			<<", each user: "<<userRate<<", burst: "<<shapeBurst<<" msec.");
+	}
+	scheduler = new FrameScheduler(quantum);
+	scheduler->setBatch(maxBatch, coalesceDelay);
+	scheduler->setWaterMarks(streamHighWater, streamLowWater, highWater, lowWater);
+	if(capture)
+	{
+		timers->add(1000, onCaptureFlush);
+	}
+	scheduler->setLatency(&stats.userToTunnel);
+	if(sendStall)
+	{
+		timers->add(1000, onSendSweep);
+	}
 	
 	serverToClient = new TcpServer();
 	
@@ -439,11 +2440,12 @@ int main(int argc, char *argv[])
 	serverToClient->setStartSucceedCallBack(onStartSucceed);
 	serverToClient->setClosedCallBack(onClosed);
 	
-	if(serverToClient->start(portForClient))
+	if(startListen(serverToClient, portForClient))
 	{
 		//cout<<"virtual server start fail!"<<endl;
 		fprintf(stderr, "virtual server start fail!\n");
 		delete serverToClient;
+		Logger::stop();
 		return -1;
 	}
 	
@@ -453,15 +2455,38 @@ int main(int argc, char *argv[])
 	serverToUser->setStartSucceedCallBack(onStartSucceed);
 	serverToUser->setClosedCallBack(onClosed);
 	
-	if(serverToUser->start(portForUser))
+	if(startListen(serverToUser, portForUser))
 	{
 		//cout<<"proxy server start fail!"<<endl;
 		fprintf(stderr, "proxy server start fail!\n");
 		delete serverToClient;
 		delete serverToUser;
+		Logger::stop();
 		return -1;
 	}
 
+	if(portForUdp)
+	{
+		udpServer = new UdpSocket();
+		udpServer->setReadBatchCallBack(onUdpRead);
+		if(!udpServer->start(portForUdp, listenFamily))
+		{
+			fprintf(stderr, "udp server start fail!\n");
+			delete serverToClient;
+			delete serverToUser;
+			delete udpServer;
+			Logger::stop();
+			return -1;
+		}
+		udpServer->setBufferSize(udpBuffer);
+		if(udpOffload && !udpServer->setOffload(true, true))
+		{
+			EYRE_LOG_INFO("udp offload (GRO/GSO) is not supported.");
+		}
+		timers->add(1000, onFlowSweep);
+		EYRE_LOG_INFO("udp server started, port: "<<portForUdp<<", flow idle: "<<udpIdle<<" sec.");
+	}
+
 #ifndef _WIN32
 	unsigned short portForManager = config.value("listen/manager", "0").toUInt();
 
@@ -471,31 +2496,70 @@ int main(int argc, char *argv[])
 	manager->setStartSucceedCallBack(onStartSucceed);
 	manager->setClosedCallBack(onClosed);
 	
-	if(manager->start(portForManager))
+	if(startListen(manager, portForManager))
 	{
 		//cout << "proxy manager start fail!" << endl;
 		fprintf(stderr, "proxy manager start fail!\n");
 		delete serverToClient;
 		delete serverToUser;
+		delete udpServer;
 		delete manager;
+		Logger::stop();
 		return -1;
 	}
 #endif
 	
+	if(statsPort)
+	{
+		statsServer = new TcpServer();
+		statsServer->setNewConnectingCallBack(onStatsConnecting);
+		if(statsServer->start(statsPort))
+		{
+			fprintf(stderr, "stats server start fail!\n");
+			delete serverToClient;
+			delete serverToUser;
+			delete udpServer;
+#ifndef _WIN32
+			delete manager;
+#endif
+			delete statsServer;
+			Logger::stop();
+			return -1;
+		}
+		EYRE_LOG_INFO("stats on port: "<<statsPort<<".");
+	}
+	
+	unsigned long long loopStart = TimerWheel::nowUsec();
 	while(handleEvent())
 	{
+		timers->tick();
+		stats.loop.record(TimerWheel::nowUsec()-loopStart);
 #ifdef _WIN32
 		Sleep(1);
 #else
 		usleep(1000);
 #endif
+		loopStart = TimerWheel::nowUsec();
 	}
 	
+#ifndef _WIN32
+	EventLoop::stopShared();
+#endif
 	delete serverToClient;
 	delete serverToUser;
+	delete udpServer;
 #ifndef _WIN32
 	delete manager;
 #endif
+	delete statsServer;
+	delete scheduler;
+	delete timers;
+	delete shapeUdp;
+	delete shapeTcp;
+	delete shapeAll;
+	delete acceptRate;
+	delete capture;
+	Logger::stop();
 	
 	return 0;
 }